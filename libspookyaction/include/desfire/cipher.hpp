@@ -7,15 +7,25 @@
 
 #include "bits.hpp"
 #include "crypto.hpp"
+#include "crypto_algo.hpp"
 #include "log.h"
+#include <algorithm>
+#include <array>
 #include <memory>
 #include <mlab/bin_data.hpp>
+#include <optional>
+#include <type_traits>
 
 namespace desfire {
     using bits::cipher_mode;
 
     namespace {
         using mlab::bin_data;
+        using mlab::bin_stream;
+        using mlab::lsb16;
+        using mlab::lsb32;
+        using mlab::make_range;
+        using mlab::prealloc;
         using mlab::range;
     }// namespace
 
@@ -28,11 +38,116 @@ namespace desfire {
          */
         virtual bool confirm_rx(bin_data &data, cipher_mode mode) = 0;
 
+        /**
+         * @brief Begins preparing a command for transmission one chunk at a time.
+         *
+         * This is the streaming counterpart of @ref prepare_tx: the data appended by @ref prepare_tx_chunk and
+         * @ref prepare_tx_end, concatenated, is the same that @ref prepare_tx would produce on the concatenation of
+         * all chunks. This allows to transmit a command frame by frame, without holding in memory the whole command.
+         * @note The default implementation buffers all chunks and calls @ref prepare_tx in @ref prepare_tx_end.
+         *  Subclasses that can carry the cipher state across chunks should override all the streaming methods.
+         * @param offset Number of bytes at the beginning of the command that are never secured.
+         * @param mode Communication mode for the command.
+         */
+        virtual void prepare_tx_begin(std::size_t offset, cipher_mode mode);
+
+        /**
+         * @brief Processes the next chunk of the command, and appends to @p out the bytes that are ready to be sent.
+         */
+        virtual void prepare_tx_chunk(range<std::uint8_t const *> data, bin_data &out);
+
+        /**
+         * @brief Completes the command, and appends to @p out the remaining bytes (last block, MAC, CRC, padding).
+         */
+        virtual void prepare_tx_end(bin_data &out);
+
+        /**
+         * @brief Begins verifying a response received one chunk at a time.
+         *
+         * This is the streaming counterpart of @ref confirm_rx. The status byte is not part of the chunks, and is
+         * passed at the end to @ref confirm_rx_end.
+         * @note The default implementation buffers all chunks and calls @ref confirm_rx in @ref confirm_rx_end.
+         * @param mode Communication mode for the response.
+         */
+        virtual void confirm_rx_begin(cipher_mode mode);
+
+        /**
+         * @brief Processes the next chunk of the response, and appends to @p out the plaintext that is ready.
+         * @note The data appended to @p out is valid only if @ref confirm_rx_end succeeds.
+         */
+        virtual void confirm_rx_chunk(range<std::uint8_t const *> data, bin_data &out);
+
+        /**
+         * @brief Completes the response, and appends to @p out the remaining plaintext (without status byte).
+         * @param status Status byte of the response.
+         * @return False if the response did not pass validation.
+         */
+        virtual bool confirm_rx_end(std::uint8_t status, bin_data &out);
+
         virtual void init_session(bin_data const &random_data) = 0;
 
+        /**
+         * @brief Brings the cipher back to the state it had right after construction, with the crypto set up with @p key.
+         *
+         * This allows to reuse a cipher object for a new authentication instead of allocating a new one, see
+         * @ref cipher_cache. The IV and the streaming state are reset, and @ref crypto::setup_with_key is called.
+         * @param key Key body, as passed to @ref crypto::setup_with_key.
+         */
+        virtual void reset_with_key(range<std::uint8_t const *> key) = 0;
+
         [[nodiscard]] virtual bool is_legacy() const = 0;
 
         virtual ~cipher() = default;
+
+    protected:
+        /**
+         * @brief State of the streaming methods, for ciphers that process data block by block.
+         */
+        struct stream_state {
+            static constexpr std::size_t max_block_size = 16;
+
+            cipher_mode mode = cipher_mode::plain;
+            std::size_t offset = 0;///< Bytes at the beginning of the command still to be passed through as they are
+            std::size_t length = 0;///< Number of secured bytes processed so far
+            std::uint32_t crc = 0; ///< Running CRC of the bytes processed so far
+
+            /**
+             * Bytes that do not form a complete block yet.
+             */
+            std::array<std::uint8_t, max_block_size> partial{};
+            std::size_t partial_size = 0;
+
+            /**
+             * Tail of the response held back until the end, because it may contain MAC, CRC or padding.
+             */
+            std::array<std::uint8_t, 2 * max_block_size> held{};
+            std::size_t held_size = 0;
+        };
+
+        /**
+         * Appends to @p out all the complete blocks of ''partial || data'', processed in place with @p op. The bytes
+         * that do not complete a block are stored in the partial block of @p s.
+         */
+        template <class CryptoT>
+        static void process_whole_blocks(stream_state &s, CryptoT &c, range<std::uint8_t *> iv, crypto_operation op,
+                                         std::size_t block_size, range<std::uint8_t const *> data, bin_data &out);
+
+        /**
+         * Zero-pads the partial block of @p s, if any, and appends it to @p out processed with @p op.
+         */
+        template <class CryptoT>
+        static void process_padded_block(stream_state &s, CryptoT &c, range<std::uint8_t *> iv, crypto_operation op,
+                                         std::size_t block_size, bin_data &out);
+
+        /**
+         * Moves the last @p n bytes of @p out, but not before @p from, into the held tail of @p s.
+         */
+        static void hold_back(stream_state &s, std::size_t from, std::size_t n, bin_data &out);
+
+    private:
+        bin_data _stream_buffer{};
+        std::size_t _stream_offset = 0;
+        cipher_mode _stream_mode = cipher_mode::plain;
     };
 
     class cipher_dummy final : public cipher {
@@ -41,12 +156,34 @@ namespace desfire {
 
         inline bool confirm_rx(bin_data &, cipher_mode mode) override;
 
+        inline void prepare_tx_begin(std::size_t, cipher_mode mode) override;
+        inline void prepare_tx_chunk(range<std::uint8_t const *> data, bin_data &out) override;
+        inline void prepare_tx_end(bin_data &) override;
+        inline void confirm_rx_begin(cipher_mode mode) override;
+        inline void confirm_rx_chunk(range<std::uint8_t const *> data, bin_data &out) override;
+        inline bool confirm_rx_end(std::uint8_t, bin_data &) override;
+
         inline void init_session(bin_data const &) override;
 
+        inline void reset_with_key(range<std::uint8_t const *>) override;
+
         [[nodiscard]] bool is_legacy() const override;
+
+    private:
+        cipher_mode _rx_mode = cipher_mode::plain;
     };
 
-    class cipher_legacy final : public cipher {
+    /**
+     * @brief Cipher for the legacy DES and 2K3DES authentication, with a 4 bytes MAC and a CRC16.
+     *
+     * @tparam CryptoT Crypto implementation used by this cipher. When this is the concrete, final implementation
+     *  (e.g. @ref esp32::crypto_des), all the cryptographic calls are resolved at compile time; @ref cipher_legacy
+     *  uses instead a type-erased @ref crypto. @ref typed_cipher_provider instantiates this with its concrete types.
+     */
+    template <class CryptoT>
+    class typed_cipher_legacy final : public cipher {
+        static_assert(std::is_base_of_v<crypto, CryptoT>);
+
     public:
         static constexpr std::size_t block_size = 8;
         static constexpr std::size_t mac_size = 4;
@@ -59,19 +196,24 @@ namespace desfire {
          * @brief Initializess a new legacy cipher.
          *
          * @param crypto Crypto object underlying the cipher.
-         * @param buffer_pool Buffer pool to use for MAC. If `nullptr`, it uses @ref default_buffer_pool. This class
-         *  retains a pointer to the buffer pool, so it cannot be changed after construction.
          */
-        explicit cipher_legacy(std::unique_ptr<crypto> crypto, mlab::shared_buffer_pool buffer_pool = nullptr);
+        explicit typed_cipher_legacy(std::unique_ptr<CryptoT> crypto);
 
         void prepare_tx(bin_data &data, std::size_t offset, cipher_mode mode) override;
         bool confirm_rx(bin_data &data, cipher_mode mode) override;
+        void prepare_tx_begin(std::size_t offset, cipher_mode mode) override;
+        void prepare_tx_chunk(range<std::uint8_t const *> data, bin_data &out) override;
+        void prepare_tx_end(bin_data &out) override;
+        void confirm_rx_begin(cipher_mode mode) override;
+        void confirm_rx_chunk(range<std::uint8_t const *> data, bin_data &out) override;
+        bool confirm_rx_end(std::uint8_t status, bin_data &out) override;
         void init_session(bin_data const &random_data) override;
+        void reset_with_key(range<std::uint8_t const *> key) override;
         [[nodiscard]] bool is_legacy() const override;
 
     private:
         [[nodiscard]] block_t &get_zeroed_iv();
-        [[nodiscard]] crypto &crypto_provider();
+        [[nodiscard]] CryptoT &crypto_provider();
 
         /**
          * Returns the first @ref mac_length bytes of the IV after encrypting @p data.
@@ -80,39 +222,115 @@ namespace desfire {
 
         static bool drop_padding_verify_crc(bin_data &d);
 
+        /**
+         * Streaming version of @ref compute_mac: MACs all the complete blocks of @p data, the rest is kept in the
+         * partial block of @ref _stream. Call @ref finish_mac at the end.
+         */
+        void update_mac(range<std::uint8_t const *> data);
+        mac_t finish_mac();
+
         block_t _iv;
-        std::unique_ptr<crypto> _crypto;
-        mlab::shared_buffer_pool _buffer_pool;
+        std::unique_ptr<CryptoT> _crypto;
+        stream_state _stream;
     };
 
+    /**
+     * @brief Cipher for the ISO and AES authentication, with CMAC and CRC32.
+     *
+     * @tparam CryptoT Crypto implementation used by this cipher. When the block size of @p CryptoT is known at compile
+     *  time (see @ref crypto_block_size), the IV is sized exactly and paddings are computed at compile time; when it is
+     *  the concrete, final implementation (e.g. @ref esp32::crypto_aes), all the cryptographic calls are resolved at
+     *  compile time. @ref cipher_default uses instead a type-erased @ref crypto_with_cmac, with a runtime block size.
+     */
+    template <class CryptoT>
+    class typed_cipher_default final : public cipher {
+        static_assert(std::is_base_of_v<crypto_with_cmac, CryptoT>);
 
-    class cipher_default final : public cipher {
     public:
         static constexpr std::size_t mac_size = 8;
         static constexpr std::size_t crc_size = 4;
 
-        explicit cipher_default(std::unique_ptr<crypto_with_cmac> crypto);
+        /**
+         * Block size known at compile time, or zero if it has to be queried to the crypto at runtime.
+         */
+        static constexpr std::size_t static_block_size = crypto_block_size_v<CryptoT>;
+
+        static_assert(static_block_size <= stream_state::max_block_size);
+
+        explicit typed_cipher_default(std::unique_ptr<CryptoT> crypto);
 
         void prepare_tx(bin_data &data, std::size_t offset, cipher_mode mode) override;
         bool confirm_rx(bin_data &data, cipher_mode mode) override;
+        void prepare_tx_begin(std::size_t offset, cipher_mode mode) override;
+        void prepare_tx_chunk(range<std::uint8_t const *> data, bin_data &out) override;
+        void prepare_tx_end(bin_data &out) override;
+        void confirm_rx_begin(cipher_mode mode) override;
+        void confirm_rx_chunk(range<std::uint8_t const *> data, bin_data &out) override;
+        bool confirm_rx_end(std::uint8_t status, bin_data &out) override;
         void init_session(bin_data const &random_data) override;
+        void reset_with_key(range<std::uint8_t const *> key) override;
         [[nodiscard]] bool is_legacy() const override;
 
+        [[nodiscard]] std::size_t block_size() const;
+
     private:
-        [[nodiscard]] crypto_with_cmac &crypto_provider();
+        [[nodiscard]] CryptoT &crypto_provider();
 
         [[nodiscard]] range<std::uint8_t *> iv();
 
         bool drop_padding_verify_crc(bin_data &d, std::uint8_t status);
 
-
-        std::unique_ptr<std::uint8_t[]> _iv;
-        std::unique_ptr<crypto_with_cmac> _crypto;
+        std::array<std::uint8_t, static_block_size == 0 ? stream_state::max_block_size : static_block_size> _iv;
+        std::unique_ptr<CryptoT> _crypto;
+        stream_state _stream;
+        std::optional<cmac_stream> _cmac;
     };
+
+    /**
+     * @brief Legacy cipher over any @ref crypto, which is called through its virtual interface.
+     */
+    using cipher_legacy = typed_cipher_legacy<crypto>;
+
+    /**
+     * @brief Default cipher over any @ref crypto_with_cmac, which is called through its virtual interface.
+     */
+    using cipher_default = typed_cipher_default<crypto_with_cmac>;
+
 }// namespace desfire
 
 namespace desfire {
 
+    template <class CryptoT>
+    void cipher::process_whole_blocks(stream_state &s, CryptoT &c, range<std::uint8_t *> iv, crypto_operation op,
+                                      std::size_t block_size, range<std::uint8_t const *> data, bin_data &out) {
+        const std::size_t total = s.partial_size + data.size();
+        if (total < block_size) {
+            std::copy(std::begin(data), std::end(data), std::begin(s.partial) + s.partial_size);
+            s.partial_size = total;
+            return;
+        }
+        const std::size_t from_data = total - total % block_size - s.partial_size;
+        const std::size_t ofs = out.size();
+        out << prealloc(s.partial_size + from_data)
+            << make_range(s.partial.data(), s.partial.data() + s.partial_size)
+            << make_range(std::begin(data), std::begin(data) + from_data);
+        c.do_crypto(out.data_view(ofs), iv, op);
+        s.partial_size = data.size() - from_data;
+        std::copy(std::begin(data) + from_data, std::end(data), std::begin(s.partial));
+    }
+
+    template <class CryptoT>
+    void cipher::process_padded_block(stream_state &s, CryptoT &c, range<std::uint8_t *> iv, crypto_operation op,
+                                      std::size_t block_size, bin_data &out) {
+        if (s.partial_size > 0) {
+            std::fill(std::begin(s.partial) + s.partial_size, std::begin(s.partial) + block_size, 0x00);
+            const std::size_t ofs = out.size();
+            out << make_range(s.partial.data(), s.partial.data() + block_size);
+            c.do_crypto(out.data_view(ofs), iv, op);
+            s.partial_size = 0;
+        }
+    }
+
     void cipher_dummy::prepare_tx(bin_data &, std::size_t, cipher_mode mode) {
         if (mode != cipher_mode::plain) {
             DESFIRE_LOGE("Dummy cipher supports only plain comm mode.");
@@ -127,8 +345,651 @@ namespace desfire {
         return true;
     }
 
+    void cipher_dummy::prepare_tx_begin(std::size_t, cipher_mode mode) {
+        if (mode != cipher_mode::plain) {
+            DESFIRE_LOGE("Dummy cipher supports only plain comm mode.");
+        }
+    }
+
+    void cipher_dummy::prepare_tx_chunk(range<std::uint8_t const *> data, bin_data &out) {
+        out << data;
+    }
+
+    void cipher_dummy::prepare_tx_end(bin_data &) {}
+
+    void cipher_dummy::confirm_rx_begin(cipher_mode mode) {
+        _rx_mode = mode;
+    }
+
+    void cipher_dummy::confirm_rx_chunk(range<std::uint8_t const *> data, bin_data &out) {
+        out << data;
+    }
+
+    bool cipher_dummy::confirm_rx_end(std::uint8_t, bin_data &) {
+        if (_rx_mode != cipher_mode::plain) {
+            DESFIRE_LOGE("Dummy cipher supports only plain comm mode.");
+            return false;
+        }
+        return true;
+    }
+
     void cipher_dummy::init_session(bin_data const &) {}
 
+    void cipher_dummy::reset_with_key(range<std::uint8_t const *>) {
+        _rx_mode = cipher_mode::plain;
+    }
+
+    template <class CryptoT>
+    bool typed_cipher_legacy<CryptoT>::is_legacy() const {
+        return true;
+    }
+
+    template <class CryptoT>
+    typed_cipher_legacy<CryptoT>::typed_cipher_legacy(std::unique_ptr<CryptoT> crypto)
+        : _iv{0, 0, 0, 0, 0, 0, 0, 0},
+          _crypto{std::move(crypto)}
+    {}
+
+    template <class CryptoT>
+    CryptoT &typed_cipher_legacy<CryptoT>::crypto_provider() {
+        return *_crypto;
+    }
+
+    template <class CryptoT>
+    typename typed_cipher_legacy<CryptoT>::block_t &typed_cipher_legacy<CryptoT>::get_zeroed_iv() {
+        // Reset every time
+        std::fill_n(std::begin(_iv), block_size, 0x00);
+        return _iv;
+    }
+
+
+    template <class CryptoT>
+    typename typed_cipher_legacy<CryptoT>::mac_t typed_cipher_legacy<CryptoT>::compute_mac(range<bin_data::const_iterator> data) {
+        // The MAC operation overwrites the data, so the blocks are processed in a scratch buffer on the stack
+        static constexpr std::size_t scratch_blocks = 8;
+        std::array<std::uint8_t, scratch_blocks * block_size> scratch{};
+        block_t &iv = get_zeroed_iv();
+        auto it = std::begin(data);
+        do {
+            const auto n = std::min(std::size_t(std::distance(it, std::end(data))), scratch.size());
+            std::copy_n(it, n, std::begin(scratch));
+            // Only the last chunk is padded, with zeroes
+            const std::size_t length = padded_length<block_size>(n);
+            std::fill(std::begin(scratch) + n, std::begin(scratch) + length, 0x00);
+            crypto_provider().do_crypto(make_range(scratch.data(), scratch.data() + length), make_range(iv), crypto_operation::mac);
+            it += n;
+        } while (it != std::end(data));
+
+        // Return the first 4 bytes of the last block
+        return {iv[0], iv[1], iv[2], iv[3]};
+    }
+
+    template <class CryptoT>
+    void typed_cipher_legacy<CryptoT>::init_session(bin_data const &random_data) {
+        crypto_provider().init_session(random_data.data_view());
+    }
+
+    template <class CryptoT>
+    void typed_cipher_legacy<CryptoT>::reset_with_key(range<std::uint8_t const *> key) {
+        crypto_provider().setup_with_key(key);
+        _stream = stream_state{};
+        std::fill(std::begin(_iv), std::end(_iv), 0x00);
+    }
+
+    template <class CryptoT>
+    bool typed_cipher_legacy<CryptoT>::drop_padding_verify_crc(bin_data &d) {
+        static const auto crc_fn = [](bin_data::const_iterator b, bin_data::const_iterator e, std::uint16_t init) -> std::uint16_t {
+            return compute_crc16(range<std::uint8_t const *>{&*b, &*b + std::distance(b, e)}, init);
+        };
+        const auto [end_payload, did_verify] = find_crc_tail(std::begin(d), std::end(d), crc_fn, crc16_init, block_size, true);
+        if (did_verify) {
+            const std::size_t payload_length = std::distance(std::begin(d), end_payload);
+            // In case of error, make sure to not get any weird size/number
+            d.resize(std::max(payload_length, crc_size) - crc_size);
+            return true;
+        }
+        return false;
+    }
+
+    template <class CryptoT>
+    void typed_cipher_legacy<CryptoT>::prepare_tx(bin_data &data, std::size_t offset, cipher_mode mode) {
+        if (offset >= data.size() or mode == cipher_mode::plain) {
+            return;// Nothing to do
+        }
+        if (mode == cipher_mode::maced) {
+            const auto mac = compute_mac(data.view(offset));
+            DESFIRE_LOG_BUFFER_HEX_LEVEL(DESFIRE_TAG " TX MAC", mac.data(), mac.size(), ESP_LOG_DEBUG);
+            data << mac;
+        } else {
+            if (mode == cipher_mode::ciphered) {
+                data.reserve(offset + padded_length<block_size>(data.size() + crc_size - offset));
+                data << lsb16 << compute_crc16(data.data_view(offset));
+            } else {
+                data.reserve(offset + padded_length<block_size>(data.size() - offset));
+            }
+            data.resize(offset + padded_length<block_size>(data.size() - offset), 0x00);
+            crypto_provider().do_crypto(data.data_view(offset), make_range(get_zeroed_iv()), crypto_operation::encrypt);
+        }
+    }
+
+
+    template <class CryptoT>
+    bool typed_cipher_legacy<CryptoT>::confirm_rx(bin_data &data, cipher_mode mode) {
+        if (data.size() == 1 or mode == cipher_mode::plain) {
+            // Just status byte, return as-is
+            return true;
+        }
+        if (mode == cipher_mode::maced) {
+            bin_stream s{data};
+            // Data, followed by mac, followed by status
+            const auto data_view = s.read(s.remaining() - mac_size - 1);
+            // Compute mac on data
+            const mac_t computed_mac = compute_mac(data_view);
+            DESFIRE_LOG_BUFFER_HEX_LEVEL(DESFIRE_TAG " RX MAC", computed_mac.data(), computed_mac.size(), ESP_LOG_DEBUG);
+            // Extract the transmitted mac
+            mac_t rxd_mac{};
+            s >> rxd_mac;
+            if (rxd_mac == computed_mac) {
+                // Good, move status byte at the end and drop the mac
+                data[data.size() - mac_size - 1] = data[data.size() - 1];
+                data.resize(data.size() - mac_size);
+                return true;
+            }
+            DESFIRE_LOG_BUFFER_HEX_LEVEL(DESFIRE_TAG " != MAC", rxd_mac.data(), rxd_mac.size(), ESP_LOG_DEBUG);
+            return false;
+        } else {
+            // Pop the status byte
+            const std::uint8_t status = data.back();
+            data.pop_back();
+            // Decipher what's left
+            if (data.size() % block_size != 0) {
+                DESFIRE_LOGW("Received enciphered data of length %u, not a multiple of the block size %u.",
+                             data.size(), block_size);
+                ESP_LOG_BUFFER_HEX_LEVEL(DESFIRE_TAG, data.data(), data.size(), ESP_LOG_WARN);
+                return false;
+            }
+            crypto_provider().do_crypto(data.data_view(), make_range(get_zeroed_iv()), crypto_operation::decrypt);
+            if (mode == cipher_mode::ciphered) {
+                // Truncate the padding and the crc
+                const bool did_verify = drop_padding_verify_crc(data);
+                // Reappend the status byte
+                data << status;
+                return did_verify;
+            } else {
+                // Reappend the status byte
+                data << status;
+                return true;
+            }
+        }
+    }
+
+
+    template <class CryptoT>
+    void typed_cipher_legacy<CryptoT>::update_mac(range<std::uint8_t const *> data) {
+        // The MAC operation overwrites the data, so the blocks are processed in a scratch buffer
+        static constexpr std::size_t scratch_blocks = 8;
+        std::array<std::uint8_t, scratch_blocks * block_size> scratch{};
+        while (not data.empty()) {
+            const std::size_t n = std::min(data.size(), scratch.size() - _stream.partial_size);
+            std::copy_n(_stream.partial.data(), _stream.partial_size, scratch.data());
+            std::copy_n(std::begin(data), n, scratch.data() + _stream.partial_size);
+            const std::size_t total = _stream.partial_size + n;
+            const std::size_t whole = total - total % block_size;
+            if (whole > 0) {
+                crypto_provider().do_crypto(make_range(scratch.data(), scratch.data() + whole), make_range(_iv), crypto_operation::mac);
+            }
+            std::copy(scratch.data() + whole, scratch.data() + total, std::begin(_stream.partial));
+            _stream.partial_size = total - whole;
+            data = range<std::uint8_t const *>{std::begin(data) + n, std::end(data)};
+        }
+    }
+
+    template <class CryptoT>
+    typename typed_cipher_legacy<CryptoT>::mac_t typed_cipher_legacy<CryptoT>::finish_mac() {
+        if (_stream.partial_size > 0) {
+            block_t last_block{};
+            std::copy_n(_stream.partial.data(), _stream.partial_size, std::begin(last_block));
+            crypto_provider().do_crypto(make_range(last_block), make_range(_iv), crypto_operation::mac);
+            _stream.partial_size = 0;
+        }
+        return {_iv[0], _iv[1], _iv[2], _iv[3]};
+    }
+
+    template <class CryptoT>
+    void typed_cipher_legacy<CryptoT>::prepare_tx_begin(std::size_t offset, cipher_mode mode) {
+        _stream = stream_state{};
+        _stream.mode = mode;
+        _stream.offset = offset;
+        _stream.crc = crc16_init;
+        std::fill(std::begin(_iv), std::end(_iv), 0x00);
+    }
+
+    template <class CryptoT>
+    void typed_cipher_legacy<CryptoT>::prepare_tx_chunk(range<std::uint8_t const *> data, bin_data &out) {
+        if (_stream.mode == cipher_mode::plain) {
+            out << data;
+            return;
+        }
+        // Pass through everything before the offset
+        const std::size_t n_plain = std::min(_stream.offset, data.size());
+        out << make_range(std::begin(data), std::begin(data) + n_plain);
+        _stream.offset -= n_plain;
+        const range<std::uint8_t const *> secure_data{std::begin(data) + n_plain, std::end(data)};
+        if (secure_data.empty()) {
+            return;
+        }
+        _stream.length += secure_data.size();
+        if (_stream.mode == cipher_mode::maced) {
+            out << secure_data;
+            update_mac(secure_data);
+        } else {
+            if (_stream.mode == cipher_mode::ciphered) {
+                _stream.crc = compute_crc16(secure_data, std::uint16_t(_stream.crc));
+            }
+            process_whole_blocks(_stream, crypto_provider(), make_range(_iv), crypto_operation::encrypt, block_size, secure_data, out);
+        }
+    }
+
+    template <class CryptoT>
+    void typed_cipher_legacy<CryptoT>::prepare_tx_end(bin_data &out) {
+        if (_stream.length == 0 or _stream.mode == cipher_mode::plain) {
+            return;// Nothing to do
+        }
+        if (_stream.mode == cipher_mode::maced) {
+            const auto mac = finish_mac();
+            DESFIRE_LOG_BUFFER_HEX_LEVEL(DESFIRE_TAG " TX MAC", mac.data(), mac.size(), ESP_LOG_DEBUG);
+            out << mac;
+        } else {
+            if (_stream.mode == cipher_mode::ciphered) {
+                const std::array<std::uint8_t, crc_size> crc{std::uint8_t(_stream.crc), std::uint8_t(_stream.crc >> 8)};
+                process_whole_blocks(_stream, crypto_provider(), make_range(_iv), crypto_operation::encrypt, block_size, make_range(crc), out);
+            }
+            process_padded_block(_stream, crypto_provider(), make_range(_iv), crypto_operation::encrypt, block_size, out);
+        }
+    }
+
+    template <class CryptoT>
+    void typed_cipher_legacy<CryptoT>::confirm_rx_begin(cipher_mode mode) {
+        _stream = stream_state{};
+        _stream.mode = mode;
+        _stream.crc = crc16_init;
+        std::fill(std::begin(_iv), std::end(_iv), 0x00);
+    }
+
+    template <class CryptoT>
+    void typed_cipher_legacy<CryptoT>::confirm_rx_chunk(range<std::uint8_t const *> data, bin_data &out) {
+        _stream.length += data.size();
+        if (_stream.mode == cipher_mode::plain) {
+            out << data;
+            return;
+        }
+        const std::size_t ofs = out.size();
+        out << make_range(_stream.held.data(), _stream.held.data() + _stream.held_size);
+        _stream.held_size = 0;
+        if (_stream.mode == cipher_mode::maced) {
+            // Data, followed by the MAC, which must be held back
+            out << data;
+            hold_back(_stream, ofs, mac_size, out);
+            update_mac(out.data_view(ofs));
+        } else {
+            process_whole_blocks(_stream, crypto_provider(), make_range(_iv), crypto_operation::decrypt, block_size, data, out);
+            if (_stream.mode == cipher_mode::ciphered) {
+                // CRC and padding span at most the last two blocks
+                hold_back(_stream, ofs, 2 * block_size, out);
+                _stream.crc = compute_crc16(out.data_view(ofs), std::uint16_t(_stream.crc));
+            }
+        }
+    }
+
+    template <class CryptoT>
+    bool typed_cipher_legacy<CryptoT>::confirm_rx_end(std::uint8_t, bin_data &out) {
+        if (_stream.length == 0 or _stream.mode == cipher_mode::plain) {
+            // Just status byte, return as-is
+            return true;
+        }
+        if (_stream.mode == cipher_mode::maced) {
+            if (_stream.held_size < mac_size) {
+                DESFIRE_LOGW("Received maced data of length %u, shorter than the MAC.", _stream.length);
+                return false;
+            }
+            const mac_t computed_mac = finish_mac();
+            DESFIRE_LOG_BUFFER_HEX_LEVEL(DESFIRE_TAG " RX MAC", computed_mac.data(), computed_mac.size(), ESP_LOG_DEBUG);
+            if (std::equal(std::begin(computed_mac), std::end(computed_mac), std::begin(_stream.held))) {
+                return true;
+            }
+            DESFIRE_LOG_BUFFER_HEX_LEVEL(DESFIRE_TAG " != MAC", _stream.held.data(), mac_size, ESP_LOG_DEBUG);
+            return false;
+        }
+        if (_stream.partial_size != 0) {
+            DESFIRE_LOGW("Received enciphered data of length %u, not a multiple of the block size %u.",
+                         _stream.length, block_size);
+            return false;
+        }
+        if (_stream.mode == cipher_mode::ciphered) {
+            static const auto crc_fn = [](std::uint8_t const *b, std::uint8_t const *e, std::uint16_t init) -> std::uint16_t {
+                return compute_crc16(range<std::uint8_t const *>{b, e}, init);
+            };
+            std::uint8_t const *held_begin = _stream.held.data();
+            const auto [end_payload, did_verify] = find_crc_tail(held_begin, held_begin + _stream.held_size, crc_fn,
+                                                                 std::uint16_t(_stream.crc), block_size, true);
+            if (not did_verify) {
+                return false;
+            }
+            const std::size_t payload_length = std::distance(held_begin, end_payload);
+            out << make_range(held_begin, held_begin + std::max(payload_length, crc_size) - crc_size);
+        }
+        return true;
+    }
+
+
+    template <class CryptoT>
+    typed_cipher_default<CryptoT>::typed_cipher_default(std::unique_ptr<CryptoT> crypto)
+        : _iv{},
+          _crypto{std::move(crypto)} {
+        if constexpr (static_block_size == 0) {
+            if (block_size() > _iv.size()) {
+                DESFIRE_LOGE("Block size %d exceeds the maximum supported, %d.", block_size(), _iv.size());
+            }
+        }
+    }
+
+    template <class CryptoT>
+    bool typed_cipher_default<CryptoT>::is_legacy() const {
+        return false;
+    }
+
+    template <class CryptoT>
+    std::size_t typed_cipher_default<CryptoT>::block_size() const {
+        if constexpr (static_block_size > 0) {
+            return static_block_size;
+        } else {
+            return _crypto->block_size();
+        }
+    }
+
+    template <class CryptoT>
+    bool typed_cipher_default<CryptoT>::drop_padding_verify_crc(bin_data &d, std::uint8_t status) {
+        // Here we get a sequence [[ DATA || CRC || PADDING ]], but the CRC is computed on [[ DATA || STATUS ]].
+        static const auto crc_fn = [](auto b, auto e, std::uint32_t init) -> std::uint32_t {
+            if (b == e) {
+                return init;
+            }
+            return compute_crc32(range<std::uint8_t const *>{&*b, &*b + std::distance(b, e)}, init);
+        };
+        const auto [end_payload, did_verify] = find_crc_tail_with_extra_byte(std::begin(d), std::end(d), crc_fn, crc32_init, block_size(), status);
+        if (did_verify) {
+            const std::size_t payload_length = std::distance(std::begin(d), end_payload);
+            // In case of error, make sure to not get any weird size/number
+            d.resize(std::max(payload_length, crc_size) - crc_size);
+            return true;
+        }
+        return false;
+    }
+
+    template <class CryptoT>
+    CryptoT &typed_cipher_default<CryptoT>::crypto_provider() {
+        return *_crypto;
+    }
+
+    template <class CryptoT>
+    range<std::uint8_t *> typed_cipher_default<CryptoT>::iv() {
+        if constexpr (static_block_size > 0) {
+            return make_range(_iv);
+        } else {
+            return {_iv.data(), _iv.data() + std::min(block_size(), _iv.size())};
+        }
+    }
+
+    template <class CryptoT>
+    void typed_cipher_default<CryptoT>::prepare_tx(bin_data &data, std::size_t offset, cipher_mode mode) {
+        if (mode == cipher_mode::plain or mode == cipher_mode::maced) {
+            // Plain and MAC may still require to pass data through CMAC, unless specified otherwise
+            // CMAC has to be computed on the whole data
+            const auto cmac = crypto_provider().do_cmac(data.data_view(), iv());
+            DESFIRE_LOG_BUFFER_HEX_LEVEL(DESFIRE_TAG " TX MAC", cmac.data(), cmac.size(), ESP_LOG_DEBUG);
+            if (mode == cipher_mode::maced) {
+                // Only MAC comm mode will actually append
+                data << cmac;
+            }
+        } else {
+            if (offset >= data.size()) {
+                return;// Nothing to do
+            }
+            if (mode == cipher_mode::ciphered) {
+                data.reserve(offset + padded_length(data.size() + crc_size - offset, block_size()));
+                // CRC has to be computed on the whole data
+                data << lsb32 << compute_crc32(data);
+            } else {
+                data.reserve(offset + padded_length(data.size() - offset, block_size()));
+            }
+            data.resize(offset + padded_length(data.size() - offset, block_size()), 0x00);
+            crypto_provider().do_crypto(data.data_view(offset), iv(), crypto_operation::encrypt);
+        }
+    }
+
+    template <class CryptoT>
+    bool typed_cipher_default<CryptoT>::confirm_rx(bin_data &data, cipher_mode mode) {
+        if (data.size() == 1) {
+            // Just status byte, return as-is
+            return true;
+        }
+        if (mode == cipher_mode::plain) {
+            // Always pass data + status byte through CMAC
+            // This will keep the IV in sync
+            const auto cmac = crypto_provider().do_cmac(data.data_view(), iv());
+            DESFIRE_LOG_BUFFER_HEX_LEVEL(DESFIRE_TAG " RX MAC", cmac.data(), cmac.size(), ESP_LOG_DEBUG);
+        } else if (mode == cipher_mode::maced) {
+            // [ data || maced || status ] -> [ data || status || maced ]; rotate mac_size + 1 bytes
+            std::rotate(data.rbegin(), data.rbegin() + 1, data.rbegin() + mac_size + 1);
+            // This will keep the IV in sync
+            const auto computed_mac = crypto_provider().do_cmac(data.data_view(0, data.size() - mac_size), iv());
+            DESFIRE_LOG_BUFFER_HEX_LEVEL(DESFIRE_TAG " RX MAC", computed_mac.data(), computed_mac.size(), ESP_LOG_DEBUG);
+            // Extract the transmitted maced
+            bin_stream s{data};
+            s.seek(data.size() - mac_size);
+            crypto_with_cmac::mac_t rxd_mac{};
+            s >> rxd_mac;
+            if (rxd_mac == computed_mac) {
+                // Good, drop the maced
+                data.resize(data.size() - mac_size);
+                return true;
+            }
+            DESFIRE_LOG_BUFFER_HEX_LEVEL(DESFIRE_TAG " != MAC", rxd_mac.data(), rxd_mac.size(), ESP_LOG_DEBUG);
+            return false;
+        } else {
+            // Pop the status byte
+            const std::uint8_t status = data.back();
+            data.pop_back();
+            // Decipher what's left
+            if (data.size() % block_size() != 0) {
+                DESFIRE_LOGW("Received enciphered data of length %u, not a multiple of the block size %u.",
+                             data.size(), block_size());
+                ESP_LOG_BUFFER_HEX_LEVEL(DESFIRE_TAG, data.data(), data.size(), ESP_LOG_WARN);
+                return false;
+            }
+            crypto_provider().do_crypto(data.data_view(), iv(), crypto_operation::decrypt);
+            if (mode == cipher_mode::ciphered) {
+                // Truncate the padding and the crc
+                const bool did_verify = drop_padding_verify_crc(data, status);
+                // Reappend the status byte
+                data << status;
+                return did_verify;
+            } else {
+                // Reappend the status byte
+                data << status;
+                return true;
+            }
+        }
+        return true;
+    }
+
+    template <class CryptoT>
+    void typed_cipher_default<CryptoT>::prepare_tx_begin(std::size_t offset, cipher_mode mode) {
+        _stream = stream_state{};
+        _stream.mode = mode;
+        _stream.offset = offset;
+        _stream.crc = crc32_init;
+        if (mode == cipher_mode::plain or mode == cipher_mode::maced) {
+            // CMAC has to be computed on the whole data
+            _cmac.emplace(crypto_provider().begin_cmac(iv()));
+        } else {
+            _cmac.reset();
+        }
+    }
+
+    template <class CryptoT>
+    void typed_cipher_default<CryptoT>::prepare_tx_chunk(range<std::uint8_t const *> data, bin_data &out) {
+        if (_stream.mode == cipher_mode::plain or _stream.mode == cipher_mode::maced) {
+            _cmac->update(data);
+            out << data;
+            return;
+        }
+        if (_stream.mode == cipher_mode::ciphered) {
+            // CRC has to be computed on the whole data
+            _stream.crc = compute_crc32(data, _stream.crc);
+        }
+        // Pass through everything before the offset
+        const std::size_t n_plain = std::min(_stream.offset, data.size());
+        out << make_range(std::begin(data), std::begin(data) + n_plain);
+        _stream.offset -= n_plain;
+        const range<std::uint8_t const *> secure_data{std::begin(data) + n_plain, std::end(data)};
+        _stream.length += secure_data.size();
+        process_whole_blocks(_stream, crypto_provider(), iv(), crypto_operation::encrypt, block_size(), secure_data, out);
+    }
+
+    template <class CryptoT>
+    void typed_cipher_default<CryptoT>::prepare_tx_end(bin_data &out) {
+        if (_stream.mode == cipher_mode::plain or _stream.mode == cipher_mode::maced) {
+            const auto cmac = _cmac->finish();
+            _cmac.reset();
+            DESFIRE_LOG_BUFFER_HEX_LEVEL(DESFIRE_TAG " TX MAC", cmac.data(), cmac.size(), ESP_LOG_DEBUG);
+            if (_stream.mode == cipher_mode::maced) {
+                // Only MAC comm mode will actually append
+                out << cmac;
+            }
+        } else {
+            if (_stream.length == 0) {
+                return;// Nothing to do
+            }
+            if (_stream.mode == cipher_mode::ciphered) {
+                const std::array<std::uint8_t, crc_size> crc{std::uint8_t(_stream.crc), std::uint8_t(_stream.crc >> 8),
+                                                             std::uint8_t(_stream.crc >> 16), std::uint8_t(_stream.crc >> 24)};
+                process_whole_blocks(_stream, crypto_provider(), iv(), crypto_operation::encrypt, block_size(), make_range(crc), out);
+            }
+            process_padded_block(_stream, crypto_provider(), iv(), crypto_operation::encrypt, block_size(), out);
+        }
+    }
+
+    template <class CryptoT>
+    void typed_cipher_default<CryptoT>::confirm_rx_begin(cipher_mode mode) {
+        _stream = stream_state{};
+        _stream.mode = mode;
+        _stream.crc = crc32_init;
+        if (mode == cipher_mode::plain or mode == cipher_mode::maced) {
+            _cmac.emplace(crypto_provider().begin_cmac(iv()));
+        } else {
+            _cmac.reset();
+        }
+    }
+
+    template <class CryptoT>
+    void typed_cipher_default<CryptoT>::confirm_rx_chunk(range<std::uint8_t const *> data, bin_data &out) {
+        _stream.length += data.size();
+        if (_stream.mode == cipher_mode::plain) {
+            _cmac->update(data);
+            out << data;
+            return;
+        }
+        const std::size_t ofs = out.size();
+        out << make_range(_stream.held.data(), _stream.held.data() + _stream.held_size);
+        _stream.held_size = 0;
+        if (_stream.mode == cipher_mode::maced) {
+            // Data, followed by the MAC, which must be held back
+            out << data;
+            hold_back(_stream, ofs, mac_size, out);
+            _cmac->update(out.data_view(ofs));
+        } else {
+            process_whole_blocks(_stream, crypto_provider(), iv(), crypto_operation::decrypt, block_size(), data, out);
+            if (_stream.mode == cipher_mode::ciphered) {
+                // CRC and padding span at most the last two blocks
+                hold_back(_stream, ofs, 2 * block_size(), out);
+                _stream.crc = compute_crc32(out.data_view(ofs), _stream.crc);
+            }
+        }
+    }
+
+    template <class CryptoT>
+    bool typed_cipher_default<CryptoT>::confirm_rx_end(std::uint8_t status, bin_data &out) {
+        if (_stream.length == 0) {
+            // Just status byte, return as-is
+            _cmac.reset();
+            return true;
+        }
+        if (_stream.mode == cipher_mode::plain) {
+            // Always pass data + status byte through CMAC
+            // This will keep the IV in sync
+            _cmac->update(make_range(&status, &status + 1));
+            const auto cmac = _cmac->finish();
+            _cmac.reset();
+            DESFIRE_LOG_BUFFER_HEX_LEVEL(DESFIRE_TAG " RX MAC", cmac.data(), cmac.size(), ESP_LOG_DEBUG);
+            return true;
+        } else if (_stream.mode == cipher_mode::maced) {
+            if (_stream.held_size < mac_size) {
+                DESFIRE_LOGW("Received maced data of length %u, shorter than the MAC.", _stream.length);
+                _cmac.reset();
+                return false;
+            }
+            // The CMAC is computed on [ data || status ], this will keep the IV in sync
+            _cmac->update(make_range(&status, &status + 1));
+            const auto computed_mac = _cmac->finish();
+            _cmac.reset();
+            DESFIRE_LOG_BUFFER_HEX_LEVEL(DESFIRE_TAG " RX MAC", computed_mac.data(), computed_mac.size(), ESP_LOG_DEBUG);
+            if (std::equal(std::begin(computed_mac), std::end(computed_mac), std::begin(_stream.held))) {
+                return true;
+            }
+            DESFIRE_LOG_BUFFER_HEX_LEVEL(DESFIRE_TAG " != MAC", _stream.held.data(), mac_size, ESP_LOG_DEBUG);
+            return false;
+        }
+        if (_stream.partial_size != 0) {
+            DESFIRE_LOGW("Received enciphered data of length %u, not a multiple of the block size %u.",
+                         _stream.length, block_size());
+            return false;
+        }
+        if (_stream.mode == cipher_mode::ciphered) {
+            // Here we hold [[ DATA || CRC || PADDING ]], but the CRC is computed on [[ DATA || STATUS ]].
+            static const auto crc_fn = [](std::uint8_t const *b, std::uint8_t const *e, std::uint32_t init) -> std::uint32_t {
+                return compute_crc32(range<std::uint8_t const *>{b, e}, init);
+            };
+            std::uint8_t const *held_begin = _stream.held.data();
+            const auto [end_payload, did_verify] = find_crc_tail_with_extra_byte(held_begin, held_begin + _stream.held_size, crc_fn,
+                                                                                 _stream.crc, block_size(), status);
+            if (not did_verify) {
+                return false;
+            }
+            const std::size_t payload_length = std::distance(held_begin, end_payload);
+            out << make_range(held_begin, held_begin + std::max(payload_length, crc_size) - crc_size);
+        }
+        return true;
+    }
+
+    template <class CryptoT>
+    void typed_cipher_default<CryptoT>::init_session(bin_data const &random_data) {
+        crypto_provider().init_session(random_data.data_view());
+        // Reset the IV
+        std::fill(std::begin(_iv), std::end(_iv), 0x00);
+    }
+
+    template <class CryptoT>
+    void typed_cipher_default<CryptoT>::reset_with_key(range<std::uint8_t const *> key) {
+        crypto_provider().setup_with_key(key);
+        _stream = stream_state{};
+        _cmac.reset();
+        std::fill(std::begin(_iv), std::end(_iv), 0x00);
+    }
+
+    extern template class typed_cipher_legacy<crypto>;
+    extern template class typed_cipher_default<crypto_with_cmac>;
+
 }// namespace desfire
 
 #endif//DESFIRE_CIPHER_HPP
@@ -0,0 +1,137 @@
+#ifndef DESFIRE_CIPHER_CACHE_HPP
+#define DESFIRE_CIPHER_CACHE_HPP
+
+#include <array>
+#include <desfire/cipher.hpp>
+#include <memory>
+#include <vector>
+
+namespace desfire {
+
+    /**
+     * @brief Bounded pool of ciphers whose crypto is already set up with a given key.
+     *
+     * Authenticating requires a new @ref cipher, which means allocating the cipher and its @ref crypto and running
+     * the key schedule of the underlying primitives. When the same few keys are used over and over, e.g. a door reader
+     * that authenticates every card with the same application key, a @ref typed_cipher_provider that shares a cache
+     * hands out a cipher that is ready for the key, and takes it back through @ref cipher_provider::recycle_cipher
+     * when the session is over.
+     *
+     * Every entry is either idle, holding a cipher set up with its key, or lent out. A cipher that is given back is
+     * set up again with the key it was lent for, so the key schedule runs when a session ends rather than when the
+     * next one begins. When the cache is full, the least recently used idle cipher of the same type is set up with
+     * the new key instead of allocating a new one. Once the cache is warm, taking and giving back ciphers does not
+     * allocate.
+     * @note The key bodies are kept in memory as long as an entry refers to them, and are wiped on eviction.
+     * @note This class is not thread safe, a cache can only be shared by tags that are used from the same thread.
+     */
+    class cipher_cache {
+    public:
+        struct cache_stats {
+            /**
+             * Number of times a cipher already set up for the key was returned.
+             */
+            std::size_t hits = 0;
+            /**
+             * Number of times an idle cipher for a different key was set up again and returned, without allocating.
+             */
+            std::size_t recycled = 0;
+            /**
+             * Number of times a new cipher had to be allocated.
+             */
+            std::size_t misses = 0;
+        };
+
+        static constexpr std::size_t default_capacity = 4;
+
+        /**
+         * @param capacity Maximum number of ciphers tracked, lent or idle. The storage is reserved upfront.
+         */
+        explicit cipher_cache(std::size_t capacity = default_capacity);
+
+        cipher_cache(cipher_cache const &) = delete;
+        cipher_cache &operator=(cipher_cache const &) = delete;
+
+        ~cipher_cache();
+
+        /**
+         * @brief Takes out a cipher set up with @p key.
+         * @param type Type of the cipher and of @p key.
+         * @param key Key body, as passed to @ref crypto::setup_with_key.
+         * @return An idle cipher for @p key or, if the cache is full, the least recently used idle cipher of type
+         *  @p type, set up with @p key. Otherwise `nullptr`: the caller should then allocate a new cipher and
+         *  @ref track it.
+         */
+        [[nodiscard]] std::unique_ptr<cipher> take(cipher_type type, range<std::uint8_t const *> key);
+
+        /**
+         * @brief Records that @p c was allocated for @p key, so that it can be given back to the cache.
+         *
+         * If the cache is full, the least recently used idle entry is evicted; if there are no idle entries, @p c
+         * is not tracked and will be destroyed when given back.
+         */
+        void track(cipher_type type, range<std::uint8_t const *> key, cipher const &c);
+
+        /**
+         * @brief Gives back a cipher obtained from @ref take or passed to @ref track, set it up again and make it idle.
+         * @note Ciphers that are not tracked by this cache are destroyed.
+         */
+        void give_back(std::unique_ptr<cipher> c);
+
+        /**
+         * @brief Destroys all idle ciphers and wipes their keys. Lent ciphers are destroyed when given back.
+         */
+        void clear();
+
+        [[nodiscard]] inline std::size_t capacity() const;
+
+        /**
+         * @brief Number of tracked ciphers, lent or idle.
+         */
+        [[nodiscard]] inline std::size_t size() const;
+
+        [[nodiscard]] inline cache_stats const &stats() const;
+
+    private:
+        static constexpr std::size_t max_key_length = 24;
+
+        struct entry {
+            cipher_type type = cipher_type::none;
+            std::array<std::uint8_t, max_key_length> key{};
+            std::size_t key_length = 0;
+            std::unique_ptr<cipher> idle = nullptr;
+            cipher const *lent = nullptr;
+            std::uint32_t last_use = 0;
+
+            [[nodiscard]] bool matches(cipher_type type_, range<std::uint8_t const *> key_) const;
+            [[nodiscard]] range<std::uint8_t const *> key_view() const;
+            void assign(cipher_type type_, range<std::uint8_t const *> key_);
+            void wipe();
+        };
+
+        [[nodiscard]] std::vector<entry>::iterator least_recently_used_idle(cipher_type type);
+
+        std::vector<entry> _entries;
+        std::size_t _capacity;
+        std::uint32_t _last_use;
+        cache_stats _stats;
+    };
+}// namespace desfire
+
+namespace desfire {
+
+    std::size_t cipher_cache::capacity() const {
+        return _capacity;
+    }
+
+    std::size_t cipher_cache::size() const {
+        return _entries.size();
+    }
+
+    cipher_cache::cache_stats const &cipher_cache::stats() const {
+        return _stats;
+    }
+
+}// namespace desfire
+
+#endif//DESFIRE_CIPHER_CACHE_HPP
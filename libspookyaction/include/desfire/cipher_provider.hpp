@@ -6,6 +6,7 @@
 #define DESFIRE_CIPHER_PROVIDER_HPP
 
 #include <desfire/cipher.hpp>
+#include <desfire/cipher_cache.hpp>
 #include <desfire/data.hpp>
 
 namespace desfire {
@@ -17,12 +18,28 @@ namespace desfire {
         [[nodiscard]] virtual std::unique_ptr<cipher> cipher_from_key(any_key const &key) = 0;
         [[nodiscard]] virtual std::unique_ptr<crypto> crypto_from_key(any_key const &key) = 0;
 
+        /**
+         * @brief Gives back a cipher obtained from @ref cipher_from_key that is no longer needed.
+         *
+         * Providers that pool their ciphers (see @ref cipher_cache) reuse it for a later @ref cipher_from_key call.
+         * The default implementation destroys @p c.
+         */
+        virtual void recycle_cipher(std::unique_ptr<cipher> c);
+
         virtual ~cipher_provider() = default;
     };
 
+    /**
+     * @brief Cipher provider over the concrete crypto implementations @p CryptoDES, @p Crypto2K3DES, @p Crypto3K3DES,
+     * @p CryptoAES.
+     *
+     * By default, the ciphers are @ref typed_cipher_legacy and @ref typed_cipher_default instantiated on the concrete
+     * crypto types, so that the cryptographic calls are resolved at compile time. Pass e.g. @ref cipher_default to use
+     * a cipher that goes through the virtual interface of the crypto instead.
+     */
     template <class CryptoDES, class Crypto2K3DES, class Crypto3K3DES, class CryptoAES,
-              class CipherDES = cipher_legacy, class Cipher2K3DES = cipher_legacy,
-              class Cipher3K3DES = cipher_default, class CipherAES = cipher_default>
+              class CipherDES = typed_cipher_legacy<CryptoDES>, class Cipher2K3DES = typed_cipher_legacy<Crypto2K3DES>,
+              class Cipher3K3DES = typed_cipher_default<Crypto3K3DES>, class CipherAES = typed_cipher_default<CryptoAES>>
     struct typed_cipher_provider final : public cipher_provider {
         static_assert(std::is_base_of_v<crypto, CryptoDES>);
         static_assert(std::is_base_of_v<crypto, Crypto2K3DES>);
@@ -33,38 +50,88 @@ namespace desfire {
         static_assert(std::is_base_of_v<cipher, Cipher3K3DES>);
         static_assert(std::is_base_of_v<cipher, CipherAES>);
 
+        typed_cipher_provider() = default;
+
+        /**
+         * @param cache Cache of ciphers set up with a key, see @ref cipher_cache. Share it among all the providers that
+         *  should reuse the same ciphers, e.g. the ones of all the tags created by a reader. If `nullptr`, every cipher
+         *  is allocated and set up from scratch.
+         */
+        explicit typed_cipher_provider(std::shared_ptr<cipher_cache> cache);
+
         [[nodiscard]] std::unique_ptr<cipher> cipher_from_key(any_key const &key) override;
         [[nodiscard]] std::unique_ptr<crypto> crypto_from_key(any_key const &key) override;
+        void recycle_cipher(std::unique_ptr<cipher> c) override;
+
+        [[nodiscard]] std::shared_ptr<cipher_cache> const &cache() const;
+
+    private:
+        template <class CryptoT, class CipherT, cipher_type Type>
+        [[nodiscard]] std::unique_ptr<cipher> make_cipher(key<Type> const &k);
+
+        std::shared_ptr<cipher_cache> _cache = nullptr;
     };
 }// namespace desfire
 
 namespace desfire {
 
+    inline void cipher_provider::recycle_cipher(std::unique_ptr<cipher>) {}
+
+    template <class CryptoDES, class Crypto2K3DES, class Crypto3K3DES, class CryptoAES,
+              class CipherDES, class Cipher2K3DES, class Cipher3K3DES, class CipherAES>
+    typed_cipher_provider<CryptoDES, Crypto2K3DES, Crypto3K3DES, CryptoAES,
+                          CipherDES, Cipher2K3DES, Cipher3K3DES, CipherAES>::typed_cipher_provider(std::shared_ptr<cipher_cache> cache)
+        : _cache{std::move(cache)} {}
+
+    template <class CryptoDES, class Crypto2K3DES, class Crypto3K3DES, class CryptoAES,
+              class CipherDES, class Cipher2K3DES, class Cipher3K3DES, class CipherAES>
+    std::shared_ptr<cipher_cache> const &typed_cipher_provider<CryptoDES, Crypto2K3DES, Crypto3K3DES, CryptoAES,
+                                                               CipherDES, Cipher2K3DES, Cipher3K3DES, CipherAES>::cache() const {
+        return _cache;
+    }
+
+    template <class CryptoDES, class Crypto2K3DES, class Crypto3K3DES, class CryptoAES,
+              class CipherDES, class Cipher2K3DES, class Cipher3K3DES, class CipherAES>
+    template <class CryptoT, class CipherT, cipher_type Type>
+    std::unique_ptr<cipher> typed_cipher_provider<CryptoDES, Crypto2K3DES, Crypto3K3DES, CryptoAES,
+                                                  CipherDES, Cipher2K3DES, Cipher3K3DES, CipherAES>::make_cipher(key<Type> const &k) {
+        const auto key_body = make_range(k.k);
+        if (_cache != nullptr) {
+            if (auto pcipher = _cache->take(Type, key_body); pcipher != nullptr) {
+                return pcipher;
+            }
+        }
+        auto crypto = std::make_unique<CryptoT>();
+        crypto->setup_with_key(key_body);
+        auto pcipher = std::make_unique<CipherT>(std::move(crypto));
+        if (_cache != nullptr) {
+            _cache->track(Type, key_body, *pcipher);
+        }
+        return pcipher;
+    }
+
+    template <class CryptoDES, class Crypto2K3DES, class Crypto3K3DES, class CryptoAES,
+              class CipherDES, class Cipher2K3DES, class Cipher3K3DES, class CipherAES>
+    void typed_cipher_provider<CryptoDES, Crypto2K3DES, Crypto3K3DES, CryptoAES,
+                               CipherDES, Cipher2K3DES, Cipher3K3DES, CipherAES>::recycle_cipher(std::unique_ptr<cipher> c) {
+        if (_cache != nullptr) {
+            _cache->give_back(std::move(c));
+        }
+    }
+
     template <class CryptoDES, class Crypto2K3DES, class Crypto3K3DES, class CryptoAES,
               class CipherDES, class Cipher2K3DES, class Cipher3K3DES, class CipherAES>
     std::unique_ptr<cipher> typed_cipher_provider<CryptoDES, Crypto2K3DES, Crypto3K3DES, CryptoAES,
                                                   CipherDES, Cipher2K3DES, Cipher3K3DES, CipherAES>::cipher_from_key(any_key const &key) {
         switch (key.type()) {
-            case cipher_type::des: {
-                auto crypto = std::make_unique<CryptoDES>();
-                crypto->setup_with_key(make_range(key.template get<cipher_type::des>().k));
-                return std::make_unique<CipherDES>(std::move(crypto));
-            }
-            case cipher_type::des3_2k: {
-                auto crypto = std::make_unique<Crypto2K3DES>();
-                crypto->setup_with_key(make_range(key.template get<cipher_type::des3_2k>().k));
-                return std::make_unique<Cipher2K3DES>(std::move(crypto));
-            }
-            case cipher_type::des3_3k: {
-                auto crypto = std::make_unique<Crypto3K3DES>();
-                crypto->setup_with_key(make_range(key.template get<cipher_type::des3_3k>().k));
-                return std::make_unique<Cipher3K3DES>(std::move(crypto));
-            }
-            case cipher_type::aes128: {
-                auto crypto = std::make_unique<CryptoAES>();
-                crypto->setup_with_key(make_range(key.template get<cipher_type::aes128>().k));
-                return std::make_unique<CipherAES>(std::move(crypto));
-            }
+            case cipher_type::des:
+                return make_cipher<CryptoDES, CipherDES>(key.template get<cipher_type::des>());
+            case cipher_type::des3_2k:
+                return make_cipher<Crypto2K3DES, Cipher2K3DES>(key.template get<cipher_type::des3_2k>());
+            case cipher_type::des3_3k:
+                return make_cipher<Crypto3K3DES, Cipher3K3DES>(key.template get<cipher_type::des3_3k>());
+            case cipher_type::aes128:
+                return make_cipher<CryptoAES, CipherAES>(key.template get<cipher_type::aes128>());
             case cipher_type::none:
                 [[fallthrough]];
             default:
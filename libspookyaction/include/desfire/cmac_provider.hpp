@@ -5,6 +5,7 @@
 #ifndef DESFIRE_CRYPTO_CMAC_HPP
 #define DESFIRE_CRYPTO_CMAC_HPP
 
+#include <array>
 #include <memory>
 #include <mlab/bin_data.hpp>
 #include <mlab/pool.hpp>
@@ -135,6 +136,53 @@ namespace desfire {
         void prepare_cmac_data(bin_data &data, std::size_t desired_padded_length) const;
     };
 
+    /**
+     * @brief Incremental CMAC computation, see @ref cmac_provider::begin.
+     *
+     * Data can be fed in any number of chunks of any size through @ref update; the result is the same as calling
+     * @ref cmac_provider::compute_cmac on the concatenation of all chunks. Since @ref crypto::do_crypto operates in
+     * place, the input is passed through a small fixed-size buffer, a few blocks at a time; the last block is always
+     * held back, because it has to be padded and XORed with the subkey in @ref finish. No memory is allocated.
+     * @note The IV passed to @ref cmac_provider::begin is updated as blocks are processed, and must outlive this object.
+     */
+    class cmac_stream {
+    public:
+        using mac_t = std::array<std::uint8_t, 8>;
+
+        /**
+         * @brief Largest supported block size (AES128).
+         */
+        static constexpr std::size_t max_block_size = 16;
+
+        /**
+         * @brief Appends @p data to the message being authenticated.
+         */
+        void update(range<std::uint8_t const *> data);
+
+        /**
+         * @brief Pads and XORs the last block, completes the CMAC, and returns the first 8 bytes of the resulting IV.
+         * @note After this call, the stream must not be used anymore.
+         */
+        [[nodiscard]] mac_t finish();
+
+    private:
+        friend class cmac_provider;
+
+        cmac_stream(cmac_keychain const &keychain, crypto &crypto, range<std::uint8_t *> iv);
+
+        /**
+         * Processes all the buffered blocks except for the last one, which is moved at the beginning of the buffer.
+         */
+        void flush();
+
+        cmac_keychain const *_keychain;
+        crypto *_crypto;
+        range<std::uint8_t *> _iv;
+        std::array<std::uint8_t, 4 * max_block_size> _buffer;
+        std::size_t _buffered;
+        bool _valid;
+    };
+
     /**
      * @brief Class tasked with computing CMACs using a @ref crypto implementation.
      *
@@ -145,7 +193,6 @@ namespace desfire {
      */
     class cmac_provider {
         cmac_keychain _keychain;
-        mlab::shared_buffer_pool _buffer_pool;
 
     public:
         /**
@@ -162,15 +209,13 @@ namespace desfire {
          * @param last_byte_xor Used in subkey generation, this is specific to the Desfire implementation. Refer to
          *  @ref prepare_subkey for more details; the values used are @ref desfire::bits::crypto_cmac_xor_byte_3k3des
          *  for 3K3DES, and @ref desfire::bits::crypto_cmac_xor_byte_aes for AES128.
-         * @param buffer_pool Buffer pool to use for CMAC. If `nullptr`, it uses @ref default_buffer_pool. This class
-         *  retains a pointer to the buffer pool, so it cannot be changed after construction.
          *
          * @see cmac_keychain::cmac_keychain
          * @see cmac_keychain::prepare_subkey
          * @see desfire::bits::crypto_cmac_xor_byte_3k3des
          * @see desfire::bits::crypto_cmac_xor_byte_aes
          */
-        cmac_provider(std::size_t block_size, std::uint8_t last_byte_xor, mlab::shared_buffer_pool buffer_pool = nullptr);
+        cmac_provider(std::size_t block_size, std::uint8_t last_byte_xor);
 
         /**
          * @brief Returns the keychain that holds the keys used for computing a CMAC.
@@ -210,8 +255,21 @@ namespace desfire {
          * @param data Data to compute the CMAC on.
          *
          * @return A 8-byte message authentication code.
+         * @note This is equivalent to @ref begin, followed by a single @ref cmac_stream::update and
+         *  @ref cmac_stream::finish.
          */
         mac_t compute_cmac(crypto &crypto, range<std::uint8_t *> iv, range<std::uint8_t const *> data);
+
+        /**
+         * @brief Begins an incremental CMAC computation, to which data can be fed in chunks.
+         *
+         * Make sure that the subkeys are initialized with @ref initialize_subkeys before calling.
+         * @param crypto Cryptographic implementation to use. Must outlive the returned stream.
+         * @param iv Initialization vector to use, updated as the data is processed. Must outlive the returned stream.
+         * @return A stream that computes the same CMAC as @ref compute_cmac on the concatenation of all the data
+         *  passed to @ref cmac_stream::update.
+         */
+        [[nodiscard]] cmac_stream begin(crypto &crypto, range<std::uint8_t *> iv) const;
     };
 }// namespace desfire
 
@@ -9,6 +9,7 @@
 #include <desfire/bits.hpp>
 #include <desfire/cmac_provider.hpp>
 #include <mlab/bin_data.hpp>
+#include <type_traits>
 
 namespace desfire {
     namespace {
@@ -122,11 +123,9 @@ namespace desfire {
          *  no clue about why we have to do this, maybe some nice key pre-conditioning to resist certain attacks? I do
          *  not know, but it is a constant specific to the cipher used. This is passed directly to
          *  @ref cmac_provider::cmac_provider.
-         * @param buffer_pool Buffer pool to use for CMAC. If `nullptr`, it uses @ref default_buffer_pool. This class
-         *  retains a pointer to the buffer pool, so it cannot be changed after construction.
          * @see cmac_provider::cmac_provider
          */
-        crypto_with_cmac(std::uint8_t block_size, std::uint8_t last_byte_xor, mlab::shared_buffer_pool buffer_pool = nullptr);
+        crypto_with_cmac(std::uint8_t block_size, std::uint8_t last_byte_xor);
 
         /**
          * @brief Subclasses should implement this instead of @ref setup_with_key, to the same effect.
@@ -146,6 +145,12 @@ namespace desfire {
 
         virtual mac_t do_cmac(range<std::uint8_t const *> data, range<std::uint8_t *> iv);
 
+        /**
+         * @brief Begins an incremental CMAC on this crypto, see @ref cmac_provider::begin.
+         * @param iv Initialization vector to use, updated as the data is processed. Must outlive the returned stream.
+         */
+        [[nodiscard]] cmac_stream begin_cmac(range<std::uint8_t *> iv);
+
         /**
          * @brief Block size for this cipher. This is specified upon construction and is cipher-specific.
          * @return Size in bytes of the underlying block cipher.
@@ -253,18 +258,7 @@ namespace desfire {
      */
     class crypto_3k3des_base : public crypto_with_cmac {
     public:
-        /**
-         * @brief Initializes a new crypto object with a default buffer pool.
-         * @note This overload uses @ref default_buffer_pool as a buffer pool for @ref cmac_provider.
-         */
         crypto_3k3des_base();
-
-        /**
-         * @brief Initializes a new crypto object with a custom buffer pool.
-         * @param buffer_pool Buffer pool to use for CMAC. If `nullptr`, it uses @ref default_buffer_pool. This class
-         *  retains a pointer to the buffer pool, so it cannot be changed after construction.
-         */
-        explicit crypto_3k3des_base(mlab::shared_buffer_pool buffer_pool);
         [[nodiscard]] inline desfire::cipher_type cipher_type() const final;
         void init_session(range<std::uint8_t const *> random_data) final;
         void setup_with_key(range<std::uint8_t const *> key) override;
@@ -279,22 +273,28 @@ namespace desfire {
      */
     class crypto_aes_base : public crypto_with_cmac {
     public:
-        /**
-         * @brief Initializes a new crypto object with a default buffer pool.
-         * @note This overload uses @ref default_buffer_pool as a buffer pool for @ref cmac_provider.
-         */
         crypto_aes_base();
-
-        /**
-         * @brief Initializes a new crypto object with a custom buffer pool.
-         * @param buffer_pool Buffer pool to use for CMAC. If `nullptr`, it uses @ref default_buffer_pool. This class
-         *  retains a pointer to the buffer pool, so it cannot be changed after construction.
-         */
-        explicit crypto_aes_base(mlab::shared_buffer_pool buffer_pool);
         [[nodiscard]] inline desfire::cipher_type cipher_type() const final;
         void init_session(range<std::uint8_t const *> random_data) final;
     };
 
+    /**
+     * @brief Block size of @p CryptoT, if it can be determined at compile time from its base class, otherwise zero.
+     *
+     * This allows @ref typed_cipher_default to size its buffers and compute paddings at compile time. For a generic
+     * @ref crypto_with_cmac, the block size is only known at runtime via @ref crypto_with_cmac::block_size.
+     */
+    template <class CryptoT>
+    struct crypto_block_size
+        : std::integral_constant<std::size_t, std::is_base_of_v<crypto_aes_base, CryptoT>      ? 16
+                                              : std::is_base_of_v<crypto_3k3des_base, CryptoT> ? 8
+                                              : std::is_base_of_v<crypto_2k3des_base, CryptoT> ? 8
+                                              : std::is_base_of_v<crypto_des_base, CryptoT>    ? 8
+                                                                                               : 0> {};
+
+    template <class CryptoT>
+    static constexpr std::size_t crypto_block_size_v = crypto_block_size<CryptoT>::value;
+
 }// namespace desfire
 
 namespace desfire {
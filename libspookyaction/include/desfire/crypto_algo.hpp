@@ -63,6 +63,24 @@ namespace desfire {
     std::pair<ByteIterator, bool> find_crc_tail(ByteIterator begin, ByteIterator end, Fn &&crc_fn, N init, std::size_t block_size,
                                                 bool incremental_crc, std::array<std::uint8_t, NPaddingBytes> const &valid_padding_bytes = default_padding_bytes);
 
+    /**
+     * @brief Finds the CRC tail of a sequence ''DATA || CRC || PADDING'', where the CRC is computed on
+     * ''DATA || extra_byte'' instead of ''DATA'' alone.
+     *
+     * This is what happens for example with the status byte in @ref cipher_default, which is not part of the
+     * transmitted data but enters the CRC. Differently from @ref find_crc_tail with ''incremental_crc'' false, the CRC
+     * of the data is computed once and extended one byte at a time, so that the whole search is linear in the length of
+     * the sequence; for each candidate tail, only ''extra_byte'' and the ''sizeof(N)'' CRC bytes are processed.
+     * @tparam N A unsigned integer size matching the crc size, e.g. ''std::uint32_t'' for a CRC32.
+     * @tparam Fn Must satisfy ''CRC(A || B, init) = crc_fn(B, crc_fn(A, init))'', and must accept both @p ByteIterator
+     *  and ''std::uint8_t const *'' pairs, e.g. a generic lambda ''N crc_fn(auto b, auto e, N init)''.
+     * @param extra_byte Byte that enters the CRC between the data and the CRC itself.
+     * @return An iterator past the end of the CRC, and whether the CRC was verified.
+     */
+    template <class ByteIterator, class N, class Fn, std::size_t NPaddingBytes = 2>
+    std::pair<ByteIterator, bool> find_crc_tail_with_extra_byte(ByteIterator begin, ByteIterator end, Fn &&crc_fn, N init, std::size_t block_size,
+                                                                std::uint8_t extra_byte, std::array<std::uint8_t, NPaddingBytes> const &valid_padding_bytes = default_padding_bytes);
+
     struct randbytes {
         std::size_t n;
         explicit randbytes(std::size_t len) : n{len} {}
@@ -154,6 +172,44 @@ namespace desfire {
         return {end, false};
     }
 
+    template <class ByteIterator, class N, class Fn, std::size_t NPaddingBytes>
+    std::pair<ByteIterator, bool> find_crc_tail_with_extra_byte(ByteIterator begin, ByteIterator end, Fn &&crc_fn, N init,
+                                                                std::size_t block_size, std::uint8_t extra_byte,
+                                                                std::array<std::uint8_t, NPaddingBytes> const &valid_padding_bytes) {
+        static constexpr auto crc_size = typename std::iterator_traits<ByteIterator>::difference_type(sizeof(N));
+        const auto nonzero_byte_pred = [&](std::uint8_t b) -> bool {
+            return std::find(std::begin(valid_padding_bytes), std::end(valid_padding_bytes), b) == std::end(valid_padding_bytes);
+        };
+        const bool multiple_of_block_size = std::distance(begin, end) % block_size == 0;
+        if (not multiple_of_block_size) {
+            DESFIRE_LOGE("Cannot scan for CRC tail if data length is not a multiple of the block size.");
+        }
+        if (begin != end and multiple_of_block_size) {
+            // Same as find_crc_tail, the last non-padding byte is in the last block
+            const auto rev_end = std::reverse_iterator<ByteIterator>(end);
+            auto end_payload = std::find_if(rev_end, rev_end + block_size, nonzero_byte_pred).base();
+            // The candidate CRC is the range [end_data, end_payload). Sequences shorter than the CRC have no data.
+            auto end_data = std::distance(begin, end_payload) > crc_size ? std::prev(end_payload, crc_size) : begin;
+            // This is the only pass on the bulk of the data
+            N crc_data = crc_fn(begin, end_data, init);
+            const auto crc_candidate = [&]() -> N {
+                return crc_fn(end_data, end_payload, crc_fn(&extra_byte, &extra_byte + 1, crc_data));
+            };
+            N crc = crc_candidate();
+            while (crc != N(0) and end_payload != end) {
+                // Advance the supposed end of the payload, the first byte of the previous CRC is now data
+                ++end_payload;
+                if (std::distance(end_data, end_payload) > crc_size) {
+                    crc_data = crc_fn(end_data, std::next(end_data), crc_data);
+                    ++end_data;
+                }
+                crc = crc_candidate();
+            }
+            return {end_payload, crc == N(0)};
+        }
+        return {end, false};
+    }
+
     template <class Integral>
     std::pair<unsigned, Integral> log2_remainder(Integral n) {
         static_assert(std::is_integral_v<Integral> and std::is_unsigned_v<Integral>);
@@ -66,7 +66,8 @@ namespace desfire {
                               *
                               * This could mean invalid MAC, CMAC, or CRC, or data length is not a multiple of block
                               * size when encrypted; this depends on the specified communication config.
-                              */
+                              */,
+        out_of_buffers   ///< The buffer pool is exhausted (only with a @ref mlab::pool_mode::preallocated pool).
     };
 
     [[nodiscard]] error error_from_status(status s);
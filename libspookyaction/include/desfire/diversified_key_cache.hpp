@@ -0,0 +1,136 @@
+#ifndef DESFIRE_DIVERSIFIED_KEY_CACHE_HPP
+#define DESFIRE_DIVERSIFIED_KEY_CACHE_HPP
+
+#include <array>
+#include <desfire/data.hpp>
+#include <vector>
+
+namespace desfire {
+    namespace {
+        using mlab::range;
+    }
+
+    struct cipher_provider;
+
+    /**
+     * @brief Bounded LRU cache of keys diversified with @ref kdf_an10922.
+     *
+     * Diversifying a key requires a new @ref crypto set up with the master key, deriving the CMAC subkeys, and two or
+     * three CMAC passes, all before the authentication with the card can begin. When the same cards come back to the
+     * same reader, @ref get returns the key diversified the last time. Entries are identified by an id of the master
+     * key, chosen by the caller, and by the diversification input.
+     *
+     * To also skip setting up the cipher, obtain it from a @ref typed_cipher_provider that shares a @ref cipher_cache:
+     * the cipher set up with the diversified key is then reused as well.
+     * @note The diversified keys are kept in memory as long as they are in the cache, and are wiped on eviction.
+     * @note This class is not thread safe.
+     */
+    class diversified_key_cache {
+    public:
+        struct cache_stats {
+            /**
+             * Number of times a key was found in the cache.
+             */
+            std::size_t hits = 0;
+            /**
+             * Number of times a key had to be diversified.
+             */
+            std::size_t misses = 0;
+            /**
+             * Number of times a key was evicted to make space for a new one.
+             */
+            std::size_t evictions = 0;
+        };
+
+        static constexpr std::size_t default_capacity = 16;
+
+        /**
+         * @brief Longest diversification input that can be cached; @ref kdf_an10922 uses at most 31 bytes for AES.
+         */
+        static constexpr std::size_t max_input_length = 31;
+
+        /**
+         * @param capacity Maximum number of keys in the cache. The storage is reserved upfront.
+         */
+        explicit diversified_key_cache(std::size_t capacity = default_capacity);
+
+        diversified_key_cache(diversified_key_cache const &) = delete;
+        diversified_key_cache &operator=(diversified_key_cache const &) = delete;
+
+        ~diversified_key_cache();
+
+        /**
+         * @brief Key obtained by diversifying @p master_key with @p diversify_input, from the cache when possible.
+         *
+         * On a miss, runs @ref kdf_an10922 and stores the result, evicting the least recently used key if the cache is
+         * full. Inputs longer than @ref max_input_length are diversified without caching.
+         * @param master_key_id Identifies @p master_key among the master keys used with this cache, e.g. the AID and
+         *  key number. Keys are only reused if @p master_key_id and the type of @p master_key match.
+         * @param master_key Key to diversify.
+         * @param provider Used to create the crypto for @p master_key on a miss.
+         * @param diversify_input Diversification input.
+         * @return The same key as `kdf_an10922(master_key, provider, diversify_input)`.
+         */
+        [[nodiscard]] any_key get(std::uint32_t master_key_id, any_key const &master_key, cipher_provider &provider,
+                                  range<std::uint8_t const *> diversify_input);
+
+        /**
+         * @brief Wipes and removes all the keys derived from the master key identified by @p master_key_id. Call this
+         * when the master key changes.
+         */
+        void erase(std::uint32_t master_key_id);
+
+        /**
+         * @brief Wipes and removes all the keys.
+         */
+        void clear();
+
+        [[nodiscard]] inline std::size_t capacity() const;
+
+        [[nodiscard]] inline std::size_t size() const;
+
+        [[nodiscard]] inline cache_stats const &stats() const;
+
+    private:
+        static constexpr std::size_t max_key_length = 24;
+
+        struct entry {
+            std::uint32_t master_key_id = 0;
+            cipher_type master_key_type = cipher_type::none;
+            std::array<std::uint8_t, max_input_length> input{};
+            std::size_t input_length = 0;
+            cipher_type type = cipher_type::none;
+            std::array<std::uint8_t, max_key_length> key{};
+            std::uint8_t key_version = 0;
+            std::uint32_t last_use = 0;
+
+            [[nodiscard]] bool matches(std::uint32_t master_key_id_, cipher_type master_key_type_, range<std::uint8_t const *> input_) const;
+            void assign(std::uint32_t master_key_id_, cipher_type master_key_type_, range<std::uint8_t const *> input_, any_key const &k);
+            [[nodiscard]] any_key get_key() const;
+            void wipe();
+        };
+
+        std::vector<entry> _entries;
+        std::size_t _capacity;
+        std::uint32_t _last_use;
+        cache_stats _stats;
+    };
+}// namespace desfire
+
+namespace desfire {
+
+    std::size_t diversified_key_cache::capacity() const {
+        return _capacity;
+    }
+
+    std::size_t diversified_key_cache::size() const {
+        return _entries.size();
+    }
+
+    diversified_key_cache::cache_stats const &diversified_key_cache::stats() const {
+        return _stats;
+    }
+
+}// namespace desfire
+
+#endif//DESFIRE_DIVERSIFIED_KEY_CACHE_HPP
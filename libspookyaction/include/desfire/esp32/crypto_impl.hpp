@@ -9,10 +9,13 @@
 #include <desfire/crypto.hpp>
 
 /**
- * @note ''esp_config.h'' must be included before ''aes.h'' to enable hardware AES.
+ * @note ''esp_config.h'' must be included before ''aes.h'' to enable hardware AES. On other platforms, e.g. when
+ *  running the tests natively, these implementations use the software mbedTLS library installed on the system.
  * @{
  */
+#ifdef ESP_PLATFORM
 #include <mbedtls/esp_config.h>
+#endif
 /**
  * @}
  */
@@ -62,7 +65,6 @@ namespace desfire::esp32 {
     public:
         void do_crypto(range<std::uint8_t *> data, range<std::uint8_t *> iv, crypto_operation op) override;
         crypto_3k3des();
-        explicit crypto_3k3des(mlab::shared_buffer_pool buffer_pool);
         ~crypto_3k3des() override;
 
     protected:
@@ -76,7 +78,6 @@ namespace desfire::esp32 {
     public:
         void do_crypto(range<std::uint8_t *> data, range<std::uint8_t *> iv, crypto_operation op) override;
         crypto_aes();
-        explicit crypto_aes(mlab::shared_buffer_pool buffer_pool);
         ~crypto_aes() override;
 
     protected:
@@ -13,14 +13,42 @@ namespace desfire::esp32 {
         static heap_trace_record_t records[num_records];// This buffer must be in internal RAM
     }                                                   // namespace trace
 
+    /**
+     * @brief Traces the heap for the lifetime of this object.
+     * @note Requires `CONFIG_HEAP_TRACING_STANDALONE`.
+     */
     struct mem_monitor {
-        mem_monitor();
+        /**
+         * @param record_all_allocations If true, records every allocation, also those that are freed before the end
+         *  of the monitoring, so that @ref count_allocations can prove that a piece of code does not touch the heap.
+         *  Otherwise, only records leaks.
+         */
+        explicit mem_monitor(bool record_all_allocations = false);
         ~mem_monitor();
         mem_monitor(mem_monitor &&) noexcept = delete;
         mem_monitor(mem_monitor const &) = delete;
         mem_monitor &operator=(mem_monitor &&) noexcept = delete;
         mem_monitor &operator=(mem_monitor const &) = delete;
         [[nodiscard]] std::size_t count_leaked_memory() const;
+
+        /**
+         * @brief Number of heap allocations since construction; only counts the leaks unless recording all allocations.
+         * @note At most @ref trace::num_records allocations are recorded.
+         */
+        [[nodiscard]] std::size_t count_allocations() const;
+
+        /**
+         * @brief Stops recording until @ref resume, e.g. to leave out the allocations of a simulated device.
+         */
+        void pause();
+
+        /**
+         * @brief Resumes recording after @ref pause, keeping what was recorded before.
+         */
+        void resume();
+
+    private:
+        bool _record_all_allocations;
     };
 
 }// namespace desfire::esp32
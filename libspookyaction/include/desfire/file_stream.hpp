@@ -0,0 +1,242 @@
+#ifndef DESFIRE_FILE_STREAM_HPP
+#define DESFIRE_FILE_STREAM_HPP
+
+#include "tag.hpp"
+#include <algorithm>
+#include <functional>
+#include <optional>
+
+namespace desfire {
+
+    /**
+     * @brief Reads a standard or backup data file in windows of bounded size.
+     *
+     * Instead of returning the whole region at once like @ref tag::read_data, every window is requested separately and
+     * handed to a sink as soon as its MAC or CRC has been verified. The memory used is bounded by the window size, and
+     * the first bytes are available after the first window, not after the last frame of the file.
+     *
+     * The reader remembers how far it got. If a window fails (e.g. the card left the field), the caller can restore the
+     * session (select the application, authenticate again) and call @ref resume to continue from the first byte that
+     * was not delivered.
+     * @ingroup standardFile
+     */
+    class file_reader {
+    public:
+        /**
+         * @brief Receives a verified window.
+         * @param offset Offset in the file of the first byte in @p data.
+         * @param data Content of the window; it is valid only for the duration of the call.
+         * @return False to stop reading. @ref resume picks up from the following window.
+         */
+        using sink_fn = std::function<bool(std::uint32_t offset, mlab::range<std::uint8_t const *> data)>;
+
+        static constexpr std::uint32_t default_window_size = 0x100;
+
+        /**
+         * @param mifare Tag to read from. Must outlive the reader.
+         * @param fid Max @ref bits::max_standard_data_file_id or @ref bits::max_backup_data_file_id
+         * @param window_size Maximum number of bytes requested with a single @ref tag::read_data, at least 1.
+         */
+        file_reader(tag &mifare, file_id fid, std::uint32_t window_size = default_window_size);
+
+        /**
+         * @param mifare Tag to read from. Must outlive the reader.
+         * @param fid Max @ref bits::max_standard_data_file_id or @ref bits::max_backup_data_file_id
+         * @param security Force the communication mode, and do not auto-detect
+         * @param window_size Maximum number of bytes requested with a single @ref tag::read_data, at least 1.
+         */
+        file_reader(tag &mifare, file_id fid, file_security security, std::uint32_t window_size = default_window_size);
+
+        /**
+         * @brief Reads @p length bytes starting at @p offset, window by window.
+         * @param offset Limited to 24 bits, i.e. must be below 0xFFFFFF.
+         * @param length Limited to 24 bits. As in the DESFire protocol, zero means up to the end of the file; the file
+         *  size is then obtained through @ref tag::get_file_settings.
+         * @param sink Called once per window, in order.
+         * @return None, or any error returned by @ref tag::read_data. In case of error, @ref position is the first byte
+         *  that was not delivered.
+         */
+        tag::result<> read(std::uint32_t offset, std::uint32_t length, sink_fn const &sink);
+
+        /**
+         * @brief Continues an interrupted @ref read from @ref position.
+         */
+        tag::result<> resume(sink_fn const &sink);
+
+        /**
+         * @brief Sink that copies every window into @p it.
+         */
+        template <class OutputIt>
+        [[nodiscard]] static sink_fn copy_to(OutputIt it);
+
+        /**
+         * @brief Offset in the file of the next byte to read.
+         */
+        [[nodiscard]] inline std::uint32_t position() const;
+
+        /**
+         * @brief Number of bytes that still have to be read.
+         */
+        [[nodiscard]] inline std::uint32_t remaining() const;
+
+        [[nodiscard]] inline bool done() const;
+
+        [[nodiscard]] inline std::uint32_t window_size() const;
+
+    private:
+        tag *_mifare;
+        file_id _fid;
+        std::optional<file_security> _security;
+        std::uint32_t _window_size;
+        std::uint32_t _position;
+        std::uint32_t _end;
+    };
+
+    /**
+     * @brief Writes a standard or backup data file in windows of bounded size.
+     *
+     * The data is pulled from a source one window at a time, so that it does not need to be entirely in memory. The
+     * writer remembers how far it got; if a window fails, the caller can restore the session and call @ref resume.
+     * @note Writes to a backup file take effect only after @ref tag::commit_transaction, and a tear discards all
+     *  the windows that were not committed. Use @ref set_commit_each_window to make every window durable, so that
+     *  @ref resume does not have to start over. This commits all pending changes of the active application.
+     * @ingroup standardFile
+     */
+    class file_writer {
+    public:
+        /**
+         * @brief Produces the content of a window.
+         * @param offset Offset in the file of the first byte of @p window.
+         * @param window Buffer to fill completely.
+         * @return False to stop writing; @p window is then not written, and @ref resume starts from it.
+         */
+        using source_fn = std::function<bool(std::uint32_t offset, mlab::range<std::uint8_t *> window)>;
+
+        static constexpr std::uint32_t default_window_size = file_reader::default_window_size;
+
+        /**
+         * @param mifare Tag to write to. Must outlive the writer.
+         * @param fid Max @ref bits::max_standard_data_file_id or @ref bits::max_backup_data_file_id
+         * @param window_size Maximum number of bytes sent with a single @ref tag::write_data, at least 1.
+         */
+        file_writer(tag &mifare, file_id fid, std::uint32_t window_size = default_window_size);
+
+        /**
+         * @param mifare Tag to write to. Must outlive the writer.
+         * @param fid Max @ref bits::max_standard_data_file_id or @ref bits::max_backup_data_file_id
+         * @param security Force the communication mode, and do not auto-detect
+         * @param window_size Maximum number of bytes sent with a single @ref tag::write_data, at least 1.
+         */
+        file_writer(tag &mifare, file_id fid, file_security security, std::uint32_t window_size = default_window_size);
+
+        /**
+         * @brief Writes @p length bytes starting at @p offset, pulling them from @p source one window at a time.
+         * @param offset Limited to 24 bits, i.e. must be below 0xFFFFFF.
+         * @param length Limited to 24 bits, i.e. must be below 0xFFFFFF.
+         * @return None, or any error returned by @ref tag::write_data or @ref tag::commit_transaction. In case of
+         *  error, @ref position is the first byte that was not written.
+         */
+        tag::result<> write(std::uint32_t offset, std::uint32_t length, source_fn const &source);
+
+        /**
+         * @brief Writes @p data starting at @p offset, one window at a time.
+         */
+        tag::result<> write(std::uint32_t offset, bin_data const &data);
+
+        /**
+         * @brief Continues an interrupted @ref write from @ref position.
+         */
+        tag::result<> resume(source_fn const &source);
+
+        /**
+         * @brief Continues an interrupted @ref write from @ref position.
+         * @param data The same data that was passed to @ref write.
+         */
+        tag::result<> resume(bin_data const &data);
+
+        /**
+         * @brief Offset in the file of the next byte to write.
+         */
+        [[nodiscard]] inline std::uint32_t position() const;
+
+        /**
+         * @brief Number of bytes that still have to be written.
+         */
+        [[nodiscard]] inline std::uint32_t remaining() const;
+
+        [[nodiscard]] inline bool done() const;
+
+        [[nodiscard]] inline std::uint32_t window_size() const;
+
+        [[nodiscard]] inline bool commit_each_window() const;
+        inline void set_commit_each_window(bool v);
+
+    private:
+        [[nodiscard]] source_fn copy_from(bin_data const &data) const;
+
+        tag *_mifare;
+        file_id _fid;
+        std::optional<file_security> _security;
+        std::uint32_t _window_size;
+        std::uint32_t _begin;
+        std::uint32_t _position;
+        std::uint32_t _end;
+        bool _commit_each_window;
+        bin_data _window;
+    };
+
+}// namespace desfire
+
+namespace desfire {
+
+    template <class OutputIt>
+    file_reader::sink_fn file_reader::copy_to(OutputIt it) {
+        return [it](std::uint32_t, mlab::range<std::uint8_t const *> data) mutable -> bool {
+            it = std::copy(std::begin(data), std::end(data), it);
+            return true;
+        };
+    }
+
+    std::uint32_t file_reader::position() const {
+        return _position;
+    }
+
+    std::uint32_t file_reader::remaining() const {
+        return _end - _position;
+    }
+
+    bool file_reader::done() const {
+        return _position == _end;
+    }
+
+    std::uint32_t file_reader::window_size() const {
+        return _window_size;
+    }
+
+    std::uint32_t file_writer::position() const {
+        return _position;
+    }
+
+    std::uint32_t file_writer::remaining() const {
+        return _end - _position;
+    }
+
+    bool file_writer::done() const {
+        return _position == _end;
+    }
+
+    std::uint32_t file_writer::window_size() const {
+        return _window_size;
+    }
+
+    bool file_writer::commit_each_window() const {
+        return _commit_each_window;
+    }
+
+    void file_writer::set_commit_each_window(bool v) {
+        _commit_each_window = v;
+    }
+
+}// namespace desfire
+
+#endif//DESFIRE_FILE_STREAM_HPP
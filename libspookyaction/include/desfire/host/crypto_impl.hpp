@@ -0,0 +1,116 @@
+#ifndef DESFIRE_HOST_CRYPTO_IMPL_HPP
+#define DESFIRE_HOST_CRYPTO_IMPL_HPP
+
+/**
+ * @brief Crypto implementations for Linux hosts, on top of OpenSSL's libcrypto (link with ''-lcrypto'').
+ *
+ * These implement the same contracts as @ref desfire::esp32::crypto_des and siblings, and can be used e.g. on
+ * provisioning or key diversification servers. AES goes through the EVP interface, which dispatches to AES-NI (or the
+ * ARMv8 crypto extensions) when the CPU supports it. DES and 3DES use the low level DES interface, since single DES is
+ * only available in the legacy provider of OpenSSL 3, and the EVP overhead is significant on the short messages
+ * exchanged with the card.
+ * @note The implementations are only available when building for Linux with the OpenSSL headers available, in which
+ *  case `DESFIRE_HOST_CRYPTO` is defined.
+ */
+#if defined(__linux__) && __has_include(<openssl/evp.h>) && __has_include(<openssl/des.h>)
+#include <openssl/des.h>
+#include <openssl/evp.h>
+#if !defined(OPENSSL_NO_DES) && !defined(OPENSSL_NO_DEPRECATED_3_0)
+#define DESFIRE_HOST_CRYPTO
+#endif
+#endif
+
+#ifdef DESFIRE_HOST_CRYPTO
+
+#include <array>
+#include <desfire/cipher_provider.hpp>
+#include <desfire/crypto.hpp>
+
+namespace desfire::host {
+
+    /**
+     * @brief OpenSSL cipher context in CBC mode, which keeps track of the IV it holds.
+     *
+     * OpenSSL chains the IV in the context across operations. When the caller passes back the IV resulting from the
+     * previous operation, as @ref cmac_stream does while processing data a few blocks at a time, there is no need to
+     * set it again, which in OpenSSL 3 is comparatively expensive.
+     */
+    class evp_cbc_context {
+        EVP_CIPHER_CTX *_ctx;
+        std::array<std::uint8_t, EVP_MAX_IV_LENGTH> _iv;
+        std::size_t _block_size;
+        bool _encrypt;
+        bool _iv_valid;
+
+    public:
+        evp_cbc_context();
+        evp_cbc_context(evp_cbc_context const &) = delete;
+        evp_cbc_context &operator=(evp_cbc_context const &) = delete;
+        ~evp_cbc_context();
+
+        void setup(EVP_CIPHER const *type, range<std::uint8_t const *> key, bool encrypt);
+
+        /**
+         * @brief CBC on @p data in place. Upon exit, @p iv contains the last ciphertext block.
+         */
+        void crypt(range<std::uint8_t *> data, range<std::uint8_t *> iv);
+    };
+
+    class crypto_des final : public crypto_des_base {
+        DES_key_schedule _key_schedule;
+
+    public:
+        void setup_with_key(range<std::uint8_t const *> key) override;
+        void do_crypto(range<std::uint8_t *> data, range<std::uint8_t *> iv, crypto_operation op) override;
+        crypto_des();
+        ~crypto_des() override;
+    };
+
+    class crypto_2k3des final : public crypto_2k3des_base {
+        DES_key_schedule _key_schedule_1;
+        DES_key_schedule _key_schedule_2;
+
+    protected:
+        void setup_primitives_with_key(range<std::uint8_t const *> key) override;
+
+    public:
+        /**
+         * @note When the key is degenerate (see @ref is_degenerate), this runs single DES instead of 3DES.
+         */
+        void do_crypto(range<std::uint8_t *> data, range<std::uint8_t *> iv, crypto_operation op) override;
+        crypto_2k3des();
+        ~crypto_2k3des() override;
+    };
+
+    class crypto_3k3des final : public crypto_3k3des_base {
+        DES_key_schedule _key_schedule_1;
+        DES_key_schedule _key_schedule_2;
+        DES_key_schedule _key_schedule_3;
+
+    public:
+        void do_crypto(range<std::uint8_t *> data, range<std::uint8_t *> iv, crypto_operation op) override;
+        crypto_3k3des();
+        ~crypto_3k3des() override;
+
+    protected:
+        void setup_primitives_with_key(range<std::uint8_t const *> key) override;
+    };
+
+    class crypto_aes final : public crypto_aes_base {
+        evp_cbc_context _enc_context;
+        evp_cbc_context _dec_context;
+
+    public:
+        void do_crypto(range<std::uint8_t *> data, range<std::uint8_t *> iv, crypto_operation op) override;
+        crypto_aes();
+
+    protected:
+        void setup_primitives_with_key(range<std::uint8_t const *> key) override;
+    };
+
+    using default_cipher_provider = typed_cipher_provider<crypto_des, crypto_2k3des, crypto_3k3des, crypto_aes>;
+}// namespace desfire::host
+
+#endif
+
+#endif//DESFIRE_HOST_CRYPTO_IMPL_HPP
@@ -5,13 +5,18 @@
 #ifndef LIBSPOOKYACTION_KDF_HPP
 #define LIBSPOOKYACTION_KDF_HPP
 
+#include <algorithm>
 #include <cstdint>
 #include <desfire/cmac_provider.hpp>
 #include <desfire/crypto.hpp>
 #include <desfire/log.h>
+#include <functional>
 #include <mlab/bin_data.hpp>
 
 namespace desfire {
+    namespace {
+        using mlab::make_range;
+    }
 
     class any_key;
     struct cipher_provider;
@@ -112,6 +117,74 @@ namespace desfire {
      * @}
      */
 
+    /**
+     * @brief AN10922 constants for the key type of @p CryptoT, one per block of the key.
+     * @see bits::kdf_aes_const
+     */
+    template <class CryptoT>
+    [[nodiscard]] constexpr auto kdf_an10922_constants();
+
+    /**
+     * @brief AN10922 key diversification of many inputs under the same master key.
+     *
+     * Produces the same keys as @ref kdf_an10922 on each input, but the CMAC subkeys are derived once at construction,
+     * the diversification inputs are not modified, and no memory is allocated. When @p CryptoT is the concrete, final
+     * implementation (e.g. @ref esp32::crypto_aes), the cryptographic calls are resolved at compile time. Like the
+     * templated @ref kdf_an10922, it does not set the version of the keys, see @ref set_key_version.
+     *
+     * @tparam CryptoT A subclass of @ref crypto_des_base, @ref crypto_2k3des_base, @ref crypto_3k3des_base or
+     *  @ref crypto_aes_base.
+     */
+    template <class CryptoT>
+    class kdf_an10922_batch {
+        static_assert(crypto_block_size_v<CryptoT> != 0, "kdf_an10922_batch needs a DES, 2K3DES, 3K3DES or AES crypto.");
+
+    public:
+        static constexpr std::size_t block_size = crypto_block_size_v<CryptoT>;
+        static constexpr std::size_t max_input_length = 2 * block_size - 1;
+
+        static constexpr std::size_t key_length = block_size * kdf_an10922_constants<CryptoT>().size();
+        using key_t = std::array<std::uint8_t, key_length>;
+
+        /**
+         * @param crypto Crypto set up with the master key. It must outlive this object, and its key must not change.
+         */
+        explicit kdf_an10922_batch(CryptoT &crypto);
+        kdf_an10922_batch(kdf_an10922_batch const &) = delete;
+        kdf_an10922_batch &operator=(kdf_an10922_batch const &) = delete;
+        ~kdf_an10922_batch();
+
+        /**
+         * @brief Diversifies a single key.
+         * @param diversify_input At most @ref max_input_length bytes will be used.
+         * @param key Output range of at least @ref key_length bytes.
+         */
+        void diversify(range<std::uint8_t const *> diversify_input, range<std::uint8_t *> key);
+
+        [[nodiscard]] key_t diversify(range<std::uint8_t const *> diversify_input);
+
+        /**
+         * @brief Diversifies one key for each of @p diversify_inputs.
+         * @param keys Contiguous output, the i-th key is written at offset `i * key_length`.
+         * @return The number of keys written, which is less than the number of inputs if @p keys is too short.
+         */
+        std::size_t diversify(range<range<std::uint8_t const *> const *> diversify_inputs, range<std::uint8_t *> keys);
+
+        /**
+         * @brief Diversifies one key for each of the packed inputs of the same length, e.g. UID || AID || system id.
+         * @param diversify_inputs Contiguous inputs, the i-th is at offset `i * input_length`.
+         * @param input_length Length of each input. At most @ref max_input_length bytes of each will be used.
+         * @param keys Contiguous output, the i-th key is written at offset `i * key_length`.
+         * @return The number of keys written, which is less than the number of inputs if @p keys is too short.
+         */
+        std::size_t diversify(range<std::uint8_t const *> diversify_inputs, std::size_t input_length, range<std::uint8_t *> keys);
+
+    private:
+        CryptoT *_crypto;
+        std::array<std::uint8_t, block_size> _subkey_pad;
+        std::array<std::uint8_t, block_size> _subkey_nopad;
+    };
+
 }// namespace desfire
 
 namespace desfire {
@@ -182,5 +255,112 @@ namespace desfire {
         return diversified_key;
     }
 
+    template <class CryptoT>
+    constexpr auto kdf_an10922_constants() {
+        if constexpr (std::is_base_of_v<crypto_aes_base, CryptoT>) {
+            return bits::kdf_aes_const;
+        } else if constexpr (std::is_base_of_v<crypto_3k3des_base, CryptoT>) {
+            return bits::kdf_3k3des_const;
+        } else if constexpr (std::is_base_of_v<crypto_2k3des_base, CryptoT>) {
+            return bits::kdf_2k3des_const;
+        } else {
+            return bits::kdf_des_const;
+        }
+    }
+
+    template <class CryptoT>
+    kdf_an10922_batch<CryptoT>::kdf_an10922_batch(CryptoT &crypto) : _crypto{&crypto}, _subkey_pad{}, _subkey_nopad{} {
+        if constexpr (std::is_base_of_v<crypto_with_cmac, CryptoT>) {
+            // Reuse the subkeys already derived by the crypto
+            cmac_keychain const &keychain = crypto.provider().keychain();
+            std::copy(std::begin(keychain.key_pad()), std::end(keychain.key_pad()), std::begin(_subkey_pad));
+            std::copy(std::begin(keychain.key_nopad()), std::end(keychain.key_nopad()), std::begin(_subkey_nopad));
+        } else {
+            cmac_keychain keychain{block_size, std::is_base_of_v<crypto_2k3des_base, CryptoT> ? bits::crypto_cmac_xor_byte_2k3des : bits::crypto_cmac_xor_byte_des};
+            keychain.initialize_subkeys(crypto);
+            std::copy(std::begin(keychain.key_pad()), std::end(keychain.key_pad()), std::begin(_subkey_pad));
+            std::copy(std::begin(keychain.key_nopad()), std::end(keychain.key_nopad()), std::begin(_subkey_nopad));
+            std::fill(std::begin(keychain.key_pad()), std::end(keychain.key_pad()), 0x00);
+            std::fill(std::begin(keychain.key_nopad()), std::end(keychain.key_nopad()), 0x00);
+        }
+    }
+
+    template <class CryptoT>
+    kdf_an10922_batch<CryptoT>::~kdf_an10922_batch() {
+        std::fill(std::begin(_subkey_pad), std::end(_subkey_pad), 0x00);
+        std::fill(std::begin(_subkey_nopad), std::end(_subkey_nopad), 0x00);
+    }
+
+    template <class CryptoT>
+    void kdf_an10922_batch<CryptoT>::diversify(range<std::uint8_t const *> diversify_input, range<std::uint8_t *> key) {
+        if (key.size() < key_length) {
+            DESFIRE_LOGE("KDF: output of %d bytes cannot hold a key of %u bytes.", key.size(), key_length);
+            return;
+        }
+        if (diversify_input.size() > max_input_length) {
+            DESFIRE_LOGW("Too long diversification input, %d > %u bytes. Will truncate.", diversify_input.size(), max_input_length);
+            diversify_input = {std::begin(diversify_input), std::begin(diversify_input) + max_input_length};
+        }
+        // Same as kdf_an10922: [[ CONST || INPUT || 80 00 .. 00 ]], the last block XORed with the subkey
+        std::array<std::uint8_t, 2 * block_size> message{};
+        std::copy(std::begin(diversify_input), std::end(diversify_input), std::next(std::begin(message)));
+        auto const *subkey = &_subkey_nopad;
+        if (diversify_input.size() < max_input_length) {
+            message[diversify_input.size() + 1] = 0x80;
+            subkey = &_subkey_pad;
+        }
+        const auto last_block = std::next(std::begin(message), block_size);
+        std::transform(last_block, std::end(message), std::begin(*subkey), last_block, std::bit_xor<>{});
+
+        std::array<std::uint8_t, 2 * block_size> buffer{};
+        for (std::size_t block_idx = 0; block_idx < kdf_an10922_constants<CryptoT>().size(); ++block_idx) {
+            buffer = message;
+            buffer[0] = kdf_an10922_constants<CryptoT>()[block_idx];
+            // The last ciphertext block, i.e. the block of the key, is left in the IV, which must start at zero
+            const range<std::uint8_t *> iv{std::begin(key) + block_idx * block_size, std::begin(key) + (block_idx + 1) * block_size};
+            std::fill(std::begin(iv), std::end(iv), 0x00);
+            _crypto->do_crypto(make_range(buffer), iv, crypto_operation::mac);
+        }
+        std::fill(std::begin(message), std::end(message), 0x00);
+        std::fill(std::begin(buffer), std::end(buffer), 0x00);
+    }
+
+    template <class CryptoT>
+    typename kdf_an10922_batch<CryptoT>::key_t kdf_an10922_batch<CryptoT>::diversify(range<std::uint8_t const *> diversify_input) {
+        key_t k{};
+        diversify(diversify_input, make_range(k));
+        return k;
+    }
+
+    template <class CryptoT>
+    std::size_t kdf_an10922_batch<CryptoT>::diversify(range<range<std::uint8_t const *> const *> diversify_inputs, range<std::uint8_t *> keys) {
+        const std::size_t n = std::min(diversify_inputs.size(), keys.size() / key_length);
+        if (n < diversify_inputs.size()) {
+            DESFIRE_LOGW("KDF: output of %d bytes can only hold %u keys out of %d.", keys.size(), n, diversify_inputs.size());
+        }
+        for (std::size_t i = 0; i < n; ++i) {
+            diversify(*(std::begin(diversify_inputs) + i), {std::begin(keys) + i * key_length, std::begin(keys) + (i + 1) * key_length});
+        }
+        return n;
+    }
+
+    template <class CryptoT>
+    std::size_t kdf_an10922_batch<CryptoT>::diversify(range<std::uint8_t const *> diversify_inputs, std::size_t input_length, range<std::uint8_t *> keys) {
+        if (input_length == 0) {
+            DESFIRE_LOGE("KDF: packed diversification inputs must have a nonzero length.");
+            return 0;
+        }
+        const std::size_t num_inputs = diversify_inputs.size() / input_length;
+        const std::size_t n = std::min(num_inputs, keys.size() / key_length);
+        if (n < num_inputs) {
+            DESFIRE_LOGW("KDF: output of %d bytes can only hold %u keys out of %u.", keys.size(), n, num_inputs);
+        }
+        for (std::size_t i = 0; i < n; ++i) {
+            diversify({std::begin(diversify_inputs) + i * input_length, std::begin(diversify_inputs) + (i + 1) * input_length},
+                      {std::begin(keys) + i * key_length, std::begin(keys) + (i + 1) * key_length});
+        }
+        return n;
+    }
+
 }// namespace desfire
 #endif//LIBSPOOKYACTION_KDF_HPP
@@ -5,6 +5,7 @@
 #ifndef DESFIRE_PCD_HPP
 #define DESFIRE_PCD_HPP
 
+#include "bits.hpp"
 #include <mlab/bin_data.hpp>
 #include <utility>
 
@@ -13,8 +14,37 @@ namespace desfire {
     public:
         virtual std::pair<mlab::bin_data, bool> communicate(mlab::bin_data const &data) = 0;
 
+        /**
+         * @brief Same as @ref communicate, but appends the response to @p data_in instead of returning a new buffer.
+         * @ref tag passes a buffer borrowed from its pool, so that implementations overriding this can exchange data
+         * without allocating memory. The default implementation copies the response of @ref communicate.
+         * @return True on success.
+         */
+        virtual bool communicate_into(mlab::bin_data const &data, mlab::bin_data &data_in);
+
+        /**
+         * @brief Largest frame that can be sent to the PICC in a single @ref communicate call, command code included.
+         * Longer commands are split by @ref tag into @ref command_code::additional_frame continuations.
+         * Implementations that know the ISO 14443-4 frame size of the PICC (e.g. from the FSC in the ATS) should
+         * override this; the default is the frame size of a DESFire EV1, @ref bits::max_packet_length. Smaller values
+         * are raised to @ref bits::max_packet_length, since some commands cannot be split.
+         */
+        [[nodiscard]] virtual std::size_t max_frame_length() const;
+
         virtual ~pcd() = default;
     };
 }// namespace desfire
 
+namespace desfire {
+    inline bool pcd::communicate_into(mlab::bin_data const &data, mlab::bin_data &data_in) {
+        const auto [response, success] = communicate(data);
+        data_in << response;
+        return success;
+    }
+
+    inline std::size_t pcd::max_frame_length() const {
+        return bits::max_packet_length;
+    }
+}// namespace desfire
+
 #endif//DESFIRE_PCD_HPP
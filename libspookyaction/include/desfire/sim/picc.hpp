@@ -0,0 +1,295 @@
+#ifndef DESFIRE_SIM_PICC_HPP
+#define DESFIRE_SIM_PICC_HPP
+
+#include <array>
+#include <chrono>
+#include <desfire/cipher_provider.hpp>
+#include <desfire/data.hpp>
+#include <desfire/pcd.hpp>
+#include <limits>
+#include <memory>
+#include <vector>
+
+namespace desfire::sim {
+    namespace {
+        using mlab::bin_data;
+    }
+
+    /**
+     * @brief Stateful emulation of a Mifare DESFire EV1 PICC, that can be used as a @ref pcd for @ref tag.
+     *
+     * The card side of the protocol is implemented here: applications and their keys, the five file types with backup
+     * and transaction semantics, the legacy, ISO and AES authentication handshakes, the three communication modes, and
+     * the chaining of long commands and responses through @ref status::additional_frame.
+     *
+     * The secure messaging mirrors what @ref cipher_legacy and @ref cipher_default expect on the host side, and the
+     * cryptographic primitives are obtained from the same @ref cipher_provider that the host uses.
+     *
+     * Time is simulated: every exchange advances a virtual clock by the time the bytes take on the RF link, plus a fixed
+     * processing time of the card. Optionally, the emulator can also really wait (see @ref card_config::real_time).
+     * @note The emulator answers @ref pcd::communicate directly; to run it behind a simulated PN532, forward
+     *  @ref pn532::sim::emulated_firmware::target::exchange to @ref communicate.
+     */
+    class emulated_picc final : public pcd {
+    public:
+        using duration = std::chrono::nanoseconds;
+
+        /**
+         * @brief Characteristics of the emulated card.
+         */
+        struct card_config {
+            std::array<std::uint8_t, 7> uid = {0x04, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06};
+
+            /**
+             * User memory of the card in bytes. The default is a DESFire EV1 8K.
+             */
+            std::size_t memory_size = 8192;
+
+            /**
+             * Longest frame exchanged in either direction, i.e. the ISO 14443-4 frame size that the card would
+             * advertise in its ATS, minus the protocol overhead. Longer commands are rejected with
+             * @ref status::length_error. Must be at least @ref bits::max_packet_length.
+             */
+            std::size_t max_frame_length = bits::max_packet_length;
+
+            /**
+             * Time the card takes to process every exchange, on top of the transfer time.
+             */
+            duration exchange_time = std::chrono::microseconds{1000};
+
+            /**
+             * Time it takes to transfer one byte. The default is ISO/IEC 14443 type A at 106 kbps (9 bits per byte).
+             */
+            duration byte_time = std::chrono::microseconds{85};
+
+            /**
+             * If true, @ref communicate actually sleeps for the simulated time, instead of only accounting for it.
+             */
+            bool real_time = false;
+        };
+
+        /**
+         * @brief Counters of the emulated traffic.
+         */
+        struct card_stats {
+            std::size_t exchanges = 0;       ///< Calls to @ref communicate, including additional frames
+            std::size_t commands = 0;        ///< Complete commands processed
+            std::size_t bytes_received = 0;  ///< Bytes sent by the host to the card
+            std::size_t bytes_sent = 0;      ///< Bytes sent by the card to the host
+            std::size_t authentications = 0; ///< Successful authentications
+            std::size_t integrity_errors = 0;///< Commands rejected because of a wrong MAC, CMAC, CRC or padding
+        };
+
+        /**
+         * @brief Emulated card with the default @ref card_config.
+         * @param provider Cipher provider used for the cryptographic primitives of the card.
+         */
+        explicit emulated_picc(std::unique_ptr<cipher_provider> provider);
+
+        /**
+         * @param provider Cipher provider used for the cryptographic primitives of the card.
+         * @param config Characteristics of the emulated card.
+         */
+        emulated_picc(std::unique_ptr<cipher_provider> provider, card_config config);
+
+        std::pair<bin_data, bool> communicate(bin_data const &data) override;
+
+        /**
+         * @return @ref card_config::max_frame_length
+         */
+        [[nodiscard]] std::size_t max_frame_length() const override;
+
+        /**
+         * @brief Simulates removing the card from the field: clears authentication, pending transactions and
+         * chained frames, and selects the root application.
+         */
+        void reset_session();
+
+        [[nodiscard]] inline card_config const &config() const;
+        inline void set_config(card_config config);
+
+        /**
+         * @brief Total simulated time spent in @ref communicate since construction.
+         */
+        [[nodiscard]] inline duration elapsed() const;
+
+        [[nodiscard]] inline card_stats const &stats() const;
+
+        /**
+         * @brief Bytes of memory still available for files.
+         */
+        [[nodiscard]] std::size_t free_memory() const;
+
+        /**
+         * @brief Bytes of heap held by the card for chained commands and responses.
+         * This is the part of the emulator's memory that depends on the traffic, and can be subtracted from heap
+         * measurements to isolate the memory used by the host side.
+         */
+        [[nodiscard]] std::size_t buffered_bytes() const;
+
+    private:
+        struct emulated_file {
+            file_id fid = 0;
+            any_file_settings settings{};
+            /**
+             * Data of standard and backup files, or all the records (oldest first) of record files.
+             */
+            bin_data data{};
+            /**
+             * Uncommitted copy of a backup file, or uncommitted record of a record file.
+             */
+            bin_data staged_data{};
+            std::int32_t staged_value = 0;
+            std::int32_t staged_debit = 0;
+            std::int32_t limited_credit_value = 0;
+            bool staged = false;
+            bool staged_clear = false;
+        };
+
+        struct emulated_app {
+            app_id aid{};
+            app_settings settings{};
+            std::vector<any_key> keys{};
+            std::vector<emulated_file> files{};
+        };
+
+        struct session {
+            std::uint8_t key_no = std::numeric_limits<std::uint8_t>::max();
+            std::unique_ptr<crypto> session_crypto = nullptr;
+            bool legacy = true;
+            bin_data iv{};
+        };
+
+        struct auth_challenge {
+            std::uint8_t key_no = 0;
+            std::unique_ptr<crypto> key_crypto = nullptr;
+            bool legacy = true;
+            bin_data rndb{};
+            bin_data iv{};
+        };
+
+        /**
+         * Result of processing one command, before secure messaging and chaining are applied.
+         */
+        struct reply {
+            status s = status::ok;
+            bin_data data{};
+            cipher_mode mode = cipher_mode::plain;
+            bool raw = false;   ///< Send @ref data as it is, without secure messaging
+            bool logout = false;///< Drop the authentication after answering
+        };
+
+        void advance(duration d);
+
+        [[nodiscard]] bool authenticated() const;
+        [[nodiscard]] bool authenticated_with(std::uint8_t key_no) const;
+        [[nodiscard]] cipher_mode default_rx_mode() const;
+        void logout();
+        void commit(bool keep);
+
+        [[nodiscard]] emulated_app &active_app();
+        [[nodiscard]] emulated_app *find_app(app_id const &aid);
+        [[nodiscard]] emulated_file *find_file(file_id fid);
+
+        /**
+         * Communication mode for accessing @p f in the given way with the current authentication, or
+         * @ref status::permission_denied if the access is not granted.
+         */
+        [[nodiscard]] std::pair<status, cipher_mode> file_access_mode(emulated_file const &f, file_access access) const;
+
+        /**
+         * Total length that a write command with @p header is expected to have, to know whether more frames follow.
+         */
+        [[nodiscard]] std::size_t expected_command_length(bin_data const &header);
+
+        /**
+         * @brief Card side of @ref cipher::prepare_tx: verifies and strips MAC or CRC, deciphers.
+         * @param data Full command, starting with the command code. Modified in place.
+         * @param mode Communication mode used by the host.
+         * @param offset Number of bytes at the beginning of @p data that are never enciphered.
+         * @param plain_length Length of the plaintext after @p offset, used to locate the CRC in
+         *  @ref cipher_mode::ciphered. Ignored otherwise.
+         * @return False if the integrity check failed.
+         */
+        [[nodiscard]] bool unwrap_command(bin_data &data, cipher_mode mode, std::size_t offset, std::size_t plain_length);
+
+        /**
+         * @brief Card side of @ref cipher::confirm_rx: assembles status and data, adding MAC or CRC and enciphering.
+         */
+        [[nodiscard]] bin_data wrap_response(reply r);
+
+        [[nodiscard]] crypto_with_cmac &session_cmac_crypto();
+
+        [[nodiscard]] bin_data process(bin_data &cmd_data);
+
+        /**
+         * Splits @p response in frames of at most @ref card_config::max_frame_length bytes, returns the first one.
+         */
+        [[nodiscard]] bin_data begin_response(bin_data response);
+        [[nodiscard]] bin_data next_response_frame();
+
+        reply authenticate(bin_data &cmd_data);
+        reply authenticate_answer(bin_data &cmd_data, auth_challenge &challenge);
+        reply select_application(bin_data &cmd_data);
+        reply create_application(bin_data &cmd_data);
+        reply delete_application(bin_data &cmd_data);
+        reply get_application_ids(bin_data &cmd_data);
+        reply get_key_settings(bin_data &cmd_data);
+        reply change_key_settings(bin_data &cmd_data);
+        reply get_key_version(bin_data &cmd_data);
+        reply change_key(bin_data &cmd_data);
+        reply format_picc(bin_data &cmd_data);
+        reply set_configuration(bin_data &cmd_data);
+        reply get_version(bin_data &cmd_data);
+        reply get_card_uid(bin_data &cmd_data);
+        reply get_free_mem(bin_data &cmd_data);
+        reply get_file_ids(bin_data &cmd_data);
+        reply get_file_settings(bin_data &cmd_data);
+        reply change_file_settings(bin_data &cmd_data);
+        reply create_file(bin_data &cmd_data);
+        reply delete_file(bin_data &cmd_data);
+        reply read_data(bin_data &cmd_data);
+        reply write_data(bin_data &cmd_data);
+        reply get_value(bin_data &cmd_data);
+        reply write_value(bin_data &cmd_data);
+        reply read_records(bin_data &cmd_data);
+        reply write_record(bin_data &cmd_data);
+        reply clear_record_file(bin_data &cmd_data);
+        reply commit_transaction(bin_data &cmd_data);
+        reply abort_transaction(bin_data &cmd_data);
+
+        std::unique_ptr<cipher_provider> _provider;
+        card_config _config;
+        duration _now;
+        card_stats _stats;
+        std::vector<emulated_app> _apps;
+        std::size_t _active_app;
+        session _session;
+        std::unique_ptr<auth_challenge> _challenge;
+        bin_data _chained_command;
+        std::size_t _chained_command_length;
+        bin_data _chained_response;
+        std::size_t _chained_response_offset;
+        std::uint8_t _config_flags;
+    };
+}// namespace desfire::sim
+
+namespace desfire::sim {
+    emulated_picc::card_config const &emulated_picc::config() const {
+        return _config;
+    }
+
+    void emulated_picc::set_config(card_config config) {
+        _config = config;
+    }
+
+    emulated_picc::duration emulated_picc::elapsed() const {
+        return _now;
+    }
+
+    emulated_picc::card_stats const &emulated_picc::stats() const {
+        return _stats;
+    }
+}// namespace desfire::sim
+
+#endif//DESFIRE_SIM_PICC_HPP
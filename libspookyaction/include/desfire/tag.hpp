@@ -46,9 +46,12 @@
 #include "data.hpp"
 #include "msg.hpp"
 #include "pcd.hpp"
+#include <algorithm>
+#include <functional>
 #include <list>
 #include <memory>
 #include <mlab/result.hpp>
+#include <vector>
 
 
 namespace ut::desfire_exchanges {
@@ -66,9 +69,25 @@ namespace desfire {
     public:
         struct comm_cfg;
 
+        struct cache_stats {
+            /**
+             * Number of times the item was found in the cache, i.e. an exchange with the PICC was saved.
+             */
+            std::size_t hits = 0;
+            /**
+             * Number of times the item had to be fetched from the PICC.
+             */
+            std::size_t misses = 0;
+        };
+
         template <class... Tn>
         using result = mlab::result<error, Tn...>;
 
+        /**
+         * @brief Function that fills @p length bytes at @p data with random bytes, see @ref set_random_source.
+         */
+        using random_source = std::function<void(std::uint8_t *data, std::size_t length)>;
+
         /**
          * @brief Construct a new tag object
          * @note if you want to create a custom pcd, you should extend  @ref desfire::pcd and implement @ref desfire::pcd::communicate
@@ -86,24 +105,25 @@ namespace desfire {
 
         tag &operator=(tag const &) = delete;
 
-        tag &operator=(tag &&) = default;
+        /**
+         * @note The active cipher of this tag is given back to its @ref cipher_provider before taking over @p other.
+         */
+        tag &operator=(tag &&other) noexcept;
 
         /**
-         * @return bin_data, or the following errors:
-         * - @ref error::malformed
-         * - @ref error::controller_error
-         * @note This method is *not* private because we do not have access to a Desfire/Mifare specification, therefore we cannot
-         *  guarantee that the list of commands implemented here is at all complete. Users who have access to the manual may therefore
-         *  directly send packets encoding further commands without having to explicitly extend or modify this class.
+         * @brief Gives back the active cipher to the @ref cipher_provider, see @ref cipher_provider::recycle_cipher.
          */
-        result<mlab::borrowed<bin_data>> raw_command_response(bin_stream &tx_data, bool rx_fetch_additional_frames);
+        ~tag();
 
         /**
          * This method automatically divides @p data into appropriate chunks and sends them to the PICC, pre-processing
-         * the data to send according to @p cfg by means of @ref cipher::prepare_tx (which is called on every chunk).
+         * the data to send according to @p cfg by means of @ref cipher::prepare_tx_chunk, one chunk at a time.
          * It will then collect the response data, and if @p cfg allows, it will also automatically concatenate all
-         * response chunks, should the PICC request to send additional frames. The response data is the post-processed
-         * by means of @ref cipher::confirm_rx, as set by @p cfg. The status byte is passed through and returned.
+         * response chunks, should the PICC request to send additional frames. Every response chunk is post-processed
+         * as soon as it arrives by means of @ref cipher::confirm_rx_chunk, as set by @p cfg. The status byte is passed
+         * through and returned.
+         * Since the cipher state is carried across frames, only a couple of frames of secured data are held in memory
+         * at any time, independently of the size of @p data and of the response.
          *
          * @note Only returns an error in case of malformed packet sequence, communication error, malformed data in the
          * sense of not passing @ref cipher::confirm_rx. All other status codes are passed through as the first result
@@ -153,6 +173,35 @@ namespace desfire {
          */
         [[nodiscard]] inline std::uint8_t active_key_no() const;
 
+        /**
+         * @brief Hit/miss counters of the file settings cache used by the overloads that auto-detect @ref file_security.
+         *
+         * Every method that does not take an explicit @ref file_security (e.g. @ref read_data, @ref write_data,
+         * @ref get_value) needs the settings of the file to determine the communication mode. These are cached per
+         * (@ref active_app, @ref file_id), so that only the first access to a file issues a @ref get_file_settings
+         * exchange. A miss therefore corresponds to one extra round trip to the PICC.
+         */
+        [[nodiscard]] inline cache_stats const &file_settings_cache_stats() const;
+
+        /**
+         * @brief Drops all cached file settings and resets @ref file_settings_cache_stats.
+         *
+         * The cache is already cleared automatically on @ref select_application and @ref format_picc, and the single
+         * entry is dropped on @ref delete_file and @ref change_file_settings. It survives @ref authenticate and logouts,
+         * because the settings of a file do not depend on who is authenticated. Call this only if the file settings were
+         * changed behind the back of this object, e.g. by a different reader.
+         */
+        void clear_file_settings_cache();
+
+        /**
+         * @brief Replaces the source of the random challenge (RndA) that @ref authenticate sends to the PICC.
+         *
+         * By default RndA comes from the hardware random number generator. A different source is only needed to
+         * record the challenges of a session, or to play them back, so that a recorded authentication can be replayed.
+         * @param source The new source, or `nullptr` to go back to the hardware random number generator.
+         */
+        inline void set_random_source(random_source source);
+
         template <cipher_type Type>
         result<> authenticate(key<Type> const &k);
         result<> authenticate(any_key const &k);
@@ -438,6 +487,9 @@ namespace desfire {
          * @brief Read the file settings
          * @ingroup data
          * @param fid The file ID, Max @ref bits::max_standard_data_file_id.
+         * @note This always queries the PICC, because the file-type-specific part (e.g. the number of records, or the
+         *  limited credit value) may change at any time. The security settings read are stored in the file settings
+         *  cache (see @ref file_settings_cache_stats).
          * @return @ref any_file_settings containingthe file settings, or the following errors:
          * - @ref error::malformed
          * - @ref error::crypto_error
@@ -1098,14 +1150,44 @@ namespace desfire {
         template <class T>
         [[nodiscard]] static std::vector<T> parse_records(bin_data const &data, std::uint32_t exp_count);
 
+        /**
+         * Uses the file settings cache if possible, otherwise calls @ref get_file_settings.
+         */
         [[nodiscard]] result<file_security> determine_file_security(file_id fid, file_access access);
-        [[nodiscard]] file_security determine_file_security(file_access access, any_file_settings const &settings) const;
+        [[nodiscard]] file_security determine_file_security(file_access access, generic_file_settings const &settings) const;
+
+        struct cached_file_settings {
+            app_id app;
+            file_id fid;
+            generic_file_settings settings;
+        };
+
+        [[nodiscard]] generic_file_settings const *find_cached_file_settings(file_id fid) const;
+        void cache_file_settings(file_id fid, generic_file_settings const &settings);
+        void uncache_file_settings(file_id fid);
+
+        /**
+         * Same as the public @ref command_status_response, with the payload given as ''header || data''. This allows to
+         * stream large payloads such as file data straight from the caller's buffer, without copying them.
+         */
+        result<status, mlab::borrowed<bin_data>> command_status_response(command_code cmd, bin_data const &header, bin_data const &data, comm_cfg const &cfg, bool rx_fetch_additional_frames, cipher *override_cipher);
+
+        /**
+         * Same as the public @ref command_response, with the payload given as ''header || data''.
+         */
+        result<mlab::borrowed<bin_data>> command_response(command_code cmd, bin_data const &header, bin_data const &data, comm_cfg const &cfg, bool rx_fetch_additional_frames = true, cipher *override_cipher = nullptr);
 
         [[nodiscard]] static result<> safe_drop_payload(command_code cmd, tag::result<mlab::borrowed<bin_data>> const &result);
         static void log_not_empty(command_code cmd, range<bin_data::const_iterator> data);
 
         [[nodiscard]] inline desfire::pcd &pcd();
 
+        /**
+         * Size of the frames in which commands are split, as reported by @ref pcd::max_frame_length. This is never
+         * less than @ref bits::max_packet_length, because some commands (e.g. authentication) cannot be split.
+         */
+        [[nodiscard]] inline std::size_t frame_length();
+
         result<> change_key_internal(any_key const *current_key, std::uint8_t key_no_to_change, any_key const &new_key);
 
         /**
@@ -1124,16 +1206,32 @@ namespace desfire {
         [[nodiscard]] comm_cfg const &default_comm_cfg() const;
         [[nodiscard]] bool active_cipher_is_legacy() const;
 
+        /**
+         * @brief The cipher of the current session, or a plain cipher if not authenticated.
+         */
+        [[nodiscard]] cipher &active_cipher();
+
+        /**
+         * @brief Gives back the cipher of the current session to the provider, leaving @ref _active_cipher empty.
+         */
+        void release_active_cipher();
+
         struct auto_logout;
+        struct auto_recycle;
 
         desfire::pcd *_pcd;
 
         std::unique_ptr<cipher_provider> _provider;
         std::unique_ptr<cipher> _active_cipher;
+        cipher_dummy _plain_cipher;
         cipher_type _active_key_type;
         std::uint8_t _active_key_number;
         app_id _active_app;
         mlab::shared_buffer_pool _buffer_pool;
+        random_source _random_source;
+
+        std::vector<cached_file_settings> _file_settings_cache;
+        cache_stats _file_settings_cache_stats;
     };
 
 
@@ -1141,6 +1239,10 @@ namespace desfire {
         cipher_mode tx = cipher_mode::plain;
         cipher_mode rx = cipher_mode::plain;
         std::size_t tx_secure_data_offset = 0;
+        /**
+         * Expected length of the response data, if known, so that a buffer large enough is taken upfront.
+         */
+        std::size_t rx_length_hint = 0;
 
         inline comm_cfg(cipher_mode txrx, std::size_t sec_data_ofs = 1);
         inline comm_cfg(cipher_mode tx, cipher_mode rx, std::size_t sec_data_ofs = 1);
@@ -1153,6 +1255,10 @@ namespace desfire {
         return *_pcd;
     }
 
+    std::size_t tag::frame_length() {
+        return std::max(pcd().max_frame_length(), bits::max_packet_length);
+    }
+
     template <cipher_type Type>
     tag::result<> tag::authenticate(key<Type> const &k) {
         return authenticate(any_key{k});
@@ -1178,6 +1284,14 @@ namespace desfire {
         return _active_key_number;
     }
 
+    tag::cache_stats const &tag::file_settings_cache_stats() const {
+        return _file_settings_cache_stats;
+    }
+
+    void tag::set_random_source(random_source source) {
+        _random_source = std::move(source);
+    }
+
     tag::comm_cfg::comm_cfg(cipher_mode txrx, std::size_t sec_data_ofs) : tx{txrx},
                                                                           rx{txrx},
                                                                           tx_secure_data_offset{sec_data_ofs} {}
@@ -1212,6 +1326,7 @@ namespace desfire {
 
     template <cipher_type Cipher>
     void tag::ut_init_session(desfire::key<Cipher> const &session_key, desfire::app_id app, std::uint8_t key_no) {
+        release_active_cipher();
         _active_cipher = _provider->cipher_from_key(session_key);
         _active_app = app;
         _active_key_type = Cipher;
@@ -1235,6 +1350,9 @@ namespace desfire {
     template <class T>
     tag::result<> tag::write_record(file_id fid, T &&record, file_security security) {
         auto buffer = _buffer_pool->template take();
+        if (not buffer) {
+            return error::out_of_buffers;
+        }
         buffer << std::forward<T>(record);
         return write_record(fid, 0, *buffer, security);
     }
@@ -1242,6 +1360,9 @@ namespace desfire {
     template <class T>
     tag::result<> tag::write_record(file_id fid, T &&record) {
         auto buffer = _buffer_pool->template take();
+        if (not buffer) {
+            return error::out_of_buffers;
+        }
         buffer << std::forward<T>(record);
         return write_record(fid, 0, *buffer);
     }
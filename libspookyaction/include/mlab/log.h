@@ -0,0 +1,83 @@
+#ifndef MITTELIB_LOG_H
+#define MITTELIB_LOG_H
+
+/**
+ * @file
+ * ESP-IDF logging on ESP32. On other platforms, e.g. when running the tests natively, a minimal replacement of the
+ * ESP-IDF logging macros and of @ref esp_log_level_set, which prints to `stderr`.
+ */
+
+#ifdef ESP_PLATFORM
+#include <esp_log.h>
+#else
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef enum {
+    ESP_LOG_NONE,
+    ESP_LOG_ERROR,
+    ESP_LOG_WARN,
+    ESP_LOG_INFO,
+    ESP_LOG_DEBUG,
+    ESP_LOG_VERBOSE
+} esp_log_level_t;
+
+#ifndef LOG_LOCAL_LEVEL
+#define LOG_LOCAL_LEVEL ESP_LOG_INFO
+#endif
+
+/**
+ * @brief Sets the level of @p tag, or of all the tags if @p tag is `"*"`. Messages above this level are dropped.
+ */
+void esp_log_level_set(const char *tag, esp_log_level_t level);
+
+esp_log_level_t esp_log_level_get(const char *tag);
+
+/**
+ * @brief Milliseconds since the first message was logged.
+ */
+uint32_t esp_log_timestamp(void);
+
+/**
+ * @brief Prints a line, prefixed with the level, the timestamp and @p tag, if @p level is enabled for @p tag.
+ */
+void esp_log_write(esp_log_level_t level, const char *tag, const char *format, ...);
+
+void esp_log_buffer_hex_internal(const char *tag, const void *buffer, uint16_t buff_len, esp_log_level_t level);
+
+#ifdef __cplusplus
+}
+#endif
+
+#define ESP_LOG_LEVEL(level, tag, format, ...) esp_log_write(level, tag, format, ##__VA_ARGS__)
+
+#define ESP_LOG_LEVEL_LOCAL(level, tag, format, ...)          \
+    do {                                                      \
+        if (LOG_LOCAL_LEVEL >= (level)) {                     \
+            ESP_LOG_LEVEL(level, tag, format, ##__VA_ARGS__); \
+        }                                                     \
+    } while (0)
+
+#define ESP_LOGE(tag, format, ...) ESP_LOG_LEVEL_LOCAL(ESP_LOG_ERROR, tag, format, ##__VA_ARGS__)
+#define ESP_LOGW(tag, format, ...) ESP_LOG_LEVEL_LOCAL(ESP_LOG_WARN, tag, format, ##__VA_ARGS__)
+#define ESP_LOGI(tag, format, ...) ESP_LOG_LEVEL_LOCAL(ESP_LOG_INFO, tag, format, ##__VA_ARGS__)
+#define ESP_LOGD(tag, format, ...) ESP_LOG_LEVEL_LOCAL(ESP_LOG_DEBUG, tag, format, ##__VA_ARGS__)
+#define ESP_LOGV(tag, format, ...) ESP_LOG_LEVEL_LOCAL(ESP_LOG_VERBOSE, tag, format, ##__VA_ARGS__)
+
+#define ESP_LOG_BUFFER_HEX_LEVEL(tag, buffer, buff_len, level)                      \
+    do {                                                                            \
+        if (LOG_LOCAL_LEVEL >= (level)) {                                           \
+            esp_log_buffer_hex_internal(tag, buffer, (uint16_t) (buff_len), level); \
+        }                                                                           \
+    } while (0)
+
+#define ESP_LOG_BUFFER_HEX(tag, buffer, buff_len) ESP_LOG_BUFFER_HEX_LEVEL(tag, buffer, buff_len, ESP_LOG_INFO)
+
+#endif// ESP_PLATFORM
+
+#endif//MITTELIB_LOG_H
@@ -5,9 +5,12 @@
 #ifndef MITTELIB_POOL_HPP
 #define MITTELIB_POOL_HPP
 
+#include <algorithm>
+#include <atomic>
 #include <memory>
 #include <vector>
 #include <mlab/bin_data.hpp>
+#include <mlab/log.h>
 
 namespace mlab {
 
@@ -49,43 +52,231 @@ namespace mlab {
 
         template <class T>
         static constexpr bool is_clearable_container_v = is_clearable_container<T>::value;
+
+        template <class T>
+        struct is_reservable_container {
+            template <class U>
+            static constexpr decltype(std::declval<U &>().reserve(std::size_t{}),
+                                      std::size_t{std::declval<U const &>().capacity()},
+                                      bool())
+            test_get(int) {
+                return true;
+            }
+
+            template <class>
+            static constexpr bool test_get(...) {
+                return false;
+            }
+
+            static constexpr bool value = test_get<T>(int());
+        };
+
+        template <class T>
+        static constexpr bool is_reservable_container_v = is_reservable_container<T>::value;
+
+        template <class N>
+        void atomic_store_max(std::atomic<N> &a, N value) {
+            N current = a.load(std::memory_order_relaxed);
+            while (current < value and not a.compare_exchange_weak(current, value, std::memory_order_relaxed)) {
+            }
+        }
     }// namespace impl
 
+    /**
+     * @brief A size class of a @ref pool.
+     */
+    struct pool_size_class {
+        /**
+         * Capacity of the containers in this class; containers allocated for this class reserve this much.
+         * Ignored for types which are not containers with `reserve` and `capacity`.
+         */
+        std::size_t capacity = 0;
+
+        /**
+         * Maximum number of idle objects kept in this class. Objects given back when the class is full are destroyed.
+         */
+        std::size_t max_idle = 0;
+    };
+
+    enum struct pool_mode {
+        dynamic,     ///< Objects are constructed on demand, and those in excess are destroyed when given back.
+        preallocated ///< All objects are constructed with the pool, @ref pool::take fails when none is idle.
+    };
+
+    struct pool_stats {
+        /**
+         * Number of times @ref pool::take returned an idle object.
+         */
+        std::size_t hits = 0;
+
+        /**
+         * Number of times @ref pool::take had to construct a new object.
+         */
+        std::size_t misses = 0;
+
+        /**
+         * Number of objects destroyed on @ref pool::give because their size class was full.
+         */
+        std::size_t dropped = 0;
+
+        /**
+         * Number of times @ref pool::take failed because the pool was exhausted (@ref pool_mode::preallocated only).
+         */
+        std::size_t exhausted = 0;
+
+        /**
+         * Objects taken and held by a @ref borrowed wrapper. Objects that are released from their wrapper no longer
+         * count as outstanding, whether or not they are given back later.
+         */
+        std::size_t outstanding = 0;
+
+        std::size_t peak_outstanding = 0;
+
+        /**
+         * Peak of the total capacity, in bytes, of the idle containers kept by the pool. Zero if `T` is not a container.
+         */
+        std::size_t peak_bytes = 0;
+    };
+
     template <class T>
     using default_borrow_policy = std::conditional_t<impl::is_clearable_container_v<T>, clear_container_policy<T>, no_policy<T>>;
 
+    /**
+     * @brief Thread-safe, bounded pool of reusable objects, e.g. @ref bin_data buffers.
+     *
+     * Idle objects are kept in size classes, each with a fixed number of slots which are claimed with atomic
+     * operations: no thread ever blocks on the pool, and no memory is allocated to store idle objects after
+     * construction. Containers are sorted by capacity: @ref take_sized returns a container that already has enough
+     * capacity, and on a miss it reserves the capacity of the size class.
+     *
+     * In @ref pool_mode::preallocated, every slot is filled at construction with a container of the capacity of its
+     * class, and the pool never constructs objects afterwards: when there is no idle object, @ref take and
+     * @ref take_sized return a @ref borrowed object which is already released, i.e. evaluates to false. Containers
+     * which are grown past the capacity of their class still reallocate, so callers should stay within the largest
+     * size class.
+     */
     template <class T, class Policy = default_borrow_policy<T>>
     class pool : public std::enable_shared_from_this<pool<T, Policy>> {
-        std::vector<T> _queue{};
+        enum struct slot_state : std::uint8_t {
+            empty,
+            busy,
+            full
+        };
+
+        struct slot {
+            std::atomic<slot_state> state{slot_state::empty};
+            T obj{};
+        };
+
+        struct size_class {
+            std::size_t capacity = 0;
+            std::size_t num_slots = 0;
+            std::unique_ptr<slot[]> slots = nullptr;
+        };
+
+        std::vector<size_class> _classes;
         Policy _policy;
+        pool_mode _mode;
+        std::atomic<std::size_t> _hits{0};
+        std::atomic<std::size_t> _misses{0};
+        std::atomic<std::size_t> _dropped{0};
+        std::atomic<std::size_t> _exhausted{0};
+        std::atomic<std::ptrdiff_t> _outstanding{0};
+        std::atomic<std::ptrdiff_t> _peak_outstanding{0};
+        std::atomic<std::size_t> _idle_bytes{0};
+        std::atomic<std::size_t> _peak_bytes{0};
+
+        [[nodiscard]] static std::size_t capacity_of(T const &obj);
+
+        [[nodiscard]] bool try_take_from(size_class &c, T &obj);
+        [[nodiscard]] bool try_give_to(size_class &c, T &obj);
+
+        [[nodiscard]] borrowed<T, Policy> make_borrowed(T &&obj);
+        [[nodiscard]] borrowed<T, Policy> make_exhausted();
+
+        friend class borrowed<T, Policy>;
+
+        /**
+         * Called when a @ref borrowed object is released or given back, it is no longer outstanding.
+         */
+        inline void note_released();
 
     public:
         using std::enable_shared_from_this<pool<T, Policy>>::weak_from_this;
 
+        static constexpr std::size_t default_max_idle = 16;
+
+        /**
+         * @brief A pool with a single size class of @ref default_max_idle objects.
+         */
         inline pool();
         explicit inline pool(Policy policy);
 
+        /**
+         * @param size_classes Size classes, in any order. If empty, uses a single class of @ref default_max_idle objects.
+         * @param mode If @ref pool_mode::preallocated, all the objects are constructed here.
+         */
+        explicit pool(std::vector<pool_size_class> const &size_classes, pool_mode mode = pool_mode::dynamic, Policy policy = Policy{});
+
         pool(pool const &) = delete;
         pool &operator=(pool const &) = delete;
-        pool(pool &&) noexcept = default;
-        pool &operator=(pool &&) noexcept = default;
 
+        /**
+         * @brief Takes an idle object, or constructs one from @p args if there is none.
+         * @note For containers, idle ones are taken from the smallest size class first, so that the larger ones stay
+         *  available to @ref take_sized. Use @ref take_sized when the size is known.
+         * @return A released @ref borrowed object if the pool is @ref pool_mode::preallocated and exhausted.
+         */
         template <class... Args>
         [[nodiscard]] borrowed<T, Policy> take(Args &&...args);
 
+        /**
+         * @brief Takes an idle container of at least @p capacity, or constructs one with the capacity of the smallest
+         * size class that can hold @p capacity.
+         * @note For types that are not containers, this is the same as @ref take.
+         * @return A released @ref borrowed object if the pool is @ref pool_mode::preallocated and either exhausted, or
+         *  @p capacity exceeds the capacity of the largest size class.
+         */
+        [[nodiscard]] borrowed<T, Policy> take_sized(std::size_t capacity);
+
         inline void give(borrowed<T, Policy> &&obj);
 
+        /**
+         * @brief Stores @p obj in the largest size class whose capacity it has, or destroys it if that class is full.
+         * @note A @ref pool_mode::preallocated pool falls back to any other class with a free slot, so that none of the
+         *  objects it constructed is lost.
+         */
         void give(T &&obj);
 
-        [[nodiscard]] inline bool empty() const;
+        /**
+         * @brief True if there are no idle objects. With concurrent users, this is just a hint.
+         */
+        [[nodiscard]] bool empty() const;
+
+        [[nodiscard]] pool_stats stats() const;
+
+        [[nodiscard]] pool_mode mode() const;
+
+        [[nodiscard]] std::vector<pool_size_class> size_classes() const;
     };
 
     using shared_buffer_pool = std::shared_ptr<pool<bin_data>>;
 
     /**
-     * @brief Default shared buffer pool that is used in @ref cmac_provider if none is explicitly passed.
+     * @brief Size classes of @ref default_buffer_pool: PN532 ACK and error frames, DESFire frames, and the longest
+     * PN532 frames (263 bytes of data, in an extended info frame of 275 bytes).
+     */
+    [[nodiscard]] std::vector<pool_size_class> default_buffer_size_classes();
+
+    /**
+     * @brief Default shared buffer pool that is used by @ref desfire::tag and @ref pn532::channel if none is
+     * explicitly passed.
      *
-     * This function is thread-safe; however, a buffer pool is **not**.
+     * This function is thread-safe, and so is the buffer pool. It uses @ref default_buffer_size_classes.
+     *
+     * When `SPOOKY_STATIC_BUFFER_POOL` is defined, the default pool is @ref pool_mode::preallocated: all its buffers
+     * are allocated once, the first time this is called, and are never reallocated nor freed. Operations that cannot
+     * get a buffer fail with an "out of buffers" error instead of allocating a new one.
      *
      * Passing a buffer pool across all virtual instances can be annoying.
      *
@@ -95,12 +286,13 @@ namespace mlab {
     [[nodiscard]] shared_buffer_pool default_buffer_pool();
 
     /**
-     * @brief Change the default buffer pool used by @ref cmac_provider if none is explicitly passed.
+     * @brief Change the default buffer pool used by @ref desfire::tag and @ref pn532::channel if none is
+     * explicitly passed.
      *
-     * This function is thread-safe; however, a buffer pool is **not**.
+     * This function is thread-safe.
      *
      * @note Changing the default buffer pool must be done **before** the creation of any instance.
-     *  Each @ref crypto_with_cmac instance will hold such a `shared_ptr`.
+     *  Each @ref desfire::tag and @ref pn532::channel instance will hold such a `shared_ptr`.
      *
      * @param new_pool New pool to set. Passing `nullptr` has no effect.
      */
@@ -115,11 +307,20 @@ namespace mlab {
 
         [[nodiscard]] bool assert_not_released() const;
 
+        /**
+         * Marks this as released and unbinds it from the pool, without notifying the pool.
+         */
+        T detach();
+
     public:
         borrowed(borrowed const &) = delete;
         borrowed &operator=(borrowed const &) = delete;
         borrowed(borrowed &&) noexcept = default;
-        borrowed &operator=(borrowed &&) noexcept = default;
+
+        /**
+         * Gives back the object held by this to its pool, then takes over the one held by @p other.
+         */
+        borrowed &operator=(borrowed &&other) noexcept;
 
         explicit borrowed(std::weak_ptr<pool<T, Policy>> owner);
         explicit borrowed(std::weak_ptr<pool<T, Policy>> owner, T &&obj);
@@ -167,6 +368,19 @@ namespace mlab {
     template <class T, class Policy>
     borrowed<T, Policy>::borrowed(std::weak_ptr<pool<T, Policy>> owner, T &&obj) : _owner{std::move(owner)}, _obj{std::move(obj)}, _was_released{false} {}
 
+    template <class T, class Policy>
+    borrowed<T, Policy> &borrowed<T, Policy>::operator=(borrowed &&other) noexcept {
+        if (this != &other) {
+            give_back();
+            _owner = std::move(other._owner);
+            _obj = std::move(other._obj);
+            _was_released = other._was_released;
+            other._owner.reset();
+            other._was_released = true;
+        }
+        return *this;
+    }
+
     template <class T, class Policy>
     borrowed<T, Policy>::operator bool() const {
         return not _was_released;
@@ -197,7 +411,7 @@ namespace mlab {
     }
 
     template <class T, class Policy>
-    T borrowed<T, Policy>::release() {
+    T borrowed<T, Policy>::detach() {
         if (assert_not_released()) {
             _was_released = true;
             _owner.reset();
@@ -206,6 +420,14 @@ namespace mlab {
         return T{};
     }
 
+    template <class T, class Policy>
+    T borrowed<T, Policy>::release() {
+        if (auto owner = _owner.lock(); owner != nullptr) {
+            owner->note_released();
+        }
+        return detach();
+    }
+
     template <class T, class Policy>
     bool borrowed<T, Policy>::assert_not_released() const {
         if (not bool(*this)) {
@@ -217,53 +439,233 @@ namespace mlab {
 
     template <class T, class Policy>
     bool borrowed<T, Policy>::give_back() {
-        if (not _owner.expired()) {
-            _owner.lock()->give(release());
+        if (auto owner = _owner.lock(); owner != nullptr) {
+            owner->note_released();
+            owner->give(detach());
             return true;
         }
         return false;
     }
 
     template <class T, class Policy>
-    pool<T, Policy>::pool() : _queue{}, _policy{} {}
+    pool<T, Policy>::pool() : pool{std::vector<pool_size_class>{}, pool_mode::dynamic, Policy{}} {}
+
+    template <class T, class Policy>
+    pool<T, Policy>::pool(Policy policy) : pool{std::vector<pool_size_class>{}, pool_mode::dynamic, std::move(policy)} {}
 
     template <class T, class Policy>
-    pool<T, Policy>::pool(Policy policy) : _queue{}, _policy{std::move(policy)} {}
+    pool<T, Policy>::pool(std::vector<pool_size_class> const &size_classes, pool_mode mode, Policy policy)
+        : _classes{}, _policy{std::move(policy)}, _mode{mode} {
+        if (size_classes.empty()) {
+            _classes.push_back({0, default_max_idle, std::make_unique<slot[]>(default_max_idle)});
+        } else {
+            _classes.reserve(size_classes.size());
+            for (pool_size_class const &c : size_classes) {
+                _classes.push_back({c.capacity, c.max_idle, std::make_unique<slot[]>(c.max_idle)});
+            }
+            std::sort(std::begin(_classes), std::end(_classes), [](size_class const &l, size_class const &r) {
+                return l.capacity < r.capacity;
+            });
+        }
+        if (_mode == pool_mode::preallocated) {
+            std::size_t bytes = 0;
+            for (size_class &c : _classes) {
+                for (std::size_t i = 0; i < c.num_slots; ++i) {
+                    if constexpr (impl::is_reservable_container_v<T>) {
+                        c.slots[i].obj.reserve(c.capacity);
+                    }
+                    bytes += capacity_of(c.slots[i].obj);
+                    c.slots[i].state.store(slot_state::full, std::memory_order_relaxed);
+                }
+            }
+            _idle_bytes.store(bytes, std::memory_order_relaxed);
+            _peak_bytes.store(bytes, std::memory_order_relaxed);
+        }
+    }
 
     template <class T, class Policy>
     void pool<T, Policy>::give(borrowed<T, Policy> &&obj) {
         give(obj.release());
     }
 
+    template <class T, class Policy>
+    void pool<T, Policy>::note_released() {
+        _outstanding.fetch_sub(1, std::memory_order_relaxed);
+    }
+
     template <class T, class Policy>
     borrowed<T, Policy>::~borrowed() {
         give_back();
     }
 
+    template <class T, class Policy>
+    std::size_t pool<T, Policy>::capacity_of(T const &obj) {
+        if constexpr (impl::is_reservable_container_v<T>) {
+            return obj.capacity();
+        } else {
+            return 0;
+        }
+    }
+
+    template <class T, class Policy>
+    bool pool<T, Policy>::try_take_from(size_class &c, T &obj) {
+        for (std::size_t i = 0; i < c.num_slots; ++i) {
+            slot &s = c.slots[i];
+            auto expected = slot_state::full;
+            if (s.state.compare_exchange_strong(expected, slot_state::busy, std::memory_order_acquire)) {
+                obj = std::move(s.obj);
+                s.obj = T{};
+                s.state.store(slot_state::empty, std::memory_order_release);
+                _idle_bytes.fetch_sub(capacity_of(obj), std::memory_order_relaxed);
+                return true;
+            }
+        }
+        return false;
+    }
+
+    template <class T, class Policy>
+    bool pool<T, Policy>::try_give_to(size_class &c, T &obj) {
+        for (std::size_t i = 0; i < c.num_slots; ++i) {
+            slot &s = c.slots[i];
+            auto expected = slot_state::empty;
+            if (s.state.compare_exchange_strong(expected, slot_state::busy, std::memory_order_acquire)) {
+                const std::size_t bytes = capacity_of(obj);
+                s.obj = std::move(obj);
+                s.state.store(slot_state::full, std::memory_order_release);
+                impl::atomic_store_max(_peak_bytes, _idle_bytes.fetch_add(bytes, std::memory_order_relaxed) + bytes);
+                return true;
+            }
+        }
+        return false;
+    }
+
+    template <class T, class Policy>
+    borrowed<T, Policy> pool<T, Policy>::make_borrowed(T &&obj) {
+        impl::atomic_store_max(_peak_outstanding, _outstanding.fetch_add(1, std::memory_order_relaxed) + 1);
+        borrowed<T, Policy> retval{weak_from_this(), std::move(obj)};
+        _policy.on_take(*retval);
+        return retval;
+    }
+
+    template <class T, class Policy>
+    borrowed<T, Policy> pool<T, Policy>::make_exhausted() {
+        _exhausted.fetch_add(1, std::memory_order_relaxed);
+        ESP_LOGE("MLAB", "Pool exhausted.");
+        // Not bound to the pool, and released right away, so that it evaluates to false
+        borrowed<T, Policy> retval{std::weak_ptr<pool>{}};
+        static_cast<void>(retval.release());
+        return retval;
+    }
+
     template <class T, class Policy>
     bool pool<T, Policy>::empty() const {
-        return _queue.empty();
+        for (size_class const &c : _classes) {
+            for (std::size_t i = 0; i < c.num_slots; ++i) {
+                if (c.slots[i].state.load(std::memory_order_relaxed) == slot_state::full) {
+                    return false;
+                }
+            }
+        }
+        return true;
     }
 
     template <class T, class Policy>
     void pool<T, Policy>::give(T &&obj) {
-        _queue.emplace_back(std::move(obj));
-        _policy.on_give(_queue.back());
+        _policy.on_give(obj);
+        // Largest class whose capacity obj already has, or the smallest one
+        const std::size_t capacity = capacity_of(obj);
+        auto it = std::find_if(std::rbegin(_classes), std::rend(_classes), [&](size_class const &c) {
+            return c.capacity <= capacity;
+        });
+        size_class &c = it != std::rend(_classes) ? *it : _classes.front();
+        if (try_give_to(c, obj)) {
+            return;
+        }
+        if (_mode == pool_mode::preallocated) {
+            // Prefer the smaller classes, whose capacity obj has anyway
+            for (size_class &other : _classes) {
+                if (&other != &c and try_give_to(other, obj)) {
+                    return;
+                }
+            }
+        }
+        _dropped.fetch_add(1, std::memory_order_relaxed);
     }
 
     template <class T, class Policy>
     template <class... Args>
     borrowed<T, Policy> pool<T, Policy>::take(Args &&...args) {
-        if (empty()) {
-            borrowed retval{weak_from_this(), T{std::forward<Args>(args)...}};
-            _policy.on_take(*retval);
-            return retval;
+        T obj{};
+        for (size_class &c : _classes) {
+            if (try_take_from(c, obj)) {
+                _hits.fetch_add(1, std::memory_order_relaxed);
+                return make_borrowed(std::move(obj));
+            }
+        }
+        if (_mode == pool_mode::preallocated) {
+            return make_exhausted();
+        }
+        _misses.fetch_add(1, std::memory_order_relaxed);
+        return make_borrowed(T{std::forward<Args>(args)...});
+    }
+
+    template <class T, class Policy>
+    borrowed<T, Policy> pool<T, Policy>::take_sized(std::size_t capacity) {
+        if constexpr (not impl::is_reservable_container_v<T>) {
+            return take();
         } else {
-            borrowed retval{weak_from_this(), std::move(_queue.back())};
-            _queue.pop_back();
-            _policy.on_take(*retval);
-            return retval;
+            const auto first_fit = std::find_if(std::begin(_classes), std::end(_classes), [&](size_class const &c) {
+                return c.capacity >= capacity;
+            });
+            T obj{};
+            const std::size_t reserve_capacity = first_fit != std::end(_classes) ? first_fit->capacity : capacity;
+            // Past the largest class, try the largest one anyway: its containers may have grown enough already
+            const auto first_try = first_fit != std::end(_classes) ? first_fit : std::prev(std::end(_classes));
+            for (auto it = first_try; it != std::end(_classes); ++it) {
+                if (try_take_from(*it, obj)) {
+                    _hits.fetch_add(1, std::memory_order_relaxed);
+                    // The smallest class also holds containers that are smaller than its capacity
+                    if (obj.capacity() < capacity) {
+                        obj.reserve(reserve_capacity);
+                    }
+                    return make_borrowed(std::move(obj));
+                }
+            }
+            if (_mode == pool_mode::preallocated) {
+                return make_exhausted();
+            }
+            _misses.fetch_add(1, std::memory_order_relaxed);
+            obj.reserve(reserve_capacity);
+            return make_borrowed(std::move(obj));
+        }
+    }
+
+    template <class T, class Policy>
+    pool_stats pool<T, Policy>::stats() const {
+        pool_stats retval{};
+        retval.hits = _hits.load(std::memory_order_relaxed);
+        retval.misses = _misses.load(std::memory_order_relaxed);
+        retval.dropped = _dropped.load(std::memory_order_relaxed);
+        retval.exhausted = _exhausted.load(std::memory_order_relaxed);
+        retval.outstanding = std::size_t(std::max(std::ptrdiff_t{0}, _outstanding.load(std::memory_order_relaxed)));
+        retval.peak_outstanding = std::size_t(_peak_outstanding.load(std::memory_order_relaxed));
+        retval.peak_bytes = _peak_bytes.load(std::memory_order_relaxed);
+        return retval;
+    }
+
+    template <class T, class Policy>
+    pool_mode pool<T, Policy>::mode() const {
+        return _mode;
+    }
+
+    template <class T, class Policy>
+    std::vector<pool_size_class> pool<T, Policy>::size_classes() const {
+        std::vector<pool_size_class> retval{};
+        retval.reserve(_classes.size());
+        for (size_class const &c : _classes) {
+            retval.push_back({c.capacity, c.num_slots});
         }
+        return retval;
     }
 }// namespace mlab
 
@@ -0,0 +1,279 @@
+#ifndef MITTELIB_PROFILER_HPP
+#define MITTELIB_PROFILER_HPP
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <limits>
+
+namespace mlab {
+
+    /**
+     * @brief Instrumented operations, from the outermost to the innermost layer.
+     *
+     * Probes are nested: the time and the allocations of a @ref probe::tag_command include those of the RF exchanges it
+     * triggers, which in turn include those of the host link. Subtract the inner probes to tell whether an operation is
+     * bound by the link to the PN532, by the RF field, or by the cryptography.
+     */
+    enum struct probe : std::uint8_t {
+        tag_command,    ///< A whole DESFire command, from @ref desfire::tag (securing, exchanging, verifying).
+        cipher_tx,      ///< Securing the data of a DESFire command (@ref desfire::cipher::prepare_tx and siblings).
+        cipher_rx,      ///< Verifying the response of a DESFire command (@ref desfire::cipher::confirm_rx and siblings).
+        rf_exchange,    ///< A data exchange with a target in the field (@ref pn532::controller::initiator_data_exchange).
+        channel_send,   ///< A single send operation on the host link (@ref pn532::channel::send).
+        channel_receive ///< A single receive operation on the host link (@ref pn532::channel::receive).
+    };
+
+    static constexpr std::size_t probe_count = static_cast<std::size_t>(probe::channel_receive) + 1;
+
+    [[nodiscard]] const char *probe_name(probe p);
+
+    /**
+     * @brief True when the library is built with `SPOOKY_PROFILING`.
+     *
+     * Otherwise @ref profile_scope, @ref profile_accumulator and @ref note_allocation compile to nothing, and
+     * @ref default_profiler stays empty.
+     */
+#ifdef SPOOKY_PROFILING
+    static constexpr bool profiling_enabled = true;
+#else
+    static constexpr bool profiling_enabled = false;
+#endif
+
+    struct probe_stats {
+        /**
+         * Number of samples recorded.
+         */
+        std::size_t count = 0;
+
+        std::chrono::microseconds total{0};
+        std::chrono::microseconds min{0};
+        std::chrono::microseconds max{0};
+
+        /**
+         * Median and 99th percentile, estimated from a logarithmic histogram with 4 buckets per power of two, i.e. to
+         * within 25%. They never exceed @ref max.
+         * @{
+         */
+        std::chrono::microseconds p50{0};
+        std::chrono::microseconds p99{0};
+        /**
+         * @}
+         */
+
+        /**
+         * Heap allocations reported by @ref note_allocation while the probe was active, and their total size.
+         * @{
+         */
+        std::size_t allocations = 0;
+        std::size_t allocated_bytes = 0;
+        /**
+         * @}
+         */
+
+        [[nodiscard]] inline std::chrono::microseconds mean() const;
+    };
+
+    /**
+     * @brief Thread-safe collection of per-@ref probe counters and latency histograms.
+     *
+     * Recording does not allocate nor lock; the memory is fixed, about half a KiB per probe.
+     */
+    class profiler {
+    public:
+        static constexpr std::size_t histogram_buckets = 128;
+
+        profiler() = default;
+        profiler(profiler const &) = delete;
+        profiler &operator=(profiler const &) = delete;
+
+        void record(probe p, std::chrono::microseconds duration, std::size_t allocations = 0, std::size_t allocated_bytes = 0);
+
+        [[nodiscard]] probe_stats stats(probe p) const;
+
+        /**
+         * @brief Samples in each bucket of the latency histogram of @p p.
+         * @see histogram_bucket_upper_bound
+         */
+        [[nodiscard]] std::array<std::uint32_t, histogram_buckets> histogram(probe p) const;
+
+        /**
+         * @brief Drops all samples. Not atomic with respect to concurrent calls to @ref record.
+         */
+        void reset();
+
+        /**
+         * @brief Logs @ref stats of all the probes that have at least one sample.
+         */
+        void log_summary() const;
+
+        /**
+         * @brief Index of the histogram bucket containing @p us microseconds.
+         */
+        [[nodiscard]] static std::size_t histogram_bucket(std::uint32_t us);
+
+        /**
+         * @brief Largest number of microseconds that falls into the histogram bucket @p idx.
+         */
+        [[nodiscard]] static std::uint32_t histogram_bucket_upper_bound(std::size_t idx);
+
+    private:
+        struct probe_data {
+            std::atomic<std::uint32_t> count{0};
+            std::atomic<std::uint64_t> total_us{0};
+            std::atomic<std::uint32_t> min_us{std::numeric_limits<std::uint32_t>::max()};
+            std::atomic<std::uint32_t> max_us{0};
+            std::atomic<std::uint32_t> allocations{0};
+            std::atomic<std::uint64_t> allocated_bytes{0};
+            std::array<std::atomic<std::uint32_t>, histogram_buckets> histogram{};
+        };
+
+        [[nodiscard]] probe_data &data(probe p);
+        [[nodiscard]] probe_data const &data(probe p) const;
+
+        std::array<probe_data, probe_count> _data{};
+    };
+
+    /**
+     * @brief Profiler into which @ref profile_scope and @ref profile_accumulator record.
+     *
+     * This function is thread-safe.
+     */
+    [[nodiscard]] profiler &default_profiler();
+
+    /**
+     * @brief Reports a heap allocation of @p bytes to the probes active on the calling thread.
+     *
+     * Call this from an allocation hook. When `SPOOKY_PROFILING` is defined and the target is ESP-IDF with
+     * `CONFIG_HEAP_USE_HOOKS`, the library installs `esp_heap_trace_alloc_hook`, which calls this. On other platforms,
+     * call it e.g. from a replacement of `operator new`.
+     */
+    inline void note_allocation(std::size_t bytes);
+
+    namespace impl {
+        struct allocation_counter {
+            std::size_t allocations = 0;
+            std::size_t bytes = 0;
+        };
+
+        /**
+         * @brief Allocations noted so far on this thread.
+         */
+        [[nodiscard]] allocation_counter &thread_allocations();
+
+        class probe_timer {
+            std::chrono::steady_clock::time_point _begin;
+            allocation_counter _allocations_at_begin;
+
+        public:
+            probe_timer();
+            void add_elapsed(std::chrono::microseconds &duration, allocation_counter &allocations) const;
+        };
+    }// namespace impl
+
+    /**
+     * @brief Records a sample of a @ref probe into @ref default_profiler, spanning the lifetime of this object.
+     */
+    class profile_scope {
+#ifdef SPOOKY_PROFILING
+        probe _probe;
+        impl::probe_timer _timer;
+#endif
+
+    public:
+        inline explicit profile_scope(probe p);
+        profile_scope(profile_scope const &) = delete;
+        profile_scope &operator=(profile_scope const &) = delete;
+        inline ~profile_scope();
+    };
+
+    /**
+     * @brief Records a single sample of a @ref probe into @ref default_profiler, summing all the sections run through
+     * @ref measure.
+     *
+     * Use this when the operation is interleaved with others, e.g. securing the data of a command one frame at a time
+     * between RF exchanges. Nothing is recorded if no section was measured.
+     */
+    class profile_accumulator {
+#ifdef SPOOKY_PROFILING
+        probe _probe;
+        bool _measured = false;
+        std::chrono::microseconds _duration{0};
+        impl::allocation_counter _allocations{};
+#endif
+
+    public:
+        inline explicit profile_accumulator(probe p);
+        profile_accumulator(profile_accumulator const &) = delete;
+        profile_accumulator &operator=(profile_accumulator const &) = delete;
+        inline ~profile_accumulator();
+
+        /**
+         * @brief Calls @p fn and adds its duration to the sample.
+         * @return Whatever @p fn returns.
+         */
+        template <class Fn>
+        decltype(auto) measure(Fn &&fn);
+    };
+}// namespace mlab
+
+namespace mlab {
+
+    std::chrono::microseconds probe_stats::mean() const {
+        return count > 0 ? total / std::chrono::microseconds::rep(count) : std::chrono::microseconds{0};
+    }
+
+    void note_allocation([[maybe_unused]] std::size_t bytes) {
+#ifdef SPOOKY_PROFILING
+        auto &counter = impl::thread_allocations();
+        ++counter.allocations;
+        counter.bytes += bytes;
+#endif
+    }
+
+#ifdef SPOOKY_PROFILING
+    profile_scope::profile_scope(probe p) : _probe{p}, _timer{} {}
+
+    profile_scope::~profile_scope() {
+        std::chrono::microseconds duration{0};
+        impl::allocation_counter allocations{};
+        _timer.add_elapsed(duration, allocations);
+        default_profiler().record(_probe, duration, allocations.allocations, allocations.bytes);
+    }
+
+    profile_accumulator::profile_accumulator(probe p) : _probe{p} {}
+
+    profile_accumulator::~profile_accumulator() {
+        if (_measured) {
+            default_profiler().record(_probe, _duration, _allocations.allocations, _allocations.bytes);
+        }
+    }
+
+    template <class Fn>
+    decltype(auto) profile_accumulator::measure(Fn &&fn) {
+        struct section {
+            profile_accumulator &owner;
+            impl::probe_timer timer{};
+            ~section() { timer.add_elapsed(owner._duration, owner._allocations); }
+        } s{*this};
+        _measured = true;
+        return std::forward<Fn>(fn)();
+    }
+#else
+    profile_scope::profile_scope(probe) {}
+
+    profile_scope::~profile_scope() {}
+
+    profile_accumulator::profile_accumulator(probe) {}
+
+    profile_accumulator::~profile_accumulator() {}
+
+    template <class Fn>
+    decltype(auto) profile_accumulator::measure(Fn &&fn) {
+        return std::forward<Fn>(fn)();
+    }
+#endif
+}// namespace mlab
+
+#endif//MITTELIB_PROFILER_HPP
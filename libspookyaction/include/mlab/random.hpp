@@ -0,0 +1,19 @@
+#ifndef MITTELIB_RANDOM_HPP
+#define MITTELIB_RANDOM_HPP
+
+#include <cstddef>
+#include <cstdint>
+
+namespace mlab {
+
+    /**
+     * @brief Fills @p length bytes at @p data with random bytes, suitable for cryptographic use.
+     *
+     * On ESP32 this uses the hardware random number generator (`esp_fill_random`), on other platforms the random
+     * source of the operating system (`std::random_device`).
+     */
+    void fill_random(std::uint8_t *data, std::size_t length);
+
+}// namespace mlab
+
+#endif//MITTELIB_RANDOM_HPP
@@ -0,0 +1,183 @@
+#ifndef MITTELIB_TRACE_HPP
+#define MITTELIB_TRACE_HPP
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mlab/bin_data.hpp>
+#include <vector>
+
+namespace mlab {
+
+    enum struct trace_event : std::uint8_t {
+        link_tx,///< Raw bytes sent to the PN532 on the host link. @ref trace_record::arg is unused.
+        link_rx,///< Raw bytes received from the PN532 on the host link. @ref trace_record::arg is unused.
+        pcd_tx, ///< A DESFire frame sent to the card. @ref trace_record::arg is the index of the frame in the command.
+        pcd_rx, ///< A DESFire frame received from the card. @ref trace_record::arg is the index of the frame in the command.
+        crypto, ///< A cryptographic primitive run on @ref trace_record::length bytes, the data is not recorded. @ref trace_record::arg has the cipher type in the upper nibble, the operation in the lower.
+        status  ///< The status byte of a DESFire command. @ref trace_record::arg is the command code.
+    };
+
+    [[nodiscard]] const char *trace_event_name(trace_event e);
+
+    /**
+     * @brief True when the library is built with `SPOOKY_TRACE`.
+     *
+     * Otherwise @ref trace compiles to nothing, and @ref default_trace stays empty.
+     */
+#ifdef SPOOKY_TRACE
+    static constexpr bool tracing_enabled = true;
+#else
+    static constexpr bool tracing_enabled = false;
+#endif
+
+    /**
+     * @brief A timestamped event of a @ref trace_ring, with the first bytes of its data.
+     */
+    struct trace_record {
+        static constexpr std::size_t max_data_length = 23;
+
+        /**
+         * Microseconds on the steady clock, truncated to 32 bits (it wraps around every ~71 minutes).
+         */
+        std::uint32_t timestamp_us = 0;
+        trace_event event = trace_event::link_tx;
+
+        /**
+         * Event-specific argument, see @ref trace_event.
+         */
+        std::uint8_t arg = 0;
+
+        /**
+         * Length of the data of the event, of which only the first @ref data_length bytes are in @ref data.
+         */
+        std::uint16_t length = 0;
+
+        /**
+         * Number of bytes of @ref data that are set, at most @ref max_data_length. Zero for events which do not record
+         * their data, e.g. @ref trace_event::crypto.
+         */
+        std::uint8_t data_length = 0;
+        std::array<std::uint8_t, max_data_length> data{};
+
+        /**
+         * @brief The bytes of @ref data that are actually set.
+         */
+        [[nodiscard]] inline range<std::uint8_t const *> data_view() const;
+    };
+
+    /**
+     * @brief Fixed-size ring of @ref trace_record, which overwrites the oldest records when full.
+     *
+     * Recording is thread-safe and neither allocates nor locks, so it is cheap enough to leave on in release builds,
+     * unlike hex dumps through the log. Records can be read back in place with @ref snapshot, or exported with
+     * @ref dump in a compact binary format to be decoded offline with @ref decode.
+     */
+    class trace_ring {
+    public:
+        explicit trace_ring(std::size_t capacity = 128);
+        trace_ring(trace_ring const &) = delete;
+        trace_ring &operator=(trace_ring const &) = delete;
+
+        void record(trace_event e, std::uint8_t arg, range<std::uint8_t const *> data);
+        void record(trace_event e, std::uint8_t arg, std::size_t length);
+
+        /**
+         * @brief The records in the ring, oldest first.
+         *
+         * Records being written concurrently are skipped.
+         */
+        [[nodiscard]] std::vector<trace_record> snapshot() const;
+
+        /**
+         * @brief Number of records ever written, including those that have been overwritten.
+         */
+        [[nodiscard]] std::size_t total_records() const;
+
+        [[nodiscard]] std::size_t capacity() const;
+
+        /**
+         * @brief Drops all records. Not atomic with respect to concurrent calls to @ref record.
+         */
+        void clear();
+
+        /**
+         * @brief Serializes @ref snapshot. Each record takes 9 bytes, plus the bytes of its @ref trace_record::data_view.
+         */
+        [[nodiscard]] bin_data dump() const;
+
+        /**
+         * @brief Parses the output of @ref dump.
+         * @return The records, oldest first, or an empty vector if @p dumped is malformed.
+         */
+        [[nodiscard]] static std::vector<trace_record> decode(bin_data const &dumped);
+
+        /**
+         * @brief Logs @ref snapshot, one record per line.
+         */
+        void log_records() const;
+
+    private:
+        struct slot {
+            /**
+             * Zero while the slot is empty or being written, otherwise the index of the record in it plus one.
+             */
+            std::atomic<std::size_t> sequence{0};
+            trace_record rec{};
+        };
+
+        [[nodiscard]] trace_record &begin_record(std::size_t &sequence, trace_event e, std::uint8_t arg, std::size_t length);
+        void end_record(std::size_t sequence);
+
+        std::size_t _capacity;
+        std::unique_ptr<slot[]> _slots;
+        std::atomic<std::size_t> _next;
+    };
+
+    /**
+     * @brief Ring into which @ref trace records.
+     *
+     * This function is thread-safe.
+     */
+    [[nodiscard]] trace_ring &default_trace();
+
+    /**
+     * @brief Records an event with its data into @ref default_trace. Compiles to nothing without `SPOOKY_TRACE`.
+     */
+    inline void trace(trace_event e, std::uint8_t arg, range<std::uint8_t const *> data);
+    inline void trace(trace_event e, std::uint8_t arg, bin_data const &data);
+
+    /**
+     * @brief Records an event that refers to @p length bytes of data, without the data itself.
+     * Compiles to nothing without `SPOOKY_TRACE`.
+     */
+    inline void trace(trace_event e, std::uint8_t arg, std::size_t length);
+}// namespace mlab
+
+namespace mlab {
+
+    range<std::uint8_t const *> trace_record::data_view() const {
+        return {data.data(), data.data() + std::min<std::size_t>(data_length, max_data_length)};
+    }
+
+    void trace([[maybe_unused]] trace_event e, [[maybe_unused]] std::uint8_t arg, [[maybe_unused]] range<std::uint8_t const *> data) {
+#ifdef SPOOKY_TRACE
+        default_trace().record(e, arg, data);
+#endif
+    }
+
+    void trace([[maybe_unused]] trace_event e, [[maybe_unused]] std::uint8_t arg, [[maybe_unused]] bin_data const &data) {
+#ifdef SPOOKY_TRACE
+        default_trace().record(e, arg, data.data_view());
+#endif
+    }
+
+    void trace([[maybe_unused]] trace_event e, [[maybe_unused]] std::uint8_t arg, [[maybe_unused]] std::size_t length) {
+#ifdef SPOOKY_TRACE
+        default_trace().record(e, arg, length);
+#endif
+    }
+}// namespace mlab
+
+#endif//MITTELIB_TRACE_HPP
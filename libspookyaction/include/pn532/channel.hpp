@@ -10,9 +10,12 @@
 #include <mlab/result.hpp>
 #include <mlab/time.hpp>
 #include <mlab/pool.hpp>
+#include <mlab/profiler.hpp>
+#include <mlab/trace.hpp>
 #include <pn532/bits.hpp>
 #include <pn532/log.h>
 #include <pn532/msg.hpp>
+#include <vector>
 
 namespace pn532 {
     namespace {
@@ -50,7 +53,19 @@ namespace pn532 {
     struct frame<frame_type::info> {
         bits::transport transport = bits::transport::host_to_pn532;
         bits::command command = bits::command::diagnose;
-        bin_data data; // TODO Investigate whether this can become a borrowed buffer. This especially has consequences on the signature of send
+        bin_data data;
+    };
+
+    /**
+     * @brief Non-owning counterpart of @ref frame<frame_type::info>, used for sending.
+     *
+     * The frame header, length checksum, data checksum and postamble are written directly around @ref data into the
+     * transmission buffer, so that the caller's payload is copied exactly once.
+     */
+    struct info_frame_view {
+        bits::transport transport;
+        bits::command command;
+        mlab::range<bin_data::const_iterator> data;
     };
 
     /**
@@ -118,6 +133,7 @@ namespace pn532 {
     bin_data &operator<<(bin_data &bd, frame<frame_type::nack> const &);
     bin_data &operator<<(bin_data &bd, frame<frame_type::error> const &);
     bin_data &operator<<(bin_data &bd, frame<frame_type::info> const &f);
+    bin_data &operator<<(bin_data &bd, info_frame_view const &f);
     bin_data &operator<<(bin_data &bd, any_frame const &f);
 
     bin_stream &operator>>(bin_stream &s, any_frame &f);
@@ -150,6 +166,136 @@ namespace pn532 {
      */
     bin_stream &operator>>(bin_stream &s, frame_id &id);
 
+    /**
+     * @brief Incremental, push-based decoder for PN532 frames.
+     *
+     * Bytes are pushed into the decoder via @ref feed as soon as they are received from the channel, in chunks of
+     * arbitrary size. The decoder tracks the position within the frame (start of packet code, length, length
+     * checksum, body, data checksum, postamble) and examines every byte exactly once, therefore framing takes linear
+     * time regardless of how many partial reads the transport delivers. @ref bytes_needed tells at any time how many
+     * bytes can be requested without reading past the frame boundary.
+     * Once @ref done, @ref id holds the complete @ref frame_id, and the decoded info frame is available in place in
+     * @ref info_frame, without boxing it into an @ref any_frame. Alternatively, @ref pop_frame moves it out.
+     * @code
+     *  frame_decoder decoder{};
+     *  while (not decoder.done() and not decoder.failed()) {
+     *      buffer.resize(decoder.bytes_needed());
+     *      // Receive into buffer...
+     *      decoder.feed(buffer.view());
+     *  }
+     *  any_frame f = decoder.pop_frame();
+     * @endcode
+     */
+    class frame_decoder {
+    public:
+        /**
+         * @brief Part of the frame that is expected next.
+         */
+        enum struct state {
+            start_of_packet,///< Skipping the preamble and looking for @ref bits::start_of_packet_code
+            code_or_length, ///< Reading either the ACK/NACK code, or the normal info frame length and its checksum
+            extended_length,///< Reading the length and its checksum of an extended info frame
+            body,           ///< Reading transport, command and data of an info frame
+            body_checksum,  ///< Reading the data checksum of an info frame
+            postamble,      ///< Reading the postamble (only if a preamble was present)
+            done,           ///< A frame was successfully decoded and is available in @ref info_frame or @ref pop_frame
+            failed          ///< The data does not represent a valid frame
+        };
+
+        /**
+         * If the start of packet code is not found within this many bytes, the decoder fails.
+         */
+        static constexpr std::size_t max_start_of_packet_offset = frame_id::max_min_info_frame_header_length;
+
+        frame_decoder();
+
+        /**
+         * @brief Prepares the decoder to decode a new frame, discarding any progress made.
+         * @note The data storage (see @ref use_data_storage) is kept, including a partially decoded info frame data.
+         */
+        void reset();
+
+        /**
+         * @brief Provides the buffer into which the data of the next info frame is decoded.
+         *
+         * The decoded @ref frame<frame_type::info>::data will be @p storage, cleared, so that its capacity is reused.
+         * Use this with a buffer borrowed from a pool to avoid allocating memory for each received frame.
+         * @param storage Buffer to move into the decoder.
+         */
+        void use_data_storage(bin_data storage);
+
+        /**
+         * @brief Pushes more received bytes into the decoder.
+         * @param data Range of received bytes.
+         * @return The number of bytes consumed from @p data. This is less than the size of @p data only if the
+         *  decoder reached @ref state::done or @ref state::failed before the end of @p data; the remaining bytes
+         *  are past the frame boundary.
+         */
+        std::size_t feed(mlab::range<bin_data::const_iterator> data);
+
+        /**
+         * @brief Number of bytes that can be received without reading past the end of the frame.
+         * @return A strictly positive number, unless @ref done or @ref failed, in which case this is zero.
+         */
+        [[nodiscard]] std::size_t bytes_needed() const;
+
+        /**
+         * @brief Total number of bytes consumed so far by @ref feed.
+         */
+        [[nodiscard]] inline std::size_t bytes_consumed() const;
+
+        [[nodiscard]] inline state current_state() const;
+        [[nodiscard]] inline bool done() const;
+        [[nodiscard]] inline bool failed() const;
+
+        /**
+         * @brief What is known so far about the frame being decoded.
+         *
+         * @ref frame_id::frame_total_length is always a lower bound on the total frame length, and is exact as soon
+         * as the frame length has been read.
+         */
+        [[nodiscard]] inline frame_id const &id() const;
+
+        /**
+         * @brief Type of the decoded frame.
+         * @note Only valid if @ref done.
+         */
+        [[nodiscard]] inline frame_type type() const;
+
+        /**
+         * @brief The decoded info frame, whose data is the storage passed to @ref use_data_storage.
+         * @note Only valid if @ref done and @ref type is @ref frame_type::info.
+         */
+        [[nodiscard]] inline frame<frame_type::info> &info_frame();
+
+        /**
+         * @brief Moves out the data storage, including any decoded data, e.g. to give it back to its pool.
+         * This can be called in any state, in particular also when the decoder @ref failed.
+         */
+        [[nodiscard]] bin_data release_data_storage();
+
+        /**
+         * @brief Moves out the decoded frame.
+         * @note Only valid if @ref done. The decoder has to be @ref reset before it can be fed again.
+         */
+        [[nodiscard]] any_frame pop_frame();
+
+    private:
+        void consume(std::uint8_t b);
+        void consume_body(bin_data::const_iterator &it, bin_data::const_iterator end);
+        void complete_frame();
+
+        state _state;
+        frame_id _id;
+        std::size_t _consumed;
+        std::size_t _sop_offset;
+        std::array<std::uint8_t, 3> _header;
+        std::size_t _header_size;
+        std::size_t _body_read;
+        std::uint8_t _body_sum;
+        frame<frame_type::info> _info_frame;
+    };
+
 
     /**
      * @brief Abstract class for the PN532 communication channel.
@@ -195,12 +341,57 @@ namespace pn532 {
             comm_timeout,  ///< The given timeout was exceeded before the transmission was complete
             comm_error,    ///< Hardware error during trasmission.
             comm_malformed,///< Malformed data cannot be parsed (or unexpected frame).
-            failure        ///< The PN532 gave an application-level ERROR frame..
+            failure,       ///< The PN532 gave an application-level ERROR frame..
+            out_of_buffers ///< The buffer pool is exhausted (only with a @ref mlab::pool_mode::preallocated pool).
         };
 
         template <class... Tn>
         using result = mlab::result<error, Tn...>;
 
+        /**
+         * @brief Statistics on the trailing ACK frames that were deferred.
+         * @see set_defer_trailing_ack
+         */
+        struct deferred_ack_stats {
+            /**
+             * Number of responses for which the trailing ACK was not sent right away.
+             */
+            std::size_t deferred = 0;
+
+            /**
+             * Number of deferred ACKs that were then sent at the beginning of the following command.
+             */
+            std::size_t flushed = 0;
+
+            /**
+             * Cumulative time spent sending the deferred ACKs. This is the time that was removed from the critical
+             * path of @ref response, i.e. dividing it by @ref flushed gives the latency saved per command.
+             */
+            std::chrono::microseconds time_saved = std::chrono::microseconds{0};
+        };
+
+        /**
+         * @brief Statistics on the response length prediction in @ref receive_mode::buffered.
+         * @see set_predict_response_length
+         */
+        struct response_length_stats {
+            /**
+             * Number of responses for which the first read was sized on a predicted length.
+             */
+            std::size_t predicted = 0;
+
+            /**
+             * Number of responses that were read in one go thanks to the prediction, and would have otherwise
+             * required a NACK and a retransmission of the whole frame from the PN532.
+             */
+            std::size_t nacks_avoided = 0;
+
+            /**
+             * Number of NACKs sent to request a retransmission, because the first read was too short.
+             */
+            std::size_t nacks_sent = 0;
+        };
+
     protected:
         /**
          * One of the two possible half-duplex communication modes of the channel, send and receive.
@@ -273,6 +464,22 @@ namespace pn532 {
 
         result<> send(any_frame const &frame, ms timeout);
 
+        /**
+         * @copydoc send(any_frame const &, ms)
+         * @note Unlike @ref send(any_frame const &, ms), this does not require to box the frame into an @ref any_frame.
+         */
+        result<> send(frame<frame_type::ack> const &frame, ms timeout);
+
+        /**
+         * @copydoc send(frame<frame_type::ack> const &, ms)
+         */
+        result<> send(frame<frame_type::nack> const &frame, ms timeout);
+
+        /**
+         * Sends an info frame without copying @ref info_frame_view::data other than into the transmission buffer.
+         */
+        result<> send(info_frame_view const &frame, ms timeout);
+
         result<any_frame> receive(ms timeout);
 
     public:
@@ -287,6 +494,68 @@ namespace pn532 {
          */
         result<> send_ack(bool ack_value, ms timeout);
 
+        /**
+         * @brief Enables or disables deferring the ACK that follows every response.
+         *
+         * After receiving an info frame, @ref response acknowledges it by sending an ACK to the PN532. This is an
+         * extra host-to-PN532 transmission that delays the moment in which the caller gets the response data. When
+         * this is enabled, the ACK is not sent immediately, but at the beginning of the next @ref command (or when
+         * @ref flush_deferred_ack is called). This is useful in tight polling loops, where these small fixed costs
+         * dominate. It is disabled by default.
+         * @param v True to send the trailing ACK lazily. Disabling this will not flush a pending ACK.
+         * @see deferred_ack_statistics
+         */
+        void set_defer_trailing_ack(bool v);
+
+        /**
+         * @return True if the trailing ACK of @ref response is sent lazily.
+         * @see set_defer_trailing_ack
+         */
+        [[nodiscard]] inline bool defer_trailing_ack() const;
+
+        /**
+         * @brief Statistics on the deferred trailing ACKs.
+         * @see set_defer_trailing_ack
+         */
+        [[nodiscard]] inline deferred_ack_stats const &deferred_ack_statistics() const;
+
+        /**
+         * @brief Sends a pending trailing ACK, if any.
+         *
+         * This is automatically called at the beginning of @ref command. Call this explicitly before leaving the
+         * PN532 idle for a long time, or before powering it down.
+         * @param timeout maximum time for sending the ACK
+         * @return No data, but can return the following errors: @ref error::comm_timeout.
+         */
+        result<> flush_deferred_ack(ms timeout);
+
+        /**
+         * @brief Enables or disables predicting the length of the response to each command.
+         *
+         * This only affects channels in @ref receive_mode::buffered. In this mode, the length of a frame is unknown
+         * before reading it, so by default only @ref frame_id::max_min_info_frame_header_length bytes are read, and
+         * any longer frame costs a NACK and a full retransmission from the PN532. With prediction, the first read
+         * is sized on the expected response length to the command: this is fixed for some commands (e.g.
+         * @ref bits::command::get_firmware_version), and it is the largest response seen so far for the others
+         * (e.g. @ref bits::command::in_data_exchange). Reading past the frame boundary is harmless in this mode.
+         * It is enabled by default.
+         * @param v True to size the first read on the predicted response length.
+         * @see response_length_statistics
+         */
+        void set_predict_response_length(bool v);
+
+        /**
+         * @return True if the response length is predicted in @ref receive_mode::buffered.
+         * @see set_predict_response_length
+         */
+        [[nodiscard]] inline bool predict_response_length() const;
+
+        /**
+         * @brief Statistics on the response length prediction.
+         * @see set_predict_response_length
+         */
+        [[nodiscard]] inline response_length_stats const &response_length_statistics() const;
+
         /**
          * @brief Wait for an ACK or NACK
          * @internal
@@ -305,7 +574,12 @@ namespace pn532 {
          * @return No data, but can return the following errors: @ref error::comm_timeout, @ref error::nack,
          *   @ref error::comm_malformed
          */
-        result<> command(bits::command cmd, bin_data data, ms timeout);
+        result<> command(bits::command cmd, mlab::range<bin_data::const_iterator> data, ms timeout);
+
+        /**
+         * @copydoc command(bits::command, mlab::range<bin_data::const_iterator>, ms)
+         */
+        inline result<> command(bits::command cmd, bin_data const &data, ms timeout);
 
         /**
          * @brief Wait for a response frame of a command
@@ -314,9 +588,25 @@ namespace pn532 {
          * @param timeout maximum time for getting a response
          * @return Either the received data, or one of the following errors: @ref error::comm_malformed,
          *  @ref error::comm_checksum_fail, or @ref error::comm_timeout. No other error codes are produced.
+         * @note The data is copied out of the pooled receive buffer, which allocates unless the response is empty. On hot
+         *  paths, use @ref borrowed_response instead.
          */
         result<bin_data> response(bits::command cmd, ms timeout);
 
+        /**
+         * @brief Wait for a response frame of a command, and return its data into a buffer borrowed from the pool.
+         *
+         * The response data is decoded directly into the borrowed buffer, so that no memory is allocated once the
+         * pool is warm. The buffer returns to the pool when the result is destroyed.
+         * @internal
+         * @param cmd Command code
+         * @param timeout maximum time for getting a response
+         * @return Either the received data, or one of the following errors: @ref error::comm_malformed,
+         *  @ref error::comm_checksum_fail, or @ref error::comm_timeout. No other error codes are produced.
+         * @see response
+         */
+        result<mlab::borrowed<bin_data>> borrowed_response(bits::command cmd, ms timeout);
+
         /**
          * @brief Command with response
          * @internal
@@ -328,7 +618,26 @@ namespace pn532 {
          *         - @ref error::comm_checksum_fail
          *         - @ref error::comm_timeout
          */
-        result<bin_data> command_response(bits::command cmd, bin_data data, ms timeout);
+        result<bin_data> command_response(bits::command cmd, mlab::range<bin_data::const_iterator> data, ms timeout);
+
+        /**
+         * @copydoc command_response(bits::command, mlab::range<bin_data::const_iterator>, ms)
+         */
+        inline result<bin_data> command_response(bits::command cmd, bin_data const &data, ms timeout);
+
+        /**
+         * @brief Command with response, returned into a buffer borrowed from the pool.
+         * @internal
+         * @param cmd Command code
+         * @param payload Max 263 bytes, will be truncated
+         * @param timeout maximum time for getting a response
+         * @return Either the received data, or one of the following errors:
+         *         - @ref error::comm_malformed
+         *         - @ref error::comm_checksum_fail
+         *         - @ref error::comm_timeout
+         * @see borrowed_response
+         */
+        result<mlab::borrowed<bin_data>> command_borrowed_response(bits::command cmd, mlab::range<bin_data::const_iterator> data, ms timeout);
 
         /**
          * @brief Get data from a command response
@@ -342,21 +651,70 @@ namespace pn532 {
          *         - @ref error::comm_timeout
          */
         template <class Data, class = typename std::enable_if<bin_stream::is_extractable<Data>::value>::type>
-        result<Data> command_parse_response(bits::command cmd, bin_data data, ms timeout);
+        result<Data> command_parse_response(bits::command cmd, mlab::range<bin_data::const_iterator> data, ms timeout);
+
+        /**
+         * @copydoc command_parse_response(bits::command, mlab::range<bin_data::const_iterator>, ms)
+         */
+        template <class Data, class = typename std::enable_if<bin_stream::is_extractable<Data>::value>::type>
+        result<Data> command_parse_response(bits::command cmd, bin_data const &data, ms timeout);
 
     private:
+        /**
+         * Forwards the raw transfers and the events to the channel it records.
+         */
+        friend class recording_channel;
+
+        /**
+         * Serializes @p frame into a pooled buffer of at least @p frame_length bytes, and sends it.
+         */
+        template <class Frame>
+        result<> send_frame(Frame const &frame, std::size_t frame_length, ms timeout);
+
+        /**
+         * Receives a frame into @p decoder, using the appropriate method for @ref raw_receive_mode.
+         * On success, @p decoder is @ref frame_decoder::done.
+         */
+        result<> receive(frame_decoder &decoder, ms timeout, std::size_t expected_length = 0);
+
         /**
          * Receives the frame one piece at a time.
          */
-        result<any_frame> receive_stream(ms timeout);
+        result<> receive_stream(frame_decoder &decoder, ms timeout);
 
         /**
          * Receives the frame but restarts every time it needs to read a new chunk.
+         * @param expected_length Expected total length of the frame, used to size the first read.
+         */
+        result<> receive_restart(frame_decoder &decoder, ms timeout, std::size_t expected_length);
+
+        struct learned_response_length {
+            bits::command command;
+            std::size_t frame_length;
+        };
+
+        /**
+         * @brief Expected total length of the response frame to @p cmd.
+         * @param cmd Command code
+         * @param request_size Size of the data sent with @p cmd.
+         * @return The expected frame length, or zero if unknown.
          */
-        result<any_frame> receive_restart(ms timeout);
+        [[nodiscard]] std::size_t predicted_response_length(bits::command cmd, std::size_t request_size) const;
+
+        /**
+         * @brief Records that the response frame to @p cmd was @p frame_length bytes long.
+         */
+        void learn_response_length(bits::command cmd, std::size_t frame_length);
 
         mlab::shared_buffer_pool _buffer_pool;
         bool _has_operation;
+        bool _defer_trailing_ack;
+        bool _ack_pending;
+        deferred_ack_stats _deferred_ack_stats;
+        bool _predict_response_length;
+        std::size_t _expected_response_length;
+        std::vector<learned_response_length> _learned_response_lengths;
+        response_length_stats _response_length_stats;
     };
 
     [[nodiscard]] const char *to_string(frame_type type);
@@ -440,6 +798,7 @@ namespace pn532 {
         channel &_owner;
         comm_mode _event;
         result<> _result;
+        mlab::profile_scope _profile;
 
     public:
         /**
@@ -525,9 +884,22 @@ namespace pn532 {
 namespace pn532 {
 
     template <class Data, class>
-    channel::result<Data> channel::command_parse_response(bits::command cmd, bin_data data, ms timeout) {
-        if (const auto res_cmd = command_response(cmd, std::move(data), timeout); res_cmd) {
-            bin_stream s{*res_cmd};
+    channel::result<Data> channel::command_parse_response(bits::command cmd, bin_data const &data, ms timeout) {
+        return command_parse_response<Data>(cmd, data.view(), timeout);
+    }
+
+    channel::result<> channel::command(bits::command cmd, bin_data const &data, ms timeout) {
+        return command(cmd, data.view(), timeout);
+    }
+
+    channel::result<bin_data> channel::command_response(bits::command cmd, bin_data const &data, ms timeout) {
+        return command_response(cmd, data.view(), timeout);
+    }
+
+    template <class Data, class>
+    channel::result<Data> channel::command_parse_response(bits::command cmd, mlab::range<bin_data::const_iterator> data, ms timeout) {
+        if (const auto res_cmd = command_borrowed_response(cmd, data, timeout); res_cmd) {
+            bin_stream s{**res_cmd};
             auto retval = Data();
             s >> retval;
             if (s.bad()) {
@@ -543,6 +915,50 @@ namespace pn532 {
         }
     }
 
+    std::size_t frame_decoder::bytes_consumed() const {
+        return _consumed;
+    }
+
+    frame_decoder::state frame_decoder::current_state() const {
+        return _state;
+    }
+
+    bool frame_decoder::done() const {
+        return _state == state::done;
+    }
+
+    bool frame_decoder::failed() const {
+        return _state == state::failed;
+    }
+
+    frame_type frame_decoder::type() const {
+        return _id.type;
+    }
+
+    frame<frame_type::info> &frame_decoder::info_frame() {
+        return _info_frame;
+    }
+
+    frame_id const &frame_decoder::id() const {
+        return _id;
+    }
+
+    bool channel::defer_trailing_ack() const {
+        return _defer_trailing_ack;
+    }
+
+    channel::deferred_ack_stats const &channel::deferred_ack_statistics() const {
+        return _deferred_ack_stats;
+    }
+
+    bool channel::predict_response_length() const {
+        return _predict_response_length;
+    }
+
+    channel::response_length_stats const &channel::response_length_statistics() const {
+        return _response_length_stats;
+    }
+
     bool channel::comm_operation::ok() const {
         return bool(_result);
     }
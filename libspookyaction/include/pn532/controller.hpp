@@ -435,6 +435,24 @@ namespace pn532 {
         result<rf_status, bin_data>
         initiator_data_exchange(std::uint8_t target_logical_index, bin_data const &data, ms timeout = default_timeout);
 
+        /**
+         * @brief Exchange data with the tag (UM0701-02 §7.3.8), appending the response to a caller-provided buffer.
+         * @ingroup Initiator
+         * Same as @ref initiator_data_exchange(std::uint8_t, bin_data const &, ms), but no buffer is allocated for the
+         * response. Pass a buffer borrowed from a pool as @p data_in to exchange data without touching the heap.
+         * @param target_logical_index index the PN532 has given to the tag,
+         *  can be retrived with initiator_list_passive_* commands or via @ref initiator_auto_poll
+         * @param data If the total payload exceeds 262 bytes, multiple commands will be issued.
+         * @param data_in Buffer to which the data sent by the tag is appended. It is not cleared.
+         * @param timeout maximum time for getting a response
+         * @return @ref rf_status of the last chunk, or one of the following errors:
+         *         - @ref error::comm_malformed,
+         *         - @ref error::comm_checksum_fail
+         *         - @ref error::comm_timeout
+         */
+        result<rf_status>
+        initiator_data_exchange(std::uint8_t target_logical_index, bin_data const &data, bin_data &data_in, ms timeout = default_timeout);
+
         /**
          * @brief Select the tag, next commands will effect the selected tag (UM0701-02 §7.3.12)
          * @ingroup Initiator
@@ -1294,14 +1312,22 @@ namespace pn532 {
 
         [[nodiscard]] borrowed_buffer borrow_buffer(std::size_t prealloc_size = std::numeric_limits<std::size_t>::max()) const;
 
+        /**
+         * @brief Borrows a buffer with room for @p prealloc_size bytes and serializes @p args into it, in order.
+         * Use this instead of `bin_data::chain` to build command payloads without heap allocations.
+         * @return A released buffer if the pool is exhausted.
+         */
+        template <class... Args>
+        [[nodiscard]] borrowed_buffer borrow_payload(std::size_t prealloc_size, Args &&...args) const;
+
         [[nodiscard]] inline channel &chn() const;
 
         [[nodiscard]] static std::uint8_t get_target(command_code cmd, std::uint8_t target_logical_index, bool expect_more_data);
 
-        template <baudrate_modulation BrMd>
+        template <baudrate_modulation BrMd, class... Args>
         result<std::vector<bits::target<BrMd>>> initiator_list_passive(
-                std::uint8_t max_targets,
-                bin_data const &initiator_data, ms timeout);
+                std::uint8_t max_targets, ms timeout,
+                std::size_t initiator_data_size, Args &&...initiator_data);
     };
 
 }// namespace pn532
@@ -1312,7 +1338,7 @@ namespace pn532 {
     controller::controller(channel &chn, std::shared_ptr<buffer_pool> pool) : _channel{&chn}, _pool{std::move(pool)}
     {
         if (_pool == nullptr) {
-            _pool = std::make_shared<buffer_pool>();
+            _pool = mlab::default_buffer_pool();
         }
     }
 
@@ -1333,10 +1359,22 @@ namespace pn532 {
     template <class T, class>
     controller::result<rf_status, bin_data> controller::initiator_data_exchange(std::uint8_t target_logical_index, T &&data, ms timeout) {
         auto buffer = borrow_buffer();
+        if (not buffer) {
+            return channel::error::out_of_buffers;
+        }
         buffer << std::forward<T>(data);
         return initiator_data_exchange(target_logical_index, *buffer, timeout);
     }
 
+    template <class... Args>
+    borrowed_buffer controller::borrow_payload(std::size_t prealloc_size, Args &&...args) const {
+        auto buffer = borrow_buffer(prealloc_size);
+        if (buffer) {
+            (*buffer << ... << std::forward<Args>(args));
+        }
+        return buffer;
+    }
+
 }// namespace pn532
 
 
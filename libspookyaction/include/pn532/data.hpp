@@ -294,6 +294,26 @@ namespace pn532 {
 
         inline mlab::bit_ref operator[](std::pair<gpio_loc, std::uint8_t> const &gpio_idx);
     };
+
+    /**
+     * @brief Bit rates in the two directions of an ISO/IEC 14443-4 link, as set by @ref controller::initiator_psl.
+     */
+    struct iso_iec_14443_4_bit_rates {
+        baudrate in_to_trg = baudrate::kbps106;//!< From the PN532 to the target (DR)
+        baudrate trg_to_in = baudrate::kbps106;//!< From the target to the PN532 (DS)
+
+        [[nodiscard]] inline bool operator==(iso_iec_14443_4_bit_rates const &other) const;
+        [[nodiscard]] inline bool operator!=(iso_iec_14443_4_bit_rates const &other) const;
+    };
+
+    /**
+     * @brief Highest bit rates supported both by the PN532 and by an ISO/IEC 14443-4 target.
+     * Reads DS and DR from the interface byte TA(1) of the ATS (ISO/IEC 14443-4, 5.2.4), and caps them at 424 kbps.
+     * If the target requires the same bit rate in both directions, the lowest of the two is used.
+     * @param ats The ATS without the length byte, as in @ref target_info::ats.
+     * @return 106 kbps in both directions if the ATS does not contain TA(1).
+     */
+    [[nodiscard]] iso_iec_14443_4_bit_rates max_bit_rates_from_ats(std::vector<std::uint8_t> const &ats);
 }// namespace pn532
 
 namespace mlab {
@@ -435,6 +455,14 @@ namespace pn532 {
     reg_addr::reg_addr(std::uint16_t xram_mmap_reg) : std::array<std::uint8_t, 2>{{std::uint8_t(xram_mmap_reg >> 8),
                                                                                    std::uint8_t(xram_mmap_reg & 0xff)}} {}
 
+    bool iso_iec_14443_4_bit_rates::operator==(iso_iec_14443_4_bit_rates const &other) const {
+        return in_to_trg == other.in_to_trg and trg_to_in == other.trg_to_in;
+    }
+
+    bool iso_iec_14443_4_bit_rates::operator!=(iso_iec_14443_4_bit_rates const &other) const {
+        return not operator==(other);
+    }
+
 }// namespace pn532
 
 namespace mlab {
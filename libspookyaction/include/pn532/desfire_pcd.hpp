@@ -7,34 +7,108 @@
 
 #include "controller.hpp"
 #include "desfire/pcd.hpp"
+#include <bitset>
 
 namespace pn532 {
     class desfire_pcd final : public desfire::pcd {
         controller *_pcd;
         std::uint8_t _target;
         controller::result<rf_status> _last_result;
+        std::size_t _max_frame_length;
+        iso_iec_14443_4_bit_rates _max_bit_rates;
+        iso_iec_14443_4_bit_rates _bit_rates;
+        std::bitset<16> _recent_errors;
 
         [[nodiscard]] inline controller &ctrl();
 
+        void track_error(bool failed);
+
     public:
+        /**
+         * @brief Selects @p target_logical_index. Since the ATS is not known, frames are limited to
+         * @ref desfire::bits::max_packet_length.
+         */
         inline desfire_pcd(controller &controller, std::uint8_t target_logical_index);
 
+        /**
+         * @brief Selects @p target, with a frame size negotiated from the FSC in its ATS.
+         * @param target A target obtained from @ref controller::initiator_list_passive_kbps106_typea.
+         */
+        inline desfire_pcd(controller &controller, target_kbps106_typea const &target);
+
+        /**
+         * @brief Largest ISO 14443-4 information field that a PICC accepts, according to its ATS.
+         * This is the frame size encoded by FSCI in T0, minus PCB, CID and CRC, and is capped at what
+         * @ref controller::initiator_data_exchange can carry. If the ATS is missing or too short, it falls back to
+         * @ref desfire::bits::max_packet_length.
+         * @param ats The ATS without the length byte, as in @ref target_info::ats.
+         */
+        [[nodiscard]] static std::size_t max_frame_length_from_ats(std::vector<std::uint8_t> const &ats);
+
+        /**
+         * @brief Number of failed exchanges, among the last 16, that cause a fall back to 106 kbps.
+         */
+        static constexpr std::size_t fallback_error_count = 3;
+
+        /**
+         * @brief Switches to the highest bit rate supported by the target, up to @p max_bit_rate, with
+         * @ref controller::initiator_psl.
+         * This is opt-in: the link stays at 106 kbps until this is called. The supported bit rates are only known when
+         * the pcd is built from a @ref target_kbps106_typea; otherwise, this does nothing.
+         * If afterwards @ref fallback_error_count of the last 16 exchanges fail at the RF level, the pcd goes back to
+         * 106 kbps automatically.
+         * @return The result of @ref controller::initiator_psl, or a successful @ref rf_status if there was nothing to
+         *  change.
+         */
+        controller::result<rf_status> upgrade_bit_rate(baudrate max_bit_rate = baudrate::kbps424);
+
+        /**
+         * @brief Goes back to 106 kbps in both directions.
+         */
+        controller::result<rf_status> reset_bit_rate();
+
+        /**
+         * @brief Bit rates currently in use.
+         */
+        [[nodiscard]] inline iso_iec_14443_4_bit_rates const &bit_rates() const;
+
+        /**
+         * @brief Highest bit rates supported by the target, from its ATS.
+         */
+        [[nodiscard]] inline iso_iec_14443_4_bit_rates const &max_bit_rates() const;
+
         [[nodiscard]] inline controller &tag_reader();
         [[nodiscard]] inline controller const &tag_reader() const;
         [[nodiscard]] inline controller::result<rf_status> last_result() const;
         [[nodiscard]] inline std::uint8_t target_logical_index() const;
 
         std::pair<bin_data, bool> communicate(bin_data const &data) override;
+
+        /**
+         * @brief Appends the response straight into @p data_in, with @ref controller::initiator_data_exchange.
+         */
+        bool communicate_into(bin_data const &data, bin_data &data_in) override;
+
+        [[nodiscard]] std::size_t max_frame_length() const override;
     };
 }// namespace pn532
 
 namespace pn532 {
     desfire_pcd::desfire_pcd(controller &controller, std::uint8_t target_logical_index) : _pcd{&controller}, _target{target_logical_index},
-                                                                                          _last_result{rf_status{false, false, controller_error::none}} {
+                                                                                          _last_result{rf_status{false, false, controller_error::none}},
+                                                                                          _max_frame_length{desfire::bits::max_packet_length},
+                                                                                          _max_bit_rates{},
+                                                                                          _bit_rates{},
+                                                                                          _recent_errors{} {
         _pcd->rf_configuration_field(true, true);
         _pcd->initiator_select(target_logical_index);
     }
 
+    desfire_pcd::desfire_pcd(controller &controller, target_kbps106_typea const &target) : desfire_pcd{controller, target.logical_index} {
+        _max_frame_length = max_frame_length_from_ats(target.info.ats);
+        _max_bit_rates = max_bit_rates_from_ats(target.info.ats);
+    }
+
     controller &desfire_pcd::ctrl() { return *_pcd; }
 
     std::uint8_t desfire_pcd::target_logical_index() const {
@@ -52,6 +126,14 @@ namespace pn532 {
         return *_pcd;
     }
 
+    iso_iec_14443_4_bit_rates const &desfire_pcd::bit_rates() const {
+        return _bit_rates;
+    }
+
+    iso_iec_14443_4_bit_rates const &desfire_pcd::max_bit_rates() const {
+        return _max_bit_rates;
+    }
+
 }// namespace pn532
 
 #endif//PN532_DESFIRE_PCD_HPP
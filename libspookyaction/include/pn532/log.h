@@ -5,7 +5,7 @@
 #ifndef PN532_LOG_H
 #define PN532_LOG_H
 
-#include <esp_log.h>
+#include <mlab/log.h>
 
 #ifdef __cplusplus
 extern "C" {
@@ -18,6 +18,21 @@ extern "C" {
 #define PN532_LOGD(format, ...) ESP_LOGD(PN532_TAG, format, ##__VA_ARGS__)
 #define PN532_LOGV(format, ...) ESP_LOGV(PN532_TAG, format, ##__VA_ARGS__)
 
+/**
+ * Hex dumps of the data on the hot path. In release builds (`NDEBUG`) these are compiled out together with their
+ * arguments; build with `SPOOKY_TRACE` and use @ref mlab::default_trace to follow the traffic instead.
+ */
+#ifdef NDEBUG
+#define PN532_LOG_BUFFER_HEX_LEVEL(tag, buffer, buff_len, level) \
+    do {                                                         \
+        (void) sizeof(tag);                                      \
+        (void) sizeof(buffer);                                   \
+        (void) sizeof(buff_len);                                 \
+    } while (0)
+#else
+#define PN532_LOG_BUFFER_HEX_LEVEL(tag, buffer, buff_len, level) ESP_LOG_BUFFER_HEX_LEVEL(tag, buffer, buff_len, level)
+#endif
+
 #ifdef __cplusplus
 }
 #endif
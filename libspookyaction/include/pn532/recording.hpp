@@ -0,0 +1,284 @@
+#ifndef PN532_RECORDING_HPP
+#define PN532_RECORDING_HPP
+
+#include <chrono>
+#include <functional>
+#include <optional>
+#include <pn532/channel.hpp>
+#include <vector>
+
+namespace pn532 {
+
+    /**
+     * @brief Function that fills @p length bytes at @p data with random bytes; matches `desfire::tag::random_source`.
+     */
+    using random_fn = std::function<void(std::uint8_t *data, std::size_t length)>;
+
+    /**
+     * @brief A raw transfer on the host link, or random bytes drawn by the host, as captured by @ref recording_channel.
+     */
+    struct link_event {
+        enum struct kind : std::uint8_t {
+            send,   ///< A call to @ref channel::raw_send, @ref data holds the bytes sent (empty on failure).
+            receive,///< A call to @ref channel::raw_receive, @ref data holds the bytes received (empty on failure).
+            wake,   ///< A call to @ref channel::wake, @ref data is empty.
+            random  ///< Random bytes drawn by the host, e.g. an authentication challenge, @ref data holds them.
+        };
+
+        kind type = kind::send;
+
+        /**
+         * Empty if the transfer succeeded, otherwise the error it returned. A failed @ref kind::wake is recorded as
+         * @ref channel::error::comm_error.
+         */
+        std::optional<channel::error> outcome = std::nullopt;
+
+        /**
+         * Time between the completion of the previous event (or the beginning of the recording) and of this one.
+         */
+        std::chrono::microseconds delay{0};
+
+        bin_data data{};
+    };
+
+    /**
+     * @brief A recording of the traffic on a host link, decoded.
+     *
+     * A recording starts with a 5 bytes header (the magic `PNR`, a version byte, and a byte which is 1 if the channel
+     * was in buffered receive mode), followed by the events. Each event takes 8 bytes: kind, outcome (0 for success,
+     * otherwise the @ref channel::error plus one), delay in microseconds (LSB 32 bits), data length (LSB 16 bits);
+     * then the data bytes.
+     */
+    struct link_recording {
+        /**
+         * True if the channel read each frame at once (I2C, SPI), false if it read frames as a stream (HSU).
+         */
+        bool buffered = false;
+        std::vector<link_event> events{};
+
+        /**
+         * @brief Total time spanned by @ref events.
+         */
+        [[nodiscard]] std::chrono::microseconds duration() const;
+
+        /**
+         * @brief Parses the output of @ref recording_channel.
+         * @return The decoded recording, or `std::nullopt` if @p data is malformed.
+         */
+        [[nodiscard]] static std::optional<link_recording> decode(bin_data const &data);
+    };
+
+    /**
+     * @brief Decorator that records every raw transfer of another channel into a compact binary format.
+     *
+     * Use this to capture the traffic of a reader in the field (HSU, I2C or SPI alike), then feed it back into a
+     * @ref controller on a host with @ref replay_channel. The recorded channel must not be used directly while
+     * wrapped. Recording adds a copy of the transferred bytes and 8 bytes per transfer, and does not alter timing
+     * otherwise. To be able to replay authenticated sessions, pass @ref random_source to the `desfire::tag`.
+     */
+    class recording_channel final : public channel {
+    public:
+        /**
+         * @brief Function that receives consecutive chunks of the recording, e.g. to append them to a file on flash.
+         * The concatenation of all chunks is a valid recording.
+         */
+        using sink_fn = std::function<void(bin_data const &)>;
+
+        /**
+         * @brief Records in RAM, up to @p max_size bytes; the events that do not fit are dropped.
+         * @param inner The channel to record. The caller must keep it alive for the lifetime of this object.
+         * @param max_size Maximum size of @ref recording.
+         * @param buffer_pool Pool for frame buffers. If `nullptr`, it uses @ref default_buffer_pool.
+         */
+        explicit recording_channel(channel &inner, std::size_t max_size = 0x4000, mlab::shared_buffer_pool buffer_pool = nullptr);
+
+        /**
+         * @brief Records in chunks of about @p chunk_size bytes, which are handed over to @p sink, without limits.
+         * @param inner The channel to record. The caller must keep it alive for the lifetime of this object.
+         * @param sink Function called with each chunk. The last chunk is passed at destruction or by @ref flush.
+         * @param chunk_size Size above which the recorded data is passed to @p sink.
+         * @param buffer_pool Pool for frame buffers. If `nullptr`, it uses @ref default_buffer_pool.
+         */
+        recording_channel(channel &inner, sink_fn sink, std::size_t chunk_size = 0x200, mlab::shared_buffer_pool buffer_pool = nullptr);
+
+        recording_channel(recording_channel const &) = delete;
+        recording_channel &operator=(recording_channel const &) = delete;
+
+        ~recording_channel() override;
+
+        bool wake() override;
+
+        /**
+         * @brief The data recorded so far, and not yet passed to the sink.
+         */
+        [[nodiscard]] inline bin_data const &recording() const;
+
+        /**
+         * @brief Number of events recorded so far.
+         */
+        [[nodiscard]] inline std::size_t event_count() const;
+
+        /**
+         * @brief True if some events were dropped because @ref recording reached its maximum size.
+         */
+        [[nodiscard]] inline bool truncated() const;
+
+        /**
+         * @brief Random source that draws from the hardware random number generator, and records the bytes drawn.
+         * @note The returned function refers to this object, which must outlive it.
+         * @see replay_channel::random_source
+         */
+        [[nodiscard]] random_fn random_source();
+
+        /**
+         * @brief Passes whatever is in @ref recording to the sink, if any.
+         */
+        void flush();
+
+        /**
+         * @brief Discards the recording and starts a new one, with the time reference reset to now.
+         */
+        void restart();
+
+    protected:
+        result<> raw_send(mlab::range<bin_data::const_iterator> buffer, ms timeout) override;
+        result<> raw_receive(mlab::range<bin_data::iterator> buffer, ms timeout) override;
+
+        [[nodiscard]] receive_mode raw_receive_mode() const override;
+
+        bool on_receive_prepare(ms timeout) override;
+        void on_receive_complete(result<> const &outcome) override;
+        bool on_send_prepare(ms timeout) override;
+        void on_send_complete(result<> const &outcome) override;
+
+    private:
+        /**
+         * Appends the header of an event with @p length bytes of data, unless it does not fit.
+         */
+        [[nodiscard]] bool append_header(link_event::kind type, std::optional<error> outcome, std::size_t length);
+
+        void append(link_event::kind type, std::optional<error> outcome);
+        void append(link_event::kind type, mlab::range<bin_data::const_iterator> data);
+
+        channel *_inner;
+        sink_fn _sink;
+        std::size_t _max_size;
+        bin_data _recording;
+        std::chrono::steady_clock::time_point _last_event;
+        std::size_t _event_count;
+        bool _truncated;
+    };
+
+    /**
+     * @brief Channel that plays back a @ref link_recording, as if it were talking to the recorded PN532.
+     *
+     * Every @ref raw_send and @ref raw_receive consumes the next event of the recording, returns its outcome and, for
+     * receiving, its data. When a controller performs the same operations as in the recorded session, it receives the
+     * same responses, with the same errors and timeouts, which makes the session reproducible on a host.
+     *
+     * @note The replay does not react to what is sent. If the host sends something different (e.g. because
+     *  authentication uses a fresh random challenge, see @ref random_source), the mismatch is counted in
+     *  @ref replay_stats, and the recorded responses are returned anyway, thus the upper layers may then fail. If the
+     *  kind of operation diverges from the recording, or the recording is over, the operation fails with
+     *  @ref channel::error::comm_error.
+     * @note Channels adapt their reads to the responses seen so far (see @ref set_predict_response_length), therefore
+     *  a recording must be played back on a new replay channel, configured like the recorded one.
+     */
+    class replay_channel final : public channel {
+    public:
+        struct replay_stats {
+            std::size_t events_replayed = 0;
+            std::size_t send_mismatches = 0;///< Sends whose data differs from the recorded one.
+            std::size_t divergences = 0;    ///< Operations that failed because they do not match the next event.
+        };
+
+        /**
+         * @param recording The session to play back.
+         * @param speed Playback speed relative to the recording: 1 waits for each event to take as long as it did
+         *  originally, 2 half of that, and 0 does not wait at all. The speed can be changed during the playback.
+         * @param buffer_pool Pool for frame buffers. If `nullptr`, it uses @ref default_buffer_pool.
+         */
+        explicit replay_channel(link_recording recording, double speed = 1., mlab::shared_buffer_pool buffer_pool = nullptr);
+
+        bool wake() override;
+
+        [[nodiscard]] inline double speed() const;
+        inline void set_speed(double speed);
+
+        [[nodiscard]] inline replay_stats const &stats() const;
+
+        /**
+         * @brief Random source that plays back the bytes drawn from @ref recording_channel::random_source.
+         *
+         * Pass it to the `desfire::tag`, so that it sends the same challenges as in the recorded session. If the next
+         * event is not a @ref link_event::kind::random, it counts a divergence and yields zeroes.
+         * @note The returned function refers to this object, which must outlive it.
+         */
+        [[nodiscard]] random_fn random_source();
+
+        /**
+         * @brief True if all the events have been played back.
+         */
+        [[nodiscard]] inline bool exhausted() const;
+
+    protected:
+        result<> raw_send(mlab::range<bin_data::const_iterator> buffer, ms timeout) override;
+        result<> raw_receive(mlab::range<bin_data::iterator> buffer, ms timeout) override;
+
+        [[nodiscard]] inline receive_mode raw_receive_mode() const override;
+
+    private:
+        /**
+         * Returns the next event if it is of kind @p type, and advances the playback to it.
+         */
+        [[nodiscard]] link_event const *next_event(link_event::kind type);
+
+        /**
+         * Waits until @p e would have completed in the recording, scaled by @ref speed. The time reference is the
+         * first event played back.
+         */
+        void wait_for(link_event const &e);
+
+        link_recording _recording;
+        double _speed;
+        std::size_t _next;
+        std::optional<std::chrono::steady_clock::time_point> _deadline;
+        replay_stats _stats;
+    };
+}// namespace pn532
+
+namespace pn532 {
+    bin_data const &recording_channel::recording() const {
+        return _recording;
+    }
+
+    std::size_t recording_channel::event_count() const {
+        return _event_count;
+    }
+
+    bool recording_channel::truncated() const {
+        return _truncated;
+    }
+
+    double replay_channel::speed() const {
+        return _speed;
+    }
+
+    void replay_channel::set_speed(double speed) {
+        _speed = speed;
+    }
+
+    replay_channel::replay_stats const &replay_channel::stats() const {
+        return _stats;
+    }
+
+    bool replay_channel::exhausted() const {
+        return _next >= _recording.events.size();
+    }
+
+    channel::receive_mode replay_channel::raw_receive_mode() const {
+        return _recording.buffered ? receive_mode::buffered : receive_mode::stream;
+    }
+}// namespace pn532
+
+#endif//PN532_RECORDING_HPP
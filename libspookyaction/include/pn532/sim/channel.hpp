@@ -0,0 +1,151 @@
+#ifndef PN532_SIM_CHANNEL_HPP
+#define PN532_SIM_CHANNEL_HPP
+
+#include <chrono>
+#include <pn532/channel.hpp>
+#include <pn532/sim/firmware.hpp>
+#include <vector>
+
+namespace pn532::sim {
+
+    /**
+     * @brief Channel connected to a simulated PN532, that does not require any hardware.
+     *
+     * The PN532 side of the framing protocol is implemented here: every info frame is acknowledged, a NACK causes
+     * the last response to be sent again, and an ACK aborts any pending response. The content of the responses is
+     * produced by a @ref firmware.
+     *
+     * Time is simulated: every transfer advances a virtual clock by the time the bytes take on the link, and a
+     * response becomes available only after the processing delay. This makes latency measurements deterministic and
+     * independent of the host; optionally, the channel can also really wait (see @ref link_config::real_time).
+     */
+    class sim_channel final : public channel {
+    public:
+        using duration = std::chrono::nanoseconds;
+
+        /**
+         * @brief Characteristics of the simulated link between host and PN532.
+         */
+        struct link_config {
+            /**
+             * If true, the channel behaves like I2C and SPI (@ref receive_mode::buffered), otherwise like HSU
+             * (@ref receive_mode::stream).
+             */
+            bool buffered = false;
+
+            /**
+             * Time it takes to transfer one byte. The default is HSU at 115200 baud (10 bits per byte).
+             */
+            duration byte_time = std::chrono::microseconds{87};
+
+            /**
+             * Time between the end of a command frame and the moment in which the ACK frame is available.
+             */
+            duration ack_delay = std::chrono::microseconds{100};
+
+            /**
+             * Time between the end of a command frame and the moment in which the response is available, on top of
+             * @ref firmware::processing_time.
+             */
+            duration processing_delay = std::chrono::microseconds{500};
+
+            /**
+             * If true, the channel actually sleeps for the simulated time, instead of only accounting for it.
+             */
+            bool real_time = false;
+        };
+
+        /**
+         * @brief Counters of the simulated traffic.
+         */
+        struct link_stats {
+            std::size_t bytes_sent = 0;
+            std::size_t bytes_received = 0;
+            std::size_t commands_received = 0;///< Info frames received by the PN532
+            std::size_t nacks_received = 0;   ///< Retransmissions requested to the PN532
+            std::size_t aborts = 0;           ///< Responses discarded because the host sent an ACK before reading them
+        };
+
+        /**
+         * @brief Simulated link with the default @ref link_config.
+         * @param fw Firmware producing the responses. The caller must keep it alive for the lifetime of this object.
+         * @param buffer_pool Pool for frame buffers. If `nullptr`, it uses @ref default_buffer_pool.
+         */
+        explicit sim_channel(firmware &fw, mlab::shared_buffer_pool buffer_pool = nullptr);
+
+        /**
+         * @param fw Firmware producing the responses. The caller must keep it alive for the lifetime of this object.
+         * @param config Characteristics of the simulated link.
+         * @param buffer_pool Pool for frame buffers. If `nullptr`, it uses @ref default_buffer_pool.
+         */
+        sim_channel(firmware &fw, link_config config, mlab::shared_buffer_pool buffer_pool = nullptr);
+
+        bool wake() override;
+
+        [[nodiscard]] inline link_config const &config() const;
+        inline void set_config(link_config config);
+
+        /**
+         * @brief Total simulated time elapsed on the link since construction.
+         */
+        [[nodiscard]] inline duration elapsed() const;
+
+        [[nodiscard]] inline link_stats const &stats() const;
+
+    protected:
+        result<> raw_send(mlab::range<bin_data::const_iterator> buffer, ms timeout) override;
+        result<> raw_receive(mlab::range<bin_data::iterator> buffer, ms timeout) override;
+
+        [[nodiscard]] inline receive_mode raw_receive_mode() const override;
+
+    private:
+        /**
+         * A frame sent by the PN532, available to be read from @ref ready_at on.
+         */
+        struct pending_frame {
+            bin_data data;
+            duration ready_at;
+            std::size_t offset = 0;///< Bytes already read, in @ref receive_mode::stream.
+        };
+
+        void advance(duration d);
+
+        /**
+         * Waits until the first pending frame is ready, if that happens within @p timeout.
+         */
+        [[nodiscard]] bool wait_first_pending(duration timeout);
+
+        void process_frame(any_frame const &f);
+
+        firmware *_firmware;
+        link_config _config;
+        duration _now;
+        std::vector<pending_frame> _pending;
+        bin_data _last_response;
+        link_stats _stats;
+    };
+}// namespace pn532::sim
+
+namespace pn532::sim {
+    sim_channel::link_config const &sim_channel::config() const {
+        return _config;
+    }
+
+    void sim_channel::set_config(link_config config) {
+        _config = config;
+    }
+
+    sim_channel::duration sim_channel::elapsed() const {
+        return _now;
+    }
+
+    sim_channel::link_stats const &sim_channel::stats() const {
+        return _stats;
+    }
+
+    channel::receive_mode sim_channel::raw_receive_mode() const {
+        return _config.buffered ? receive_mode::buffered : receive_mode::stream;
+    }
+}// namespace pn532::sim
+
+#endif//PN532_SIM_CHANNEL_HPP
@@ -0,0 +1,130 @@
+#ifndef PN532_SIM_FIRMWARE_HPP
+#define PN532_SIM_FIRMWARE_HPP
+
+#include <array>
+#include <chrono>
+#include <functional>
+#include <mlab/bin_data.hpp>
+#include <pn532/bits.hpp>
+#include <utility>
+#include <vector>
+
+namespace pn532::sim {
+    namespace {
+        using mlab::bin_data;
+    }
+
+    /**
+     * @brief Firmware of a simulated PN532, i.e. what answers to the commands sent over a @ref sim_channel.
+     *
+     * Subclass this to script the exact response to each command, or use @ref emulated_firmware.
+     */
+    class firmware {
+    public:
+        /**
+         * @brief Processes a command received by the simulated PN532.
+         * @param cmd Command code
+         * @param data Command data, excluding transport and command code.
+         * @param response Empty buffer to fill with the response data, excluding transport and command code.
+         * @return True if @p response has to be sent back, false to answer with an application-level error frame.
+         */
+        virtual bool process(bits::command cmd, mlab::range<bin_data::const_iterator> data, bin_data &response) = 0;
+
+        /**
+         * @brief Time the PN532 needs to process @p cmd, on top of the fixed processing delay of the channel.
+         * Use this e.g. to simulate the RF exchange with a target.
+         */
+        [[nodiscard]] virtual std::chrono::microseconds processing_time(bits::command cmd) const;
+
+        virtual ~firmware() = default;
+    };
+
+    /**
+     * @brief Emulates the subset of PN532 commands used by @ref controller to talk to a single ISO/IEC 14443-4 type A
+     * target, such as a DESFire card.
+     *
+     * All configuration commands succeed without effect, registers are stored in memory, and the data of
+     * @ref bits::command::in_data_exchange is forwarded to @ref target::exchange.
+     */
+    class emulated_firmware final : public firmware {
+    public:
+        /**
+         * @brief Function that delivers data to the target and returns its answer, and whether the exchange succeeded.
+         */
+        using exchange_fn = std::function<std::pair<bin_data, bool>(bin_data const &)>;
+
+        /**
+         * @brief A 106 kbps type A target in the field.
+         */
+        struct target {
+            std::array<std::uint8_t, 2> sens_res = {0x03, 0x44};
+            std::uint8_t sel_res = 0x20;
+            std::vector<std::uint8_t> nfcid = {0x04, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06};
+            std::vector<std::uint8_t> ats = {0x75, 0x77, 0x81, 0x02, 0x80};
+            exchange_fn exchange = nullptr;
+
+            /**
+             * Time it takes for each RF exchange with the target.
+             */
+            std::chrono::microseconds rf_latency = std::chrono::microseconds{0};
+
+            /**
+             * Time it takes to transfer one byte over RF at 106 kbps, on top of @ref rf_latency. It is halved at
+             * 212 kbps and divided by four at 424 kbps.
+             */
+            std::chrono::nanoseconds rf_byte_time = std::chrono::nanoseconds{0};
+
+            /**
+             * Highest bit rate at which exchanges succeed. Above this, every exchange times out, as it would in a noisy
+             * field. The bit rates that @ref bits::command::in_psl accepts are instead those advertised in @ref ats.
+             */
+            bits::baudrate max_stable_bit_rate = bits::baudrate::kbps424;
+        };
+
+        emulated_firmware() = default;
+
+        /**
+         * @brief Places @p t in the field. It can then be listed and exchanged data with.
+         */
+        void set_target(target t);
+
+        /**
+         * @brief Removes the target from the field.
+         */
+        void remove_target();
+
+        [[nodiscard]] inline bool has_target() const;
+
+        bool process(bits::command cmd, mlab::range<bin_data::const_iterator> data, bin_data &response) override;
+
+        [[nodiscard]] std::chrono::microseconds processing_time(bits::command cmd) const override;
+
+    private:
+        [[nodiscard]] std::uint8_t read_register(std::uint16_t addr) const;
+        void write_register(std::uint16_t addr, std::uint8_t value);
+
+        bool in_list_passive_target(mlab::range<bin_data::const_iterator> data, bin_data &response);
+        bool in_data_exchange(mlab::range<bin_data::const_iterator> data, bin_data &response);
+        bool in_psl(mlab::range<bin_data::const_iterator> data, bin_data &response);
+
+        [[nodiscard]] std::chrono::nanoseconds rf_transfer_time(std::size_t bytes, bits::baudrate rate) const;
+
+        target _target{};
+        bool _has_target = false;
+        bool _target_listed = false;
+        bool _rf_field = false;
+        bin_data _chained_data{};
+        bits::baudrate _in_to_trg = bits::baudrate::kbps106;
+        bits::baudrate _trg_to_in = bits::baudrate::kbps106;
+        std::chrono::nanoseconds _last_rf_time{0};
+        std::vector<std::pair<std::uint16_t, std::uint8_t>> _registers{};
+    };
+}// namespace pn532::sim
+
+namespace pn532::sim {
+    bool emulated_firmware::has_target() const {
+        return _has_target;
+    }
+}// namespace pn532::sim
+
+#endif//PN532_SIM_FIRMWARE_HPP
@@ -0,0 +1,141 @@
+#include <algorithm>
+#include <desfire/cipher_cache.hpp>
+#include <desfire/log.h>
+
+namespace desfire {
+
+    bool cipher_cache::entry::matches(cipher_type type_, range<std::uint8_t const *> key_) const {
+        return type == type_ and key_length == key_.size() and std::equal(std::begin(key_), std::end(key_), std::begin(key));
+    }
+
+    range<std::uint8_t const *> cipher_cache::entry::key_view() const {
+        return {key.data(), key.data() + key_length};
+    }
+
+    void cipher_cache::entry::assign(cipher_type type_, range<std::uint8_t const *> key_) {
+        wipe();
+        type = type_;
+        key_length = std::min(key_.size(), max_key_length);
+        std::copy_n(std::begin(key_), key_length, std::begin(key));
+    }
+
+    void cipher_cache::entry::wipe() {
+        std::fill(std::begin(key), std::end(key), 0x00);
+        key_length = 0;
+        type = cipher_type::none;
+    }
+
+    cipher_cache::cipher_cache(std::size_t capacity)
+        : _entries{},
+          _capacity{capacity},
+          _last_use{0},
+          _stats{} {
+        _entries.reserve(_capacity);
+    }
+
+    cipher_cache::~cipher_cache() {
+        for (entry &e : _entries) {
+            e.wipe();
+        }
+    }
+
+    std::vector<cipher_cache::entry>::iterator cipher_cache::least_recently_used_idle(cipher_type type) {
+        // cipher_type::none stands for any type
+        auto lru = std::end(_entries);
+        for (auto it = std::begin(_entries); it != std::end(_entries); ++it) {
+            if (it->idle == nullptr or (type != cipher_type::none and it->type != type)) {
+                continue;
+            }
+            if (lru == std::end(_entries) or it->last_use < lru->last_use) {
+                lru = it;
+            }
+        }
+        return lru;
+    }
+
+    std::unique_ptr<cipher> cipher_cache::take(cipher_type type, range<std::uint8_t const *> key) {
+        if (key.size() > max_key_length) {
+            DESFIRE_LOGE("Cipher cache: key of %d bytes is too long, max %d.", key.size(), max_key_length);
+            ++_stats.misses;
+            return nullptr;
+        }
+        for (entry &e : _entries) {
+            if (e.idle != nullptr and e.matches(type, key)) {
+                ++_stats.hits;
+                e.lent = e.idle.get();
+                e.last_use = ++_last_use;
+                return std::move(e.idle);
+            }
+        }
+        // Keep the other keys warm as long as there is space for a new cipher
+        if (_entries.size() < _capacity) {
+            ++_stats.misses;
+            return nullptr;
+        }
+        if (const auto it = least_recently_used_idle(type); it != std::end(_entries)) {
+            ++_stats.recycled;
+            it->assign(type, key);
+            it->idle->reset_with_key(it->key_view());
+            it->lent = it->idle.get();
+            it->last_use = ++_last_use;
+            return std::move(it->idle);
+        }
+        ++_stats.misses;
+        return nullptr;
+    }
+
+    void cipher_cache::track(cipher_type type, range<std::uint8_t const *> key, cipher const &c) {
+        if (key.size() > max_key_length) {
+            return;
+        }
+        // A stale entry for the same address means that a lent cipher was destroyed instead of being given back
+        for (entry &e : _entries) {
+            if (e.lent == &c) {
+                e.lent = nullptr;
+                e.wipe();
+            }
+        }
+        auto it = std::find_if(std::begin(_entries), std::end(_entries), [](entry const &e) {
+            return e.idle == nullptr and e.lent == nullptr;
+        });
+        if (it == std::end(_entries)) {
+            if (_entries.size() < _capacity) {
+                it = _entries.emplace(std::end(_entries));
+            } else if (it = least_recently_used_idle(cipher_type::none); it != std::end(_entries)) {
+                it->idle = nullptr;
+            } else {
+                DESFIRE_LOGD("Cipher cache: all %d ciphers are in use, not tracking a new one.", _capacity);
+                return;
+            }
+        }
+        it->assign(type, key);
+        it->lent = &c;
+        it->last_use = ++_last_use;
+    }
+
+    void cipher_cache::give_back(std::unique_ptr<cipher> c) {
+        if (c == nullptr) {
+            return;
+        }
+        for (entry &e : _entries) {
+            if (e.lent == c.get()) {
+                // Set up the key schedule now, so that it is ready when the key is needed again
+                c->reset_with_key(e.key_view());
+                e.lent = nullptr;
+                e.idle = std::move(c);
+                return;
+            }
+        }
+    }
+
+    void cipher_cache::clear() {
+        const auto is_not_lent = [](entry const &e) { return e.lent == nullptr; };
+        for (entry &e : _entries) {
+            if (is_not_lent(e)) {
+                e.wipe();
+            }
+        }
+        _entries.erase(std::remove_if(std::begin(_entries), std::end(_entries), is_not_lent), std::end(_entries));
+    }
+
+}// namespace desfire
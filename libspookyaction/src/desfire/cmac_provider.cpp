@@ -44,9 +44,9 @@ namespace desfire {
         prepare_subkey(rg_key_pad, last_byte_xor());
 
         ESP_LOGD(DESFIRE_TAG " KEY", "CMAC key for unpadded data:");
-        ESP_LOG_BUFFER_HEX_LEVEL(DESFIRE_TAG " KEY", _subkey_nopad.get(), block_size(), ESP_LOG_DEBUG);
+        DESFIRE_LOG_BUFFER_HEX_LEVEL(DESFIRE_TAG " KEY", _subkey_nopad.get(), block_size(), ESP_LOG_DEBUG);
         ESP_LOGD(DESFIRE_TAG " KEY", "CMAC key for padded data:");
-        ESP_LOG_BUFFER_HEX_LEVEL(DESFIRE_TAG " KEY", _subkey_pad.get(), block_size(), ESP_LOG_DEBUG);
+        DESFIRE_LOG_BUFFER_HEX_LEVEL(DESFIRE_TAG " KEY", _subkey_pad.get(), block_size(), ESP_LOG_DEBUG);
     }
 
 
@@ -74,30 +74,80 @@ namespace desfire {
         }
     }
 
-    cmac_provider::cmac_provider(std::size_t block_size, std::uint8_t last_byte_xor, mlab::shared_buffer_pool buffer_pool)
-        : _keychain{block_size, last_byte_xor}, _buffer_pool{buffer_pool ? std::move(buffer_pool) : mlab::default_buffer_pool()} {
+    cmac_provider::cmac_provider(std::size_t block_size, std::uint8_t last_byte_xor)
+        : _keychain{block_size, last_byte_xor} {
     }
 
     cmac_provider::mac_t cmac_provider::compute_cmac(crypto &crypto, range<std::uint8_t *> iv, range<std::uint8_t const *> data) {
-        mac_t retval{0, 0, 0, 0, 0, 0, 0, 0};
+        auto stream = begin(crypto, iv);
+        stream.update(data);
+        return stream.finish();
+    }
 
-        if (iv.size() < keychain().block_size()) {
-            DESFIRE_LOGE("CMAC: got %d bytes for IV, need at least %d for CMAC.", iv.size(), keychain().block_size());
-            return retval;
-        }
+    cmac_stream cmac_provider::begin(crypto &crypto, range<std::uint8_t *> iv) const {
+        return cmac_stream{keychain(), crypto, iv};
+    }
 
-        auto buffer = _buffer_pool->take();
+    cmac_stream::cmac_stream(cmac_keychain const &keychain, crypto &crypto, range<std::uint8_t *> iv)
+        : _keychain{&keychain}, _crypto{&crypto}, _iv{iv}, _buffer{}, _buffered{0}, _valid{true} {
+        if (iv.size() < keychain.block_size()) {
+            DESFIRE_LOGE("CMAC: got %d bytes for IV, need at least %d for CMAC.", iv.size(), keychain.block_size());
+            _valid = false;
+        } else if (keychain.block_size() > max_block_size or _buffer.size() % keychain.block_size() != 0) {
+            DESFIRE_LOGE("CMAC: unsupported block size %d.", keychain.block_size());
+            _valid = false;
+        }
+    }
 
-        // Resize the buffer and copy data
-        buffer->reserve(padded_length(data.size(), keychain().block_size()));
-        buffer->resize(data.size());
+    void cmac_stream::flush() {
+        const std::size_t block_size = _keychain->block_size();
+        if (_buffered <= block_size) {
+            return;
+        }
+        const std::size_t n_process = padded_length(_buffered, block_size) - block_size;
+        _crypto->do_crypto(range<std::uint8_t *>{_buffer.data(), _buffer.data() + n_process}, _iv, crypto_operation::mac);
+        std::copy(std::begin(_buffer) + n_process, std::begin(_buffer) + _buffered, std::begin(_buffer));
+        _buffered -= n_process;
+    }
 
-        std::copy(std::begin(data), std::end(data), std::begin(*buffer));
-        keychain().prepare_cmac_data(*buffer);
+    void cmac_stream::update(range<std::uint8_t const *> data) {
+        if (not _valid) {
+            return;
+        }
+        for (auto it = std::begin(data); it != std::end(data);) {
+            // Only flush when more data is incoming, so that the last block stays in the buffer
+            if (_buffered == _buffer.size()) {
+                flush();
+            }
+            const auto n = std::min(std::size_t(std::distance(it, std::end(data))), _buffer.size() - _buffered);
+            std::copy_n(it, n, std::begin(_buffer) + _buffered);
+            _buffered += n;
+            it += n;
+        }
+    }
 
+    cmac_stream::mac_t cmac_stream::finish() {
+        mac_t retval{0, 0, 0, 0, 0, 0, 0, 0};
+        if (not _valid) {
+            return retval;
+        }
+        if (_buffered > 0) {
+            const std::size_t block_size = _keychain->block_size();
+            const std::size_t padded_size = padded_length(_buffered, block_size);
+            const std::uint8_t *subkey = std::begin(_keychain->key_nopad());
+            if (padded_size != _buffered) {
+                // Padding needs to begin with 0x80
+                _buffer[_buffered] = 0x80;
+                std::fill(std::begin(_buffer) + _buffered + 1, std::begin(_buffer) + padded_size, 0x00);
+                subkey = std::begin(_keychain->key_pad());
+            }
+            const auto last_block = std::begin(_buffer) + (padded_size - block_size);
+            std::transform(last_block, last_block + block_size, subkey, last_block,
+                           [](std::uint8_t l, std::uint8_t r) -> std::uint8_t { return l ^ r; });
+            _crypto->do_crypto(range<std::uint8_t *>{_buffer.data(), _buffer.data() + padded_size}, _iv, crypto_operation::mac);
+        }
         // Return the first 8 bytes of the last block
-        crypto.do_crypto(buffer->data_view(), iv, crypto_operation::mac);
-        std::copy(std::begin(iv), std::begin(iv) + retval.size(), std::begin(retval));
+        std::copy(std::begin(_iv), std::begin(_iv) + retval.size(), std::begin(retval));
         return retval;
     }
 }// namespace desfire
\ No newline at end of file
@@ -26,7 +26,7 @@ namespace desfire {
         set_key_version(new_key, 0x00);
 
         ESP_LOGD(DESFIRE_TAG " KEY", "Session key %s:", to_string(cipher_type::des));
-        ESP_LOG_BUFFER_HEX_LEVEL(DESFIRE_TAG " KEY", new_key.data(), new_key.size(), ESP_LOG_DEBUG);
+        DESFIRE_LOG_BUFFER_HEX_LEVEL(DESFIRE_TAG " KEY", new_key.data(), new_key.size(), ESP_LOG_DEBUG);
 
         setup_with_key(make_range(new_key));
     }
@@ -76,7 +76,7 @@ namespace desfire {
         set_key_version(new_key, 0);
 
         ESP_LOGD(DESFIRE_TAG " KEY", "Session key %s:", to_string(cipher_type::des3_2k));
-        ESP_LOG_BUFFER_HEX_LEVEL(DESFIRE_TAG " KEY", new_key.data(), new_key.size(), ESP_LOG_DEBUG);
+        DESFIRE_LOG_BUFFER_HEX_LEVEL(DESFIRE_TAG " KEY", new_key.data(), new_key.size(), ESP_LOG_DEBUG);
 
         setup_with_key(make_range(new_key));
     }
@@ -100,7 +100,7 @@ namespace desfire {
         set_key_version(new_key, 0);
 
         ESP_LOGD(DESFIRE_TAG " KEY", "Session key %s:", to_string(cipher_type::des3_3k));
-        ESP_LOG_BUFFER_HEX_LEVEL(DESFIRE_TAG " KEY", new_key.data(), new_key.size(), ESP_LOG_DEBUG);
+        DESFIRE_LOG_BUFFER_HEX_LEVEL(DESFIRE_TAG " KEY", new_key.data(), new_key.size(), ESP_LOG_DEBUG);
 
         setup_with_key(make_range(new_key));
     }
@@ -126,23 +126,19 @@ namespace desfire {
         std::copy_n(bsrc + 28, 4, btrg + 12);
 
         ESP_LOGD(DESFIRE_TAG " KEY", "Session key %s:", to_string(cipher_type::aes128));
-        ESP_LOG_BUFFER_HEX_LEVEL(DESFIRE_TAG " KEY", new_key.data(), new_key.size(), ESP_LOG_DEBUG);
+        DESFIRE_LOG_BUFFER_HEX_LEVEL(DESFIRE_TAG " KEY", new_key.data(), new_key.size(), ESP_LOG_DEBUG);
 
         setup_with_key(make_range(new_key));
     }
 
-    crypto_3k3des_base::crypto_3k3des_base(mlab::shared_buffer_pool buffer_pool)
-        : crypto_with_cmac{8, bits::crypto_cmac_xor_byte_3k3des, std::move(buffer_pool)} {
+    crypto_3k3des_base::crypto_3k3des_base()
+        : crypto_with_cmac{8, bits::crypto_cmac_xor_byte_3k3des} {
     }
 
-    crypto_3k3des_base::crypto_3k3des_base() : crypto_3k3des_base{nullptr} {}
-
-    crypto_aes_base::crypto_aes_base(mlab::shared_buffer_pool buffer_pool)
-        : crypto_with_cmac{16, bits::crypto_cmac_xor_byte_aes, std::move(buffer_pool)} {
+    crypto_aes_base::crypto_aes_base()
+        : crypto_with_cmac{16, bits::crypto_cmac_xor_byte_aes} {
     }
 
-    crypto_aes_base::crypto_aes_base() : crypto_aes_base{nullptr} {}
-
 
     void crypto_with_cmac::setup_with_key(range<const std::uint8_t *> key) {
         setup_primitives_with_key(key);
@@ -153,11 +149,15 @@ namespace desfire {
         return _cmac.keychain().block_size();
     }
 
-    crypto_with_cmac::crypto_with_cmac(std::uint8_t block_size, std::uint8_t last_byte_xor, mlab::shared_buffer_pool buffer_pool)
-        : _cmac{block_size, last_byte_xor, std::move(buffer_pool)} {}
+    crypto_with_cmac::crypto_with_cmac(std::uint8_t block_size, std::uint8_t last_byte_xor)
+        : _cmac{block_size, last_byte_xor} {}
 
     crypto_with_cmac::mac_t crypto_with_cmac::do_cmac(range<std::uint8_t const *> data, range<std::uint8_t *> iv) {
         return _cmac.compute_cmac(*this, iv, data);
     }
 
+    cmac_stream crypto_with_cmac::begin_cmac(range<std::uint8_t *> iv) {
+        return _cmac.begin(*this, iv);
+    }
+
 }// namespace desfire
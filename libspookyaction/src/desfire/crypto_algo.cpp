@@ -3,37 +3,87 @@
 //
 
 #include <desfire/crypto_algo.hpp>
-#include <esp32/rom/crc.h>
-#include <esp_system.h>
+#include <mlab/random.hpp>
 
 namespace desfire {
 
+    namespace {
+        /**
+         * Reflected polynomials of CRC32 (IEEE 802.3) and CRC16 (ISO/IEC 14443-3 type A).
+         */
+        constexpr std::uint32_t crc32_poly = 0xedb88320;
+        constexpr std::uint16_t crc16_poly = 0x8408;
 
-    std::uint16_t compute_crc16(std::uint8_t extra_byte, std::uint16_t init) {
-        /* @note This is correct, we need to negate the init value (0x6363, as per spec), negate the output value
-         * (that is documented in ESP's CRC header), and remember to send LSB first.
+        /**
+         * Tables for slice-by-8: ''table[0]'' is the classic byte-at-a-time table, ''table[k][b]'' is the CRC of
+         * byte ''b'' followed by ''k'' zero bytes.
          */
-        return ~crc16_le(~init, &extra_byte, 1);
+        template <class N>
+        using slice8_tables = std::array<std::array<N, 256>, 8>;
+
+        template <class N, N Poly>
+        constexpr slice8_tables<N> make_slice8_tables() {
+            slice8_tables<N> tables{};
+            for (unsigned b = 0; b < 256; ++b) {
+                N crc = N(b);
+                for (unsigned bit = 0; bit < 8; ++bit) {
+                    crc = (crc & 1) != 0 ? N((crc >> 1) ^ Poly) : N(crc >> 1);
+                }
+                tables[0][b] = crc;
+            }
+            for (std::size_t k = 1; k < tables.size(); ++k) {
+                for (unsigned b = 0; b < 256; ++b) {
+                    const N prev = tables[k - 1][b];
+                    tables[k][b] = N(prev >> 8) ^ tables[0][prev & 0xff];
+                }
+            }
+            return tables;
+        }
+
+        constexpr slice8_tables<std::uint32_t> crc32_tables = make_slice8_tables<std::uint32_t, crc32_poly>();
+        constexpr slice8_tables<std::uint16_t> crc16_tables = make_slice8_tables<std::uint16_t, crc16_poly>();
+
+        /**
+         * Updates the CRC register @p crc with @p n bytes. There is no negation at the beginning nor at the end, this is
+         * exactly what DESFire expects.
+         */
+        template <class N>
+        [[nodiscard]] N crc_slice8(slice8_tables<N> const &tables, std::uint8_t const *p, std::size_t n, N crc) {
+            for (; n >= 8; n -= 8, p += 8) {
+                N next_crc = 0;
+                // The first sizeof(N) bytes are combined with the register, then all 8 bytes are looked up in parallel
+                for (std::size_t i = 0; i < 8; ++i) {
+                    const auto b = std::uint8_t(i < sizeof(N) ? p[i] ^ (crc >> (8 * i)) : p[i]);
+                    next_crc ^= tables[7 - i][b];
+                }
+                crc = next_crc;
+            }
+            for (; n > 0; --n, ++p) {
+                crc = N(crc >> 8) ^ tables[0][(crc ^ *p) & 0xff];
+            }
+            return crc;
+        }
+    }// namespace
+
+    /* @note All these functions use the DESFire convention: the register is initialized with ''init'' (0x6363 or
+     * 0xffffffff as per spec), and the output is not negated; the CRC is then sent LSB first. This is equivalent to
+     * ''~crc_le(~init, ...)'' with the ESP32 ROM functions.
+     */
+
+    std::uint16_t compute_crc16(std::uint8_t extra_byte, std::uint16_t init) {
+        return std::uint16_t(init >> 8) ^ crc16_tables[0][(init ^ extra_byte) & 0xff];
     }
 
     std::uint32_t compute_crc32(std::uint8_t extra_byte, std::uint32_t init) {
-        /* @note This is correct, we need to negate the init value (0xffffffff, as per spec), negate the output value
-         * (that is documented in ESP's CRC header), and remember to send LSB first.
-         */
-        return ~crc32_le(~init, &extra_byte, 1);
+        return (init >> 8) ^ crc32_tables[0][(init ^ extra_byte) & 0xff];
     }
 
     std::uint16_t compute_crc16(mlab::range<std::uint8_t const *> data, std::uint16_t init) {
-        /* @note This is correct, we need to negate the init value (0x6363, as per spec), negate the output value
-         * (that is documented in ESP's CRC header), and remember to send LSB first.
-         */
-        return ~crc16_le(~init, std::begin(data), data.size());
+        return crc_slice8(crc16_tables, std::begin(data), data.size(), init);
     }
+
     std::uint32_t compute_crc32(mlab::range<std::uint8_t const *> data, std::uint32_t init) {
-        /* @note This is correct, we need to negate the init value (0xffffffff, as per spec), negate the output value
-         * (that is documented in ESP's CRC header), and remember to send LSB first.
-         */
-        return ~crc32_le(~init, std::begin(data), data.size());
+        return crc_slice8(crc32_tables, std::begin(data), data.size(), init);
     }
 }// namespace desfire
 
@@ -42,7 +92,7 @@ namespace mlab {
     bin_data &operator<<(bin_data &bd, desfire::randbytes const &rndb) {
         const std::size_t old_size = bd.size();
         bd.resize(bd.size() + rndb.n, 0x00);
-        esp_fill_random(&bd[old_size], rndb.n);
+        fill_random(&bd[old_size], rndb.n);
         return bd;
     }
 
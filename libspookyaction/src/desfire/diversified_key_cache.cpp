@@ -0,0 +1,151 @@
+#include <algorithm>
+#include <desfire/diversified_key_cache.hpp>
+#include <desfire/kdf.hpp>
+#include <desfire/log.h>
+
+namespace desfire {
+
+    namespace {
+        template <cipher_type Type>
+        [[nodiscard]] any_key make_key(std::array<std::uint8_t, 24> const &body, std::uint8_t version) {
+            typename key<Type>::key_t k{};
+            std::copy_n(std::begin(body), k.size(), std::begin(k));
+            any_key retval = key<Type>{0, k, version};
+            std::fill(std::begin(k), std::end(k), 0x00);
+            return retval;
+        }
+
+        template <cipher_type Type>
+        void copy_key_body(any_key const &k, std::array<std::uint8_t, 24> &body) {
+            auto const &src = k.template get<Type>().k;
+            std::copy(std::begin(src), std::end(src), std::begin(body));
+        }
+    }// namespace
+
+    bool diversified_key_cache::entry::matches(std::uint32_t master_key_id_, cipher_type master_key_type_, range<std::uint8_t const *> input_) const {
+        return master_key_type != cipher_type::none and master_key_id == master_key_id_ and
+               master_key_type == master_key_type_ and input_length == input_.size() and
+               std::equal(std::begin(input_), std::end(input_), std::begin(input));
+    }
+
+    void diversified_key_cache::entry::assign(std::uint32_t master_key_id_, cipher_type master_key_type_, range<std::uint8_t const *> input_, any_key const &k) {
+        wipe();
+        master_key_id = master_key_id_;
+        master_key_type = master_key_type_;
+        input_length = std::min(input_.size(), max_input_length);
+        std::copy_n(std::begin(input_), input_length, std::begin(input));
+        type = k.type();
+        key_version = k.version();
+        switch (type) {
+            case cipher_type::des:
+                copy_key_body<cipher_type::des>(k, key);
+                break;
+            case cipher_type::des3_2k:
+                copy_key_body<cipher_type::des3_2k>(k, key);
+                break;
+            case cipher_type::des3_3k:
+                copy_key_body<cipher_type::des3_3k>(k, key);
+                break;
+            case cipher_type::aes128:
+                copy_key_body<cipher_type::aes128>(k, key);
+                break;
+            case cipher_type::none:
+                [[fallthrough]];
+            default:
+                break;
+        }
+    }
+
+    any_key diversified_key_cache::entry::get_key() const {
+        switch (type) {
+            case cipher_type::des:
+                return make_key<cipher_type::des>(key, key_version);
+            case cipher_type::des3_2k:
+                return make_key<cipher_type::des3_2k>(key, key_version);
+            case cipher_type::des3_3k:
+                return make_key<cipher_type::des3_3k>(key, key_version);
+            case cipher_type::aes128:
+                return make_key<cipher_type::aes128>(key, key_version);
+            case cipher_type::none:
+                [[fallthrough]];
+            default:
+                return any_key{};
+        }
+    }
+
+    void diversified_key_cache::entry::wipe() {
+        std::fill(std::begin(key), std::end(key), 0x00);
+        std::fill(std::begin(input), std::end(input), 0x00);
+        input_length = 0;
+        key_version = 0;
+        type = cipher_type::none;
+        master_key_type = cipher_type::none;
+        master_key_id = 0;
+    }
+
+    diversified_key_cache::diversified_key_cache(std::size_t capacity)
+        : _entries{},
+          _capacity{capacity},
+          _last_use{0},
+          _stats{} {
+        _entries.reserve(_capacity);
+    }
+
+    diversified_key_cache::~diversified_key_cache() {
+        clear();
+    }
+
+    any_key diversified_key_cache::get(std::uint32_t master_key_id, any_key const &master_key, cipher_provider &provider,
+                                       range<std::uint8_t const *> diversify_input) {
+        if (diversify_input.size() <= max_input_length) {
+            for (entry &e : _entries) {
+                if (e.matches(master_key_id, master_key.type(), diversify_input)) {
+                    ++_stats.hits;
+                    e.last_use = ++_last_use;
+                    return e.get_key();
+                }
+            }
+        }
+        ++_stats.misses;
+        bin_data input = bin_data::chain(mlab::prealloc(2 * max_input_length), diversify_input);
+        any_key div_key = kdf_an10922(master_key, provider, input);
+        std::fill(std::begin(input), std::end(input), 0x00);
+        if (diversify_input.size() > max_input_length or div_key.type() == cipher_type::none or _capacity == 0) {
+            return div_key;
+        }
+        auto it = std::end(_entries);
+        if (_entries.size() < _capacity) {
+            it = _entries.emplace(std::end(_entries));
+        } else {
+            it = std::min_element(std::begin(_entries), std::end(_entries), [](entry const &l, entry const &r) {
+                return l.last_use < r.last_use;
+            });
+            ++_stats.evictions;
+        }
+        it->assign(master_key_id, master_key.type(), diversify_input, div_key);
+        it->last_use = ++_last_use;
+        return div_key;
+    }
+
+    void diversified_key_cache::erase(std::uint32_t master_key_id) {
+        for (entry &e : _entries) {
+            if (e.master_key_id == master_key_id) {
+                e.wipe();
+            }
+        }
+        const auto first_erased = std::remove_if(std::begin(_entries), std::end(_entries), [](entry const &e) {
+            return e.master_key_type == cipher_type::none;
+        });
+        // The entries left at the end still hold copies of the keys that were moved forward
+        std::for_each(first_erased, std::end(_entries), [](entry &e) { e.wipe(); });
+        _entries.erase(first_erased, std::end(_entries));
+    }
+
+    void diversified_key_cache::clear() {
+        for (entry &e : _entries) {
+            e.wipe();
+        }
+        _entries.clear();
+    }
+
+}// namespace desfire
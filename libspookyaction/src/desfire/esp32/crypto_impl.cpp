@@ -4,6 +4,7 @@
 
 #include <desfire/esp32/crypto_impl.hpp>
 #include <desfire/msg.hpp>
+#include <mlab/trace.hpp>
 
 
 namespace desfire::esp32 {
@@ -23,6 +24,13 @@ namespace desfire::esp32 {
                 return DESFIRE_TAG " BLOB";
             }
         }
+
+        /**
+         * Records the operation in @ref mlab::default_trace, with the cipher in the upper nibble of the argument.
+         */
+        void trace_crypto(cipher_type cipher, crypto_operation op, std::size_t length) {
+            mlab::trace(mlab::trace_event::crypto, std::uint8_t((static_cast<std::uint8_t>(cipher) << 4) | static_cast<std::uint8_t>(op)), length);
+        }
     }// namespace
 
 
@@ -54,8 +62,9 @@ namespace desfire::esp32 {
 
     void crypto_des::do_crypto(range<std::uint8_t *> data, range<std::uint8_t *> iv, crypto_operation op) {
         ESP_LOGD(DESFIRE_TAG " CRYPTO", "DES: %s %u bytes.", desfire::to_string(op), std::distance(std::begin(data), std::end(data)));
-        ESP_LOG_BUFFER_HEX_LEVEL(input_tag(op), data.data(), data.size(), ESP_LOG_DEBUG);
-        ESP_LOG_BUFFER_HEX_LEVEL(DESFIRE_TAG "   IV", iv.data(), iv.size(), ESP_LOG_DEBUG);
+        trace_crypto(cipher_type::des, op, data.size());
+        DESFIRE_LOG_BUFFER_HEX_LEVEL(input_tag(op), data.data(), data.size(), ESP_LOG_DEBUG);
+        DESFIRE_LOG_BUFFER_HEX_LEVEL(DESFIRE_TAG "   IV", iv.data(), iv.size(), ESP_LOG_DEBUG);
         assert(data.size() % 8 == 0);
         switch (op) {
             case crypto_operation::encrypt:
@@ -69,7 +78,7 @@ namespace desfire::esp32 {
                 break;
                 break;
         }
-        ESP_LOG_BUFFER_HEX_LEVEL(output_tag(op), data.data(), data.size(), ESP_LOG_DEBUG);
+        DESFIRE_LOG_BUFFER_HEX_LEVEL(output_tag(op), data.data(), data.size(), ESP_LOG_DEBUG);
     }
 
     void crypto_2k3des::setup_primitives_with_key(range<std::uint8_t const *> key) {
@@ -100,8 +109,9 @@ namespace desfire::esp32 {
 
     void crypto_2k3des::do_crypto(range<std::uint8_t *> data, range<std::uint8_t *> iv, crypto_operation op) {
         ESP_LOGD(DESFIRE_TAG " CRYPTO", "2K3DES: %s %u bytes.", to_string(op), std::distance(std::begin(data), std::end(data)));
-        ESP_LOG_BUFFER_HEX_LEVEL(input_tag(op), data.data(), data.size(), ESP_LOG_DEBUG);
-        ESP_LOG_BUFFER_HEX_LEVEL(DESFIRE_TAG "   IV", iv.data(), iv.size(), ESP_LOG_DEBUG);
+        trace_crypto(cipher_type::des3_2k, op, data.size());
+        DESFIRE_LOG_BUFFER_HEX_LEVEL(input_tag(op), data.data(), data.size(), ESP_LOG_DEBUG);
+        DESFIRE_LOG_BUFFER_HEX_LEVEL(DESFIRE_TAG "   IV", iv.data(), iv.size(), ESP_LOG_DEBUG);
         assert(data.size() % 8 == 0);
         switch (op) {
             case crypto_operation::encrypt:
@@ -115,7 +125,7 @@ namespace desfire::esp32 {
                 break;
                 break;
         }
-        ESP_LOG_BUFFER_HEX_LEVEL(output_tag(op), data.data(), data.size(), ESP_LOG_DEBUG);
+        DESFIRE_LOG_BUFFER_HEX_LEVEL(output_tag(op), data.data(), data.size(), ESP_LOG_DEBUG);
     }
 
     void crypto_3k3des::setup_primitives_with_key(range<std::uint8_t const *> key) {
@@ -127,10 +137,8 @@ namespace desfire::esp32 {
         mbedtls_des3_set3key_dec(&_dec_context, std::begin(key));
     }
 
-    crypto_3k3des::crypto_3k3des() : crypto_3k3des{nullptr} {}
-
-    crypto_3k3des::crypto_3k3des(mlab::shared_buffer_pool buffer_pool)
-        : crypto_3k3des_base(std::move(buffer_pool)), _enc_context{}, _dec_context{} {
+    crypto_3k3des::crypto_3k3des()
+        : crypto_3k3des_base{}, _enc_context{}, _dec_context{} {
         mbedtls_des3_init(&_enc_context);
         mbedtls_des3_init(&_dec_context);
     }
@@ -142,8 +150,9 @@ namespace desfire::esp32 {
 
     void crypto_3k3des::do_crypto(range<std::uint8_t *> data, range<std::uint8_t *> iv, crypto_operation op) {
         ESP_LOGD(DESFIRE_TAG " CRYPTO", "3K3DES: %s %u bytes.", to_string(op), std::distance(std::begin(data), std::end(data)));
-        ESP_LOG_BUFFER_HEX_LEVEL(input_tag(op), data.data(), data.size(), ESP_LOG_DEBUG);
-        ESP_LOG_BUFFER_HEX_LEVEL(DESFIRE_TAG "   IV", iv.data(), iv.size(), ESP_LOG_DEBUG);
+        trace_crypto(cipher_type::des3_3k, op, data.size());
+        DESFIRE_LOG_BUFFER_HEX_LEVEL(input_tag(op), data.data(), data.size(), ESP_LOG_DEBUG);
+        DESFIRE_LOG_BUFFER_HEX_LEVEL(DESFIRE_TAG "   IV", iv.data(), iv.size(), ESP_LOG_DEBUG);
         assert(data.size() % 8 == 0);
         switch (op) {
             case crypto_operation::mac:
@@ -155,7 +164,7 @@ namespace desfire::esp32 {
                 mbedtls_des3_crypt_cbc(&_dec_context, MBEDTLS_DES_DECRYPT, data.size(), iv.data(), data.data(), data.data());
                 break;
         }
-        ESP_LOG_BUFFER_HEX_LEVEL(output_tag(op), data.data(), data.size(), ESP_LOG_DEBUG);
+        DESFIRE_LOG_BUFFER_HEX_LEVEL(output_tag(op), data.data(), data.size(), ESP_LOG_DEBUG);
     }
 
     void crypto_aes::setup_primitives_with_key(range<std::uint8_t const *> key) {
@@ -167,10 +176,8 @@ namespace desfire::esp32 {
         mbedtls_aes_setkey_dec(&_dec_context, std::begin(key), 8 * key.size());
     }
 
-    crypto_aes::crypto_aes() : crypto_aes{nullptr} {}
-
-    crypto_aes::crypto_aes(mlab::shared_buffer_pool buffer_pool)
-        : crypto_aes_base{std::move(buffer_pool)}, _enc_context{}, _dec_context{} {
+    crypto_aes::crypto_aes()
+        : crypto_aes_base{}, _enc_context{}, _dec_context{} {
         mbedtls_aes_init(&_enc_context);
         mbedtls_aes_init(&_dec_context);
     }
@@ -182,8 +189,9 @@ namespace desfire::esp32 {
 
     void crypto_aes::do_crypto(range<std::uint8_t *> data, range<std::uint8_t *> iv, crypto_operation op) {
         ESP_LOGD(DESFIRE_TAG " CRYPTO", "AES128: %s %u bytes.", to_string(op), std::distance(std::begin(data), std::end(data)));
-        ESP_LOG_BUFFER_HEX_LEVEL(input_tag(op), data.data(), data.size(), ESP_LOG_DEBUG);
-        ESP_LOG_BUFFER_HEX_LEVEL(DESFIRE_TAG "   IV", iv.data(), iv.size(), ESP_LOG_DEBUG);
+        trace_crypto(cipher_type::aes128, op, data.size());
+        DESFIRE_LOG_BUFFER_HEX_LEVEL(input_tag(op), data.data(), data.size(), ESP_LOG_DEBUG);
+        DESFIRE_LOG_BUFFER_HEX_LEVEL(DESFIRE_TAG "   IV", iv.data(), iv.size(), ESP_LOG_DEBUG);
         assert(data.size() % 16 == 0);
         switch (op) {
             case crypto_operation::mac:
@@ -195,6 +203,6 @@ namespace desfire::esp32 {
                 mbedtls_aes_crypt_cbc(&_dec_context, MBEDTLS_AES_DECRYPT, data.size(), iv.data(), data.data(), data.data());
                 break;
         }
-        ESP_LOG_BUFFER_HEX_LEVEL(output_tag(op), data.data(), data.size(), ESP_LOG_DEBUG);
+        DESFIRE_LOG_BUFFER_HEX_LEVEL(output_tag(op), data.data(), data.size(), ESP_LOG_DEBUG);
     }
 }// namespace desfire::esp32
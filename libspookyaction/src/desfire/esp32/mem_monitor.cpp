@@ -2,19 +2,24 @@
 // Created by spak on 3/14/21.
 //
 
+#ifdef ESP_PLATFORM
+
 #include <desfire/esp32/mem_monitor.hpp>
 #include <esp_log.h>
 
 namespace desfire::esp32 {
 
-    mem_monitor::mem_monitor() {
+    mem_monitor::mem_monitor(bool record_all_allocations) : _record_all_allocations{record_all_allocations} {
         ESP_LOGI("MEM", "Begin heap monitoring");
         ESP_ERROR_CHECK(heap_trace_init_standalone(trace::records, trace::num_records));
-        ESP_ERROR_CHECK(heap_trace_start(HEAP_TRACE_LEAKS));
+        ESP_ERROR_CHECK(heap_trace_start(_record_all_allocations ? HEAP_TRACE_ALL : HEAP_TRACE_LEAKS));
     }
 
     mem_monitor::~mem_monitor() {
         ESP_ERROR_CHECK(heap_trace_stop());
+        if (_record_all_allocations) {
+            ESP_LOGI("MEM", "Heap allocations: %d", count_allocations());
+        }
         if (const auto leaked = count_leaked_memory(); leaked > 0) {
             ESP_LOGW("MEM", "End heap monitoring, leak: %d", leaked);
             heap_trace_dump();
@@ -29,8 +34,25 @@ namespace desfire::esp32 {
         for (std::size_t i = 0; i < heap_trace_get_count(); ++i) {
             heap_trace_record_t record{};
             heap_trace_get(i, &record);
-            leaked += record.size;
+            // When recording all allocations, the freed ones are kept too
+            if (not _record_all_allocations or record.freed_by[0] == nullptr) {
+                leaked += record.size;
+            }
         }
         return leaked;
     }
-}// namespace desfire::esp32
\ No newline at end of file
+
+    std::size_t mem_monitor::count_allocations() const {
+        return heap_trace_get_count();
+    }
+
+    void mem_monitor::pause() {
+        ESP_ERROR_CHECK(heap_trace_stop());
+    }
+
+    void mem_monitor::resume() {
+        ESP_ERROR_CHECK(heap_trace_resume());
+    }
+}// namespace desfire::esp32
+
+#endif
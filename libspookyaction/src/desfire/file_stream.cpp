@@ -0,0 +1,169 @@
+#include <desfire/file_stream.hpp>
+#include <desfire/log.h>
+
+namespace desfire {
+
+    namespace {
+        constexpr std::uint32_t max_window_size = 0xffffff;
+
+        [[nodiscard]] std::uint32_t clamp_window_size(std::uint32_t window_size) {
+            return std::clamp(window_size, std::uint32_t{1}, max_window_size);
+        }
+
+        [[nodiscard]] bool check_offset_length(const char *op, std::uint32_t offset, std::uint32_t length) {
+            if ((offset & 0xffffff) != offset) {
+                DESFIRE_LOGW("%s: offset can be at most 24 bits, %d is an invalid value.", op, offset);
+                return false;
+            }
+            if ((length & 0xffffff) != length or ((offset + length) & 0xffffff) != offset + length) {
+                DESFIRE_LOGW("%s: offset + length can be at most 24 bits, %d + %d is an invalid value.", op, offset, length);
+                return false;
+            }
+            return true;
+        }
+    }// namespace
+
+    file_reader::file_reader(tag &mifare, file_id fid, std::uint32_t window_size)
+        : _mifare{&mifare},
+          _fid{fid},
+          _security{std::nullopt},
+          _window_size{clamp_window_size(window_size)},
+          _position{0},
+          _end{0} {}
+
+    file_reader::file_reader(tag &mifare, file_id fid, file_security security, std::uint32_t window_size)
+        : _mifare{&mifare},
+          _fid{fid},
+          _security{security},
+          _window_size{clamp_window_size(window_size)},
+          _position{0},
+          _end{0} {}
+
+    tag::result<> file_reader::read(std::uint32_t offset, std::uint32_t length, sink_fn const &sink) {
+        if (length == 0) {
+            // Up to the end of the file, which we need to know to split in windows
+            const auto res_settings = _mifare->get_file_settings(_fid);
+            if (not res_settings) {
+                return res_settings.error();
+            }
+            if (res_settings->type() != file_type::standard and res_settings->type() != file_type::backup) {
+                DESFIRE_LOGW("file_reader: file %d is a %s file, not a data file.", _fid, to_string(res_settings->type()));
+                return error::parameter_error;
+            }
+            const std::uint32_t file_size = res_settings->data_settings().size;
+            length = file_size - std::min(offset, file_size);
+        }
+        if (not check_offset_length("file_reader", offset, length)) {
+            return error::parameter_error;
+        }
+        _position = offset;
+        _end = offset + length;
+        return resume(sink);
+    }
+
+    tag::result<> file_reader::resume(sink_fn const &sink) {
+        while (not done()) {
+            const std::uint32_t window = std::min(remaining(), _window_size);
+            const auto res_data = _security ? _mifare->read_data(_fid, _position, window, *_security)
+                                            : _mifare->read_data(_fid, _position, window);
+            if (not res_data) {
+                DESFIRE_LOGW("file_reader: window at offset %d failed, %d bytes left to read.", _position, remaining());
+                return res_data.error();
+            }
+            bin_data const &data = **res_data;
+            if (data.size() != window) {
+                DESFIRE_LOGW("file_reader: expected %d bytes at offset %d, got %d.", window, _position, data.size());
+                return error::malformed;
+            }
+            const std::uint32_t window_offset = _position;
+            _position += window;
+            if (not sink(window_offset, data.data_view())) {
+                DESFIRE_LOGD("file_reader: stopped by the sink at offset %d.", _position);
+                break;
+            }
+        }
+        return mlab::result_success;
+    }
+
+    file_writer::file_writer(tag &mifare, file_id fid, std::uint32_t window_size)
+        : _mifare{&mifare},
+          _fid{fid},
+          _security{std::nullopt},
+          _window_size{clamp_window_size(window_size)},
+          _begin{0},
+          _position{0},
+          _end{0},
+          _commit_each_window{false},
+          _window{} {}
+
+    file_writer::file_writer(tag &mifare, file_id fid, file_security security, std::uint32_t window_size)
+        : _mifare{&mifare},
+          _fid{fid},
+          _security{security},
+          _window_size{clamp_window_size(window_size)},
+          _begin{0},
+          _position{0},
+          _end{0},
+          _commit_each_window{false},
+          _window{} {}
+
+    tag::result<> file_writer::write(std::uint32_t offset, std::uint32_t length, source_fn const &source) {
+        if (not check_offset_length("file_writer", offset, length)) {
+            return error::parameter_error;
+        }
+        _begin = offset;
+        _position = offset;
+        _end = offset + length;
+        return resume(source);
+    }
+
+    tag::result<> file_writer::write(std::uint32_t offset, bin_data const &data) {
+        if (data.size() > max_window_size) {
+            DESFIRE_LOGW("file_writer: data size can be at most 24 bits, %d is an invalid value.", data.size());
+            return error::parameter_error;
+        }
+        return write(offset, std::uint32_t(data.size()), copy_from(data));
+    }
+
+    tag::result<> file_writer::resume(bin_data const &data) {
+        if (data.size() != _end - _begin) {
+            DESFIRE_LOGW("file_writer: cannot resume with %d bytes, %d were passed to write.", data.size(), _end - _begin);
+            return error::parameter_error;
+        }
+        return resume(copy_from(data));
+    }
+
+    file_writer::source_fn file_writer::copy_from(bin_data const &data) const {
+        return [&data, begin = _begin](std::uint32_t offset, mlab::range<std::uint8_t *> window) -> bool {
+            std::copy_n(std::begin(data) + (offset - begin), window.size(), std::begin(window));
+            return true;
+        };
+    }
+
+    tag::result<> file_writer::resume(source_fn const &source) {
+        while (not done()) {
+            const std::uint32_t window = std::min(remaining(), _window_size);
+            // Reuse the same buffer for all windows
+            _window.resize(window);
+            if (not source(_position, _window.data_view())) {
+                DESFIRE_LOGD("file_writer: stopped by the source at offset %d.", _position);
+                break;
+            }
+            const auto res_write = _security ? _mifare->write_data(_fid, _position, _window, *_security)
+                                             : _mifare->write_data(_fid, _position, _window);
+            if (not res_write) {
+                DESFIRE_LOGW("file_writer: window at offset %d failed, %d bytes left to write.", _position, remaining());
+                return res_write.error();
+            }
+            if (_commit_each_window) {
+                if (const auto res_commit = _mifare->commit_transaction(); not res_commit) {
+                    DESFIRE_LOGW("file_writer: commit at offset %d failed, %d bytes left to write.", _position, remaining());
+                    return res_commit.error();
+                }
+            }
+            _position += window;
+        }
+        return mlab::result_success;
+    }
+
+}// namespace desfire
@@ -0,0 +1,272 @@
+#include <desfire/host/crypto_impl.hpp>
+
+#ifdef DESFIRE_HOST_CRYPTO
+
+#include <algorithm>
+#include <cassert>
+#include <desfire/msg.hpp>
+#include <functional>
+#include <mlab/trace.hpp>
+#include <openssl/crypto.h>
+
+namespace desfire::host {
+
+    namespace {
+        [[nodiscard]] const char *input_tag(crypto_operation op) {
+            if (op == crypto_operation::decrypt) {
+                return DESFIRE_TAG " BLOB";
+            } else {
+                return DESFIRE_TAG " DATA";
+            }
+        }
+        [[nodiscard]] const char *output_tag(crypto_operation op) {
+            if (op == crypto_operation::decrypt) {
+                return DESFIRE_TAG " DATA";
+            } else {
+                return DESFIRE_TAG " BLOB";
+            }
+        }
+
+        /**
+         * Records the operation in @ref mlab::default_trace, with the cipher in the upper nibble of the argument.
+         */
+        void trace_crypto(cipher_type cipher, crypto_operation op, std::size_t length) {
+            mlab::trace(mlab::trace_event::crypto, std::uint8_t((static_cast<std::uint8_t>(cipher) << 4) | static_cast<std::uint8_t>(op)), length);
+        }
+
+        /**
+         * Key schedules for single DES (only @ref k1 set) or for 3DES.
+         */
+        struct des_keys {
+            DES_key_schedule *k1 = nullptr;
+            DES_key_schedule *k2 = nullptr;
+            DES_key_schedule *k3 = nullptr;
+        };
+
+        // The low level DES interface is deprecated since OpenSSL 3, but single DES is otherwise only in the legacy provider.
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wdeprecated-declarations"
+
+        void des_set_key(DES_key_schedule &ks, std::uint8_t const *key) {
+            // The parity bits carry the key version, do not check them. Note that const_DES_cblock is not const.
+            DES_set_key_unchecked(reinterpret_cast<const_DES_cblock *>(const_cast<std::uint8_t *>(key)), &ks);
+        }
+
+        void des_cbc(des_keys const &keys, range<std::uint8_t *> data, range<std::uint8_t *> iv, int enc) {
+            auto *piv = reinterpret_cast<DES_cblock *>(iv.data());
+            if (keys.k2 == nullptr) {
+                DES_ncbc_encrypt(data.data(), data.data(), long(data.size()), keys.k1, piv, enc);
+            } else {
+                DES_ede3_cbc_encrypt(data.data(), data.data(), long(data.size()), keys.k1, keys.k2, keys.k3, piv, enc);
+            }
+        }
+
+        /**
+         * CBC on @p data in place, using the decryption as block primitive, see note on @ref cipher_scheme_legacy.
+         */
+        void des_cbc_with_decryption(des_keys const &keys, range<std::uint8_t *> data, range<std::uint8_t *> iv) {
+            static constexpr std::size_t block_size = 8;
+            for (auto it = std::begin(data); it != std::end(data); it += block_size) {
+                std::transform(it, it + block_size, std::begin(iv), it, std::bit_xor<>{});
+                auto *block = reinterpret_cast<DES_cblock *>(it);
+                if (keys.k2 == nullptr) {
+                    DES_ecb_encrypt(block, block, keys.k1, DES_DECRYPT);
+                } else {
+                    DES_ecb3_encrypt(block, block, keys.k1, keys.k2, keys.k3, DES_DECRYPT);
+                }
+                std::copy_n(it, block_size, std::begin(iv));
+            }
+        }
+
+#pragma GCC diagnostic pop
+
+        void des_legacy_do_crypto(des_keys const &keys, range<std::uint8_t *> data, range<std::uint8_t *> iv, crypto_operation op) {
+            switch (op) {
+                case crypto_operation::encrypt:
+                    des_cbc_with_decryption(keys, data, iv);
+                    break;
+                case crypto_operation::decrypt:
+                    des_cbc(keys, data, iv, DES_DECRYPT);
+                    break;
+                case crypto_operation::mac:
+                    des_cbc(keys, data, iv, DES_ENCRYPT);
+                    break;
+            }
+        }
+    }// namespace
+
+    evp_cbc_context::evp_cbc_context()
+        : _ctx{EVP_CIPHER_CTX_new()}, _iv{}, _block_size{0}, _encrypt{true}, _iv_valid{false} {
+        if (_ctx == nullptr) {
+            DESFIRE_LOGE("OpenSSL: unable to allocate a cipher context.");
+        }
+    }
+
+    evp_cbc_context::~evp_cbc_context() {
+        EVP_CIPHER_CTX_free(_ctx);
+    }
+
+    void evp_cbc_context::setup(EVP_CIPHER const *type, range<std::uint8_t const *> key, bool encrypt) {
+        _encrypt = encrypt;
+        _block_size = std::size_t(EVP_CIPHER_block_size(type));
+        std::fill(std::begin(_iv), std::end(_iv), 0x00);
+        _iv_valid = _ctx != nullptr and
+                    EVP_CipherInit_ex(_ctx, type, nullptr, key.data(), _iv.data(), encrypt ? 1 : 0) == 1 and
+                    EVP_CIPHER_CTX_set_padding(_ctx, 0) == 1;
+        if (not _iv_valid) {
+            DESFIRE_LOGE("OpenSSL: unable to set up the cipher context.");
+        }
+    }
+
+    void evp_cbc_context::crypt(range<std::uint8_t *> data, range<std::uint8_t *> iv) {
+        if (data.empty()) {
+            return;
+        }
+        assert(iv.size() == _block_size);
+        if (not std::equal(std::begin(iv), std::end(iv), std::begin(_iv))) {
+            std::copy(std::begin(iv), std::end(iv), std::begin(_iv));
+            _iv_valid = _ctx != nullptr and EVP_CipherInit_ex(_ctx, nullptr, nullptr, nullptr, _iv.data(), -1) == 1;
+        }
+        // In place decryption overwrites the last ciphertext block, which is the next IV
+        if (not _encrypt) {
+            std::copy(std::end(data) - _block_size, std::end(data), std::begin(_iv));
+        }
+        int out_len = 0;
+        if (not _iv_valid or EVP_CipherUpdate(_ctx, data.data(), &out_len, data.data(), int(data.size())) != 1) {
+            DESFIRE_LOGE("OpenSSL: CBC operation on %d bytes failed.", data.size());
+            // Force setting the IV again on the next call
+            _iv_valid = false;
+            std::fill(std::begin(_iv), std::end(_iv), 0x00);
+            return;
+        }
+        if (_encrypt) {
+            std::copy(std::end(data) - _block_size, std::end(data), std::begin(_iv));
+        }
+        std::copy_n(std::begin(_iv), _block_size, std::begin(iv));
+    }
+
+    void crypto_des::setup_with_key(range<std::uint8_t const *> key) {
+        if (key.size() != 8) {
+            DESFIRE_LOGE("DES: invalid key size %d, expected 8 bytes.", key.size());
+            return;
+        }
+        des_set_key(_key_schedule, std::begin(key));
+    }
+
+    crypto_des::crypto_des() : _key_schedule{} {}
+
+    crypto_des::~crypto_des() {
+        OPENSSL_cleanse(&_key_schedule, sizeof(_key_schedule));
+    }
+
+    void crypto_des::do_crypto(range<std::uint8_t *> data, range<std::uint8_t *> iv, crypto_operation op) {
+        ESP_LOGD(DESFIRE_TAG " CRYPTO", "DES: %s %u bytes.", desfire::to_string(op), std::distance(std::begin(data), std::end(data)));
+        trace_crypto(cipher_type::des, op, data.size());
+        DESFIRE_LOG_BUFFER_HEX_LEVEL(input_tag(op), data.data(), data.size(), ESP_LOG_DEBUG);
+        DESFIRE_LOG_BUFFER_HEX_LEVEL(DESFIRE_TAG "   IV", iv.data(), iv.size(), ESP_LOG_DEBUG);
+        assert(data.size() % 8 == 0);
+        des_legacy_do_crypto({&_key_schedule}, data, iv, op);
+        DESFIRE_LOG_BUFFER_HEX_LEVEL(output_tag(op), data.data(), data.size(), ESP_LOG_DEBUG);
+    }
+
+    void crypto_2k3des::setup_primitives_with_key(range<std::uint8_t const *> key) {
+        if (key.size() != 16) {
+            DESFIRE_LOGE("2K3DES: invalid key size %d, expected 16 bytes.", key.size());
+            return;
+        }
+        des_set_key(_key_schedule_1, std::begin(key));
+        des_set_key(_key_schedule_2, std::begin(key) + 8);
+    }
+
+    crypto_2k3des::crypto_2k3des() : _key_schedule_1{}, _key_schedule_2{} {}
+
+    crypto_2k3des::~crypto_2k3des() {
+        OPENSSL_cleanse(&_key_schedule_1, sizeof(_key_schedule_1));
+        OPENSSL_cleanse(&_key_schedule_2, sizeof(_key_schedule_2));
+    }
+
+    void crypto_2k3des::do_crypto(range<std::uint8_t *> data, range<std::uint8_t *> iv, crypto_operation op) {
+        ESP_LOGD(DESFIRE_TAG " CRYPTO", "2K3DES: %s %u bytes.", to_string(op), std::distance(std::begin(data), std::end(data)));
+        trace_crypto(cipher_type::des3_2k, op, data.size());
+        DESFIRE_LOG_BUFFER_HEX_LEVEL(input_tag(op), data.data(), data.size(), ESP_LOG_DEBUG);
+        DESFIRE_LOG_BUFFER_HEX_LEVEL(DESFIRE_TAG "   IV", iv.data(), iv.size(), ESP_LOG_DEBUG);
+        assert(data.size() % 8 == 0);
+        if (is_degenerate()) {
+            // E(K1) D(K1) E(K1) is just E(K1)
+            des_legacy_do_crypto({&_key_schedule_1}, data, iv, op);
+        } else {
+            des_legacy_do_crypto({&_key_schedule_1, &_key_schedule_2, &_key_schedule_1}, data, iv, op);
+        }
+        DESFIRE_LOG_BUFFER_HEX_LEVEL(output_tag(op), data.data(), data.size(), ESP_LOG_DEBUG);
+    }
+
+    void crypto_3k3des::setup_primitives_with_key(range<std::uint8_t const *> key) {
+        if (key.size() != 24) {
+            DESFIRE_LOGE("3K3DES: invalid key size %d, expected 24 bytes.", key.size());
+            return;
+        }
+        des_set_key(_key_schedule_1, std::begin(key));
+        des_set_key(_key_schedule_2, std::begin(key) + 8);
+        des_set_key(_key_schedule_3, std::begin(key) + 16);
+    }
+
+    crypto_3k3des::crypto_3k3des() : crypto_3k3des_base{}, _key_schedule_1{}, _key_schedule_2{}, _key_schedule_3{} {}
+
+    crypto_3k3des::~crypto_3k3des() {
+        OPENSSL_cleanse(&_key_schedule_1, sizeof(_key_schedule_1));
+        OPENSSL_cleanse(&_key_schedule_2, sizeof(_key_schedule_2));
+        OPENSSL_cleanse(&_key_schedule_3, sizeof(_key_schedule_3));
+    }
+
+    void crypto_3k3des::do_crypto(range<std::uint8_t *> data, range<std::uint8_t *> iv, crypto_operation op) {
+        ESP_LOGD(DESFIRE_TAG " CRYPTO", "3K3DES: %s %u bytes.", to_string(op), std::distance(std::begin(data), std::end(data)));
+        trace_crypto(cipher_type::des3_3k, op, data.size());
+        DESFIRE_LOG_BUFFER_HEX_LEVEL(input_tag(op), data.data(), data.size(), ESP_LOG_DEBUG);
+        DESFIRE_LOG_BUFFER_HEX_LEVEL(DESFIRE_TAG "   IV", iv.data(), iv.size(), ESP_LOG_DEBUG);
+        assert(data.size() % 8 == 0);
+        const des_keys keys{&_key_schedule_1, &_key_schedule_2, &_key_schedule_3};
+        switch (op) {
+            case crypto_operation::mac:
+                [[fallthrough]];
+            case crypto_operation::encrypt:
+                des_cbc(keys, data, iv, DES_ENCRYPT);
+                break;
+            case crypto_operation::decrypt:
+                des_cbc(keys, data, iv, DES_DECRYPT);
+                break;
+        }
+        DESFIRE_LOG_BUFFER_HEX_LEVEL(output_tag(op), data.data(), data.size(), ESP_LOG_DEBUG);
+    }
+
+    void crypto_aes::setup_primitives_with_key(range<std::uint8_t const *> key) {
+        if (key.size() != 16) {
+            DESFIRE_LOGE("AES: invalid key size %d, expected 16 bytes.", key.size());
+            return;
+        }
+        _enc_context.setup(EVP_aes_128_cbc(), key, true);
+        _dec_context.setup(EVP_aes_128_cbc(), key, false);
+    }
+
+    crypto_aes::crypto_aes() : crypto_aes_base{}, _enc_context{}, _dec_context{} {}
+
+    void crypto_aes::do_crypto(range<std::uint8_t *> data, range<std::uint8_t *> iv, crypto_operation op) {
+        ESP_LOGD(DESFIRE_TAG " CRYPTO", "AES128: %s %u bytes.", to_string(op), std::distance(std::begin(data), std::end(data)));
+        trace_crypto(cipher_type::aes128, op, data.size());
+        DESFIRE_LOG_BUFFER_HEX_LEVEL(input_tag(op), data.data(), data.size(), ESP_LOG_DEBUG);
+        DESFIRE_LOG_BUFFER_HEX_LEVEL(DESFIRE_TAG "   IV", iv.data(), iv.size(), ESP_LOG_DEBUG);
+        assert(data.size() % 16 == 0);
+        switch (op) {
+            case crypto_operation::mac:
+                [[fallthrough]];
+            case crypto_operation::encrypt:
+                _enc_context.crypt(data, iv);
+                break;
+            case crypto_operation::decrypt:
+                _dec_context.crypt(data, iv);
+                break;
+        }
+        DESFIRE_LOG_BUFFER_HEX_LEVEL(output_tag(op), data.data(), data.size(), ESP_LOG_DEBUG);
+    }
+}// namespace desfire::host
+
+#endif
@@ -101,6 +101,8 @@ namespace desfire {
                 return "malformed frame";
             case error::crypto_error:
                 return "crypto error";
+            case error::out_of_buffers:
+                return "out of buffers";
             default:
                 return to_string(static_cast<status>(e));
         }
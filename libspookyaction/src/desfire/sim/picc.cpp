@@ -0,0 +1,1453 @@
+#include <algorithm>
+#include <desfire/crypto_algo.hpp>
+#include <desfire/log.h>
+#include <desfire/msg.hpp>
+#include <desfire/sim/picc.hpp>
+#include <thread>
+
+namespace desfire::sim {
+    namespace {
+        using mlab::lsb16;
+        using mlab::lsb24;
+        using mlab::lsb32;
+        using mlab::make_range;
+        using mlab::prealloc;
+
+        constexpr std::size_t max_applications = 28;
+        constexpr std::size_t memory_block_size = 32;
+        constexpr std::size_t legacy_block_size = 8;
+        constexpr std::size_t legacy_mac_size = 4;
+        constexpr std::size_t legacy_crc_size = 2;
+        constexpr std::size_t default_mac_size = 8;
+        constexpr std::size_t default_crc_size = 4;
+        constexpr std::uint8_t app_crypto_mask = 0xc0;
+        constexpr std::uint8_t free_access_key = 0xe;
+
+        /**
+         * Fixed manufacturing data returned by @ref command_code::get_version, excluding UID and storage size.
+         */
+        constexpr std::array<std::uint8_t, 5> emulated_hw_version = {0x04, 0x01, 0x01, 0x01, 0x00};
+        constexpr std::array<std::uint8_t, 5> emulated_sw_version = {0x04, 0x01, 0x01, 0x01, 0x04};
+        constexpr std::uint8_t emulated_comm_protocol = 0x05;
+        constexpr std::array<std::uint8_t, 5> emulated_batch_no = {0xba, 0x7c, 0x00, 0x00, 0x00};
+        constexpr std::uint8_t emulated_production_week = 0x42;
+        constexpr std::uint8_t emulated_production_year = 0x26;
+
+        [[nodiscard]] std::uint32_t read_lsb(bin_data const &data, std::size_t offset, std::size_t length) {
+            std::uint32_t v = 0;
+            for (std::size_t i = 0; i < length; ++i) {
+                v |= std::uint32_t(data[offset + i]) << (8 * i);
+            }
+            return v;
+        }
+
+        [[nodiscard]] bin_data status_only(status s) {
+            bin_data response{};
+            response << s;
+            return response;
+        }
+
+        [[nodiscard]] std::size_t round_to_block(std::size_t n) {
+            return padded_length<memory_block_size>(n);
+        }
+
+        [[nodiscard]] cipher_mode mode_from_security(file_security security) {
+            return static_cast<cipher_mode>(security);
+        }
+
+        [[nodiscard]] command_code auth_command_for(app_crypto crypto) {
+            switch (crypto) {
+                case app_crypto::iso_3k3des:
+                    return command_code::authenticate_iso;
+                case app_crypto::aes_128:
+                    return command_code::authenticate_aes;
+                default:
+                    return command_code::authenticate_legacy;
+            }
+        }
+
+        [[nodiscard]] std::size_t key_body_length(app_crypto crypto) {
+            switch (crypto) {
+                case app_crypto::iso_3k3des:
+                    return 24;
+                case app_crypto::aes_128:
+                    return 17;// Includes the version
+                default:
+                    return 16;
+            }
+        }
+
+        [[nodiscard]] any_key zero_key(app_crypto crypto, std::uint8_t key_no) {
+            switch (crypto) {
+                case app_crypto::iso_3k3des:
+                    return any_key{key<cipher_type::des3_3k>{key_no, key<cipher_type::des3_3k>::key_t{}}};
+                case app_crypto::aes_128:
+                    return any_key{key<cipher_type::aes128>{key_no, key<cipher_type::aes128>::key_t{}}};
+                default:
+                    return any_key{key<cipher_type::des>{key_no, key<cipher_type::des>::key_t{}}};
+            }
+        }
+
+        /**
+         * Builds a key from the body received with @ref command_code::change_key.
+         * Legacy keys whose halves are identical are DES keys.
+         */
+        [[nodiscard]] any_key key_from_body(app_crypto crypto, std::uint8_t key_no, bin_data const &body) {
+            switch (crypto) {
+                case app_crypto::iso_3k3des: {
+                    key<cipher_type::des3_3k>::key_t k{};
+                    std::copy_n(std::begin(body), k.size(), std::begin(k));
+                    return any_key{key<cipher_type::des3_3k>{key_no, k}};
+                }
+                case app_crypto::aes_128: {
+                    key<cipher_type::aes128>::key_t k{};
+                    std::copy_n(std::begin(body), k.size(), std::begin(k));
+                    return any_key{key<cipher_type::aes128>{key_no, k, body[k.size()]}};
+                }
+                default:
+                    if (std::equal(std::begin(body), std::begin(body) + 8, std::begin(body) + 8)) {
+                        key<cipher_type::des>::key_t k{};
+                        std::copy_n(std::begin(body), k.size(), std::begin(k));
+                        return any_key{key<cipher_type::des>{key_no, k}};
+                    } else {
+                        key<cipher_type::des3_2k>::key_t k{};
+                        std::copy_n(std::begin(body), k.size(), std::begin(k));
+                        return any_key{key<cipher_type::des3_2k>{key_no, k}};
+                    }
+            }
+        }
+
+        /**
+         * @name Legacy secure messaging, card side
+         * The card only ever enciphers (in CBC mode, with zero IV); the host compensates by deciphering on send.
+         * In the crypto implementation, plain CBC encipherment is @ref crypto_operation::mac.
+         * @{
+         */
+        void legacy_encrypt(crypto &c, range<std::uint8_t *> data) {
+            std::array<std::uint8_t, legacy_block_size> iv{};
+            c.do_crypto(data, make_range(iv), crypto_operation::mac);
+        }
+
+        /**
+         * Inverse of the host's send mode: P_i = E(C_i) ^ C_{i-1}.
+         */
+        void legacy_decrypt(crypto &c, range<std::uint8_t *> data) {
+            std::array<std::uint8_t, legacy_block_size> prev_block{};
+            for (auto it = std::begin(data); std::distance(it, std::end(data)) >= std::ptrdiff_t(legacy_block_size); it += legacy_block_size) {
+                std::array<std::uint8_t, legacy_block_size> cipher_block{};
+                std::copy_n(it, legacy_block_size, std::begin(cipher_block));
+                std::array<std::uint8_t, legacy_block_size> iv{};
+                c.do_crypto(range<std::uint8_t *>{&*it, &*it + legacy_block_size}, make_range(iv), crypto_operation::mac);
+                for (std::size_t i = 0; i < legacy_block_size; ++i) {
+                    it[i] ^= prev_block[i];
+                }
+                prev_block = cipher_block;
+            }
+        }
+
+        [[nodiscard]] std::array<std::uint8_t, legacy_mac_size> legacy_mac(crypto &c, range<std::uint8_t const *> data) {
+            bin_data buffer{};
+            buffer.resize(padded_length<legacy_block_size>(data.size()), 0x00);
+            std::copy(std::begin(data), std::end(data), std::begin(buffer));
+            std::array<std::uint8_t, legacy_block_size> iv{};
+            c.do_crypto(buffer.data_view(), make_range(iv), crypto_operation::mac);
+            return {iv[0], iv[1], iv[2], iv[3]};
+        }
+        /**
+         * @}
+         */
+
+        [[nodiscard]] std::size_t file_allocation(any_file_settings const &settings) {
+            switch (settings.type()) {
+                case file_type::standard:
+                    return round_to_block(settings.data_settings().size);
+                case file_type::backup:
+                    return 2 * round_to_block(settings.data_settings().size);
+                case file_type::value:
+                    return memory_block_size;
+                case file_type::linear_record:
+                    [[fallthrough]];
+                case file_type::cyclic_record:
+                    return round_to_block(settings.record_settings().record_size * settings.record_settings().max_record_count);
+            }
+            return 0;
+        }
+
+        [[nodiscard]] bool is_data_file(file_type t) {
+            return t == file_type::standard or t == file_type::backup;
+        }
+
+        [[nodiscard]] bool is_record_file(file_type t) {
+            return t == file_type::linear_record or t == file_type::cyclic_record;
+        }
+
+        [[nodiscard]] std::size_t record_capacity(record_file_settings const &rs, file_type t) {
+            // A cyclic file always keeps one record free for the next write
+            return t == file_type::cyclic_record ? rs.max_record_count - 1 : rs.max_record_count;
+        }
+    }// namespace
+
+    emulated_picc::emulated_picc(std::unique_ptr<cipher_provider> provider)
+        : emulated_picc{std::move(provider), card_config{}} {}
+
+    emulated_picc::emulated_picc(std::unique_ptr<cipher_provider> provider, card_config config)
+        : _provider{std::move(provider)},
+          _config{config},
+          _now{0},
+          _stats{},
+          _apps{},
+          _active_app{0},
+          _session{},
+          _challenge{nullptr},
+          _chained_command{},
+          _chained_command_length{0},
+          _chained_response{},
+          _chained_response_offset{0},
+          _config_flags{0} {
+        // The root application holds only the PICC master key
+        _apps.push_back(emulated_app{root_app, app_settings{app_crypto::legacy_des_2k3des, key_rights{}, 1},
+                                     {zero_key(app_crypto::legacy_des_2k3des, 0)}, {}});
+    }
+
+    void emulated_picc::advance(duration d) {
+        _now += d;
+        if (_config.real_time and d > duration{0}) {
+            std::this_thread::sleep_for(d);
+        }
+    }
+
+    void emulated_picc::reset_session() {
+        commit(false);
+        logout();
+        _challenge = nullptr;
+        _chained_command.clear();
+        _chained_command_length = 0;
+        _chained_response.clear();
+        _chained_response_offset = 0;
+        _active_app = 0;
+    }
+
+    bool emulated_picc::authenticated() const {
+        return _session.session_crypto != nullptr;
+    }
+
+    bool emulated_picc::authenticated_with(std::uint8_t key_no) const {
+        return authenticated() and _session.key_no == key_no;
+    }
+
+    cipher_mode emulated_picc::default_rx_mode() const {
+        return authenticated() and not _session.legacy ? cipher_mode::maced : cipher_mode::plain;
+    }
+
+    void emulated_picc::logout() {
+        _session = session{};
+    }
+
+    emulated_picc::emulated_app &emulated_picc::active_app() {
+        return _apps[_active_app];
+    }
+
+    emulated_picc::emulated_app *emulated_picc::find_app(app_id const &aid) {
+        auto it = std::find_if(std::begin(_apps), std::end(_apps), [&](emulated_app const &app) { return app.aid == aid; });
+        return it != std::end(_apps) ? &*it : nullptr;
+    }
+
+    emulated_picc::emulated_file *emulated_picc::find_file(file_id fid) {
+        auto &files = active_app().files;
+        auto it = std::find_if(std::begin(files), std::end(files), [&](emulated_file const &f) { return f.fid == fid; });
+        return it != std::end(files) ? &*it : nullptr;
+    }
+
+    std::size_t emulated_picc::free_memory() const {
+        std::size_t used = 0;
+        for (emulated_app const &app : _apps) {
+            for (emulated_file const &f : app.files) {
+                used += file_allocation(f.settings);
+            }
+        }
+        return _config.memory_size - std::min(used, _config.memory_size);
+    }
+
+    std::size_t emulated_picc::max_frame_length() const {
+        return _config.max_frame_length;
+    }
+
+    std::size_t emulated_picc::buffered_bytes() const {
+        return _chained_command.capacity() + _chained_response.capacity();
+    }
+
+    void emulated_picc::commit(bool keep) {
+        for (emulated_file &f : active_app().files) {
+            if (keep) {
+                switch (f.settings.type()) {
+                    case file_type::backup:
+                        if (f.staged) {
+                            f.data = std::move(f.staged_data);
+                        }
+                        break;
+                    case file_type::value:
+                        if (f.staged) {
+                            f.settings.value_settings().value = f.staged_value;
+                            if (f.staged_debit > 0) {
+                                f.limited_credit_value = f.staged_debit;
+                            }
+                        }
+                        break;
+                    case file_type::linear_record:
+                        [[fallthrough]];
+                    case file_type::cyclic_record: {
+                        auto &rs = f.settings.record_settings();
+                        if (f.staged_clear) {
+                            f.data.clear();
+                            rs.record_count = 0;
+                        }
+                        if (f.staged) {
+                            if (rs.record_count >= record_capacity(rs, f.settings.type())) {
+                                // Only cyclic files get here, drop the oldest record
+                                f.data.erase(std::begin(f.data), std::begin(f.data) + rs.record_size);
+                                --rs.record_count;
+                            }
+                            f.data << f.staged_data;
+                            ++rs.record_count;
+                        }
+                    } break;
+                    default:
+                        break;
+                }
+            }
+            f.staged = false;
+            f.staged_clear = false;
+            f.staged_data.clear();
+            f.staged_debit = 0;
+        }
+    }
+
+    std::pair<status, cipher_mode> emulated_picc::file_access_mode(emulated_file const &f, file_access access) const {
+        auto const &generic = f.settings.generic_settings();
+        const auto nibble = [&](unsigned shift) -> std::uint8_t {
+            return (generic.rights.value >> shift) & bits::max_keys_mask;
+        };
+        std::uint8_t specific = 0;
+        std::uint8_t shared = 0;
+        switch (access) {
+            case file_access::read:
+                specific = nibble(bits::file_access_rights_read_shift);
+                shared = nibble(bits::file_access_rights_read_write_shift);
+                break;
+            case file_access::write:
+                specific = nibble(bits::file_access_rights_write_shift);
+                shared = nibble(bits::file_access_rights_read_write_shift);
+                break;
+            case file_access::change:
+                specific = shared = nibble(bits::file_access_rights_change_shift);
+                break;
+        }
+        // Same rules as access_rights::is_free, seen from the card
+        if (authenticated() and (specific == _session.key_no or shared == _session.key_no)) {
+            return {status::ok, mode_from_security(generic.security)};
+        } else if (specific == free_access_key or shared == free_access_key) {
+            return {status::ok, cipher_mode::plain};
+        }
+        return {status::permission_denied, cipher_mode::plain};
+    }
+
+    crypto_with_cmac &emulated_picc::session_cmac_crypto() {
+        return static_cast<crypto_with_cmac &>(*_session.session_crypto);
+    }
+
+    std::size_t emulated_picc::expected_command_length(bin_data const &header) {
+        if (header.size() < 8) {
+            return header.size();
+        }
+        emulated_file const *f = find_file(header[1]);
+        if (f == nullptr) {
+            return header.size();
+        }
+        const auto [s, mode] = file_access_mode(*f, file_access::write);
+        if (s != status::ok) {
+            return header.size();
+        }
+        const std::size_t length = read_lsb(header, 5, 3);
+        if (not authenticated()) {
+            return 8 + length;
+        }
+        switch (mode) {
+            case cipher_mode::maced:
+                return 8 + length + (_session.legacy ? legacy_mac_size : default_mac_size);
+            case cipher_mode::ciphered:
+                return 8 + (_session.legacy ? padded_length<legacy_block_size>(length + legacy_crc_size)
+                                            : padded_length(length + default_crc_size, session_cmac_crypto().block_size()));
+            default:
+                return 8 + length;
+        }
+    }
+
+    bool emulated_picc::unwrap_command(bin_data &data, cipher_mode mode, std::size_t offset, std::size_t plain_length) {
+        if (not authenticated()) {
+            return true;
+        }
+        bool valid = true;
+        if (_session.legacy) {
+            // The host skips secure messaging entirely when there is no payload
+            if (mode == cipher_mode::plain or offset >= data.size()) {
+                return true;
+            }
+            if (mode == cipher_mode::maced) {
+                if (data.size() < offset + legacy_mac_size) {
+                    valid = false;
+                } else {
+                    const auto mac = legacy_mac(*_session.session_crypto, data.data_view(offset, data.size() - offset - legacy_mac_size));
+                    valid = std::equal(std::begin(mac), std::end(mac), std::end(data) - legacy_mac_size);
+                    data.resize(data.size() - legacy_mac_size);
+                }
+            } else if ((data.size() - offset) % legacy_block_size != 0) {
+                valid = false;
+            } else {
+                legacy_decrypt(*_session.session_crypto, data.data_view(offset));
+                if (mode == cipher_mode::ciphered) {
+                    if (offset + plain_length + legacy_crc_size > data.size()) {
+                        valid = false;
+                    } else {
+                        const std::uint16_t crc = compute_crc16(data.data_view(offset, plain_length));
+                        valid = (crc == read_lsb(data, offset + plain_length, legacy_crc_size));
+                        data.resize(offset + plain_length);
+                    }
+                }
+            }
+        } else {
+            crypto_with_cmac &c = session_cmac_crypto();
+            if (mode == cipher_mode::plain) {
+                // Only keep the IV in sync
+                c.do_cmac(data.data_view(), _session.iv.data_view());
+                return true;
+            } else if (mode == cipher_mode::maced) {
+                if (data.size() < default_mac_size + 1) {
+                    valid = false;
+                } else {
+                    const auto cmac = c.do_cmac(data.data_view(0, data.size() - default_mac_size), _session.iv.data_view());
+                    valid = std::equal(std::begin(cmac), std::end(cmac), std::end(data) - default_mac_size);
+                    data.resize(data.size() - default_mac_size);
+                }
+            } else if (offset >= data.size()) {
+                return true;
+            } else if ((data.size() - offset) % c.block_size() != 0) {
+                valid = false;
+            } else {
+                c.do_crypto(data.data_view(offset), _session.iv.data_view(), crypto_operation::decrypt);
+                if (mode == cipher_mode::ciphered) {
+                    if (offset + plain_length + default_crc_size > data.size()) {
+                        valid = false;
+                    } else {
+                        // The CRC covers also the command code and the unencrypted header
+                        const std::uint32_t crc = compute_crc32(data.data_view(0, offset + plain_length));
+                        valid = (crc == read_lsb(data, offset + plain_length, default_crc_size));
+                        data.resize(offset + plain_length);
+                    }
+                }
+            }
+        }
+        if (not valid) {
+            ++_stats.integrity_errors;
+            DESFIRE_LOGW("Emulated PICC: integrity check failed on %s.", to_string(static_cast<command_code>(data.front())));
+        }
+        return valid;
+    }
+
+    bin_data emulated_picc::wrap_response(reply r) {
+        bin_data response{};
+        if (r.raw) {
+            response << prealloc(r.data.size() + 1) << r.s << r.data;
+            if (r.s != status::ok and r.s != status::additional_frame) {
+                logout();
+            }
+            return response;
+        }
+        if (r.s != status::ok) {
+            // Any error invalidates the authentication
+            logout();
+            response << r.s;
+            return response;
+        }
+        if (not authenticated()) {
+            response << prealloc(r.data.size() + 1) << r.s << r.data;
+        } else if (_session.legacy) {
+            if (r.data.empty() or r.mode == cipher_mode::plain) {
+                response << prealloc(r.data.size() + 1) << r.s << r.data;
+            } else if (r.mode == cipher_mode::maced) {
+                const auto mac = legacy_mac(*_session.session_crypto, r.data.data_view());
+                response << prealloc(r.data.size() + legacy_mac_size + 1) << r.s << r.data << mac;
+            } else {
+                if (r.mode == cipher_mode::ciphered) {
+                    r.data << lsb16 << compute_crc16(r.data);
+                }
+                r.data.resize(padded_length<legacy_block_size>(r.data.size()), 0x00);
+                legacy_encrypt(*_session.session_crypto, r.data.data_view());
+                response << prealloc(r.data.size() + 1) << r.s << r.data;
+            }
+        } else {
+            crypto_with_cmac &c = session_cmac_crypto();
+            if (r.mode == cipher_mode::plain or r.mode == cipher_mode::maced) {
+                // The (C)MAC is computed on data || status, and the host computes it only if there is data or a MAC
+                if (not r.data.empty() or r.mode == cipher_mode::maced) {
+                    r.data << r.s;
+                    const auto cmac = c.do_cmac(r.data.data_view(), _session.iv.data_view());
+                    r.data.pop_back();
+                    if (r.mode == cipher_mode::maced) {
+                        r.data << cmac;
+                    }
+                }
+                response << prealloc(r.data.size() + 1) << r.s << r.data;
+            } else if (r.data.empty()) {
+                response << r.s;
+            } else {
+                if (r.mode == cipher_mode::ciphered) {
+                    const std::uint32_t crc = compute_crc32(static_cast<std::uint8_t>(r.s), compute_crc32(r.data));
+                    r.data << lsb32 << crc;
+                }
+                r.data.resize(padded_length(r.data.size(), c.block_size()), 0x00);
+                c.do_crypto(r.data.data_view(), _session.iv.data_view(), crypto_operation::encrypt);
+                response << prealloc(r.data.size() + 1) << r.s << r.data;
+            }
+        }
+        if (r.logout) {
+            logout();
+        }
+        return response;
+    }
+
+    bin_data emulated_picc::begin_response(bin_data response) {
+        if (response.size() <= _config.max_frame_length) {
+            return response;
+        }
+        _chained_response = std::move(response);
+        _chained_response_offset = 1;
+        return next_response_frame();
+    }
+
+    bin_data emulated_picc::next_response_frame() {
+        const std::size_t max_frame_data = _config.max_frame_length - 1;
+        const std::size_t remaining = _chained_response.size() - _chained_response_offset;
+        bin_data frame{};
+        if (remaining > max_frame_data) {
+            frame << prealloc(_config.max_frame_length) << status::additional_frame
+                  << _chained_response.view(_chained_response_offset, max_frame_data);
+            _chained_response_offset += max_frame_data;
+        } else {
+            // The final status is stored in the first byte
+            frame << prealloc(remaining + 1) << _chained_response.front() << _chained_response.view(_chained_response_offset);
+            _chained_response.clear();
+            _chained_response_offset = 0;
+        }
+        return frame;
+    }
+
+    std::pair<bin_data, bool> emulated_picc::communicate(bin_data const &data) {
+        ++_stats.exchanges;
+        _stats.bytes_received += data.size();
+        bin_data response = [&]() -> bin_data {
+            if (data.empty() or data.size() > _config.max_frame_length) {
+                return status_only(status::length_error);
+            }
+            const auto cmd = static_cast<command_code>(data.front());
+            if (cmd == command_code::additional_frame) {
+                if (not _chained_response.empty()) {
+                    return next_response_frame();
+                } else if (_chained_command_length > 0) {
+                    _chained_command << data.view(1);
+                    if (_chained_command.size() < _chained_command_length) {
+                        return status_only(status::additional_frame);
+                    }
+                    bin_data cmd_data = std::move(_chained_command);
+                    _chained_command = bin_data{};
+                    _chained_command_length = 0;
+                    return begin_response(process(cmd_data));
+                }
+            } else {
+                // A new command aborts any pending chain
+                _chained_response.clear();
+                _chained_response_offset = 0;
+                _chained_command.clear();
+                _chained_command_length = 0;
+                if (cmd == command_code::write_data or cmd == command_code::write_record) {
+                    if (const std::size_t expected_length = expected_command_length(data); expected_length > data.size()) {
+                        _chained_command << prealloc(expected_length) << data;
+                        _chained_command_length = expected_length;
+                        return status_only(status::additional_frame);
+                    }
+                }
+            }
+            bin_data cmd_data = data;
+            return begin_response(process(cmd_data));
+        }();
+        _stats.bytes_sent += response.size();
+        advance(_config.exchange_time + _config.byte_time * (data.size() + response.size()));
+        return {std::move(response), true};
+    }
+
+    bin_data emulated_picc::process(bin_data &cmd_data) {
+        ++_stats.commands;
+        // Any command other than the continuation of the handshake drops the challenge
+        auto challenge = std::move(_challenge);
+        const auto cmd = static_cast<command_code>(cmd_data.front());
+        DESFIRE_LOGD("Emulated PICC: processing %s (%u bytes).", to_string(cmd), cmd_data.size());
+        const auto dispatch = [&]() -> reply {
+            // Commands that use a custom communication mode on send unwrap the data themselves
+            switch (cmd) {
+                case command_code::authenticate_legacy:
+                    [[fallthrough]];
+                case command_code::authenticate_iso:
+                    [[fallthrough]];
+                case command_code::authenticate_aes:
+                    return authenticate(cmd_data);
+                case command_code::additional_frame:
+                    if (challenge != nullptr) {
+                        return authenticate_answer(cmd_data, *challenge);
+                    }
+                    return reply{status::illegal_command};
+                case command_code::change_key_settings:
+                    return change_key_settings(cmd_data);
+                case command_code::change_key:
+                    return change_key(cmd_data);
+                case command_code::set_configuration:
+                    return set_configuration(cmd_data);
+                case command_code::change_file_settings:
+                    return change_file_settings(cmd_data);
+                case command_code::write_data:
+                    return write_data(cmd_data);
+                case command_code::write_record:
+                    return write_record(cmd_data);
+                case command_code::credit:
+                    [[fallthrough]];
+                case command_code::debit:
+                    [[fallthrough]];
+                case command_code::limited_credit:
+                    return write_value(cmd_data);
+                default:
+                    break;
+            }
+            if (not unwrap_command(cmd_data, cipher_mode::plain, 1, 0)) {
+                return reply{status::integrity_error};
+            }
+            switch (cmd) {
+                case command_code::select_application:
+                    return select_application(cmd_data);
+                case command_code::create_application:
+                    return create_application(cmd_data);
+                case command_code::delete_application:
+                    return delete_application(cmd_data);
+                case command_code::get_application_ids:
+                    return get_application_ids(cmd_data);
+                case command_code::get_key_settings:
+                    return get_key_settings(cmd_data);
+                case command_code::get_key_version:
+                    return get_key_version(cmd_data);
+                case command_code::format_picc:
+                    return format_picc(cmd_data);
+                case command_code::get_version:
+                    return get_version(cmd_data);
+                case command_code::get_card_uid:
+                    return get_card_uid(cmd_data);
+                case command_code::free_mem:
+                    return get_free_mem(cmd_data);
+                case command_code::get_file_ids:
+                    return get_file_ids(cmd_data);
+                case command_code::get_file_settings:
+                    return get_file_settings(cmd_data);
+                case command_code::create_std_data_file:
+                    [[fallthrough]];
+                case command_code::create_backup_data_file:
+                    [[fallthrough]];
+                case command_code::create_value_file:
+                    [[fallthrough]];
+                case command_code::create_linear_record_file:
+                    [[fallthrough]];
+                case command_code::create_cyclic_record_file:
+                    return create_file(cmd_data);
+                case command_code::delete_file:
+                    return delete_file(cmd_data);
+                case command_code::read_data:
+                    return read_data(cmd_data);
+                case command_code::get_value:
+                    return get_value(cmd_data);
+                case command_code::read_records:
+                    return read_records(cmd_data);
+                case command_code::clear_record_file:
+                    return clear_record_file(cmd_data);
+                case command_code::commit_transaction:
+                    return commit_transaction(cmd_data);
+                case command_code::abort_transaction:
+                    return abort_transaction(cmd_data);
+                default:
+                    DESFIRE_LOGW("Emulated PICC does not support command %s.", to_string(cmd));
+                    return reply{status::illegal_command};
+            }
+        };
+        reply r = dispatch();
+        if (r.s != status::ok and r.s != status::additional_frame) {
+            DESFIRE_LOGD("Emulated PICC: %s failed with %s.", to_string(cmd), to_string(r.s));
+        }
+        return wrap_response(std::move(r));
+    }
+
+    emulated_picc::reply emulated_picc::authenticate(bin_data &cmd_data) {
+        logout();
+        if (cmd_data.size() != 2) {
+            return reply{status::length_error};
+        }
+        emulated_app const &app = active_app();
+        const std::uint8_t key_no = cmd_data[1];
+        if (key_no >= app.keys.size()) {
+            return reply{status::no_such_key};
+        }
+        if (static_cast<command_code>(cmd_data.front()) != auth_command_for(app.settings.crypto)) {
+            return reply{status::authentication_error};
+        }
+        auto challenge = std::make_unique<auth_challenge>();
+        challenge->key_no = key_no;
+        challenge->key_crypto = _provider->crypto_from_key(app.keys[key_no]);
+        challenge->legacy = (app.settings.crypto == app_crypto::legacy_des_2k3des);
+        if (challenge->key_crypto == nullptr) {
+            return reply{status::authentication_error};
+        }
+        challenge->rndb << randbytes(challenge->legacy ? legacy_block_size : 16);
+
+        reply r{status::additional_frame, challenge->rndb};
+        r.raw = true;
+        if (challenge->legacy) {
+            legacy_encrypt(*challenge->key_crypto, r.data.data_view());
+        } else {
+            challenge->iv.resize(static_cast<crypto_with_cmac &>(*challenge->key_crypto).block_size(), 0x00);
+            challenge->key_crypto->do_crypto(r.data.data_view(), challenge->iv.data_view(), crypto_operation::encrypt);
+        }
+        _challenge = std::move(challenge);
+        return r;
+    }
+
+    emulated_picc::reply emulated_picc::authenticate_answer(bin_data &cmd_data, auth_challenge &challenge) {
+        const std::size_t rnd_size = challenge.rndb.size();
+        if (cmd_data.size() != 1 + 2 * rnd_size) {
+            return reply{status::length_error};
+        }
+        // Payload: RndA || (RndB << 8)
+        if (challenge.legacy) {
+            legacy_decrypt(*challenge.key_crypto, cmd_data.data_view(1));
+        } else {
+            challenge.key_crypto->do_crypto(cmd_data.data_view(1), challenge.iv.data_view(), crypto_operation::decrypt);
+        }
+        for (std::size_t i = 0; i < rnd_size; ++i) {
+            if (cmd_data[1 + rnd_size + i] != challenge.rndb[(i + 1) % rnd_size]) {
+                return reply{status::authentication_error};
+            }
+        }
+        // Answer: RndA << 8
+        reply r{status::ok};
+        r.raw = true;
+        r.data << prealloc(rnd_size) << cmd_data.view(2, rnd_size - 1) << cmd_data[1];
+        if (challenge.legacy) {
+            legacy_encrypt(*challenge.key_crypto, r.data.data_view());
+        } else {
+            challenge.key_crypto->do_crypto(r.data.data_view(), challenge.iv.data_view(), crypto_operation::encrypt);
+        }
+        // Derive the session key from RndA || RndB
+        bin_data random_data{};
+        random_data << prealloc(2 * rnd_size) << cmd_data.view(1, rnd_size) << challenge.rndb;
+        challenge.key_crypto->init_session(random_data.data_view());
+
+        _session.key_no = challenge.key_no;
+        _session.session_crypto = std::move(challenge.key_crypto);
+        _session.legacy = challenge.legacy;
+        _session.iv.clear();
+        if (not _session.legacy) {
+            _session.iv.resize(session_cmac_crypto().block_size(), 0x00);
+        }
+        ++_stats.authentications;
+        return r;
+    }
+
+    emulated_picc::reply emulated_picc::select_application(bin_data &cmd_data) {
+        if (cmd_data.size() != 1 + bits::app_id_length) {
+            return reply{status::length_error};
+        }
+        app_id aid{};
+        std::copy_n(std::begin(cmd_data) + 1, aid.size(), std::begin(aid));
+        emulated_app const *app = find_app(aid);
+        if (app == nullptr) {
+            return reply{status::app_not_found};
+        }
+        // Changing application discards uncommitted data and the authentication
+        commit(false);
+        logout();
+        _active_app = app - _apps.data();
+        return reply{status::ok};
+    }
+
+    emulated_picc::reply emulated_picc::create_application(bin_data &cmd_data) {
+        if (_active_app != 0) {
+            return reply{status::permission_denied};
+        }
+        if (not active_app().settings.rights.create_delete_without_auth and not authenticated_with(0)) {
+            return reply{status::authentication_error};
+        }
+        bin_stream s{cmd_data};
+        s.seek(1);
+        app_id aid{};
+        app_settings settings{};
+        s >> aid >> settings;
+        if (s.bad() or not s.eof()) {
+            return reply{status::length_error};
+        }
+        if (aid == root_app or settings.max_num_keys == 0) {
+            return reply{status::parameter_error};
+        }
+        if (find_app(aid) != nullptr) {
+            return reply{status::duplicate_error};
+        }
+        if (_apps.size() - 1 >= max_applications) {
+            return reply{status::count_error};
+        }
+        emulated_app app{aid, settings, {}, {}};
+        app.keys.reserve(settings.max_num_keys);
+        for (std::uint8_t key_no = 0; key_no < settings.max_num_keys; ++key_no) {
+            app.keys.push_back(zero_key(settings.crypto, key_no));
+        }
+        _apps.push_back(std::move(app));
+        return reply{status::ok, {}, default_rx_mode()};
+    }
+
+    emulated_picc::reply emulated_picc::delete_application(bin_data &cmd_data) {
+        if (cmd_data.size() != 1 + bits::app_id_length) {
+            return reply{status::length_error};
+        }
+        app_id aid{};
+        std::copy_n(std::begin(cmd_data) + 1, aid.size(), std::begin(aid));
+        emulated_app const *app = find_app(aid);
+        if (app == nullptr or aid == root_app) {
+            return reply{status::app_not_found};
+        }
+        const std::size_t app_idx = app - _apps.data();
+        // Either the PICC master key, or the app master key if the PICC allows it
+        const bool allowed = authenticated_with(0) and
+                             (_active_app == 0 or (_active_app == app_idx and _apps.front().settings.rights.create_delete_without_auth));
+        if (not allowed) {
+            return reply{status::permission_denied};
+        }
+        reply r{status::ok, {}, default_rx_mode()};
+        if (_active_app == app_idx) {
+            _active_app = 0;
+            r.logout = true;
+        }
+        _apps.erase(std::begin(_apps) + app_idx);
+        return r;
+    }
+
+    emulated_picc::reply emulated_picc::get_application_ids(bin_data &) {
+        if (_active_app != 0) {
+            return reply{status::permission_denied};
+        }
+        if (not active_app().settings.rights.dir_access_without_auth and not authenticated_with(0)) {
+            return reply{status::authentication_error};
+        }
+        reply r{status::ok, {}, default_rx_mode()};
+        r.data << prealloc(bits::app_id_length * (_apps.size() - 1));
+        for (auto it = std::begin(_apps) + 1; it != std::end(_apps); ++it) {
+            r.data << it->aid;
+        }
+        return r;
+    }
+
+    emulated_picc::reply emulated_picc::get_key_settings(bin_data &) {
+        emulated_app const &app = active_app();
+        if (not app.settings.rights.dir_access_without_auth and not authenticated_with(0)) {
+            return reply{status::authentication_error};
+        }
+        reply r{status::ok, {}, default_rx_mode()};
+        r.data << app.settings;
+        return r;
+    }
+
+    emulated_picc::reply emulated_picc::change_key_settings(bin_data &cmd_data) {
+        emulated_app &app = active_app();
+        if (not authenticated_with(0)) {
+            return reply{status::authentication_error};
+        }
+        if (not app.settings.rights.config_changeable) {
+            return reply{status::permission_denied};
+        }
+        if (not unwrap_command(cmd_data, cipher_mode::ciphered, 1, 1)) {
+            return reply{status::integrity_error};
+        }
+        bin_stream s{cmd_data};
+        s.seek(1);
+        key_rights rights{};
+        s >> rights;
+        if (s.bad()) {
+            return reply{status::length_error};
+        }
+        app.settings.rights = rights;
+        return reply{status::ok, {}, default_rx_mode()};
+    }
+
+    emulated_picc::reply emulated_picc::get_key_version(bin_data &cmd_data) {
+        if (cmd_data.size() != 2) {
+            return reply{status::length_error};
+        }
+        emulated_app const &app = active_app();
+        const std::uint8_t key_no = cmd_data[1] & bits::max_keys_mask;
+        if (key_no >= app.keys.size()) {
+            return reply{status::no_such_key};
+        }
+        reply r{status::ok, {}, default_rx_mode()};
+        r.data << app.keys[key_no].version();
+        return r;
+    }
+
+    emulated_picc::reply emulated_picc::change_key(bin_data &cmd_data) {
+        if (not authenticated()) {
+            return reply{status::authentication_error};
+        }
+        if (cmd_data.size() < 2) {
+            return reply{status::length_error};
+        }
+        emulated_app &app = active_app();
+        const bool is_root = (_active_app == 0);
+        const std::uint8_t key_no = cmd_data[1] & bits::max_keys_mask;
+        // On the root app, the key number carries the crypto of the new PICC master key
+        const auto crypto = is_root ? static_cast<app_crypto>(cmd_data[1] & app_crypto_mask) : app.settings.crypto;
+        if (crypto != app_crypto::legacy_des_2k3des and crypto != app_crypto::iso_3k3des and crypto != app_crypto::aes_128) {
+            return reply{status::parameter_error};
+        }
+        if (key_no >= app.keys.size()) {
+            return reply{status::no_such_key};
+        }
+        // Check who is allowed to change this key
+        if (key_no == 0) {
+            if (not authenticated_with(0) or not app.settings.rights.master_key_changeable) {
+                return reply{status::permission_denied};
+            }
+        } else {
+            auto const &actor = app.settings.rights.allowed_to_change_keys;
+            if (actor == change_key_actor{no_key} or
+                (actor == change_key_actor{same_key} and not authenticated_with(key_no)) or
+                (actor != change_key_actor{same_key} and not authenticated_with(actor.get()))) {
+                return reply{status::permission_denied};
+            }
+        }
+        const bool changing_other_key = not authenticated_with(key_no);
+        const std::size_t body_length = key_body_length(crypto);
+        const std::size_t packed_length = crypto == app_crypto::aes_128 ? body_length - 1 : body_length;
+        const std::size_t crc_size = _session.legacy ? legacy_crc_size : default_crc_size;
+        const std::size_t plain_length = body_length + (changing_other_key ? 2 : 1) * crc_size;
+
+        if (not unwrap_command(cmd_data, cipher_mode::ciphered_no_crc, 2, 0)) {
+            return reply{status::integrity_error};
+        }
+        if (cmd_data.size() < 2 + plain_length) {
+            return reply{status::length_error};
+        }
+        // Verify the CRC on the (possibly xored) body
+        if (_session.legacy) {
+            if (compute_crc16(cmd_data.data_view(2, body_length)) != read_lsb(cmd_data, 2 + body_length, crc_size)) {
+                ++_stats.integrity_errors;
+                return reply{status::integrity_error};
+            }
+        } else if (compute_crc32(cmd_data.data_view(0, 2 + body_length)) != read_lsb(cmd_data, 2 + body_length, crc_size)) {
+            ++_stats.integrity_errors;
+            return reply{status::integrity_error};
+        }
+        bin_data body{};
+        body << prealloc(body_length) << cmd_data.view(2, body_length);
+        if (changing_other_key) {
+            // The body is xored with the current key, then there is a CRC on the new key
+            const bin_data old_body = app.keys[key_no].get_packed_key_body();
+            for (std::size_t i = 0; i < std::min(packed_length, old_body.size()); ++i) {
+                body[i] ^= old_body[i];
+            }
+            const std::size_t new_crc_offset = 2 + body_length + crc_size;
+            const std::uint32_t new_crc = _session.legacy ? compute_crc16(body.data_view(0, packed_length))
+                                                          : compute_crc32(body.data_view(0, packed_length));
+            if (new_crc != read_lsb(cmd_data, new_crc_offset, crc_size)) {
+                ++_stats.integrity_errors;
+                return reply{status::integrity_error};
+            }
+        }
+        app.keys[key_no] = key_from_body(crypto, key_no, body);
+        if (is_root and key_no == 0) {
+            app.settings.crypto = crypto;
+        }
+        reply r{status::ok};
+        // Changing the key in use ends the session
+        r.logout = not changing_other_key;
+        return r;
+    }
+
+    emulated_picc::reply emulated_picc::format_picc(bin_data &) {
+        if (_active_app != 0 or not authenticated_with(0)) {
+            return reply{status::authentication_error};
+        }
+        if ((_config_flags & bits::config_flag_disable_format) != 0) {
+            return reply{status::permission_denied};
+        }
+        _apps.erase(std::begin(_apps) + 1, std::end(_apps));
+        return reply{status::ok, {}, default_rx_mode()};
+    }
+
+    emulated_picc::reply emulated_picc::set_configuration(bin_data &cmd_data) {
+        if (_active_app != 0 or not authenticated_with(0)) {
+            return reply{status::authentication_error};
+        }
+        if (not unwrap_command(cmd_data, cipher_mode::ciphered, 2, 1)) {
+            return reply{status::integrity_error};
+        }
+        if (cmd_data.size() != 3) {
+            return reply{status::length_error};
+        } else if (cmd_data[1] != 0x00) {
+            // Only the PICC configuration option is supported
+            return reply{status::parameter_error};
+        }
+        _config_flags = cmd_data[2];
+        return reply{status::ok, {}, default_rx_mode()};
+    }
+
+    emulated_picc::reply emulated_picc::get_version(bin_data &) {
+        const storage_size size{_config.memory_size};
+        reply r{status::ok, {}, default_rx_mode()};
+        r.data << prealloc(28) << emulated_hw_version;
+        size.operator<<(r.data);
+        r.data << emulated_comm_protocol << emulated_sw_version;
+        size.operator<<(r.data);
+        r.data << emulated_comm_protocol << _config.uid << emulated_batch_no
+               << emulated_production_week << emulated_production_year;
+        return r;
+    }
+
+    emulated_picc::reply emulated_picc::get_card_uid(bin_data &) {
+        if (not authenticated()) {
+            return reply{status::authentication_error};
+        }
+        reply r{status::ok, {}, cipher_mode::ciphered};
+        r.data << _config.uid;
+        return r;
+    }
+
+    emulated_picc::reply emulated_picc::get_free_mem(bin_data &) {
+        reply r{status::ok, {}, default_rx_mode()};
+        r.data << lsb24 << free_memory();
+        return r;
+    }
+
+    emulated_picc::reply emulated_picc::get_file_ids(bin_data &) {
+        emulated_app const &app = active_app();
+        if (not app.settings.rights.dir_access_without_auth and not authenticated_with(0)) {
+            return reply{status::authentication_error};
+        }
+        reply r{status::ok, {}, default_rx_mode()};
+        r.data << prealloc(app.files.size());
+        for (emulated_file const &f : app.files) {
+            r.data << f.fid;
+        }
+        return r;
+    }
+
+    emulated_picc::reply emulated_picc::get_file_settings(bin_data &cmd_data) {
+        if (cmd_data.size() != 2) {
+            return reply{status::length_error};
+        }
+        if (not active_app().settings.rights.dir_access_without_auth and not authenticated_with(0)) {
+            return reply{status::authentication_error};
+        }
+        emulated_file const *f = find_file(cmd_data[1]);
+        if (f == nullptr) {
+            return reply{status::file_not_found};
+        }
+        reply r{status::ok, {}, default_rx_mode()};
+        r.data << f->settings.type() << f->settings.generic_settings();
+        switch (f->settings.type()) {
+            case file_type::standard:
+                [[fallthrough]];
+            case file_type::backup:
+                r.data << f->settings.data_settings();
+                break;
+            case file_type::value: {
+                // The value field reports the available limited credit
+                value_file_settings vs = f->settings.value_settings();
+                vs.value = f->limited_credit_value;
+                r.data << vs;
+            } break;
+            case file_type::linear_record:
+                [[fallthrough]];
+            case file_type::cyclic_record: {
+                auto const &rs = f->settings.record_settings();
+                r.data << lsb24 << rs.record_size << lsb24 << rs.max_record_count << lsb24 << rs.record_count;
+            } break;
+        }
+        return r;
+    }
+
+    emulated_picc::reply emulated_picc::change_file_settings(bin_data &cmd_data) {
+        if (cmd_data.size() < 2) {
+            return reply{status::length_error};
+        }
+        emulated_file *f = find_file(cmd_data[1]);
+        if (f == nullptr) {
+            return reply{status::file_not_found};
+        }
+        auto [s, mode] = file_access_mode(*f, file_access::change);
+        if (s != status::ok) {
+            return reply{s};
+        }
+        // Settings are never just MACed
+        if (mode == cipher_mode::maced) {
+            mode = cipher_mode::ciphered;
+        }
+        if (not unwrap_command(cmd_data, mode, 2, 3)) {
+            return reply{status::integrity_error};
+        }
+        bin_stream stream{cmd_data};
+        stream.seek(2);
+        generic_file_settings generic{};
+        stream >> generic;
+        if (stream.bad() or not stream.eof()) {
+            return reply{status::length_error};
+        }
+        f->settings.generic_settings() = generic;
+        return reply{status::ok, {}, mode};
+    }
+
+    emulated_picc::reply emulated_picc::create_file(bin_data &cmd_data) {
+        emulated_app &app = active_app();
+        if (_active_app == 0) {
+            return reply{status::permission_denied};
+        }
+        if (not app.settings.rights.create_delete_without_auth and not authenticated_with(0)) {
+            return reply{status::authentication_error};
+        }
+        bin_stream s{cmd_data};
+        s.seek(1);
+        emulated_file f{};
+        generic_file_settings generic{};
+        s >> f.fid >> generic;
+        file_id max_fid = bits::max_record_file_id;
+        switch (static_cast<command_code>(cmd_data.front())) {
+            case command_code::create_std_data_file: {
+                data_file_settings ds{};
+                s >> ds;
+                f.settings = file_settings<file_type::standard>{generic, ds};
+                max_fid = bits::max_standard_data_file_id;
+            } break;
+            case command_code::create_backup_data_file: {
+                data_file_settings ds{};
+                s >> ds;
+                f.settings = file_settings<file_type::backup>{generic, ds};
+                max_fid = bits::max_backup_data_file_id;
+            } break;
+            case command_code::create_value_file: {
+                value_file_settings vs{};
+                s >> vs;
+                f.settings = file_settings<file_type::value>{generic, vs};
+                max_fid = bits::max_value_file_id;
+            } break;
+            default: {
+                // The record count is not transmitted
+                record_file_settings rs{};
+                s >> lsb24 >> rs.record_size;
+                s >> lsb24 >> rs.max_record_count;
+                if (static_cast<command_code>(cmd_data.front()) == command_code::create_linear_record_file) {
+                    f.settings = file_settings<file_type::linear_record>{generic, rs};
+                } else {
+                    f.settings = file_settings<file_type::cyclic_record>{generic, rs};
+                }
+            } break;
+        }
+        if (s.bad() or not s.eof()) {
+            return reply{status::length_error};
+        }
+        if (f.fid > max_fid) {
+            return reply{status::parameter_error};
+        }
+        switch (f.settings.type()) {
+            case file_type::value: {
+                auto const &vs = f.settings.value_settings();
+                if (vs.lower_limit > vs.upper_limit or vs.value < vs.lower_limit or vs.value > vs.upper_limit) {
+                    return reply{status::boundary_error};
+                }
+            } break;
+            case file_type::linear_record:
+                [[fallthrough]];
+            case file_type::cyclic_record: {
+                auto const &rs = f.settings.record_settings();
+                if (rs.record_size == 0 or record_capacity(rs, f.settings.type()) == 0 or rs.max_record_count == 0) {
+                    return reply{status::parameter_error};
+                }
+            } break;
+            default:
+                break;
+        }
+        if (find_file(f.fid) != nullptr) {
+            return reply{status::duplicate_error};
+        }
+        if (file_allocation(f.settings) > free_memory()) {
+            return reply{status::out_of_eeprom};
+        }
+        if (is_data_file(f.settings.type())) {
+            f.data.resize(f.settings.data_settings().size, 0x00);
+        }
+        app.files.push_back(std::move(f));
+        return reply{status::ok, {}, default_rx_mode()};
+    }
+
+    emulated_picc::reply emulated_picc::delete_file(bin_data &cmd_data) {
+        if (cmd_data.size() != 2) {
+            return reply{status::length_error};
+        }
+        emulated_app &app = active_app();
+        if (not app.settings.rights.create_delete_without_auth and not authenticated_with(0)) {
+            return reply{status::authentication_error};
+        }
+        auto it = std::find_if(std::begin(app.files), std::end(app.files), [&](emulated_file const &f) { return f.fid == cmd_data[1]; });
+        if (it == std::end(app.files)) {
+            return reply{status::file_not_found};
+        }
+        app.files.erase(it);
+        return reply{status::ok, {}, default_rx_mode()};
+    }
+
+    emulated_picc::reply emulated_picc::read_data(bin_data &cmd_data) {
+        if (cmd_data.size() != 8) {
+            return reply{status::length_error};
+        }
+        emulated_file const *f = find_file(cmd_data[1]);
+        if (f == nullptr) {
+            return reply{status::file_not_found};
+        } else if (not is_data_file(f->settings.type())) {
+            return reply{status::parameter_error};
+        }
+        const auto [s, mode] = file_access_mode(*f, file_access::read);
+        if (s != status::ok) {
+            return reply{s};
+        }
+        const std::size_t offset = read_lsb(cmd_data, 2, 3);
+        std::size_t length = read_lsb(cmd_data, 5, 3);
+        if (offset > f->data.size() or offset + length > f->data.size()) {
+            return reply{status::boundary_error};
+        } else if (length == 0) {
+            // Read until the end
+            length = f->data.size() - offset;
+        }
+        reply r{status::ok, {}, cipher_mode_most_secure(mode, default_rx_mode())};
+        r.data << prealloc(length) << f->data.view(offset, length);
+        return r;
+    }
+
+    emulated_picc::reply emulated_picc::write_data(bin_data &cmd_data) {
+        if (cmd_data.size() < 8) {
+            return reply{status::length_error};
+        }
+        emulated_file *f = find_file(cmd_data[1]);
+        if (f == nullptr) {
+            return reply{status::file_not_found};
+        } else if (not is_data_file(f->settings.type())) {
+            return reply{status::parameter_error};
+        }
+        const auto [s, mode] = file_access_mode(*f, file_access::write);
+        if (s != status::ok) {
+            return reply{s};
+        }
+        const std::size_t offset = read_lsb(cmd_data, 2, 3);
+        const std::size_t length = read_lsb(cmd_data, 5, 3);
+        if (not unwrap_command(cmd_data, mode, 8, length)) {
+            return reply{status::integrity_error};
+        }
+        if (cmd_data.size() != 8 + length) {
+            return reply{status::length_error};
+        } else if (offset + length > f->data.size()) {
+            return reply{status::boundary_error};
+        }
+        if (f->settings.type() == file_type::backup) {
+            // Writes to backup files only become effective on commit
+            if (not f->staged) {
+                f->staged_data = f->data;
+                f->staged = true;
+            }
+            std::copy_n(std::begin(cmd_data) + 8, length, std::begin(f->staged_data) + offset);
+        } else {
+            std::copy_n(std::begin(cmd_data) + 8, length, std::begin(f->data) + offset);
+        }
+        return reply{status::ok, {}, default_rx_mode()};
+    }
+
+    emulated_picc::reply emulated_picc::get_value(bin_data &cmd_data) {
+        if (cmd_data.size() != 2) {
+            return reply{status::length_error};
+        }
+        emulated_file const *f = find_file(cmd_data[1]);
+        if (f == nullptr) {
+            return reply{status::file_not_found};
+        } else if (f->settings.type() != file_type::value) {
+            return reply{status::parameter_error};
+        }
+        const auto [s, mode] = file_access_mode(*f, file_access::read);
+        if (s != status::ok) {
+            return reply{s};
+        }
+        reply r{status::ok, {}, cipher_mode_most_secure(mode, default_rx_mode())};
+        r.data << lsb32 << f->settings.value_settings().value;
+        return r;
+    }
+
+    emulated_picc::reply emulated_picc::write_value(bin_data &cmd_data) {
+        if (cmd_data.size() < 2) {
+            return reply{status::length_error};
+        }
+        emulated_file *f = find_file(cmd_data[1]);
+        if (f == nullptr) {
+            return reply{status::file_not_found};
+        } else if (f->settings.type() != file_type::value) {
+            return reply{status::parameter_error};
+        }
+        const auto [s, mode] = file_access_mode(*f, file_access::write);
+        if (s != status::ok) {
+            return reply{s};
+        }
+        if (not unwrap_command(cmd_data, mode, 2, 4)) {
+            return reply{status::integrity_error};
+        }
+        if (cmd_data.size() != 6) {
+            return reply{status::length_error};
+        }
+        const auto amount = static_cast<std::int32_t>(read_lsb(cmd_data, 2, 4));
+        if (amount < 0) {
+            return reply{status::parameter_error};
+        }
+        auto const &vs = f->settings.value_settings();
+        if (not f->staged) {
+            f->staged_value = vs.value;
+            f->staged_debit = 0;
+            f->staged = true;
+        }
+        const auto new_value = [&]() -> std::int64_t {
+            if (static_cast<command_code>(cmd_data.front()) == command_code::debit) {
+                return std::int64_t(f->staged_value) - amount;
+            }
+            return std::int64_t(f->staged_value) + amount;
+        }();
+        if (new_value < vs.lower_limit or new_value > vs.upper_limit) {
+            return reply{status::boundary_error};
+        }
+        switch (static_cast<command_code>(cmd_data.front())) {
+            case command_code::debit:
+                f->staged_debit += amount;
+                break;
+            case command_code::limited_credit:
+                // Can give back at most what was debited in the last committed transaction, and only once
+                if (not vs.limited_credit_enabled or amount > f->limited_credit_value) {
+                    return reply{status::boundary_error};
+                }
+                f->limited_credit_value = 0;
+                break;
+            default:
+                break;
+        }
+        f->staged_value = static_cast<std::int32_t>(new_value);
+        return reply{status::ok, {}, default_rx_mode()};
+    }
+
+    emulated_picc::reply emulated_picc::read_records(bin_data &cmd_data) {
+        if (cmd_data.size() != 8) {
+            return reply{status::length_error};
+        }
+        emulated_file const *f = find_file(cmd_data[1]);
+        if (f == nullptr) {
+            return reply{status::file_not_found};
+        } else if (not is_record_file(f->settings.type())) {
+            return reply{status::parameter_error};
+        }
+        const auto [s, mode] = file_access_mode(*f, file_access::read);
+        if (s != status::ok) {
+            return reply{s};
+        }
+        auto const &rs = f->settings.record_settings();
+        // Index 0 is the most recent record
+        const std::size_t record_index = read_lsb(cmd_data, 2, 3);
+        std::size_t record_count = read_lsb(cmd_data, 5, 3);
+        if (record_index >= rs.record_count) {
+            return reply{status::boundary_error};
+        } else if (record_count == 0) {
+            record_count = rs.record_count - record_index;
+        } else if (record_index + record_count > rs.record_count) {
+            return reply{status::boundary_error};
+        }
+        // Records are stored and sent oldest first
+        const std::size_t first_record = rs.record_count - record_index - record_count;
+        reply r{status::ok, {}, cipher_mode_most_secure(mode, default_rx_mode())};
+        r.data << prealloc(record_count * rs.record_size) << f->data.view(first_record * rs.record_size, record_count * rs.record_size);
+        return r;
+    }
+
+    emulated_picc::reply emulated_picc::write_record(bin_data &cmd_data) {
+        if (cmd_data.size() < 8) {
+            return reply{status::length_error};
+        }
+        emulated_file *f = find_file(cmd_data[1]);
+        if (f == nullptr) {
+            return reply{status::file_not_found};
+        } else if (not is_record_file(f->settings.type())) {
+            return reply{status::parameter_error};
+        }
+        const auto [s, mode] = file_access_mode(*f, file_access::write);
+        if (s != status::ok) {
+            return reply{s};
+        }
+        const std::size_t offset = read_lsb(cmd_data, 2, 3);
+        const std::size_t length = read_lsb(cmd_data, 5, 3);
+        if (not unwrap_command(cmd_data, mode, 8, length)) {
+            return reply{status::integrity_error};
+        }
+        auto const &rs = f->settings.record_settings();
+        if (cmd_data.size() != 8 + length) {
+            return reply{status::length_error};
+        } else if (offset + length > rs.record_size) {
+            return reply{status::boundary_error};
+        } else if (f->settings.type() == file_type::linear_record and not f->staged_clear and
+                   rs.record_count >= record_capacity(rs, f->settings.type())) {
+            return reply{status::boundary_error};
+        }
+        // Multiple writes in the same transaction go to the same record
+        if (not f->staged) {
+            f->staged_data.clear();
+            f->staged_data.resize(rs.record_size, 0x00);
+            f->staged = true;
+        }
+        std::copy_n(std::begin(cmd_data) + 8, length, std::begin(f->staged_data) + offset);
+        return reply{status::ok, {}, default_rx_mode()};
+    }
+
+    emulated_picc::reply emulated_picc::clear_record_file(bin_data &cmd_data) {
+        if (cmd_data.size() != 2) {
+            return reply{status::length_error};
+        }
+        emulated_file *f = find_file(cmd_data[1]);
+        if (f == nullptr) {
+            return reply{status::file_not_found};
+        } else if (not is_record_file(f->settings.type())) {
+            return reply{status::parameter_error};
+        }
+        if (const auto [s, mode] = file_access_mode(*f, file_access::write); s != status::ok) {
+            return reply{s};
+        }
+        f->staged_clear = true;
+        f->staged = false;
+        f->staged_data.clear();
+        return reply{status::ok, {}, default_rx_mode()};
+    }
+
+    emulated_picc::reply emulated_picc::commit_transaction(bin_data &) {
+        commit(true);
+        return reply{status::ok, {}, default_rx_mode()};
+    }
+
+    emulated_picc::reply emulated_picc::abort_transaction(bin_data &) {
+        commit(false);
+        return reply{status::ok, {}, default_rx_mode()};
+    }
+
+}// namespace desfire::sim
@@ -2,8 +2,17 @@
 // Created by Pietro Saccardi on 02/01/2021.
 //
 
+#include <algorithm>
 #include <desfire/tag.hpp>
+#include <mlab/profiler.hpp>
+#include <mlab/trace.hpp>
 
+#ifdef NDEBUG
+#define ESP_LOG_BIN_DATA(tag, bin_data_like, level) \
+    do {                                            \
+        (void) sizeof(bin_data_like);               \
+    } while (false)
+#else
 #define ESP_LOG_BIN_DATA(tag, bin_data_like, level)                       \
     do {                                                                  \
         if (LOG_LOCAL_LEVEL >= (level)) {                                 \
@@ -11,6 +20,7 @@
             ESP_LOG_BUFFER_HEX_LEVEL(tag, _bd.data(), _bd.size(), level); \
         }                                                                 \
     } while (false)
+#endif
 
 namespace desfire {
 
@@ -35,29 +45,6 @@ namespace desfire {
         using mlab::prealloc;
         using mlab::result_success;
 
-        template <class T>
-        [[nodiscard]] T saturate_sub(T a, T b) {
-            static_assert(std::is_unsigned_v<T>);
-            return std::max(a, b) - b;
-        }
-
-        namespace impl {
-            template <class>
-            struct larger_signed {};
-            template <>
-            struct larger_signed<unsigned int> {
-                using type = long;
-            };
-        }// namespace impl
-
-        template <class T>
-        [[nodiscard]] T div_round_up(T n, T divisor) {
-            using larger_signed = typename impl::larger_signed<T>::type;
-            const auto div_result = std::div(larger_signed(n), larger_signed(divisor));
-            return T(div_result.quot) + (div_result.rem == 0 ? 0 : 1);
-        }
-
-
         [[nodiscard]] cipher_mode cipher_mode_from_security(file_security security) {
             switch (security) {
                 case file_security::none:
@@ -75,17 +62,43 @@ namespace desfire {
     tag::tag(desfire::pcd &pcd, std::unique_ptr<cipher_provider> provider, mlab::shared_buffer_pool buffer_pool)
         : _pcd{&pcd},
           _provider{std::move(provider)},
-          _active_cipher{std::make_unique<cipher_dummy>()},
+          _active_cipher{nullptr},
+          _plain_cipher{},
           _active_key_type{cipher_type::none},
           _active_key_number{std::numeric_limits<std::uint8_t>::max()},
           _active_app{root_app},
-          _buffer_pool{buffer_pool ? std::move(buffer_pool) : mlab::default_buffer_pool()}
+          _buffer_pool{buffer_pool ? std::move(buffer_pool) : mlab::default_buffer_pool()},
+          _random_source{},
+          _file_settings_cache{},
+          _file_settings_cache_stats{}
     {
         if (_provider == nullptr) {
             DESFIRE_LOGE("You built a desfire::tag with a nullptr cipher_provider. SIGSEGV incoming...");
         }
     }
 
+    tag &tag::operator=(tag &&other) noexcept {
+        if (this != &other) {
+            release_active_cipher();
+            _pcd = other._pcd;
+            _provider = std::move(other._provider);
+            _active_cipher = std::move(other._active_cipher);
+            _plain_cipher = other._plain_cipher;
+            _active_key_type = other._active_key_type;
+            _active_key_number = other._active_key_number;
+            _active_app = other._active_app;
+            _buffer_pool = std::move(other._buffer_pool);
+            _random_source = std::move(other._random_source);
+            _file_settings_cache = std::move(other._file_settings_cache);
+            _file_settings_cache_stats = other._file_settings_cache_stats;
+        }
+        return *this;
+    }
+
+    tag::~tag() {
+        release_active_cipher();
+    }
+
     tag::result<> tag::safe_drop_payload(command_code cmd, tag::result<mlab::borrowed<bin_data>> const &result) {
         if (result) {
             if (not (*result)->empty()) {
@@ -98,7 +111,7 @@ namespace desfire {
 
     void tag::log_not_empty(command_code cmd, range<bin_data::const_iterator> data) {
         DESFIRE_LOGW("%s: stray data (%d bytes) in response.", to_string(cmd), data.size());
-        ESP_LOG_BUFFER_HEX_LEVEL(DESFIRE_TAG, data.data(), data.size(), ESP_LOG_DEBUG);
+        DESFIRE_LOG_BUFFER_HEX_LEVEL(DESFIRE_TAG, data.data(), data.size(), ESP_LOG_DEBUG);
     }
 
 
@@ -113,10 +126,35 @@ namespace desfire {
         }
     };
 
+    struct tag::auto_recycle {
+        cipher_provider &provider;
+        std::unique_ptr<cipher> &pcipher;
+
+        ~auto_recycle() {
+            if (pcipher != nullptr) {
+                provider.recycle_cipher(std::move(pcipher));
+            }
+        }
+    };
+
     bool tag::active_cipher_is_legacy() const {
         return _active_cipher == nullptr or _active_cipher->is_legacy();
     }
 
+    cipher &tag::active_cipher() {
+        if (_active_cipher == nullptr) {
+            return _plain_cipher;
+        }
+        return *_active_cipher;
+    }
+
+    void tag::release_active_cipher() {
+        if (_active_cipher != nullptr and _provider != nullptr) {
+            _provider->recycle_cipher(std::move(_active_cipher));
+        }
+        _active_cipher = nullptr;
+    }
+
     tag::comm_cfg const &tag::default_comm_cfg() const {
         if (active_cipher_is_legacy()) {
             static const comm_cfg _legacy_plain{cipher_mode::plain};
@@ -131,131 +169,189 @@ namespace desfire {
         if (due_to_error and active_key_type() != cipher_type::none) {
             DESFIRE_LOGE("Authentication will have to be performed again.");
         }
-        _active_cipher = std::make_unique<cipher_dummy>();
+        release_active_cipher();
         _active_key_type = cipher_type::none;
         _active_key_number = std::numeric_limits<std::uint8_t>::max();
     }
 
-    tag::result<mlab::borrowed<bin_data>> tag::raw_command_response(bin_stream &tx_data, bool rx_fetch_additional_frames) {
-        static constexpr auto chunk_size = bits::max_packet_length;
-        auto tx_chunk = _buffer_pool->take();
+    void tag::clear_file_settings_cache() {
+        _file_settings_cache.clear();
+        _file_settings_cache_stats = {};
+    }
+
+    generic_file_settings const *tag::find_cached_file_settings(file_id fid) const {
+        for (cached_file_settings const &entry : _file_settings_cache) {
+            if (entry.fid == fid and entry.app == active_app()) {
+                return &entry.settings;
+            }
+        }
+        return nullptr;
+    }
+
+    void tag::cache_file_settings(file_id fid, generic_file_settings const &settings) {
+        for (cached_file_settings &entry : _file_settings_cache) {
+            if (entry.fid == fid and entry.app == active_app()) {
+                entry.settings = settings;
+                return;
+            }
+        }
+        _file_settings_cache.push_back(cached_file_settings{active_app(), fid, settings});
+    }
+
+    void tag::uncache_file_settings(file_id fid) {
+        const auto it = std::find_if(std::begin(_file_settings_cache), std::end(_file_settings_cache),
+                                     [&](cached_file_settings const &entry) { return entry.fid == fid and entry.app == active_app(); });
+        if (it != std::end(_file_settings_cache)) {
+            _file_settings_cache.erase(it);
+        }
+    }
+
+    tag::result<status, mlab::borrowed<bin_data>> tag::command_status_response(command_code cmd, bin_data const &data, comm_cfg const &cfg, bool rx_fetch_additional_frames, cipher *override_cipher) {
+        static const bin_data no_data{};
+        return command_status_response(cmd, data, no_data, cfg, rx_fetch_additional_frames, override_cipher);
+    }
+
+    tag::result<status, mlab::borrowed<bin_data>> tag::command_status_response(command_code cmd, bin_data const &header, bin_data const &data, comm_cfg const &cfg, bool rx_fetch_additional_frames, cipher *override_cipher) {
+        const mlab::profile_scope profile{mlab::probe::tag_command};
+        const std::size_t chunk_size = frame_length();
+        DESFIRE_LOGD("%s: TX mode: %s, ofs: %u", to_string(cmd),
+                     to_string(cfg.tx), cfg.tx_secure_data_offset);
+        DESFIRE_LOGD("%s: RX mode: %s, fetch AF: %u", to_string(cmd),
+                     to_string(cfg.rx), rx_fetch_additional_frames);
+
+        // If we exit prematurely, and we are using the cipher of this tag, trigger a logout by error.
+        auto_logout logout_on_error{*this, override_cipher != nullptr};
+
+        // Select the right cipher and prepare the buffers
+        cipher &c = override_cipher == nullptr ? active_cipher() : *override_cipher;
+
+        ESP_LOG_BIN_DATA(DESFIRE_TAG " >>", header, ESP_LOG_DEBUG);
+        ESP_LOG_BIN_DATA(DESFIRE_TAG " >>", data, ESP_LOG_DEBUG);
+
+        // The command is secured and sent one frame at a time, so that only a couple of frames are held in memory.
+        const std::uint8_t cmd_byte = static_cast<std::uint8_t>(cmd);
+        const std::array<range<std::uint8_t const *>, 3> tx_sources = {
+                range<std::uint8_t const *>{&cmd_byte, &cmd_byte + 1}, header.data_view(), data.data_view()};
+        auto tx_source = std::begin(tx_sources);
+        std::size_t tx_source_pos = 0;
+
+        auto tx_pending = _buffer_pool->take_sized(3 * chunk_size);// Secured data not yet sent
+        auto tx_chunk = _buffer_pool->take_sized(chunk_size);
+        // Leave room for the padding, CRC and MAC, which are removed only once all the response is received
+        auto rx_data = _buffer_pool->take_sized(std::max(chunk_size, cfg.rx_length_hint + 32));
+        auto rx_chunk = _buffer_pool->take_sized(chunk_size);
+        if (not tx_pending or not tx_chunk or not rx_data or not rx_chunk) {
+            return error::out_of_buffers;
+        }
+        tx_pending << prealloc(3 * chunk_size);
         tx_chunk << prealloc(chunk_size);
-        const auto num_tx_chunks = 1 + div_round_up(saturate_sub(tx_data.remaining(), chunk_size), chunk_size - 1);
 
+        // Securing and verifying data is interleaved with the exchanges, collect the time spent in each as a single sample
+        mlab::profile_accumulator profile_tx{mlab::probe::cipher_tx};
+        mlab::profile_accumulator profile_rx{mlab::probe::cipher_rx};
+
+        profile_tx.measure([&] { c.prepare_tx_begin(cfg.tx_secure_data_offset, cfg.tx); });
+        bool tx_done = false;
+        bool tx_eof = false;
         status last_status = status::additional_frame;
-        auto rx_data = _buffer_pool->take();
 
         for (std::size_t chunk_idx = 0; last_status == status::additional_frame; ++chunk_idx, tx_chunk->clear()) {
-            assert(tx_chunk->empty());
             // Prepare packet to send: DATA for the first, AF + DATA afterwards.
-            if (chunk_idx == 0) {
-                tx_chunk << tx_data.read(std::min(tx_data.remaining(), chunk_size));
-            } else {
-                tx_chunk << command_code::additional_frame << tx_data.read(std::min(tx_data.remaining(), chunk_size - 1));
+            const std::size_t chunk_data_size = chunk_idx == 0 ? chunk_size : chunk_size - 1;
+            // Secure data until there is more than a whole chunk, so that we know whether this is the last one
+            while (not tx_done and tx_pending->size() <= chunk_data_size) {
+                if (tx_source == std::end(tx_sources)) {
+                    profile_tx.measure([&] { c.prepare_tx_end(*tx_pending); });
+                    profile_rx.measure([&] { c.confirm_rx_begin(cfg.rx); });
+                    tx_done = true;
+                } else if (tx_source_pos >= tx_source->size()) {
+                    ++tx_source;
+                    tx_source_pos = 0;
+                } else {
+                    const std::size_t n = std::min(tx_source->size() - tx_source_pos, chunk_size);
+                    profile_tx.measure([&] { c.prepare_tx_chunk({std::begin(*tx_source) + tx_source_pos, std::begin(*tx_source) + tx_source_pos + n}, *tx_pending); });
+                    tx_source_pos += n;
+                }
             }
-            if (chunk_idx < num_tx_chunks) {
-                DESFIRE_LOGD("Exchanging chunk %d (command data %d/%d).", chunk_idx + 1, chunk_idx + 1, num_tx_chunks);
-            } else {
-                DESFIRE_LOGD("Exchanging chunk %d (additional response frame).", chunk_idx + 1);
-                assert(tx_data.eof());
+            const std::size_t n = std::min(tx_pending->size(), chunk_data_size);
+            if (chunk_idx > 0) {
+                tx_chunk << command_code::additional_frame;
             }
+            tx_chunk << tx_pending->view(0, n);
+            tx_pending->erase(std::begin(*tx_pending), std::begin(*tx_pending) + n);
+            tx_eof = tx_done and tx_pending->empty();
+            DESFIRE_LOGD("Exchanging chunk %d (%s).", chunk_idx + 1, tx_eof ? "last command frame or response frame" : "command frame");
 
             // Actual transmission
-            ESP_LOG_BUFFER_HEX_LEVEL(DESFIRE_TAG " RAW >>", tx_chunk->data(), tx_chunk->size(), ESP_LOG_DEBUG);
-            if (const auto &[rx_chunk, success] = pcd().communicate(*tx_chunk); success) {
-                ESP_LOG_BUFFER_HEX_LEVEL(DESFIRE_TAG " RAW <<", rx_chunk.data(), rx_chunk.size(), ESP_LOG_DEBUG);
+            DESFIRE_LOG_BUFFER_HEX_LEVEL(DESFIRE_TAG " RAW >>", tx_chunk->data(), tx_chunk->size(), ESP_LOG_DEBUG);
+            mlab::trace(mlab::trace_event::pcd_tx, std::uint8_t(chunk_idx), *tx_chunk);
+            rx_chunk->clear();
+            if (pcd().communicate_into(*tx_chunk, *rx_chunk)) {
+                DESFIRE_LOG_BUFFER_HEX_LEVEL(DESFIRE_TAG " RAW <<", rx_chunk->data(), rx_chunk->size(), ESP_LOG_DEBUG);
+                mlab::trace(mlab::trace_event::pcd_rx, std::uint8_t(chunk_idx), *rx_chunk);
 
                 // Make sure there was an actual response
-                if (rx_chunk.empty()) {
-                    DESFIRE_LOGE("PICC sent an empty answer.");
+                if (rx_chunk->empty()) {
+                    DESFIRE_LOGE("%s: failed, PICC sent an empty answer.", to_string(cmd));
                     return error::malformed;
                 }
-
-                // Collect data. The status byte will only be appended later, for now we store it
-                rx_data << prealloc(rx_chunk.size()) << rx_chunk.view(1);
-                last_status = static_cast<status>(rx_chunk.front());
+                last_status = static_cast<status>(rx_chunk->front());
+
+                // Collect data. The status byte is passed only at the end
+                if (rx_chunk->size() > 1) {
+                    if (not tx_eof) {
+                        DESFIRE_LOGE("%s: failed, PICC sent data before the end of the command.", to_string(cmd));
+                        return error::malformed;
+                    }
+                    const auto rx_chunk_data = rx_chunk->data_view(1);
+                    profile_rx.measure([&] { c.confirm_rx_chunk(rx_chunk_data, *rx_data); });
+                }
 
                 // If tx_data is done and we do not fetch additional frames, we abort the loop no matter what the status is
-                if (tx_data.eof() and not rx_fetch_additional_frames) {
+                if (tx_eof and not rx_fetch_additional_frames) {
                     break;
                 }
             } else {
+                DESFIRE_LOGE("%s: failed, %s", to_string(cmd), to_string(error::controller_error));
                 return error::controller_error;
             }
         }
 
+        const std::uint8_t status_byte = static_cast<std::uint8_t>(last_status);
+        mlab::trace(mlab::trace_event::status, cmd_byte, range<std::uint8_t const *>{&status_byte, &status_byte + 1});
+
         // The card may have aborted early
-        if (not tx_data.eof()) {
-            DESFIRE_LOGE("The card interrupted the transmission with status %s", to_string(last_status));
+        if (not tx_eof) {
+            DESFIRE_LOGE("%s: the card interrupted the transmission with status %s", to_string(cmd), to_string(last_status));
             return error::malformed;
         }
 
-        // Reappend status byte
-        rx_data << last_status;
-
-        return std::move(rx_data);
-    }
-
-    tag::result<status, mlab::borrowed<bin_data>> tag::command_status_response(command_code cmd, bin_data const &data, comm_cfg const &cfg, bool rx_fetch_additional_frames, cipher *override_cipher) {
-        if (_active_cipher == nullptr and override_cipher == nullptr) {
-            DESFIRE_LOGE("No active cipher and no override cipher: 'tag' is in an invalid state (coding mistake).");
-            return error::crypto_error;
-        }
-        DESFIRE_LOGD("%s: TX mode: %s, ofs: %u", to_string(cmd),
-                     to_string(cfg.tx), cfg.tx_secure_data_offset);
-        DESFIRE_LOGD("%s: RX mode: %s, fetch AF: %u", to_string(cmd),
-                     to_string(cfg.rx), rx_fetch_additional_frames);
-
-        // If we exit prematurely, and we are using the cipher of this tag, trigger a logout by error.
-        auto_logout logout_on_error{*this, override_cipher != nullptr};
-
-        // Select the right cipher and prepare the buffers
-        cipher &c = override_cipher == nullptr ? *_active_cipher : *override_cipher;
-
-        // Assemble data to transmit and preprocess
-        auto tx_data = _buffer_pool->take();
-        tx_data << prealloc(data.size() + 1) << cmd << data;
-
-        ESP_LOG_BUFFER_HEX_LEVEL(DESFIRE_TAG " >>", tx_data->data(), tx_data->size(), ESP_LOG_DEBUG);
-
-        c.prepare_tx(*tx_data, cfg.tx_secure_data_offset, cfg.tx);
-
-        bin_stream tx_stream{*tx_data};
-        auto res_cmd = raw_command_response(tx_stream, rx_fetch_additional_frames);
-        if (not res_cmd) {
-            DESFIRE_LOGE("%s: failed, %s", to_string(cmd), to_string(res_cmd.error()));
-            return res_cmd.error();
-        }
-
-        // Alias
-        auto rx_data = std::move(*res_cmd);
-
         // Postprocessing requires to know the status byte
-        if (not c.confirm_rx(*rx_data, cfg.rx)) {
+        if (not profile_rx.measure([&] { return c.confirm_rx_end(status_byte, *rx_data); })) {
             DESFIRE_LOGE("%s: failed, received data did not pass validation.", to_string(cmd));
             return error::crypto_error;
         }
-        assert(not rx_data->empty());
-
-        ESP_LOG_BUFFER_HEX_LEVEL(DESFIRE_TAG " <<", rx_data->data(), rx_data->size(), ESP_LOG_DEBUG);
 
-        // Extract status byte
-        const auto cmd_status = static_cast<status>(rx_data->back());
-        rx_data->pop_back();
+        ESP_LOG_BIN_DATA(DESFIRE_TAG " <<", *rx_data, ESP_LOG_DEBUG);
 
-        DESFIRE_LOGD("%s: completed with status %s", to_string(cmd), to_string(cmd_status));
+        DESFIRE_LOGD("%s: completed with status %s", to_string(cmd), to_string(last_status));
 
         // Passthrough the status byte, the caller decides if that is an error.
         logout_on_error.assume_success = true;
-        return {cmd_status, std::move(rx_data)};
+        return {last_status, std::move(rx_data)};
     }
 
     tag::result<mlab::borrowed<bin_data>> tag::command_response(command_code cmd, const bin_data &payload, const tag::comm_cfg &cfg, bool rx_fetch_additional_frames, cipher *override_cipher) {
+        static const bin_data no_data{};
+        return command_response(cmd, payload, no_data, cfg, rx_fetch_additional_frames, override_cipher);
+    }
+
+    tag::result<mlab::borrowed<bin_data>> tag::command_response(command_code cmd, bin_data const &header, bin_data const &data, comm_cfg const &cfg, bool rx_fetch_additional_frames, cipher *override_cipher) {
         auto_logout logout_on_error{*this, override_cipher != nullptr};
 
-        if (auto res_status_cmd = command_status_response(cmd, payload, cfg, rx_fetch_additional_frames, override_cipher); res_status_cmd) {
+        if (auto res_status_cmd = command_status_response(cmd, header, data, cfg, rx_fetch_additional_frames, override_cipher); res_status_cmd) {
             const auto cmd_status = res_status_cmd->first;
-            auto data = std::move(res_status_cmd->second);
+            auto rx_data = std::move(res_status_cmd->second);
 
             // Check the returned status. This is the only error condition handled by this method
             if (cmd_status != status::ok and cmd_status != status::no_changes) {
@@ -264,7 +360,7 @@ namespace desfire {
             }
 
             logout_on_error.assume_success = true;
-            return std::move(data);
+            return std::move(rx_data);
         } else {
             return res_status_cmd.error();
         }
@@ -276,6 +372,8 @@ namespace desfire {
             DESFIRE_LOGD("Selected application %02x %02x %02x.", app[0], app[1], app[2]);
             logout(false);
             _active_app = app;
+            // File settings do not depend on the authentication, but files may change across applications
+            _file_settings_cache.clear();
         }
         return safe_drop_payload(command_code::select_application, res_cmd);
     }
@@ -289,6 +387,8 @@ namespace desfire {
 
         /// Initialize a new cipher of the appropriate type for the key exchange protocol and the relative comm modes
         auto pcipher = _provider->cipher_from_key(k);
+        // If authentication fails, give the cipher back to the provider
+        auto_recycle recycle_on_error{*_provider, pcipher};
 
         /// Send the right authentication command for the key type and the key number, get RndB
         DESFIRE_LOGD("Authentication with key %u (%s): sending auth command.", k.key_number(), to_string(k.type()));
@@ -298,9 +398,15 @@ namespace desfire {
         // returned status is not "additional frame".
         // Also, we do not want to pass the initial command through CMAC even in modern ciphers, so we set secure data
         // offset to >= 2 (length of the payload) and mode to ciphered_no_crc
+        // Reuse the same buffer for all payloads, so that after warm-up authentication does not allocate
+        auto payload = _buffer_pool->take_sized(32 /* RndA || RndB on AES */);
+        if (not payload) {
+            return error::out_of_buffers;
+        }
+        payload << k.key_number();
         auto res_rndb = command_status_response(
                 auth_command(k.type()),
-                bin_data::chain(k.key_number()),
+                *payload,
                 comm_cfg{cipher_mode::ciphered_no_crc, 2},
                 false,
                 pcipher.get());
@@ -317,20 +423,30 @@ namespace desfire {
         auto rndb = std::move(res_rndb->second);
         DESFIRE_LOGD("Authentication: received RndB (%u bytes).", rndb->size());
         ESP_LOGD(DESFIRE_TAG " KEY", "RndB:");
-        ESP_LOG_BUFFER_HEX_LEVEL(DESFIRE_TAG " KEY", rndb->data(), rndb->size(), ESP_LOG_DEBUG);
+        DESFIRE_LOG_BUFFER_HEX_LEVEL(DESFIRE_TAG " KEY", rndb->data(), rndb->size(), ESP_LOG_DEBUG);
 
         /// Prepare and send a response: AdditionalFrames || Crypt(RndA || RndB'), RndB' = RndB << 8, obtain RndA >> 8
-        auto rnda = _buffer_pool->take();
-        rnda << randbytes(rndb->size());
+        auto rnda = _buffer_pool->take_sized(rndb->size());
+        if (not rnda) {
+            return error::out_of_buffers;
+        }
+        if (_random_source) {
+            rnda->resize(rndb->size());
+            _random_source(rnda->data(), rnda->size());
+        } else {
+            rnda << randbytes(rndb->size());
+        }
 
         DESFIRE_LOGD("Authentication: sending RndA || (RndB << 8).");
         ESP_LOGD(DESFIRE_TAG " KEY", "RndA:");
-        ESP_LOG_BUFFER_HEX_LEVEL(DESFIRE_TAG " KEY", rnda->data(), rnda->size(), ESP_LOG_DEBUG);
+        DESFIRE_LOG_BUFFER_HEX_LEVEL(DESFIRE_TAG " KEY", rnda->data(), rnda->size(), ESP_LOG_DEBUG);
 
         // Send and received encrypted; this time parse the status byte because we regularly expect a status::ok.
+        payload->clear();
+        payload << prealloc(rnda->size() * 2) << *rnda << rndb->view(1) << rndb->front();
         const auto res_rndap = command_response(
                 command_code::additional_frame,
-                bin_data::chain(prealloc(rnda->size() * 2), *rnda, rndb->view(1), rndb->front()),
+                *payload,
                 cipher_mode::ciphered_no_crc,
                 false,
                 pcipher.get());
@@ -355,7 +471,9 @@ namespace desfire {
         }
 
         DESFIRE_LOGD("Authentication: deriving session key...");
-        pcipher->init_session(bin_data::chain(prealloc(2 * rndb->size()), *rnda, *rndb));
+        payload->clear();
+        payload << prealloc(2 * rndb->size()) << *rnda << *rndb;
+        pcipher->init_session(*payload);
         DESFIRE_LOGD("Authenticated with key %u (%s).", k.key_number(), to_string(k.type()));
 
         _active_cipher = std::move(pcipher);
@@ -437,6 +555,7 @@ namespace desfire {
         if (res_cmd) {
             logout(false);
             _active_app = root_app;
+            _file_settings_cache.clear();
         }
         return safe_drop_payload(command_code::format_picc, res_cmd);
     }
@@ -480,7 +599,10 @@ namespace desfire {
         const std::uint8_t key_no_flag = (active_app() == root_app
                                                   ? key_no_to_change | static_cast<std::uint8_t>(app_crypto_from_cipher(new_key.type()))
                                                   : key_no_to_change);
-        auto payload = _buffer_pool->take();
+        auto payload = _buffer_pool->take_sized(33);
+        if (not payload) {
+            return error::out_of_buffers;
+        }
         payload << prealloc(33) << key_no_flag;
         // Changing from a different key requires to xor it with that other key
         if (current_key != nullptr) {
@@ -539,21 +661,31 @@ namespace desfire {
     }
 
     tag::result<any_file_settings> tag::get_file_settings(file_id fid) {
-        return command_parse_response<any_file_settings>(
+        auto res_cmd = command_parse_response<any_file_settings>(
                 command_code::get_file_settings, bin_data::chain(fid), default_comm_cfg());
+        if (res_cmd) {
+            cache_file_settings(fid, res_cmd->generic_settings());
+        }
+        return res_cmd;
     }
 
-    file_security tag::determine_file_security(file_access access, any_file_settings const &settings) const {
+    file_security tag::determine_file_security(file_access access, generic_file_settings const &settings) const {
         // Send in plain mode if the specific operation is "free".
-        if (settings.generic_settings().rights.is_free(access, active_key_no())) {
+        if (settings.rights.is_free(access, active_key_no())) {
             return file_security::none;
         }
-        return settings.generic_settings().security;
+        return settings.security;
     }
 
     tag::result<file_security> tag::determine_file_security(file_id fid, file_access access) {
+        // Access rights are stored, not the outcome, because the active key may change in the meantime
+        if (generic_file_settings const *cached_settings = find_cached_file_settings(fid); cached_settings != nullptr) {
+            ++_file_settings_cache_stats.hits;
+            return determine_file_security(access, *cached_settings);
+        }
+        ++_file_settings_cache_stats.misses;
         if (const auto res_get_settings = get_file_settings(fid); res_get_settings) {
-            return determine_file_security(access, *res_get_settings);
+            return determine_file_security(access, res_get_settings->generic_settings());
         } else {
             return res_get_settings.error();
         }
@@ -573,6 +705,8 @@ namespace desfire {
             security = file_security::encrypted;
         }
         const comm_cfg cfg{cipher_mode_from_security(security), 2 /* After command code and file id */};
+        // Whatever the outcome, we cannot be sure anymore of what the settings are
+        uncache_file_settings(fid);
         return safe_drop_payload(command_code::change_file_settings,
                                  command_response(
                                          command_code::change_file_settings,
@@ -605,9 +739,14 @@ namespace desfire {
         }
         // RX happens with the chosen file protection, except on nonlegacy ciphers where plain becomes maced
         const auto rx_cipher_mode = cipher_mode_most_secure(cipher_mode_from_security(security), default_comm_cfg().rx);
-        auto payload = _buffer_pool->take();
+        auto payload = _buffer_pool->take_sized(7);
+        if (not payload) {
+            return error::out_of_buffers;
+        }
         payload << prealloc(7) << fid << lsb24 << offset << lsb24 << length;
-        return command_response(command_code::read_data, *payload, comm_cfg{default_comm_cfg().tx, rx_cipher_mode});
+        comm_cfg cfg{default_comm_cfg().tx, rx_cipher_mode};
+        cfg.rx_length_hint = length;
+        return command_response(command_code::read_data, *payload, cfg);
     }
 
     tag::result<> tag::write_data(file_id fid, std::uint32_t offset, bin_data const &data) {
@@ -636,10 +775,14 @@ namespace desfire {
         const comm_cfg cfg{cipher_mode_from_security(security), default_comm_cfg().rx,
                            8 /* secure with legacy MAC only data */};
 
-        auto payload = _buffer_pool->take();
-        payload << prealloc(data.size() + 7) << fid << lsb24 << offset << lsb24 << data.size() << data;
+        // The data is streamed after the header, without copying it
+        auto header = _buffer_pool->take_sized(7);
+        if (not header) {
+            return error::out_of_buffers;
+        }
+        header << prealloc(7) << fid << lsb24 << offset << lsb24 << data.size();
 
-        return safe_drop_payload(command_code::write_data, command_response(command_code::write_data, *payload, cfg));
+        return safe_drop_payload(command_code::write_data, command_response(command_code::write_data, *header, data, cfg));
     }
 
 
@@ -677,7 +820,10 @@ namespace desfire {
             return error::parameter_error;
         }
         const comm_cfg cfg{cipher_mode_from_security(security), default_comm_cfg().rx, 2 /* after FID */};
-        auto payload = _buffer_pool->take();
+        auto payload = _buffer_pool->take_sized(5);
+        if (not payload) {
+            return error::out_of_buffers;
+        }
         payload << prealloc(5) << fid << lsb32 << amount;
         return safe_drop_payload(cmd, command_response(cmd, *payload, cfg));
     }
@@ -744,11 +890,15 @@ namespace desfire {
         const comm_cfg cfg{cipher_mode_from_security(security), default_comm_cfg().rx,
                            8 /* secure with legacy MAC only data */};
 
-        auto payload = _buffer_pool->take();
-        payload << prealloc(data.size() + 7) << fid << lsb24 << offset << lsb24 << data.size() << data;
+        // The data is streamed after the header, without copying it
+        auto header = _buffer_pool->take_sized(7);
+        if (not header) {
+            return error::out_of_buffers;
+        }
+        header << prealloc(7) << fid << lsb24 << offset << lsb24 << data.size();
 
         return safe_drop_payload(command_code::write_record,
-                                 command_response(command_code::write_record, *payload, cfg));
+                                 command_response(command_code::write_record, *header, data, cfg));
     }
 
     tag::result<mlab::borrowed<bin_data>> tag::read_records(file_id fid, std::uint32_t record_index, std::uint32_t record_count) {
@@ -776,8 +926,11 @@ namespace desfire {
         }
         // RX happens with the chosen file protection, except on nonlegacy ciphers where plain becomes maced
         const auto rx_cipher_mode = cipher_mode_most_secure(cipher_mode_from_security(security), default_comm_cfg().rx);
-        auto payload = _buffer_pool->take();
-        payload << prealloc(record_count + 7) << fid << lsb24 << record_index << lsb24 << record_count;
+        auto payload = _buffer_pool->take_sized(7);
+        if (not payload) {
+            return error::out_of_buffers;
+        }
+        payload << prealloc(7) << fid << lsb24 << record_index << lsb24 << record_count;
 
         return command_response(command_code::read_records, *payload, comm_cfg{default_comm_cfg().tx, rx_cipher_mode});
     }
@@ -806,10 +959,14 @@ namespace desfire {
             DESFIRE_LOGW("%s: invalid file id %d for a data file.", to_string(command_code::create_std_data_file), fid);
             return error::parameter_error;
         }
-        return safe_drop_payload(command_code::create_std_data_file,
-                                 command_response(
-                                         command_code::create_std_data_file, bin_data::chain(fid, settings),
-                                         default_comm_cfg()));
+        const auto res_cmd = safe_drop_payload(command_code::create_std_data_file,
+                                               command_response(
+                                                       command_code::create_std_data_file, bin_data::chain(fid, settings),
+                                                       default_comm_cfg()));
+        if (res_cmd) {
+            cache_file_settings(fid, settings);
+        }
+        return res_cmd;
     }
 
     tag::result<> tag::create_file(file_id fid, file_settings<file_type::backup> const &settings) {
@@ -817,10 +974,14 @@ namespace desfire {
             DESFIRE_LOGW("%s: invalid file id %d for a backup file.", to_string(command_code::create_backup_data_file), fid);
             return error::parameter_error;
         }
-        return safe_drop_payload(command_code::create_backup_data_file,
-                                 command_response(
-                                         command_code::create_backup_data_file, bin_data::chain(fid, settings),
-                                         default_comm_cfg()));
+        const auto res_cmd = safe_drop_payload(command_code::create_backup_data_file,
+                                               command_response(
+                                                       command_code::create_backup_data_file, bin_data::chain(fid, settings),
+                                                       default_comm_cfg()));
+        if (res_cmd) {
+            cache_file_settings(fid, settings);
+        }
+        return res_cmd;
     }
 
     tag::result<> tag::create_file(file_id fid, file_settings<file_type::value> const &settings) {
@@ -830,10 +991,14 @@ namespace desfire {
         if (settings.upper_limit < settings.lower_limit) {
             return error::parameter_error;
         }
-        return safe_drop_payload(command_code::create_value_file,
-                                 command_response(
-                                         command_code::create_value_file, bin_data::chain(fid, settings),
-                                         default_comm_cfg()));
+        const auto res_cmd = safe_drop_payload(command_code::create_value_file,
+                                               command_response(
+                                                       command_code::create_value_file, bin_data::chain(fid, settings),
+                                                       default_comm_cfg()));
+        if (res_cmd) {
+            cache_file_settings(fid, settings);
+        }
+        return res_cmd;
     }
 
     tag::result<> tag::create_file(file_id fid, file_settings<file_type::linear_record> const &settings) {
@@ -844,10 +1009,14 @@ namespace desfire {
         if (settings.record_size < 1) {
             return error::parameter_error;
         }
-        return safe_drop_payload(command_code::create_linear_record_file,
-                                 command_response(
-                                         command_code::create_linear_record_file, bin_data::chain(fid, settings),
-                                         default_comm_cfg()));
+        const auto res_cmd = safe_drop_payload(command_code::create_linear_record_file,
+                                               command_response(
+                                                       command_code::create_linear_record_file, bin_data::chain(fid, settings),
+                                                       default_comm_cfg()));
+        if (res_cmd) {
+            cache_file_settings(fid, settings);
+        }
+        return res_cmd;
     }
 
     tag::result<> tag::create_file(file_id fid, file_settings<file_type::cyclic_record> const &settings) {
@@ -861,13 +1030,18 @@ namespace desfire {
         if (settings.max_record_count < 2) {
             return error::parameter_error;
         }
-        return safe_drop_payload(command_code::create_cyclic_record_file,
-                                 command_response(
-                                         command_code::create_cyclic_record_file, bin_data::chain(fid, settings),
-                                         default_comm_cfg()));
+        const auto res_cmd = safe_drop_payload(command_code::create_cyclic_record_file,
+                                               command_response(
+                                                       command_code::create_cyclic_record_file, bin_data::chain(fid, settings),
+                                                       default_comm_cfg()));
+        if (res_cmd) {
+            cache_file_settings(fid, settings);
+        }
+        return res_cmd;
     }
 
     tag::result<> tag::delete_file(file_id fid) {
+        uncache_file_settings(fid);
         return safe_drop_payload(command_code::delete_file,
                                  command_response(
                                          command_code::delete_file, bin_data::chain(fid), default_comm_cfg()));
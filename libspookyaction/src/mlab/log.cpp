@@ -0,0 +1,108 @@
+#include <mlab/log.h>
+
+#ifndef ESP_PLATFORM
+
+#include <algorithm>
+#include <chrono>
+#include <cstdarg>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include <mutex>
+#include <string>
+
+namespace {
+    struct log_levels {
+        std::mutex lock{};
+        esp_log_level_t default_level = ESP_LOG_INFO;
+        std::map<std::string, esp_log_level_t, std::less<>> tag_levels{};
+    };
+
+    [[nodiscard]] log_levels &levels() {
+        static log_levels _levels{};
+        return _levels;
+    }
+
+    [[nodiscard]] char level_letter(esp_log_level_t level) {
+        switch (level) {
+            case ESP_LOG_ERROR:
+                return 'E';
+            case ESP_LOG_WARN:
+                return 'W';
+            case ESP_LOG_INFO:
+                return 'I';
+            case ESP_LOG_DEBUG:
+                return 'D';
+            case ESP_LOG_VERBOSE:
+                return 'V';
+            case ESP_LOG_NONE:
+                [[fallthrough]];
+            default:
+                return ' ';
+        }
+    }
+
+    [[nodiscard]] bool is_enabled(esp_log_level_t level, const char *tag) {
+        return level != ESP_LOG_NONE and level <= esp_log_level_get(tag);
+    }
+}// namespace
+
+extern "C" {
+
+void esp_log_level_set(const char *tag, esp_log_level_t level) {
+    auto &l = levels();
+    std::lock_guard<std::mutex> guard{l.lock};
+    if (std::strcmp(tag, "*") == 0) {
+        l.default_level = level;
+        l.tag_levels.clear();
+    } else {
+        l.tag_levels[tag] = level;
+    }
+}
+
+esp_log_level_t esp_log_level_get(const char *tag) {
+    auto &l = levels();
+    std::lock_guard<std::mutex> guard{l.lock};
+    if (const auto it = l.tag_levels.find(tag); it != std::end(l.tag_levels)) {
+        return it->second;
+    }
+    return l.default_level;
+}
+
+uint32_t esp_log_timestamp(void) {
+    static const auto t0 = std::chrono::steady_clock::now();
+    return uint32_t(std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - t0).count());
+}
+
+void esp_log_write(esp_log_level_t level, const char *tag, const char *format, ...) {
+    if (not is_enabled(level, tag)) {
+        return;
+    }
+    std::va_list args;
+    va_start(args, format);
+    std::fprintf(stderr, "%c (%u) %s: ", level_letter(level), unsigned(esp_log_timestamp()), tag);
+    std::vfprintf(stderr, format, args);
+    std::fputc('\n', stderr);
+    va_end(args);
+}
+
+void esp_log_buffer_hex_internal(const char *tag, const void *buffer, uint16_t buff_len, esp_log_level_t level) {
+    static constexpr std::size_t bytes_per_line = 16;
+    if (not is_enabled(level, tag)) {
+        return;
+    }
+    auto const *bytes = static_cast<std::uint8_t const *>(buffer);
+    char line[3 * bytes_per_line + 1];
+    for (std::size_t offset = 0; offset < buff_len; offset += bytes_per_line) {
+        const std::size_t n = std::min<std::size_t>(bytes_per_line, buff_len - offset);
+        for (std::size_t i = 0; i < n; ++i) {
+            std::snprintf(&line[3 * i], 4, "%02x ", bytes[offset + i]);
+        }
+        line[3 * n - 1] = '\0';
+        esp_log_write(level, tag, "%s", line);
+    }
+}
+}
+
+#endif
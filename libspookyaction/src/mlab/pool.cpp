@@ -8,11 +8,19 @@ namespace mlab {
 
     namespace {
         [[nodiscard]] shared_buffer_pool &default_buffer_pool_internal() {
-            static shared_buffer_pool _pool{std::make_shared<pool<bin_data>>()};
+#ifdef SPOOKY_STATIC_BUFFER_POOL
+            static shared_buffer_pool _pool{std::make_shared<pool<bin_data>>(default_buffer_size_classes(), pool_mode::preallocated)};
+#else
+            static shared_buffer_pool _pool{std::make_shared<pool<bin_data>>(default_buffer_size_classes())};
+#endif
             return _pool;
         }
     }// namespace
 
+    std::vector<pool_size_class> default_buffer_size_classes() {
+        return {{16, 4}, {64, 8}, {275, 4}};
+    }
+
     shared_buffer_pool default_buffer_pool() {
         // Use atomic variants for updating shared_ptr. In C++20, just replace with std::atomic<shared_buffer_pool>
         return std::atomic_load(&default_buffer_pool_internal());
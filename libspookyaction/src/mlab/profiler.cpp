@@ -0,0 +1,168 @@
+#include <mlab/log.h>
+#include <mlab/pool.hpp>
+#include <mlab/profiler.hpp>
+
+#if defined(SPOOKY_PROFILING) && defined(ESP_PLATFORM)
+#include <sdkconfig.h>
+#ifdef CONFIG_HEAP_USE_HOOKS
+extern "C" void esp_heap_trace_alloc_hook(void *, std::size_t size, std::uint32_t) {
+    mlab::note_allocation(size);
+}
+#endif
+#endif
+
+namespace mlab {
+
+    const char *probe_name(probe p) {
+        switch (p) {
+            case probe::tag_command:
+                return "tag command";
+            case probe::cipher_tx:
+                return "cipher tx";
+            case probe::cipher_rx:
+                return "cipher rx";
+            case probe::rf_exchange:
+                return "RF exchange";
+            case probe::channel_send:
+                return "channel send";
+            case probe::channel_receive:
+                return "channel receive";
+        }
+        return "UNKNOWN";
+    }
+
+    namespace impl {
+        allocation_counter &thread_allocations() {
+            thread_local allocation_counter counter{};
+            return counter;
+        }
+
+        probe_timer::probe_timer() : _begin{std::chrono::steady_clock::now()}, _allocations_at_begin{thread_allocations()} {}
+
+        void probe_timer::add_elapsed(std::chrono::microseconds &duration, allocation_counter &allocations) const {
+            duration += std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - _begin);
+            allocation_counter const &now = thread_allocations();
+            allocations.allocations += now.allocations - _allocations_at_begin.allocations;
+            allocations.bytes += now.bytes - _allocations_at_begin.bytes;
+        }
+    }// namespace impl
+
+    profiler &default_profiler() {
+        static profiler _profiler{};
+        return _profiler;
+    }
+
+    profiler::probe_data &profiler::data(probe p) {
+        return _data[static_cast<std::size_t>(p)];
+    }
+
+    profiler::probe_data const &profiler::data(probe p) const {
+        return _data[static_cast<std::size_t>(p)];
+    }
+
+    std::size_t profiler::histogram_bucket(std::uint32_t us) {
+        // Values below 4 have their own bucket, then each power of two is split in 4 buckets by the next two bits
+        if (us < 4) {
+            return us;
+        }
+        std::size_t log2 = 2;
+        while (log2 < 31 and (us >> (log2 + 1)) != 0) {
+            ++log2;
+        }
+        return 4 * (log2 - 1) + ((us >> (log2 - 2)) & 0b11);
+    }
+
+    std::uint32_t profiler::histogram_bucket_upper_bound(std::size_t idx) {
+        if (idx < 4) {
+            return std::uint32_t(idx);
+        }
+        const std::size_t log2 = idx / 4 + 1;
+        const std::uint64_t upper = (std::uint64_t(4 + idx % 4 + 1) << (log2 - 2)) - 1;
+        return std::uint32_t(std::min<std::uint64_t>(upper, std::numeric_limits<std::uint32_t>::max()));
+    }
+
+    void profiler::record(probe p, std::chrono::microseconds duration, std::size_t allocations, std::size_t allocated_bytes) {
+        const auto us = std::uint32_t(std::clamp<std::chrono::microseconds::rep>(duration.count(), 0, std::numeric_limits<std::uint32_t>::max()));
+        probe_data &d = data(p);
+        d.count.fetch_add(1, std::memory_order_relaxed);
+        d.total_us.fetch_add(us, std::memory_order_relaxed);
+        d.allocations.fetch_add(std::uint32_t(allocations), std::memory_order_relaxed);
+        d.allocated_bytes.fetch_add(allocated_bytes, std::memory_order_relaxed);
+        d.histogram[histogram_bucket(us)].fetch_add(1, std::memory_order_relaxed);
+        impl::atomic_store_max(d.max_us, us);
+        // Same as atomic_store_max, for the minimum
+        std::uint32_t current_min = d.min_us.load(std::memory_order_relaxed);
+        while (us < current_min and not d.min_us.compare_exchange_weak(current_min, us, std::memory_order_relaxed)) {
+        }
+    }
+
+    std::array<std::uint32_t, profiler::histogram_buckets> profiler::histogram(probe p) const {
+        std::array<std::uint32_t, histogram_buckets> retval{};
+        probe_data const &d = data(p);
+        for (std::size_t i = 0; i < histogram_buckets; ++i) {
+            retval[i] = d.histogram[i].load(std::memory_order_relaxed);
+        }
+        return retval;
+    }
+
+    probe_stats profiler::stats(probe p) const {
+        probe_stats retval{};
+        probe_data const &d = data(p);
+        retval.count = d.count.load(std::memory_order_relaxed);
+        if (retval.count == 0) {
+            return retval;
+        }
+        retval.total = std::chrono::microseconds{d.total_us.load(std::memory_order_relaxed)};
+        retval.min = std::chrono::microseconds{d.min_us.load(std::memory_order_relaxed)};
+        retval.max = std::chrono::microseconds{d.max_us.load(std::memory_order_relaxed)};
+        retval.allocations = d.allocations.load(std::memory_order_relaxed);
+        retval.allocated_bytes = d.allocated_bytes.load(std::memory_order_relaxed);
+
+        // Use the histogram count rather than retval.count, a concurrent record might have updated only one of them
+        const auto hist = histogram(p);
+        std::uint64_t hist_count = 0;
+        for (std::uint32_t n : hist) {
+            hist_count += n;
+        }
+        const auto percentile = [&](std::uint64_t permille) -> std::chrono::microseconds {
+            const std::uint64_t rank = std::max<std::uint64_t>(1, (hist_count * permille + 999) / 1000);
+            std::uint64_t cumulative = 0;
+            for (std::size_t i = 0; i < histogram_buckets; ++i) {
+                cumulative += hist[i];
+                if (cumulative >= rank) {
+                    return std::min(std::chrono::microseconds{histogram_bucket_upper_bound(i)}, retval.max);
+                }
+            }
+            return retval.max;
+        };
+        retval.p50 = percentile(500);
+        retval.p99 = percentile(990);
+        return retval;
+    }
+
+    void profiler::reset() {
+        for (probe_data &d : _data) {
+            d.count.store(0, std::memory_order_relaxed);
+            d.total_us.store(0, std::memory_order_relaxed);
+            d.min_us.store(std::numeric_limits<std::uint32_t>::max(), std::memory_order_relaxed);
+            d.max_us.store(0, std::memory_order_relaxed);
+            d.allocations.store(0, std::memory_order_relaxed);
+            d.allocated_bytes.store(0, std::memory_order_relaxed);
+            for (auto &bucket : d.histogram) {
+                bucket.store(0, std::memory_order_relaxed);
+            }
+        }
+    }
+
+    void profiler::log_summary() const {
+        for (std::size_t i = 0; i < probe_count; ++i) {
+            const auto p = static_cast<probe>(i);
+            if (const auto s = stats(p); s.count > 0) {
+                ESP_LOGI("MLAB", "%-15s %5u samples, mean %6u us, p50 %6u us, p99 %6u us, max %6u us, %u allocations (%u B).",
+                         probe_name(p), unsigned(s.count), unsigned(s.mean().count()), unsigned(s.p50.count()),
+                         unsigned(s.p99.count()), unsigned(s.max.count()), unsigned(s.allocations), unsigned(s.allocated_bytes));
+            }
+        }
+    }
+
+}// namespace mlab
@@ -0,0 +1,27 @@
+#include <mlab/random.hpp>
+
+#ifdef ESP_PLATFORM
+#include <esp_system.h>
+#else
+#include <random>
+#endif
+
+namespace mlab {
+
+#ifdef ESP_PLATFORM
+    void fill_random(std::uint8_t *data, std::size_t length) {
+        esp_fill_random(data, length);
+    }
+#else
+    void fill_random(std::uint8_t *data, std::size_t length) {
+        static thread_local std::random_device rng{};
+        for (std::size_t i = 0; i < length; i += sizeof(std::random_device::result_type)) {
+            const auto word = rng();
+            for (std::size_t j = 0; j < sizeof(word) and i + j < length; ++j) {
+                data[i + j] = std::uint8_t(word >> (8 * j));
+            }
+        }
+    }
+#endif
+
+}// namespace mlab
@@ -0,0 +1,151 @@
+#include <algorithm>
+#include <chrono>
+#include <limits>
+#include <mlab/log.h>
+#include <mlab/trace.hpp>
+
+namespace mlab {
+
+    namespace {
+        constexpr std::array<std::uint8_t, 3> dump_magic = {'T', 'R', 0x01 /* version */};
+    }
+
+    const char *trace_event_name(trace_event e) {
+        switch (e) {
+            case trace_event::link_tx:
+                return "link >>";
+            case trace_event::link_rx:
+                return "link <<";
+            case trace_event::pcd_tx:
+                return "pcd >>";
+            case trace_event::pcd_rx:
+                return "pcd <<";
+            case trace_event::crypto:
+                return "crypto";
+            case trace_event::status:
+                return "status";
+        }
+        return "UNKNOWN";
+    }
+
+    trace_ring &default_trace() {
+        static trace_ring _trace{};
+        return _trace;
+    }
+
+    trace_ring::trace_ring(std::size_t capacity)
+        : _capacity{std::max<std::size_t>(1, capacity)},
+          _slots{std::make_unique<slot[]>(_capacity)},
+          _next{0} {}
+
+    std::size_t trace_ring::capacity() const {
+        return _capacity;
+    }
+
+    std::size_t trace_ring::total_records() const {
+        return _next.load(std::memory_order_relaxed);
+    }
+
+    trace_record &trace_ring::begin_record(std::size_t &sequence, trace_event e, std::uint8_t arg, std::size_t length) {
+        sequence = _next.fetch_add(1, std::memory_order_relaxed) + 1;
+        slot &s = _slots[(sequence - 1) % _capacity];
+        s.sequence.store(0, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        s.rec.timestamp_us = std::uint32_t(std::chrono::duration_cast<std::chrono::microseconds>(
+                                                   std::chrono::steady_clock::now().time_since_epoch())
+                                                   .count());
+        s.rec.event = e;
+        s.rec.arg = arg;
+        s.rec.length = std::uint16_t(std::min<std::size_t>(length, std::numeric_limits<std::uint16_t>::max()));
+        return s.rec;
+    }
+
+    void trace_ring::end_record(std::size_t sequence) {
+        _slots[(sequence - 1) % _capacity].sequence.store(sequence, std::memory_order_release);
+    }
+
+    void trace_ring::record(trace_event e, std::uint8_t arg, range<std::uint8_t const *> data) {
+        std::size_t sequence = 0;
+        trace_record &rec = begin_record(sequence, e, arg, data.size());
+        rec.data_length = std::uint8_t(std::min(data.size(), trace_record::max_data_length));
+        std::copy_n(std::begin(data), rec.data_length, std::begin(rec.data));
+        end_record(sequence);
+    }
+
+    void trace_ring::record(trace_event e, std::uint8_t arg, std::size_t length) {
+        std::size_t sequence = 0;
+        begin_record(sequence, e, arg, length).data_length = 0;
+        end_record(sequence);
+    }
+
+    std::vector<trace_record> trace_ring::snapshot() const {
+        const std::size_t next = _next.load(std::memory_order_acquire);
+        const std::size_t first = next > _capacity ? next - _capacity : 0;
+        std::vector<trace_record> retval{};
+        retval.reserve(next - first);
+        for (std::size_t i = first; i < next; ++i) {
+            slot const &s = _slots[i % _capacity];
+            // Seqlock read: discard the record if it was being written while copying
+            const std::size_t sequence = s.sequence.load(std::memory_order_acquire);
+            const trace_record rec = s.rec;
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (sequence == i + 1 and s.sequence.load(std::memory_order_relaxed) == sequence) {
+                retval.push_back(rec);
+            }
+        }
+        return retval;
+    }
+
+    void trace_ring::clear() {
+        for (std::size_t i = 0; i < _capacity; ++i) {
+            _slots[i].sequence.store(0, std::memory_order_relaxed);
+        }
+        _next.store(0, std::memory_order_release);
+    }
+
+    bin_data trace_ring::dump() const {
+        const auto records = snapshot();
+        bin_data retval{};
+        retval << prealloc(dump_magic.size() + records.size() * (9 + trace_record::max_data_length)) << dump_magic;
+        for (trace_record const &rec : records) {
+            retval << lsb32 << rec.timestamp_us << rec.event << rec.arg << lsb16 << rec.length << rec.data_length << rec.data_view();
+        }
+        return retval;
+    }
+
+    std::vector<trace_record> trace_ring::decode(bin_data const &dumped) {
+        bin_stream s{dumped};
+        std::array<std::uint8_t, dump_magic.size()> magic{};
+        s >> magic;
+        if (s.bad() or magic != dump_magic) {
+            ESP_LOGE("MLAB", "Not a trace dump.");
+            return {};
+        }
+        std::vector<trace_record> retval{};
+        while (s.good()) {
+            trace_record rec{};
+            s >> lsb32 >> rec.timestamp_us >> rec.event >> rec.arg >> lsb16 >> rec.length >> rec.data_length;
+            if (rec.data_length > trace_record::max_data_length or s.remaining() < rec.data_length) {
+                s.set_bad();
+            } else {
+                s.read(std::begin(rec.data), rec.data_length);
+            }
+            if (s.bad()) {
+                ESP_LOGE("MLAB", "Truncated trace dump.");
+                return {};
+            }
+            retval.push_back(rec);
+        }
+        return retval;
+    }
+
+    void trace_ring::log_records() const {
+        for (trace_record const &rec : snapshot()) {
+            ESP_LOGI("MLAB", "%10u us %-8s %02x %4u B", unsigned(rec.timestamp_us), trace_event_name(rec.event), rec.arg, rec.length);
+            if (not rec.data_view().empty()) {
+                ESP_LOG_BUFFER_HEX_LEVEL("MLAB", rec.data.data(), rec.data_length, ESP_LOG_INFO);
+            }
+        }
+    }
+
+}// namespace mlab
@@ -2,11 +2,15 @@
 // Created by spak on 3/3/21.
 //
 
+#include <algorithm>
+#include <numeric>
 #include <pn532/bits_algo.hpp>
 #include <pn532/channel.hpp>
+#include <utility>
 
 namespace pn532 {
     using mlab::bin_stream;
+    using mlab::make_range;
     using mlab::prealloc;
     using mlab::reduce_timeout;
     using mlab::result_success;
@@ -30,6 +34,54 @@ namespace pn532 {
             return skipped_data;
         }
 
+        /**
+         * Total length of an info frame carrying @p data_length bytes of data (with preamble and postamble).
+         */
+        [[nodiscard]] constexpr std::size_t info_frame_total_length(std::size_t data_length) {
+            const std::size_t body_length = data_length + 2 /* transport info + command code */;
+            return 1 /* preamble */ + bits::start_of_packet_code.size() + (body_length > 0xff ? 5 : 2) /* length and checksum */ + body_length + 1 /* checksum */ + 1 /* postamble */;
+        }
+
+        /**
+         * Length of the response frame to those commands that have a fixed length response (UM0701-02 §7).
+         * @return The total frame length, or zero if the length of the response is variable.
+         */
+        [[nodiscard]] std::size_t fixed_response_length(bits::command cmd, std::size_t request_size) {
+            switch (cmd) {
+                case bits::command::get_firmware_version:
+                    return info_frame_total_length(4);
+                case bits::command::read_register:
+                    // One byte per 16 bits register address requested
+                    return info_frame_total_length(request_size / 2);
+                case bits::command::read_gpio:
+                    return info_frame_total_length(3);
+                case bits::command::power_down:
+                    [[fallthrough]];
+                case bits::command::in_psl:
+                    [[fallthrough]];
+                case bits::command::in_select:
+                    [[fallthrough]];
+                case bits::command::in_deselect:
+                    [[fallthrough]];
+                case bits::command::in_release:
+                    return info_frame_total_length(1);
+                case bits::command::write_register:
+                    [[fallthrough]];
+                case bits::command::write_gpio:
+                    [[fallthrough]];
+                case bits::command::set_serial_baudrate:
+                    [[fallthrough]];
+                case bits::command::set_parameters:
+                    [[fallthrough]];
+                case bits::command::sam_configuration:
+                    [[fallthrough]];
+                case bits::command::rf_configuration:
+                    return info_frame_total_length(0);
+                default:
+                    return 0;
+            }
+        }
+
     }// namespace
 
     bin_data &operator<<(bin_data &bd, frame<frame_type::ack> const &) {
@@ -59,30 +111,28 @@ namespace pn532 {
     }
 
     bin_data &operator<<(bin_data &bd, frame<frame_type::info> const &f) {
-        const bool use_extended = f.data.size() > (0xff - 2 /* transport info + command code */);
-        const std::uint8_t checksum_init = static_cast<std::uint8_t>(bits::transport::host_to_pn532) + static_cast<std::uint8_t>(f.command);
+        return bd << info_frame_view{f.transport, f.command, f.data.view()};
+    }
+
+    bin_data &operator<<(bin_data &bd, info_frame_view const &f) {
+        auto const truncated_data = make_range(std::begin(f.data), std::begin(f.data) + std::min(f.data.size(), bits::max_firmware_data_length));
+        const bool use_extended = truncated_data.size() > (0xff - 2 /* transport info + command code */);
+        const std::uint8_t checksum_init = static_cast<std::uint8_t>(f.transport) + static_cast<std::uint8_t>(f.command);
+        bd << prealloc(12 + truncated_data.size())
+           << bits::preamble << bits::start_of_packet_code;
         if (use_extended) {
-            auto const truncated_data = f.data.view(0, std::min(f.data.size(), bits::max_firmware_data_length));
-            return bd << prealloc(12 + f.data.size())
-                      << bits::preamble << bits::start_of_packet_code
-                      << bits::fixed_extended_packet_length
-                      << bits::length_and_checksum_long(truncated_data.size() + 2)
-                      << f.transport
-                      << f.command
-                      << truncated_data
-                      << bits::compute_checksum(checksum_init, std::begin(truncated_data), std::end(truncated_data))
-                      << bits::postamble;
+            bd << bits::fixed_extended_packet_length
+               << bits::length_and_checksum_long(truncated_data.size() + 2);
         } else {
-            return bd << prealloc(9 + f.data.size())
-                      << bits::preamble << bits::start_of_packet_code
-                      << bits::length_and_checksum_short(f.data.size() + 2)
-                      << f.transport
-                      << f.command
-                      << f.data
-                      << bits::compute_checksum(checksum_init, std::begin(f.data), std::end(f.data))
-                      << bits::postamble;
+            bd << bits::length_and_checksum_short(truncated_data.size() + 2);
         }
+        return bd << f.transport
+                  << f.command
+                  << truncated_data
+                  << bits::compute_checksum(checksum_init, std::begin(truncated_data), std::end(truncated_data))
+                  << bits::postamble;
     }
+
     bin_data &operator<<(bin_data &bd, any_frame const &f) {
         switch (f.type()) {
             case frame_type::ack:
@@ -227,7 +277,225 @@ namespace pn532 {
     }
 
 
-    channel::comm_operation::comm_operation(channel &owner, comm_mode event, ms timeout) : _owner{owner}, _event{event}, _result{result_success} {
+    frame_decoder::frame_decoder() : _state{state::start_of_packet},
+                                     _id{},
+                                     _consumed{0},
+                                     _sop_offset{0},
+                                     _header{},
+                                     _header_size{0},
+                                     _body_read{0},
+                                     _body_sum{0},
+                                     _info_frame{} {}
+
+    void frame_decoder::reset() {
+        _state = state::start_of_packet;
+        _id = frame_id{};
+        _consumed = 0;
+        _sop_offset = 0;
+        _header_size = 0;
+        _body_read = 0;
+        _body_sum = 0;
+        // The data storage is kept, and cleared when the body of the next info frame begins
+    }
+
+    void frame_decoder::use_data_storage(bin_data storage) {
+        _info_frame.data = std::move(storage);
+    }
+
+    bin_data frame_decoder::release_data_storage() {
+        return std::move(_info_frame.data);
+    }
+
+    std::size_t frame_decoder::bytes_needed() const {
+        switch (_state) {
+            case state::start_of_packet:
+                // Any frame has at least two more bytes past the start of packet code
+                return bits::start_of_packet_code.size() - _header_size + 2;
+            case state::code_or_length:
+                return 2 - _header_size;
+            case state::extended_length:
+                return 3 - _header_size;
+            case state::body:
+                return _id.info_frame_data_size - _body_read + 1 /* checksum */ + (_id.has_preamble ? 1 : 0);
+            case state::body_checksum:
+                return _id.has_preamble ? 2 : 1;
+            case state::postamble:
+                return 1;
+            default:
+                return 0;
+        }
+    }
+
+    any_frame frame_decoder::pop_frame() {
+        if (_state != state::done) {
+            PN532_LOGE("Attempt to extract a frame from a decoder that is not done.");
+        }
+        switch (_id.type) {
+            case frame_type::ack:
+                return frame<frame_type::ack>{};
+            case frame_type::nack:
+                return frame<frame_type::nack>{};
+            case frame_type::info:
+                return std::move(_info_frame);
+            default:
+                return frame<frame_type::error>{};
+        }
+    }
+
+    std::size_t frame_decoder::feed(mlab::range<bin_data::const_iterator> data) {
+        auto it = std::begin(data);
+        while (it != std::end(data) and _state != state::done and _state != state::failed) {
+            if (_state == state::body and _body_read >= 2) {
+                consume_body(it, std::end(data));
+            } else {
+                consume(*it++);
+            }
+        }
+        // Keep the frame id up to date, it is a lower bound
+        if (_state != state::failed) {
+            _id.frame_total_length = _consumed + bytes_needed();
+        }
+        return std::distance(std::begin(data), it);
+    }
+
+    void frame_decoder::consume_body(bin_data::const_iterator &it, bin_data::const_iterator end) {
+        const auto n = std::min(std::size_t(std::distance(it, end)), _id.info_frame_data_size - _body_read);
+        const auto chunk = make_range(it, std::next(it, n));
+        _body_sum = std::accumulate(std::begin(chunk), std::end(chunk), _body_sum);
+        _info_frame.data << chunk;
+        _body_read += n;
+        _consumed += n;
+        std::advance(it, n);
+        if (_body_read >= _id.info_frame_data_size) {
+            _state = state::body_checksum;
+        }
+    }
+
+    void frame_decoder::consume(std::uint8_t b) {
+        ++_consumed;
+        switch (_state) {
+            case state::start_of_packet:
+                // _header_size tracks how many bytes of the start of packet code have been matched
+                if (b == bits::start_of_packet_code[_header_size]) {
+                    ++_header_size;
+                } else if (b == bits::start_of_packet_code.front()) {
+                    _header_size = 1;
+                } else {
+                    _header_size = 0;
+                }
+                if (_header_size == bits::start_of_packet_code.size()) {
+                    _sop_offset = _consumed - bits::start_of_packet_code.size();
+                    // Preamble is anything that precedes that packet.
+                    _id.has_preamble = _sop_offset > 0;
+                    _header_size = 0;
+                    _state = state::code_or_length;
+                } else if (_consumed - _header_size >= max_start_of_packet_offset) {
+                    PN532_LOGE("Unable to identify start of packet.");
+                    _state = state::failed;
+                }
+                break;
+            case state::code_or_length:
+                _header[_header_size++] = b;
+                if (_header_size == 2) {
+                    const std::array<std::uint8_t, 2> code_or_length{_header[0], _header[1]};
+                    _header_size = 0;
+                    if (code_or_length == bits::ack_packet_code or code_or_length == bits::nack_packet_code) {
+                        _id.type = code_or_length == bits::ack_packet_code ? frame_type::ack : frame_type::nack;
+                        _state = _id.has_preamble ? state::postamble : state::done;
+                    } else if (code_or_length == bits::fixed_extended_packet_length) {
+                        _id.type = frame_type::info;
+                        _state = state::extended_length;
+                    } else {
+                        _id.type = frame_type::info;
+                        if (const auto [length, checksum_pass] = bits::check_length_checksum(code_or_length); checksum_pass) {
+                            _id.info_frame_data_size = length;
+                            _state = length > 0 ? state::body : state::body_checksum;
+                        } else {
+                            PN532_LOGE("Length checksum failed.");
+                            _state = state::failed;
+                        }
+                    }
+                }
+                break;
+            case state::extended_length:
+                _header[_header_size++] = b;
+                if (_header_size == 3) {
+                    _header_size = 0;
+                    if (const auto [length, checksum_pass] = bits::check_length_checksum(_header); checksum_pass) {
+                        _id.info_frame_data_size = length;
+                        _state = length > 0 ? state::body : state::body_checksum;
+                    } else {
+                        PN532_LOGE("Length checksum failed.");
+                        _state = state::failed;
+                    }
+                }
+                break;
+            case state::body:
+                _body_sum += b;
+                if (_body_read == 0) {
+                    // Store it, it may be the error code of an error frame
+                    _header[0] = b;
+                    _info_frame.transport = static_cast<bits::transport>(b);
+                    _info_frame.data.clear();
+                    _info_frame.data << prealloc(_id.info_frame_data_size - std::min(_id.info_frame_data_size, std::size_t(2)));
+                } else if (_body_read == 1) {
+                    if (_info_frame.transport == bits::transport::pn532_to_host) {
+                        _info_frame.command = bits::pn532_to_host_command(b);
+                    } else {
+                        _info_frame.command = static_cast<bits::command>(b);
+                    }
+                }
+                if (++_body_read >= _id.info_frame_data_size) {
+                    _state = state::body_checksum;
+                }
+                break;
+            case state::body_checksum:
+                if (std::uint8_t(_body_sum + b) != 0) {
+                    PN532_LOGE("Frame body checksum failed.");
+                    _state = state::failed;
+                    break;
+                }
+                _state = _id.has_preamble ? state::postamble : state::done;
+                break;
+            case state::postamble:
+                if (b != bits::postamble) {
+                    PN532_LOGW("Invalid postamble: %02x.", b);
+                }
+                _state = state::done;
+                break;
+            default:
+                break;
+        }
+        if (_state == state::done) {
+            complete_frame();
+        }
+    }
+
+    void frame_decoder::complete_frame() {
+        switch (_id.type) {
+            case frame_type::ack:
+                [[fallthrough]];
+            case frame_type::nack:
+                break;
+            default:
+                // This could be a special error frame
+                if (_id.info_frame_data_size == 1 and _header[0] == bits::specific_app_level_err_code) {
+                    PN532_LOGW("Received failure from controller.");
+                    _id.type = frame_type::error;
+                } else if (_id.info_frame_data_size < 2) {
+                    // All info known frames must have the transport and the command
+                    PN532_LOGE("Cannot parse frame body if frame length %u is less than 2.", _id.info_frame_data_size);
+                    _state = state::failed;
+                }
+                break;
+        }
+    }
+
+    channel::comm_operation::comm_operation(channel &owner, comm_mode event, ms timeout)
+        : _owner{owner},
+          _event{event},
+          _result{result_success},
+          _profile{event == comm_mode::send ? mlab::probe::channel_send : mlab::probe::channel_receive} {
         if (_owner._has_operation) {
             PN532_LOGE("Nested comm_operation instantiated: a channel can only run one at a time.");
         }
@@ -259,23 +527,44 @@ namespace pn532 {
     }
 
     channel::result<any_frame> channel::receive(ms timeout) {
+        frame_decoder decoder{};
+        if (const auto res_recv = receive(decoder, timeout); res_recv) {
+            return decoder.pop_frame();
+        } else {
+            return res_recv.error();
+        }
+    }
+
+    channel::result<> channel::receive(frame_decoder &decoder, ms timeout, std::size_t expected_length) {
         switch (raw_receive_mode()) {
             case receive_mode::stream:
-                return receive_stream(timeout);
+                return receive_stream(decoder, timeout);
             case receive_mode::buffered:
-                return receive_restart(timeout);
+                return receive_restart(decoder, timeout, expected_length);
         }
         return error::comm_error;
     }
 
     channel::channel(mlab::shared_buffer_pool buffer_pool)
         : _buffer_pool{buffer_pool ? std::move(buffer_pool) : mlab::default_buffer_pool()},
-          _has_operation{false} {}
-
-    channel::result<> channel::send(any_frame const &frame, ms timeout) {
+          _has_operation{false},
+          _defer_trailing_ack{false},
+          _ack_pending{false},
+          _deferred_ack_stats{},
+          _predict_response_length{true},
+          _expected_response_length{0},
+          _learned_response_lengths{},
+          _response_length_stats{} {}
+
+    template <class Frame>
+    channel::result<> channel::send_frame(Frame const &frame, std::size_t frame_length, ms timeout) {
         reduce_timeout rt{timeout};
-        auto buffer = _buffer_pool->take();
+        auto buffer = _buffer_pool->take_sized(frame_length);
+        if (not buffer) {
+            return error::out_of_buffers;
+        }
         buffer << frame;
+        mlab::trace(mlab::trace_event::link_tx, 0, *buffer);
         if (comm_operation op{*this, comm_mode::send, rt.remaining()}; op.ok()) {
             return op.update(raw_send(buffer->view(), rt.remaining()));
         } else {
@@ -283,12 +572,31 @@ namespace pn532 {
         }
     }
 
+    channel::result<> channel::send(any_frame const &frame, ms timeout) {
+        // Mostly ACK and NACK frames, which fit the smallest buffers
+        return send_frame(frame, frame.type() == frame_type::info ? info_frame_total_length(bits::max_firmware_data_length) : 0, timeout);
+    }
+
+    channel::result<> channel::send(frame<frame_type::ack> const &frame, ms timeout) {
+        return send_frame(frame, 0, timeout);
+    }
+
+    channel::result<> channel::send(frame<frame_type::nack> const &frame, ms timeout) {
+        return send_frame(frame, 0, timeout);
+    }
+
+    channel::result<> channel::send(info_frame_view const &frame, ms timeout) {
+        return send_frame(frame, info_frame_total_length(frame.data.size()), timeout);
+    }
+
     channel::result<> channel::receive_ack(bool ack_value, ms timeout) {
-        if (auto const res_recv = receive(timeout); res_recv) {
-            if (res_recv->type() == (ack_value ? frame_type::ack : frame_type::nack)) {
+        // Check the frame type in the decoder, there is no need to extract the frame
+        frame_decoder decoder{};
+        if (auto const res_recv = receive(decoder, timeout); res_recv) {
+            if (decoder.type() == (ack_value ? frame_type::ack : frame_type::nack)) {
                 return result_success;
             } else {
-                PN532_LOGE("Expected %s, got %s.", (ack_value ? "ack" : "nack"), to_string(res_recv->type()));
+                PN532_LOGE("Expected %s, got %s.", (ack_value ? "ack" : "nack"), to_string(decoder.type()));
                 return error::comm_error;
             }
         } else {
@@ -298,53 +606,46 @@ namespace pn532 {
 
     channel::result<> channel::send_ack(bool ack_value, ms timeout) {
         if (ack_value) {
+            // Any pending ACK is superseded by this one
+            _ack_pending = false;
             return send(frame<frame_type::ack>{}, timeout);
         } else {
             return send(frame<frame_type::nack>{}, timeout);
         }
     }
 
-    channel::result<any_frame> channel::receive_restart(ms timeout) {
+    channel::result<> channel::receive_restart(frame_decoder &decoder, ms timeout, std::size_t expected_length) {
         reduce_timeout rt{timeout};
-        auto buffer = _buffer_pool->take();
-        bin_stream s{*buffer};
-        // Repeatedly fetch the data until you have determined the frame length
-        frame_id id{};
+        // The PN532 may retransmit up to the longest frame
+        auto buffer = _buffer_pool->take_sized(info_frame_total_length(bits::max_firmware_data_length));
+        if (not buffer) {
+            return error::out_of_buffers;
+        }
+        // Read more than the minimum frame length, we will exploit this to reuce the number of nacks
+        std::size_t read_length = std::max(frame_id::max_min_info_frame_header_length, expected_length);
+        std::size_t nacks_sent = 0;
+        if (expected_length > frame_id::max_min_info_frame_header_length) {
+            ++_response_length_stats.predicted;
+        }
 
-        while (buffer->size() < id.frame_total_length) {
-            // Prepare the buffer and receive the whole frame
-            if (buffer->empty()) {
-                // Read more than the minimum frame length, we will exploit this to reuce the number of nacks
-                buffer->resize(frame_id::max_min_info_frame_header_length);
-            } else {
-                buffer->resize(id.frame_total_length);
-            }
+        while (true) {
+            // The PN532 retransmits the whole frame, decode from scratch
+            decoder.reset();
+            buffer->resize(read_length);
             if (comm_operation op{*this, comm_mode::receive, rt.remaining()}; op.ok()) {
                 if (auto const res_recv = raw_receive(buffer->view(), rt.remaining()); res_recv) {
-                    // Attempt to reparse the frame
-                    s.seek(0);
-                    s >> id;
-                    if (s.bad()) {
-                        PN532_LOGE("Could not identify frame from received data.");
+                    mlab::trace(mlab::trace_event::link_rx, 0, *buffer);
+                    // Any data past the frame boundary is not relevant in buffered mode
+                    decoder.feed(buffer->view());
+                    if (decoder.failed()) {
+                        PN532_LOGE("Could not parse frame from data.");
+                        PN532_LOG_BUFFER_HEX_LEVEL(PN532_TAG, buffer->data(), buffer->size(), ESP_LOG_DEBUG);
                         return op.update(error::comm_malformed);
-                    }
-                    // Do we finally have enough?
-                    if (buffer->size() >= id.frame_total_length) {
-                        // Truncate any leftover data we may have read extra
-                        buffer->resize(id.frame_total_length);
-                        // Now we have enough data to read the command entirely.
-                        any_frame f{};
-                        std::tie(s, id) >> f;
-                        if (s.bad()) {
-                            PN532_LOGE("Could not parse frame from data.");
-                            ESP_LOG_BUFFER_HEX_LEVEL(PN532_TAG, buffer->data(), buffer->size(), ESP_LOG_DEBUG);
-                            return op.update(error::comm_malformed);
-                        } else if (not s.eof()) {
-                            PN532_LOGW("Stray data in frame (%d bytes)", s.remaining());
-                            auto const view = s.peek();
-                            ESP_LOG_BUFFER_HEX_LEVEL(PN532_TAG, view.data(), view.size(), ESP_LOG_WARN);
+                    } else if (decoder.done()) {
+                        if (nacks_sent == 0 and decoder.id().frame_total_length > frame_id::max_min_info_frame_header_length) {
+                            ++_response_length_stats.nacks_avoided;
                         }
-                        return op.update<any_frame>(std::move(f));
+                        return op.update(result_success);
                     }
                 } else {
                     return op.update(res_recv.error());
@@ -352,60 +653,100 @@ namespace pn532 {
             } else {
                 return op.error();
             }
+            // Now we know at least that much
+            read_length = decoder.id().frame_total_length;
             // Send NACK
             if (const auto res_nack = send_ack(false, rt.remaining()); not res_nack) {
                 return res_nack.error();
             }
+            ++nacks_sent;
+            ++_response_length_stats.nacks_sent;
         }
-        PN532_LOGE("Control reached impossible location.");
-        return error::comm_error;
     }
 
-    channel::result<any_frame> channel::receive_stream(ms timeout) {
+    channel::result<> channel::receive_stream(frame_decoder &decoder, ms timeout) {
         reduce_timeout rt{timeout};
         if (comm_operation op{*this, comm_mode::receive, rt.remaining()}; op.ok()) {
-            auto buffer = _buffer_pool->take();
-            bin_stream s{*buffer};
-            // Repeatedly fetch the data until you have determined the frame length
-            frame_id id{};
-            while (rt and buffer->size() < id.frame_total_length) {
-                // Repeatedly request more bytes
-                const std::size_t old_size = buffer->size();
-                buffer->resize(id.frame_total_length);
-                if (auto res_recv = raw_receive(buffer->view(old_size), rt.remaining()); not res_recv) {
+            auto buffer = _buffer_pool->take_sized(info_frame_total_length(bits::max_firmware_data_length));
+            if (not buffer) {
+                return op.update(error::out_of_buffers);
+            }
+            decoder.reset();
+            // Repeatedly request exactly as many bytes as the decoder can consume without reading past the frame
+            while (not decoder.done()) {
+                if (not rt) {
+                    return op.update(error::comm_timeout);
+                }
+                buffer->resize(decoder.bytes_needed());
+                if (auto res_recv = raw_receive(buffer->view(), rt.remaining()); not res_recv) {
                     return op.update(res_recv.error());
                 }
-                // Attempt to reparse the frame
-                s.seek(0);
-                s >> id;
-                if (s.bad()) {
-                    PN532_LOGE("Could not identify frame from received data.");
+                mlab::trace(mlab::trace_event::link_rx, 0, *buffer);
+                decoder.feed(buffer->view());
+                if (decoder.failed()) {
+                    PN532_LOGE("Could not parse frame from data.");
+                    PN532_LOG_BUFFER_HEX_LEVEL(PN532_TAG, buffer->data(), buffer->size(), ESP_LOG_DEBUG);
                     return op.update(error::comm_malformed);
                 }
             }
-            // Now we have enough data to read the command entirely.
-            any_frame f{};
-            std::tie(s, id) >> f;
-            if (s.bad()) {
-                PN532_LOGE("Could not parse frame from data.");
-                ESP_LOG_BUFFER_HEX_LEVEL(PN532_TAG, buffer->data(), buffer->size(), ESP_LOG_DEBUG);
-                return op.update(error::comm_malformed);
-            } else if (not s.eof()) {
-                PN532_LOGW("Stray data in frame (%d bytes)", s.remaining());
-                auto const view = s.peek();
-                ESP_LOG_BUFFER_HEX_LEVEL(PN532_TAG, view.data(), view.size(), ESP_LOG_WARN);
-            }
-            return op.update<any_frame>(std::move(f));
+            return op.update(result_success);
         } else {
             return op.error();
         }
     }
 
 
-    channel::result<> channel::command(bits::command cmd, bin_data data, ms timeout) {
+    void channel::set_defer_trailing_ack(bool v) {
+        _defer_trailing_ack = v;
+    }
+
+    channel::result<> channel::flush_deferred_ack(ms timeout) {
+        if (not _ack_pending) {
+            return result_success;
+        }
+        const auto t_begin = std::chrono::steady_clock::now();
+        auto res_ack = send_ack(true, timeout);
+        _deferred_ack_stats.time_saved += std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - t_begin);
+        ++_deferred_ack_stats.flushed;
+        return res_ack;
+    }
+
+    void channel::set_predict_response_length(bool v) {
+        _predict_response_length = v;
+    }
+
+    std::size_t channel::predicted_response_length(bits::command cmd, std::size_t request_size) const {
+        if (const auto fixed_length = fixed_response_length(cmd, request_size); fixed_length > 0) {
+            return fixed_length;
+        }
+        auto it = std::find_if(std::begin(_learned_response_lengths), std::end(_learned_response_lengths),
+                               [&](learned_response_length const &entry) { return entry.command == cmd; });
+        return it != std::end(_learned_response_lengths) ? it->frame_length : 0;
+    }
+
+    void channel::learn_response_length(bits::command cmd, std::size_t frame_length) {
+        if (fixed_response_length(cmd, 0) > 0) {
+            return;
+        }
+        // Never predict more than the largest possible frame
+        frame_length = std::min(frame_length, info_frame_total_length(bits::max_firmware_data_length));
+        auto it = std::find_if(std::begin(_learned_response_lengths), std::end(_learned_response_lengths),
+                               [&](learned_response_length const &entry) { return entry.command == cmd; });
+        if (it == std::end(_learned_response_lengths)) {
+            _learned_response_lengths.push_back({cmd, frame_length});
+        } else {
+            it->frame_length = std::max(it->frame_length, frame_length);
+        }
+    }
+
+    channel::result<> channel::command(bits::command cmd, mlab::range<bin_data::const_iterator> data, ms timeout) {
         reduce_timeout rt{timeout};
-        frame<frame_type::info> f{bits::transport::host_to_pn532, cmd, std::move(data)};
-        if (auto const res_send = send(std::move(f), rt.remaining()); not res_send) {
+        if (const auto res_flush = flush_deferred_ack(rt.remaining()); not res_flush) {
+            // This is the same as failing the trailing ACK in the previous response, which we do not check
+            PN532_LOGW("Could not send deferred ACK: %s.", to_string(res_flush.error()));
+        }
+        _expected_response_length = _predict_response_length ? predicted_response_length(cmd, data.size()) : 0;
+        if (auto const res_send = send(info_frame_view{bits::transport::host_to_pn532, cmd, data}, rt.remaining()); not res_send) {
             return res_send.error();
         } else {
             return receive_ack(true, rt.remaining());
@@ -413,17 +754,38 @@ namespace pn532 {
     }
 
     channel::result<bin_data> channel::response(bits::command cmd, ms timeout) {
+        if (auto res_resp = borrowed_response(cmd, timeout); res_resp) {
+            // Copy out the payload, so that the buffer goes back to the pool
+            return bin_data{**res_resp};
+        } else {
+            return res_resp.error();
+        }
+    }
+
+    channel::result<mlab::borrowed<bin_data>> channel::borrowed_response(bits::command cmd, ms timeout) {
         reduce_timeout rt{timeout};
-        result<bin_data> retval = error::comm_timeout;
-        if (auto res_recv = receive(rt.remaining()); res_recv) {
-            if (res_recv->type() == frame_type::error) {
+        result<mlab::borrowed<bin_data>> retval = error::comm_timeout;
+        bool got_payload = false;
+        // Room for the longest frame, so that the decoder never reallocates
+        auto buffer = _buffer_pool->take_sized(bits::max_firmware_data_length + 1);
+        if (not buffer) {
+            return error::out_of_buffers;
+        }
+        frame_decoder decoder{};
+        // Decode the data straight into the borrowed buffer
+        decoder.use_data_storage(std::move(*buffer));
+        if (auto res_recv = receive(decoder, rt.remaining(), std::exchange(_expected_response_length, 0)); res_recv) {
+            if (_predict_response_length and decoder.type() == frame_type::info) {
+                learn_response_length(cmd, decoder.id().frame_total_length);
+            }
+            if (decoder.type() == frame_type::error) {
                 PN532_LOGW("Command %s failed.", to_string(cmd));
                 retval = error::failure;
-            } else if (res_recv->type() != frame_type::info) {
+            } else if (decoder.type() != frame_type::info) {
                 PN532_LOGE("Received ack/nack instead of info/error frame to %s?", to_string(cmd));
                 retval = error::comm_malformed;
             } else {
-                frame<frame_type::info> f = std::move(res_recv->get<frame_type::info>());
+                frame<frame_type::info> const &f = decoder.info_frame();
                 // Check that f matches
                 if (f.command != cmd) {
                     PN532_LOGE("Mismatch command, sent %s, received %s.", to_string(cmd), to_string(f.command));
@@ -433,7 +795,7 @@ namespace pn532 {
                         PN532_LOGW("Incorrect transport in response, ignoring...");
                     }
                     // Finally we got the right conditions
-                    retval = std::move(f.data);
+                    got_payload = true;
                 }
             }
         } else {
@@ -444,17 +806,35 @@ namespace pn532 {
             }
             retval = res_recv.error();
         }
+        // Give the storage back to the borrowed buffer whatever happened, so that it returns to the pool with its capacity
+        *buffer = decoder.release_data_storage();
+        if (got_payload) {
+            retval = std::move(buffer);
+        }
         // Make sure to send a final ACK to clear the PN532
-        send_ack(true, 1s /* allow large timeout here */);
+        if (_defer_trailing_ack) {
+            _ack_pending = true;
+            ++_deferred_ack_stats.deferred;
+        } else {
+            send_ack(true, 1s /* allow large timeout here */);
+        }
         return retval;
     }
 
-    channel::result<bin_data> channel::command_response(bits::command cmd, bin_data data, ms timeout) {
+    channel::result<bin_data> channel::command_response(bits::command cmd, mlab::range<bin_data::const_iterator> data, ms timeout) {
         reduce_timeout rt{timeout};
-        if (auto const res_cmd = command(cmd, std::move(data), rt.remaining()); not res_cmd) {
+        if (auto const res_cmd = command(cmd, data, rt.remaining()); not res_cmd) {
             return res_cmd.error();
         }
         return response(cmd, rt.remaining());
     }
 
+    channel::result<mlab::borrowed<bin_data>> channel::command_borrowed_response(bits::command cmd, mlab::range<bin_data::const_iterator> data, ms timeout) {
+        reduce_timeout rt{timeout};
+        if (auto const res_cmd = command(cmd, data, rt.remaining()); not res_cmd) {
+            return res_cmd.error();
+        }
+        return borrowed_response(cmd, rt.remaining());
+    }
+
 }// namespace pn532
\ No newline at end of file
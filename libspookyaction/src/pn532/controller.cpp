@@ -28,6 +28,9 @@ namespace pn532 {
         PN532_LOGI("%s: running %s...", to_string(command_code::diagnose), to_string(bits::test::comm_line));
         // Generate 256 bytes of random data to test
         auto payload = borrow_buffer(0xff);
+        if (not payload) {
+            return channel::error::out_of_buffers;
+        }
         payload->resize(0xff);
         std::iota(std::begin(*payload), std::end(*payload), 0x00);
         // Set the first byte to be the test number
@@ -49,15 +52,13 @@ namespace pn532 {
     }
 
     namespace {
-        template <class... Args>
         controller::result<bool> nfc_diagnose_simple(
-                channel &chn, bits::test test, std::uint8_t expected, ms timeout,
-                std::size_t expected_body_size = 0, Args &&...append_to_body) {
+                channel &chn, bits::test test, borrowed_buffer const &payload, std::uint8_t expected, ms timeout) {
             PN532_LOGI("%s: running %s...", to_string(command_code::diagnose), to_string(test));
-            // TODO Investigate whether this can become a borrowed buffer
-            bin_data payload = bin_data::chain(prealloc(expected_body_size + 1), test,
-                                               std::forward<Args>(append_to_body)...);
-            if (const auto res_cmd = chn.command_response(command_code::diagnose, std::move(payload), timeout); res_cmd) {
+            if (not payload) {
+                return channel::error::out_of_buffers;
+            }
+            if (const auto res_cmd = chn.command_response(command_code::diagnose, *payload, timeout); res_cmd) {
                 // Test that the reurned data coincides
                 if (res_cmd->size() != 1) {
                     PN532_LOGW("%s: %s test received %u bytes instead of 1.",
@@ -82,10 +83,11 @@ namespace pn532 {
             if (not do_test) {
                 return std::numeric_limits<unsigned>::max();
             }
-            const auto res_cmd = chn().command_response(
-                    command_code::diagnose,
-                    bin_data::chain(prealloc(2), bits::test::poll_target, speed),
-                    timeout);
+            auto payload = borrow_payload(2, bits::test::poll_target, speed);
+            if (not payload) {
+                return channel::error::out_of_buffers;
+            }
+            const auto res_cmd = chn().command_response(command_code::diagnose, *payload, timeout);
             if (res_cmd) {
                 if (res_cmd->size() == 1) {
                     return res_cmd->at(0);
@@ -112,25 +114,29 @@ namespace pn532 {
 
     controller::result<> controller::diagnose_echo_back(ms reply_delay, std::uint8_t tx_mode, std::uint8_t rx_mode, ms timeout) {
         PN532_LOGI("%s: running %s...", to_string(command_code::diagnose), to_string(bits::test::echo_back));
-        bin_data payload = bin_data::chain(
-                prealloc(4),
+        auto payload = borrow_payload(
+                4,
                 bits::test::echo_back,
                 std::uint8_t(reply_delay.count() * bits::echo_back_reply_delay_steps_per_ms),
                 tx_mode,
                 rx_mode);
-        return chn().command(command_code::diagnose, std::move(payload), timeout);
+        if (not payload) {
+            return channel::error::out_of_buffers;
+        }
+        return chn().command(command_code::diagnose, *payload, timeout);
     }
 
     controller::result<bool> controller::diagnose_rom(ms timeout) {
-        return nfc_diagnose_simple(chn(), bits::test::rom, 0x00, timeout);
+        return nfc_diagnose_simple(chn(), bits::test::rom, borrow_payload(1, bits::test::rom), 0x00, timeout);
     }
 
     controller::result<bool> controller::diagnose_ram(ms timeout) {
-        return nfc_diagnose_simple(chn(), bits::test::ram, 0x00, timeout);
+        return nfc_diagnose_simple(chn(), bits::test::ram, borrow_payload(1, bits::test::ram), 0x00, timeout);
     }
 
     controller::result<bool> controller::diagnose_attention_req_or_card_presence(ms timeout) {
-        return nfc_diagnose_simple(chn(), bits::test::attention_req_or_card_presence, 0x00, timeout);
+        return nfc_diagnose_simple(chn(), bits::test::attention_req_or_card_presence,
+                                   borrow_payload(1, bits::test::attention_req_or_card_presence), 0x00, timeout);
     }
 
     controller::result<bool> controller::diagnose_self_antenna(
@@ -141,7 +147,8 @@ namespace pn532 {
                 .low_current_threshold = low_threshold,
                 .high_current_threshold = high_threshold,
                 .enable_detection = true};
-        return nfc_diagnose_simple(chn(), bits::test::self_antenna, 0x00, timeout, 1, r);
+        return nfc_diagnose_simple(chn(), bits::test::self_antenna, borrow_payload(2, bits::test::self_antenna, r), 0x00,
+                                   timeout);
     }
 
     controller::result<firmware_version> controller::get_firmware_version(ms timeout) {
@@ -160,11 +167,14 @@ namespace pn532 {
                        to_string(command_code::read_register), addresses.size(), max_addr_count);
         }
         const std::size_t effective_length = std::min(addresses.size(), max_addr_count);
-        bin_data payload{prealloc(effective_length * 2)};
+        auto payload = borrow_buffer(effective_length * 2);
+        if (not payload) {
+            return channel::error::out_of_buffers;
+        }
         for (std::size_t i = 0; i < effective_length; ++i) {
             payload << addresses[i];
         }
-        if (auto res_cmd = chn().command_response(command_code::read_register, std::move(payload), timeout); res_cmd) {
+        if (auto res_cmd = chn().command_response(command_code::read_register, *payload, timeout); res_cmd) {
             if (res_cmd->size() != effective_length) {
                 PN532_LOGE("%s: requested %u registers, got %u instead.", to_string(command_code::read_register),
                            addresses.size(), res_cmd->size());
@@ -182,11 +192,14 @@ namespace pn532 {
                        to_string(command_code::write_register), addr_value_pairs.size(), max_avp_count);
         }
         const std::size_t effective_length = std::min(addr_value_pairs.size(), max_avp_count);
-        bin_data payload{prealloc(effective_length * 3)};
+        auto payload = borrow_buffer(effective_length * 3);
+        if (not payload) {
+            return channel::error::out_of_buffers;
+        }
         for (std::size_t i = 0; i < effective_length; ++i) {
             payload << addr_value_pairs[i].first << addr_value_pairs[i].second;
         }
-        return chn().command_response(command_code::write_register, std::move(payload), timeout);
+        return chn().command_response(command_code::write_register, *payload, timeout);
     }
 
     controller::result<gpio_status> controller::read_gpio(ms timeout) {
@@ -198,7 +211,10 @@ namespace pn532 {
             PN532_LOGW("Attempt to write nothing on the GPIO, did you miss to pass some parameter?");
             return mlab::result_success;
         }
-        bin_data payload{prealloc(2)};
+        auto payload = borrow_buffer(2);
+        if (not payload) {
+            return channel::error::out_of_buffers;
+        }
         if (write_p3) {
             payload << std::uint8_t(bits::gpio_write_validate_max | status.mask(gpio_loc::p3));
         } else {
@@ -209,7 +225,7 @@ namespace pn532 {
         } else {
             payload << std::uint8_t{0x00};
         }
-        return chn().command_response(command_code::write_gpio, std::move(payload), timeout);
+        return chn().command_response(command_code::write_gpio, *payload, timeout);
     }
 
     controller::result<> controller::set_gpio_pin(gpio_loc loc, std::uint8_t pin_idx, bool value, ms timeout) {
@@ -225,100 +241,134 @@ namespace pn532 {
     }
 
     controller::result<> controller::set_serial_baud_rate(serial_baudrate br, ms timeout) {
-        return chn().command_response(command_code::set_serial_baudrate, bin_data::chain(br), timeout);
+        auto payload = borrow_payload(1, br);
+        if (not payload) {
+            return channel::error::out_of_buffers;
+        }
+        return chn().command_response(command_code::set_serial_baudrate, *payload, timeout);
     }
 
     controller::result<> controller::sam_configuration(sam_mode mode, ms sam_timeout, bool controller_drives_irq, ms timeout) {
-        const std::uint8_t sam_timeout_byte = std::min(0xffll, sam_timeout.count() / bits::sam_timeout_unit_ms);
-        bin_data payload = bin_data::chain(
-                prealloc(3),
+        const std::uint8_t sam_timeout_byte = std::min<long long>(0xff, sam_timeout.count() / bits::sam_timeout_unit_ms);
+        auto payload = borrow_payload(
+                3,
                 mode,
                 sam_timeout_byte,
                 controller_drives_irq);
-        return chn().command_response(command_code::sam_configuration, std::move(payload), timeout);
+        if (not payload) {
+            return channel::error::out_of_buffers;
+        }
+        return chn().command_response(command_code::sam_configuration, *payload, timeout);
     }
 
     controller::result<> controller::rf_configuration_field(bool auto_rfca, bool rf_on, ms timeout) {
         const std::uint8_t config_data =
                 (auto_rfca ? bits::rf_configuration_field_auto_rfca_mask : 0x00) |
                 (rf_on ? bits::rf_configuration_field_auto_rf_on_mask : 0x00);
-        bin_data payload = bin_data::chain(
-                prealloc(2),
+        auto payload = borrow_payload(
+                2,
                 bits::rf_config_item::rf_field,
                 config_data);
-        return chn().command_response(command_code::rf_configuration, std::move(payload), timeout);
+        if (not payload) {
+            return channel::error::out_of_buffers;
+        }
+        return chn().command_response(command_code::rf_configuration, *payload, timeout);
     }
 
     controller::result<> controller::rf_configuration_timings(
             rf_timeout atr_res_timeout, rf_timeout retry_timeout,
             ms timeout) {
-        bin_data payload = bin_data::chain(
-                prealloc(4),
+        auto payload = borrow_payload(
+                4,
                 bits::rf_config_item::timings,
                 std::uint8_t(0x00),
                 atr_res_timeout,
                 retry_timeout);
-        return chn().command_response(command_code::rf_configuration, std::move(payload), timeout);
+        if (not payload) {
+            return channel::error::out_of_buffers;
+        }
+        return chn().command_response(command_code::rf_configuration, *payload, timeout);
     }
 
     controller::result<> controller::rf_configuration_retries(infbyte comm_retries, ms timeout) {
-        bin_data payload = bin_data::chain(
-                prealloc(2),
+        auto payload = borrow_payload(
+                2,
                 bits::rf_config_item::max_rty_com,
                 comm_retries);
-        return chn().command_response(command_code::rf_configuration, std::move(payload), timeout);
+        if (not payload) {
+            return channel::error::out_of_buffers;
+        }
+        return chn().command_response(command_code::rf_configuration, *payload, timeout);
     }
 
     controller::result<> controller::rf_configuration_retries(
             infbyte atr_retries, infbyte psl_retries,
             infbyte passive_activation_retries, ms timeout) {
-        bin_data payload = bin_data::chain(
-                prealloc(4),
+        auto payload = borrow_payload(
+                4,
                 bits::rf_config_item::max_retries,
                 atr_retries,
                 psl_retries,
                 passive_activation_retries);
-        return chn().command_response(command_code::rf_configuration, std::move(payload), timeout);
+        if (not payload) {
+            return channel::error::out_of_buffers;
+        }
+        return chn().command_response(command_code::rf_configuration, *payload, timeout);
     }
 
     controller::result<> controller::rf_configuration_analog_106kbps_typea(ciu_reg_106kbps_typea const &config, ms timeout) {
-        bin_data payload = bin_data::chain(
-                prealloc(1 + sizeof(ciu_reg_106kbps_typea)),
+        auto payload = borrow_payload(
+                1 + sizeof(ciu_reg_106kbps_typea),
                 bits::rf_config_item::analog_106kbps_typea,
                 config);
-        return chn().command_response(command_code::rf_configuration, std::move(payload), timeout);
+        if (not payload) {
+            return channel::error::out_of_buffers;
+        }
+        return chn().command_response(command_code::rf_configuration, *payload, timeout);
     }
 
     controller::result<> controller::rf_configuration_analog_212_424kbps(ciu_reg_212_424kbps const &config, ms timeout) {
-        bin_data payload = bin_data::chain(
-                prealloc(1 + sizeof(ciu_reg_212_424kbps)),
+        auto payload = borrow_payload(
+                1 + sizeof(ciu_reg_212_424kbps),
                 bits::rf_config_item::analog_212_424kbps,
                 config);
-        return chn().command_response(command_code::rf_configuration, std::move(payload), timeout);
+        if (not payload) {
+            return channel::error::out_of_buffers;
+        }
+        return chn().command_response(command_code::rf_configuration, *payload, timeout);
     }
 
     controller::result<> controller::rf_configuration_analog_typeb(ciu_reg_typeb const &config, ms timeout) {
-        bin_data payload = bin_data::chain(
-                prealloc(1 + sizeof(ciu_reg_typeb)),
+        auto payload = borrow_payload(
+                1 + sizeof(ciu_reg_typeb),
                 bits::rf_config_item::analog_typeb,
                 config);
-        return chn().command_response(command_code::rf_configuration, std::move(payload), timeout);
+        if (not payload) {
+            return channel::error::out_of_buffers;
+        }
+        return chn().command_response(command_code::rf_configuration, *payload, timeout);
     }
 
     controller::result<> controller::rf_configuration_analog_iso_iec_14443_4(ciu_reg_iso_iec_14443_4 const &config, ms timeout) {
-        bin_data payload = bin_data::chain(
-                prealloc(1 + sizeof(ciu_reg_iso_iec_14443_4)),
+        auto payload = borrow_payload(
+                1 + sizeof(ciu_reg_iso_iec_14443_4),
                 bits::rf_config_item::analog_iso_iec_14443_4,
                 config);
-        return chn().command_response(command_code::rf_configuration, std::move(payload), timeout);
+        if (not payload) {
+            return channel::error::out_of_buffers;
+        }
+        return chn().command_response(command_code::rf_configuration, *payload, timeout);
     }
 
     borrowed_buffer controller::borrow_buffer(std::size_t prealloc_size) const {
-        auto buffer = _pool->take();
         if (prealloc_size < std::numeric_limits<std::size_t>::max()) {
-            buffer << prealloc(prealloc_size);
+            auto buffer = _pool->take_sized(prealloc_size);
+            if (buffer) {
+                buffer << prealloc(prealloc_size);
+            }
+            return buffer;
         }
-        return buffer;
+        return _pool->take();
     }
 
     std::uint8_t controller::get_target(command_code cmd, std::uint8_t target_logical_index, bool expect_more_data) {
@@ -332,25 +382,40 @@ namespace pn532 {
 
     controller::result<rf_status> controller::initiator_select(std::uint8_t target_logical_index, ms timeout) {
         const std::uint8_t target_byte = get_target(command_code::in_select, target_logical_index, false);
-        return chn().command_parse_response<rf_status>(command_code::in_select, bin_data{target_byte}, timeout);
+        auto payload = borrow_payload(1, target_byte);
+        if (not payload) {
+            return channel::error::out_of_buffers;
+        }
+        return chn().command_parse_response<rf_status>(command_code::in_select, *payload, timeout);
     }
 
     controller::result<rf_status> controller::initiator_deselect(std::uint8_t target_logical_index, ms timeout) {
         const std::uint8_t target_byte = get_target(command_code::in_deselect, target_logical_index, false);
-        return chn().command_parse_response<rf_status>(command_code::in_deselect, bin_data{target_byte}, timeout);
+        auto payload = borrow_payload(1, target_byte);
+        if (not payload) {
+            return channel::error::out_of_buffers;
+        }
+        return chn().command_parse_response<rf_status>(command_code::in_deselect, *payload, timeout);
     }
 
     controller::result<rf_status> controller::initiator_release(std::uint8_t target_logical_index, ms timeout) {
         const std::uint8_t target_byte = get_target(command_code::in_release, target_logical_index, false);
-        return chn().command_parse_response<rf_status>(command_code::in_release, bin_data{target_byte}, timeout);
+        auto payload = borrow_payload(1, target_byte);
+        if (not payload) {
+            return channel::error::out_of_buffers;
+        }
+        return chn().command_parse_response<rf_status>(command_code::in_release, *payload, timeout);
     }
 
     controller::result<rf_status> controller::initiator_psl(
             std::uint8_t target_logical_index, baudrate in_to_trg, baudrate trg_to_in,
             ms timeout) {
         const std::uint8_t target_byte = get_target(command_code::in_psl, target_logical_index, false);
-        bin_data payload = bin_data::chain(prealloc(3), target_byte, in_to_trg, trg_to_in);
-        return chn().command_parse_response<rf_status>(command_code::in_psl, std::move(payload), timeout);
+        auto payload = borrow_payload(3, target_byte, in_to_trg, trg_to_in);
+        if (not payload) {
+            return channel::error::out_of_buffers;
+        }
+        return chn().command_parse_response<rf_status>(command_code::in_psl, *payload, timeout);
     }
 
     namespace {
@@ -367,65 +432,69 @@ namespace pn532 {
             std::uint8_t max_targets, ms timeout) {
         sanitize_max_targets(max_targets, "initiator_list_passive_kbps106_typea");
         return initiator_list_passive<baudrate_modulation::kbps106_iso_iec_14443_typea>(
-                max_targets, bin_data{}, timeout);
+                max_targets, timeout, 0);
     }
 
     controller::result<std::vector<target_kbps106_typea>> controller::initiator_list_passive_kbps106_typea(
             uid_cascade_l1 uid, std::uint8_t max_targets, ms timeout) {
         sanitize_max_targets(max_targets, "initiator_list_passive_kbps106_typea");
         return initiator_list_passive<baudrate_modulation::kbps106_iso_iec_14443_typea>(
-                max_targets, bin_data::chain(uid), timeout);
+                max_targets, timeout, uid.size() + 2, uid);
     }
 
     controller::result<std::vector<target_kbps106_typea>> controller::initiator_list_passive_kbps106_typea(
             uid_cascade_l2 uid, std::uint8_t max_targets, ms timeout) {
         sanitize_max_targets(max_targets, "initiator_list_passive_kbps106_typea");
         return initiator_list_passive<baudrate_modulation::kbps106_iso_iec_14443_typea>(
-                max_targets, bin_data::chain(uid), timeout);
+                max_targets, timeout, uid.size() + 2, uid);
     }
 
     controller::result<std::vector<target_kbps106_typea>> controller::initiator_list_passive_kbps106_typea(
             uid_cascade_l3 uid, std::uint8_t max_targets, ms timeout) {
         sanitize_max_targets(max_targets, "initiator_list_passive_kbps106_typea");
         return initiator_list_passive<baudrate_modulation::kbps106_iso_iec_14443_typea>(
-                max_targets, bin_data::chain(uid), timeout);
+                max_targets, timeout, uid.size() + 2, uid);
     }
 
     controller::result<std::vector<target_kbps106_typeb>> controller::initiator_list_passive_kbps106_typeb(
             std::uint8_t application_family_id, polling_method method, std::uint8_t max_targets, ms timeout) {
         sanitize_max_targets(max_targets, "initiator_list_passive_kbps106_typeb");
         return initiator_list_passive<baudrate_modulation::kbps106_iso_iec_14443_3_typeb>(
-                max_targets, bin_data::chain(prealloc(2), application_family_id, method), timeout);
+                max_targets, timeout, 2, application_family_id, method);
     }
 
     controller::result<std::vector<target_kbps212_felica>> controller::initiator_list_passive_kbps212_felica(
             std::array<std::uint8_t, 5> const &payload, std::uint8_t max_targets, ms timeout) {
         sanitize_max_targets(max_targets, "initiator_list_passive_kbps212_felica");
         return initiator_list_passive<baudrate_modulation::kbps212_felica_polling>(
-                max_targets, bin_data::chain(payload), timeout);
+                max_targets, timeout, payload.size(), payload);
     }
 
     controller::result<std::vector<target_kbps424_felica>> controller::initiator_list_passive_kbps424_felica(
             std::array<std::uint8_t, 5> const &payload, std::uint8_t max_targets, ms timeout) {
         sanitize_max_targets(max_targets, "initiator_list_passive_kbps424_felica");
         return initiator_list_passive<baudrate_modulation::kbps424_felica_polling>(
-                max_targets, bin_data::chain(payload), timeout);
+                max_targets, timeout, payload.size(), payload);
     }
 
     controller::result<std::vector<target_kbps106_jewel_tag>> controller::initiator_list_passive_kbps106_jewel_tag(ms timeout) {
-        return initiator_list_passive<baudrate_modulation::kbps106_innovision_jewel_tag>(1, bin_data{}, timeout);
+        return initiator_list_passive<baudrate_modulation::kbps106_innovision_jewel_tag>(1, timeout, 0);
     }
 
-    template <baudrate_modulation BrMd>
+    template <baudrate_modulation BrMd, class... Args>
     controller::result<std::vector<bits::target<BrMd>>> controller::initiator_list_passive(
-            std::uint8_t max_targets, bin_data const &initiator_data, ms timeout) {
-        bin_data payload = bin_data::chain(
-                prealloc(2 + initiator_data.size()),
+            std::uint8_t max_targets, ms timeout,
+            std::size_t initiator_data_size, Args &&...initiator_data) {
+        auto payload = borrow_payload(
+                2 + initiator_data_size,
                 max_targets,
                 BrMd,
-                initiator_data);
+                std::forward<Args>(initiator_data)...);
+        if (not payload) {
+            return channel::error::out_of_buffers;
+        }
         auto res_cmd = chn().command_parse_response<std::vector<bits::target<BrMd>>>(
-                command_code::in_list_passive_target, std::move(payload), timeout);
+                command_code::in_list_passive_target, *payload, timeout);
         if (not res_cmd and res_cmd.error() == channel::error::comm_timeout) {
             // Canceled commands means no target was found, return thus an empty array as technically it's correct
             return std::vector<bits::target<BrMd>>{};
@@ -468,10 +537,11 @@ namespace pn532 {
 
     controller::result<rf_status, atr_res_info> controller::initiator_activate_target(std::uint8_t target_logical_index, ms timeout) {
         const auto next_byte = get_in_atr_next(false, false);
-        return chn().command_parse_response<std::pair<rf_status, atr_res_info>>(
-                command_code::in_atr,
-                bin_data::chain(target_logical_index, next_byte),
-                timeout);
+        auto payload = borrow_payload(2, target_logical_index, next_byte);
+        if (not payload) {
+            return channel::error::out_of_buffers;
+        }
+        return chn().command_parse_response<std::pair<rf_status, atr_res_info>>(command_code::in_atr, *payload, timeout);
     }
 
     controller::result<rf_status, atr_res_info> controller::initiator_activate_target(
@@ -479,10 +549,11 @@ namespace pn532 {
             std::array<std::uint8_t, 10> const &nfcid_3t,
             ms timeout) {
         const auto next_byte = get_in_atr_next(true, false);
-        return chn().command_parse_response<std::pair<rf_status, atr_res_info>>(
-                command_code::in_atr,
-                bin_data::chain(target_logical_index, next_byte, nfcid_3t),
-                timeout);
+        auto payload = borrow_payload(2u + nfcid_3t.size(), target_logical_index, next_byte, nfcid_3t);
+        if (not payload) {
+            return channel::error::out_of_buffers;
+        }
+        return chn().command_parse_response<std::pair<rf_status, atr_res_info>>(command_code::in_atr, *payload, timeout);
     }
 
     controller::result<rf_status, atr_res_info> controller::initiator_activate_target(
@@ -491,10 +562,11 @@ namespace pn532 {
             ms timeout) {
         const auto next_byte = get_in_atr_next(false, true);
         const auto gi_view = sanitize_initiator_general_info(command_code::in_atr, general_info);
-        return chn().command_parse_response<std::pair<rf_status, atr_res_info>>(
-                command_code::in_atr,
-                bin_data::chain(target_logical_index, next_byte, gi_view),
-                timeout);
+        auto payload = borrow_payload(2u + gi_view.size(), target_logical_index, next_byte, gi_view);
+        if (not payload) {
+            return channel::error::out_of_buffers;
+        }
+        return chn().command_parse_response<std::pair<rf_status, atr_res_info>>(command_code::in_atr, *payload, timeout);
     }
 
     controller::result<rf_status, atr_res_info> controller::initiator_activate_target(
@@ -504,10 +576,12 @@ namespace pn532 {
             ms timeout) {
         const auto next_byte = get_in_atr_next(true, true);
         const auto gi_view = sanitize_initiator_general_info(command_code::in_atr, general_info);
-        return chn().command_parse_response<std::pair<rf_status, atr_res_info>>(
-                command_code::in_atr,
-                bin_data::chain(target_logical_index, next_byte, nfcid_3t, gi_view),
-                timeout);
+        auto payload = borrow_payload(2u + nfcid_3t.size() + gi_view.size(),
+                                      target_logical_index, next_byte, nfcid_3t, gi_view);
+        if (not payload) {
+            return channel::error::out_of_buffers;
+        }
+        return chn().command_parse_response<std::pair<rf_status, atr_res_info>>(command_code::in_atr, *payload, timeout);
     }
 
     controller::result<std::vector<any_target>> controller::initiator_auto_poll(
@@ -522,14 +596,17 @@ namespace pn532 {
             PN532_LOGW("%s: too many (%u) types to poll, at most %u will be considered.",
                        to_string(command_code::in_autopoll), types_to_poll.size(), bits::autopoll_max_types);
         }
-        const auto num_types = std::min(bits::autopoll_max_types, types_to_poll.size());
+        const auto num_types = std::min<std::size_t>(bits::autopoll_max_types, types_to_poll.size());
         const auto target_view = make_range(std::begin(types_to_poll), std::begin(types_to_poll) + num_types);
-        bin_data payload = bin_data::chain(
-                prealloc(2 + num_types),
+        auto payload = borrow_payload(
+                2 + num_types,
                 polls_per_type,
                 period,
                 target_view);
-        auto res_cmd = chn().command_parse_response<std::vector<any_target>>(command_code::in_autopoll, std::move(payload), timeout);
+        if (not payload) {
+            return channel::error::out_of_buffers;
+        }
+        auto res_cmd = chn().command_parse_response<std::vector<any_target>>(command_code::in_autopoll, *payload, timeout);
         if (not res_cmd and res_cmd.error() == channel::error::comm_timeout) {
             // Canceled commands means no target was found, return thus an empty array as technically it's correct
             return std::vector<any_target>{};
@@ -539,18 +616,33 @@ namespace pn532 {
 
     controller::result<rf_status, bin_data> controller::initiator_data_exchange(
             std::uint8_t target_logical_index, bin_data const &data, ms timeout) {
+        bin_data data_in{};
+        if (const auto res_exchange = initiator_data_exchange(target_logical_index, data, data_in, timeout); res_exchange) {
+            return {*res_exchange, std::move(data_in)};
+        } else {
+            return res_exchange.error();
+        }
+    }
+
+    controller::result<rf_status> controller::initiator_data_exchange(
+            std::uint8_t target_logical_index, bin_data const &data, bin_data &data_in, ms timeout) {
+        const mlab::profile_scope profile{mlab::probe::rf_exchange};
         static constexpr std::size_t max_chunk_length = bits::max_firmware_data_length - 1;// - target byte
-        const auto n_chunks = std::max(1u, (data.size() + max_chunk_length - 1) / max_chunk_length);
+        const auto n_chunks = std::max<std::size_t>(1, (data.size() + max_chunk_length - 1) / max_chunk_length);
         if (n_chunks > 1) {
             PN532_LOGI("%s: %u bytes will be sent in %u chunks.", to_string(command_code::in_data_exchange), data.size(),
                        n_chunks);
         }
         PN532_LOGD("%s: sending the following data to target %u:", to_string(command_code::in_data_exchange),
                    target_logical_index);
-        ESP_LOG_BUFFER_HEX_LEVEL(PN532_TAG, data.data(), data.size(), ESP_LOG_DEBUG);
+        PN532_LOG_BUFFER_HEX_LEVEL(PN532_TAG, data.data(), data.size(), ESP_LOG_DEBUG);
         reduce_timeout rt{timeout};
-        bin_data data_in{};
         rf_status s{};
+        // Reuse the same pooled buffer for all chunks
+        auto payload = borrow_buffer(1u + std::min(max_chunk_length, data.size()));
+        if (not payload) {
+            return channel::error::out_of_buffers;
+        }
         for (std::size_t chunk_idx = 0; chunk_idx < n_chunks; ++chunk_idx) {
             const auto data_view = data.view(chunk_idx * max_chunk_length, max_chunk_length);
             const bool more_data = (chunk_idx < n_chunks - 1);
@@ -559,26 +651,33 @@ namespace pn532 {
             if (n_chunks > 1) {
                 PN532_LOGI("%s: sending chunk %u/%u...", to_string(command_code::in_data_exchange), chunk_idx + 1, n_chunks);
             }
-            bin_data payload = bin_data::chain(prealloc(1u + data_view.size()), target_byte, data_view);
-            auto res_cmd = chn().command_parse_response<std::pair<rf_status, bin_data>>(
-                    command_code::in_data_exchange, std::move(payload), rt.remaining());
+            payload->clear();
+            payload << target_byte << data_view;
+            // Parse straight from the borrowed response buffer, and append the data to data_in without copying it twice
+            const auto res_cmd = chn().command_borrowed_response(command_code::in_data_exchange, payload->view(), rt.remaining());
             if (not res_cmd) {
                 return res_cmd.error();
             }
-            if (res_cmd->first.error != controller_error::none) {
+            bin_stream stream{**res_cmd};
+            stream >> s;
+            if (stream.bad()) {
+                PN532_LOGE("%s: could not parse result from response data.", to_string(command_code::in_data_exchange));
+                return channel::error::comm_malformed;
+            }
+            if (s.error != controller_error::none) {
                 if (more_data) {
                     PN532_LOGE("%s: aborting multiple chunks transfer because controller returned error %s.",
-                               to_string(command_code::in_data_exchange), to_string(res_cmd->first.error));
+                               to_string(command_code::in_data_exchange), to_string(s.error));
                     // Send an ack to abort whatever is left in the controller.
                     chn().send_ack(true, 1s);
                 }
-                return res_cmd;
+                data_in << stream.read(stream.remaining());
+                return s;
             }
-            // Append data and continue
-            s = res_cmd->first;
-            data_in << res_cmd->second;
+            // Append data and continue, growing data_in at most once per chunk
+            data_in << prealloc(stream.remaining()) << stream.read(stream.remaining());
         }
-        return {s, std::move(data_in)};
+        return s;
     }
 
 
@@ -598,72 +697,85 @@ namespace pn532 {
 
     controller::result<jump_dep_psl> controller::initiator_jump_for_dep_active(baudrate speed, ms timeout) {
         const auto next_byte = get_in_jump_for_dep_psl_next(false, false, false);
-        return chn().command_parse_response<jump_dep_psl>(
-                command_code::in_jump_for_dep,
-                bin_data::chain(true /* active */, speed, next_byte),
-                timeout);
+        auto payload = borrow_payload(3, true /* active */, speed, next_byte);
+        if (not payload) {
+            return channel::error::out_of_buffers;
+        }
+        return chn().command_parse_response<jump_dep_psl>(command_code::in_jump_for_dep, *payload, timeout);
     }
 
     controller::result<jump_dep_psl> controller::initiator_jump_for_dep_active(
             baudrate speed, std::array<std::uint8_t, 10> const &nfcid_3t, ms timeout) {
         const auto next_byte = get_in_jump_for_dep_psl_next(false, true, false);
-        return chn().command_parse_response<jump_dep_psl>(
-                command_code::in_jump_for_dep,
-                bin_data::chain(true /* active */, speed, next_byte, nfcid_3t),
-                timeout);
+        auto payload = borrow_payload(3u + nfcid_3t.size(), true /* active */, speed, next_byte, nfcid_3t);
+        if (not payload) {
+            return channel::error::out_of_buffers;
+        }
+        return chn().command_parse_response<jump_dep_psl>(command_code::in_jump_for_dep, *payload, timeout);
     }
 
     controller::result<jump_dep_psl> controller::initiator_jump_for_dep_passive_106kbps(ms timeout) {
         const auto next_byte = get_in_jump_for_dep_psl_next(false, false, false);
-        return chn().command_parse_response<jump_dep_psl>(
-                command_code::in_jump_for_dep,
-                bin_data::chain(false /* passive */, baudrate::kbps106, next_byte),
-                timeout);
+        auto payload = borrow_payload(3, false /* passive */, baudrate::kbps106, next_byte);
+        if (not payload) {
+            return channel::error::out_of_buffers;
+        }
+        return chn().command_parse_response<jump_dep_psl>(command_code::in_jump_for_dep, *payload, timeout);
     }
 
     controller::result<jump_dep_psl> controller::initiator_jump_for_dep_passive_106kbps(
             std::array<std::uint8_t, 10> const &nfcid_3t, ms timeout) {
         const auto next_byte = get_in_jump_for_dep_psl_next(false, true, false);
-        return chn().command_parse_response<jump_dep_psl>(
-                command_code::in_jump_for_dep,
-                bin_data::chain(false /* passive */, baudrate::kbps106, next_byte, nfcid_3t),
-                timeout);
+        auto payload = borrow_payload(3u + nfcid_3t.size(),
+                                      false /* passive */, baudrate::kbps106, next_byte, nfcid_3t);
+        if (not payload) {
+            return channel::error::out_of_buffers;
+        }
+        return chn().command_parse_response<jump_dep_psl>(command_code::in_jump_for_dep, *payload, timeout);
     }
 
     controller::result<jump_dep_psl> controller::initiator_jump_for_dep_passive_106kbps(
             std::array<std::uint8_t, 4> const &target_id, ms timeout) {
         const auto next_byte = get_in_jump_for_dep_psl_next(true, false, false);
-        return chn().command_parse_response<jump_dep_psl>(
-                command_code::in_jump_for_dep,
-                bin_data::chain(false /* passive */, baudrate::kbps106, next_byte, target_id),
-                timeout);
+        auto payload = borrow_payload(3u + target_id.size(),
+                                      false /* passive */, baudrate::kbps106, next_byte, target_id);
+        if (not payload) {
+            return channel::error::out_of_buffers;
+        }
+        return chn().command_parse_response<jump_dep_psl>(command_code::in_jump_for_dep, *payload, timeout);
     }
 
     controller::result<jump_dep_psl> controller::initiator_jump_for_dep_passive_106kbps(
             std::array<std::uint8_t, 4> const &target_id, std::array<std::uint8_t, 10> const &nfcid_3t, ms timeout) {
         const auto next_byte = get_in_jump_for_dep_psl_next(true, true, false);
-        return chn().command_parse_response<jump_dep_psl>(
-                command_code::in_jump_for_dep,
-                bin_data::chain(false /* passive */, baudrate::kbps106, next_byte, target_id, nfcid_3t),
-                timeout);
+        auto payload = borrow_payload(3u + target_id.size() + nfcid_3t.size(),
+                                      false /* passive */, baudrate::kbps106, next_byte, target_id, nfcid_3t);
+        if (not payload) {
+            return channel::error::out_of_buffers;
+        }
+        return chn().command_parse_response<jump_dep_psl>(command_code::in_jump_for_dep, *payload, timeout);
     }
 
     controller::result<jump_dep_psl> controller::initiator_jump_for_dep_passive_212kbps(
             std::array<std::uint8_t, 5> const &target_id, ms timeout) {
         const auto next_byte = get_in_jump_for_dep_psl_next(true, false, false);
-        return chn().command_parse_response<jump_dep_psl>(
-                command_code::in_jump_for_dep,
-                bin_data::chain(false /* passive */, baudrate::kbps212, next_byte, target_id, target_id),
-                timeout);
+        auto payload = borrow_payload(3u + 2 * target_id.size(),
+                                      false /* passive */, baudrate::kbps212, next_byte, target_id, target_id);
+        if (not payload) {
+            return channel::error::out_of_buffers;
+        }
+        return chn().command_parse_response<jump_dep_psl>(command_code::in_jump_for_dep, *payload, timeout);
     }
 
     controller::result<jump_dep_psl> controller::initiator_jump_for_dep_passive_424kbps(
             std::array<std::uint8_t, 5> const &target_id, ms timeout) {
         const auto next_byte = get_in_jump_for_dep_psl_next(true, false, false);
-        return chn().command_parse_response<jump_dep_psl>(
-                command_code::in_jump_for_dep,
-                bin_data::chain(false /* passive */, baudrate::kbps424, next_byte, target_id, target_id),
-                timeout);
+        auto payload = borrow_payload(3u + 2 * target_id.size(),
+                                      false /* passive */, baudrate::kbps424, next_byte, target_id, target_id);
+        if (not payload) {
+            return channel::error::out_of_buffers;
+        }
+        return chn().command_parse_response<jump_dep_psl>(command_code::in_jump_for_dep, *payload, timeout);
     }
 
 
@@ -672,10 +784,11 @@ namespace pn532 {
             std::vector<std::uint8_t> const &general_info, ms timeout) {
         const auto next_byte = get_in_jump_for_dep_psl_next(false, false, true);
         const auto gi_view = sanitize_initiator_general_info(command_code::in_jump_for_dep, general_info);
-        return chn().command_parse_response<jump_dep_psl>(
-                command_code::in_jump_for_dep,
-                bin_data::chain(true /* active */, speed, next_byte, gi_view),
-                timeout);
+        auto payload = borrow_payload(3u + gi_view.size(), true /* active */, speed, next_byte, gi_view);
+        if (not payload) {
+            return channel::error::out_of_buffers;
+        }
+        return chn().command_parse_response<jump_dep_psl>(command_code::in_jump_for_dep, *payload, timeout);
     }
 
     controller::result<jump_dep_psl> controller::initiator_jump_for_dep_active(
@@ -683,20 +796,23 @@ namespace pn532 {
             std::vector<std::uint8_t> const &general_info, ms timeout) {
         const auto next_byte = get_in_jump_for_dep_psl_next(false, true, true);
         const auto gi_view = sanitize_initiator_general_info(command_code::in_jump_for_dep, general_info);
-        return chn().command_parse_response<jump_dep_psl>(
-                command_code::in_jump_for_dep,
-                bin_data::chain(true /* active */, speed, next_byte, nfcid_3t, gi_view),
-                timeout);
+        auto payload = borrow_payload(3u + nfcid_3t.size() + gi_view.size(),
+                                      true /* active */, speed, next_byte, nfcid_3t, gi_view);
+        if (not payload) {
+            return channel::error::out_of_buffers;
+        }
+        return chn().command_parse_response<jump_dep_psl>(command_code::in_jump_for_dep, *payload, timeout);
     }
 
     controller::result<jump_dep_psl> controller::initiator_jump_for_dep_passive_106kbps(
             std::vector<std::uint8_t> const &general_info, ms timeout) {
         const auto next_byte = get_in_jump_for_dep_psl_next(false, false, true);
         const auto gi_view = sanitize_initiator_general_info(command_code::in_jump_for_dep, general_info);
-        return chn().command_parse_response<jump_dep_psl>(
-                command_code::in_jump_for_dep,
-                bin_data::chain(false /* passive */, baudrate::kbps106, next_byte, gi_view),
-                timeout);
+        auto payload = borrow_payload(3u + gi_view.size(), false /* passive */, baudrate::kbps106, next_byte, gi_view);
+        if (not payload) {
+            return channel::error::out_of_buffers;
+        }
+        return chn().command_parse_response<jump_dep_psl>(command_code::in_jump_for_dep, *payload, timeout);
     }
 
     controller::result<jump_dep_psl> controller::initiator_jump_for_dep_passive_106kbps(
@@ -704,10 +820,12 @@ namespace pn532 {
             std::vector<std::uint8_t> const &general_info, ms timeout) {
         const auto next_byte = get_in_jump_for_dep_psl_next(false, true, true);
         const auto gi_view = sanitize_initiator_general_info(command_code::in_jump_for_dep, general_info);
-        return chn().command_parse_response<jump_dep_psl>(
-                command_code::in_jump_for_dep,
-                bin_data::chain(false /* passive */, baudrate::kbps106, next_byte, nfcid_3t, gi_view),
-                timeout);
+        auto payload = borrow_payload(3u + nfcid_3t.size() + gi_view.size(),
+                                      false /* passive */, baudrate::kbps106, next_byte, nfcid_3t, gi_view);
+        if (not payload) {
+            return channel::error::out_of_buffers;
+        }
+        return chn().command_parse_response<jump_dep_psl>(command_code::in_jump_for_dep, *payload, timeout);
     }
 
     controller::result<jump_dep_psl> controller::initiator_jump_for_dep_passive_106kbps(
@@ -715,10 +833,12 @@ namespace pn532 {
             std::vector<std::uint8_t> const &general_info, ms timeout) {
         const auto next_byte = get_in_jump_for_dep_psl_next(true, false, true);
         const auto gi_view = sanitize_initiator_general_info(command_code::in_jump_for_dep, general_info);
-        return chn().command_parse_response<jump_dep_psl>(
-                command_code::in_jump_for_dep,
-                bin_data::chain(false /* passive */, baudrate::kbps106, next_byte, target_id, gi_view),
-                timeout);
+        auto payload = borrow_payload(3u + target_id.size() + gi_view.size(),
+                                      false /* passive */, baudrate::kbps106, next_byte, target_id, gi_view);
+        if (not payload) {
+            return channel::error::out_of_buffers;
+        }
+        return chn().command_parse_response<jump_dep_psl>(command_code::in_jump_for_dep, *payload, timeout);
     }
 
     controller::result<jump_dep_psl> controller::initiator_jump_for_dep_passive_106kbps(
@@ -726,10 +846,12 @@ namespace pn532 {
             std::vector<std::uint8_t> const &general_info, ms timeout) {
         const auto next_byte = get_in_jump_for_dep_psl_next(true, true, true);
         const auto gi_view = sanitize_initiator_general_info(command_code::in_jump_for_dep, general_info);
-        return chn().command_parse_response<jump_dep_psl>(
-                command_code::in_jump_for_dep,
-                bin_data::chain(false /* passive */, baudrate::kbps106, next_byte, target_id, nfcid_3t, gi_view),
-                timeout);
+        auto payload = borrow_payload(3u + target_id.size() + nfcid_3t.size() + gi_view.size(),
+                                      false /* passive */, baudrate::kbps106, next_byte, target_id, nfcid_3t, gi_view);
+        if (not payload) {
+            return channel::error::out_of_buffers;
+        }
+        return chn().command_parse_response<jump_dep_psl>(command_code::in_jump_for_dep, *payload, timeout);
     }
 
     controller::result<jump_dep_psl> controller::initiator_jump_for_dep_passive_212kbps(
@@ -737,10 +859,12 @@ namespace pn532 {
             std::vector<std::uint8_t> const &general_info, ms timeout) {
         const auto next_byte = get_in_jump_for_dep_psl_next(true, false, true);
         const auto gi_view = sanitize_initiator_general_info(command_code::in_jump_for_dep, general_info);
-        return chn().command_parse_response<jump_dep_psl>(
-                command_code::in_jump_for_dep,
-                bin_data::chain(false /* passive */, baudrate::kbps212, next_byte, target_id, target_id, gi_view),
-                timeout);
+        auto payload = borrow_payload(3u + 2 * target_id.size() + gi_view.size(),
+                                      false /* passive */, baudrate::kbps212, next_byte, target_id, target_id, gi_view);
+        if (not payload) {
+            return channel::error::out_of_buffers;
+        }
+        return chn().command_parse_response<jump_dep_psl>(command_code::in_jump_for_dep, *payload, timeout);
     }
 
     controller::result<jump_dep_psl> controller::initiator_jump_for_dep_passive_424kbps(
@@ -748,81 +872,96 @@ namespace pn532 {
             std::vector<std::uint8_t> const &general_info, ms timeout) {
         const auto next_byte = get_in_jump_for_dep_psl_next(true, false, true);
         const auto gi_view = sanitize_initiator_general_info(command_code::in_jump_for_dep, general_info);
-        return chn().command_parse_response<jump_dep_psl>(
-                command_code::in_jump_for_dep,
-                bin_data::chain(false /* passive */, baudrate::kbps424, next_byte, target_id, target_id, gi_view),
-                timeout);
+        auto payload = borrow_payload(3u + 2 * target_id.size() + gi_view.size(),
+                                      false /* passive */, baudrate::kbps424, next_byte, target_id, target_id, gi_view);
+        if (not payload) {
+            return channel::error::out_of_buffers;
+        }
+        return chn().command_parse_response<jump_dep_psl>(command_code::in_jump_for_dep, *payload, timeout);
     }
 
 
     controller::result<jump_dep_psl> controller::initiator_jump_for_psl_active(baudrate speed, ms timeout) {
         const auto next_byte = get_in_jump_for_dep_psl_next(false, false, false);
-        return chn().command_parse_response<jump_dep_psl>(
-                command_code::in_jump_for_psl,
-                bin_data::chain(true /* active */, speed, next_byte),
-                timeout);
+        auto payload = borrow_payload(3, true /* active */, speed, next_byte);
+        if (not payload) {
+            return channel::error::out_of_buffers;
+        }
+        return chn().command_parse_response<jump_dep_psl>(command_code::in_jump_for_psl, *payload, timeout);
     }
 
     controller::result<jump_dep_psl> controller::initiator_jump_for_psl_active(
             baudrate speed, std::array<std::uint8_t, 10> const &nfcid_3t, ms timeout) {
         const auto next_byte = get_in_jump_for_dep_psl_next(false, true, false);
-        return chn().command_parse_response<jump_dep_psl>(
-                command_code::in_jump_for_psl,
-                bin_data::chain(true /* active */, speed, next_byte, nfcid_3t),
-                timeout);
+        auto payload = borrow_payload(3u + nfcid_3t.size(), true /* active */, speed, next_byte, nfcid_3t);
+        if (not payload) {
+            return channel::error::out_of_buffers;
+        }
+        return chn().command_parse_response<jump_dep_psl>(command_code::in_jump_for_psl, *payload, timeout);
     }
 
     controller::result<jump_dep_psl> controller::initiator_jump_for_psl_passive_106kbps(ms timeout) {
         const auto next_byte = get_in_jump_for_dep_psl_next(false, false, false);
-        return chn().command_parse_response<jump_dep_psl>(
-                command_code::in_jump_for_psl,
-                bin_data::chain(false /* passive */, baudrate::kbps106, next_byte),
-                timeout);
+        auto payload = borrow_payload(3, false /* passive */, baudrate::kbps106, next_byte);
+        if (not payload) {
+            return channel::error::out_of_buffers;
+        }
+        return chn().command_parse_response<jump_dep_psl>(command_code::in_jump_for_psl, *payload, timeout);
     }
 
     controller::result<jump_dep_psl> controller::initiator_jump_for_psl_passive_106kbps(
             std::array<std::uint8_t, 10> const &nfcid_3t, ms timeout) {
         const auto next_byte = get_in_jump_for_dep_psl_next(false, true, false);
-        return chn().command_parse_response<jump_dep_psl>(
-                command_code::in_jump_for_psl,
-                bin_data::chain(false /* passive */, baudrate::kbps106, next_byte, nfcid_3t),
-                timeout);
+        auto payload = borrow_payload(3u + nfcid_3t.size(),
+                                      false /* passive */, baudrate::kbps106, next_byte, nfcid_3t);
+        if (not payload) {
+            return channel::error::out_of_buffers;
+        }
+        return chn().command_parse_response<jump_dep_psl>(command_code::in_jump_for_psl, *payload, timeout);
     }
 
     controller::result<jump_dep_psl> controller::initiator_jump_for_psl_passive_106kbps(
             std::array<std::uint8_t, 4> const &target_id, ms timeout) {
         const auto next_byte = get_in_jump_for_dep_psl_next(true, false, false);
-        return chn().command_parse_response<jump_dep_psl>(
-                command_code::in_jump_for_psl,
-                bin_data::chain(false /* passive */, baudrate::kbps106, next_byte, target_id),
-                timeout);
+        auto payload = borrow_payload(3u + target_id.size(),
+                                      false /* passive */, baudrate::kbps106, next_byte, target_id);
+        if (not payload) {
+            return channel::error::out_of_buffers;
+        }
+        return chn().command_parse_response<jump_dep_psl>(command_code::in_jump_for_psl, *payload, timeout);
     }
 
     controller::result<jump_dep_psl> controller::initiator_jump_for_psl_passive_106kbps(
             std::array<std::uint8_t, 4> const &target_id, std::array<std::uint8_t, 10> const &nfcid_3t, ms timeout) {
         const auto next_byte = get_in_jump_for_dep_psl_next(true, true, false);
-        return chn().command_parse_response<jump_dep_psl>(
-                command_code::in_jump_for_psl,
-                bin_data::chain(false /* passive */, baudrate::kbps106, next_byte, target_id, nfcid_3t),
-                timeout);
+        auto payload = borrow_payload(3u + target_id.size() + nfcid_3t.size(),
+                                      false /* passive */, baudrate::kbps106, next_byte, target_id, nfcid_3t);
+        if (not payload) {
+            return channel::error::out_of_buffers;
+        }
+        return chn().command_parse_response<jump_dep_psl>(command_code::in_jump_for_psl, *payload, timeout);
     }
 
     controller::result<jump_dep_psl> controller::initiator_jump_for_psl_passive_212kbps(
             std::array<std::uint8_t, 5> const &target_id, ms timeout) {
         const auto next_byte = get_in_jump_for_dep_psl_next(true, false, false);
-        return chn().command_parse_response<jump_dep_psl>(
-                command_code::in_jump_for_psl,
-                bin_data::chain(false /* passive */, baudrate::kbps212, next_byte, target_id, target_id),
-                timeout);
+        auto payload = borrow_payload(3u + 2 * target_id.size(),
+                                      false /* passive */, baudrate::kbps212, next_byte, target_id, target_id);
+        if (not payload) {
+            return channel::error::out_of_buffers;
+        }
+        return chn().command_parse_response<jump_dep_psl>(command_code::in_jump_for_psl, *payload, timeout);
     }
 
     controller::result<jump_dep_psl> controller::initiator_jump_for_psl_passive_424kbps(
             std::array<std::uint8_t, 5> const &target_id, ms timeout) {
         const auto next_byte = get_in_jump_for_dep_psl_next(true, false, false);
-        return chn().command_parse_response<jump_dep_psl>(
-                command_code::in_jump_for_psl,
-                bin_data::chain(false /* passive */, baudrate::kbps424, next_byte, target_id, target_id),
-                timeout);
+        auto payload = borrow_payload(3u + 2 * target_id.size(),
+                                      false /* passive */, baudrate::kbps424, next_byte, target_id, target_id);
+        if (not payload) {
+            return channel::error::out_of_buffers;
+        }
+        return chn().command_parse_response<jump_dep_psl>(command_code::in_jump_for_psl, *payload, timeout);
     }
 
 
@@ -831,10 +970,11 @@ namespace pn532 {
             std::vector<std::uint8_t> const &general_info, ms timeout) {
         const auto next_byte = get_in_jump_for_dep_psl_next(false, false, true);
         const auto gi_view = sanitize_initiator_general_info(command_code::in_jump_for_psl, general_info);
-        return chn().command_parse_response<jump_dep_psl>(
-                command_code::in_jump_for_psl,
-                bin_data::chain(true /* active */, speed, next_byte, gi_view),
-                timeout);
+        auto payload = borrow_payload(3u + gi_view.size(), true /* active */, speed, next_byte, gi_view);
+        if (not payload) {
+            return channel::error::out_of_buffers;
+        }
+        return chn().command_parse_response<jump_dep_psl>(command_code::in_jump_for_psl, *payload, timeout);
     }
 
     controller::result<jump_dep_psl> controller::initiator_jump_for_psl_active(
@@ -842,20 +982,23 @@ namespace pn532 {
             std::vector<std::uint8_t> const &general_info, ms timeout) {
         const auto next_byte = get_in_jump_for_dep_psl_next(false, true, true);
         const auto gi_view = sanitize_initiator_general_info(command_code::in_jump_for_psl, general_info);
-        return chn().command_parse_response<jump_dep_psl>(
-                command_code::in_jump_for_psl,
-                bin_data::chain(true /* active */, speed, next_byte, nfcid_3t, gi_view),
-                timeout);
+        auto payload = borrow_payload(3u + nfcid_3t.size() + gi_view.size(),
+                                      true /* active */, speed, next_byte, nfcid_3t, gi_view);
+        if (not payload) {
+            return channel::error::out_of_buffers;
+        }
+        return chn().command_parse_response<jump_dep_psl>(command_code::in_jump_for_psl, *payload, timeout);
     }
 
     controller::result<jump_dep_psl> controller::initiator_jump_for_psl_passive_106kbps(
             std::vector<std::uint8_t> const &general_info, ms timeout) {
         const auto next_byte = get_in_jump_for_dep_psl_next(false, false, true);
         const auto gi_view = sanitize_initiator_general_info(command_code::in_jump_for_psl, general_info);
-        return chn().command_parse_response<jump_dep_psl>(
-                command_code::in_jump_for_psl,
-                bin_data::chain(false /* passive */, baudrate::kbps106, next_byte, gi_view),
-                timeout);
+        auto payload = borrow_payload(3u + gi_view.size(), false /* passive */, baudrate::kbps106, next_byte, gi_view);
+        if (not payload) {
+            return channel::error::out_of_buffers;
+        }
+        return chn().command_parse_response<jump_dep_psl>(command_code::in_jump_for_psl, *payload, timeout);
     }
 
     controller::result<jump_dep_psl> controller::initiator_jump_for_psl_passive_106kbps(
@@ -863,10 +1006,12 @@ namespace pn532 {
             std::vector<std::uint8_t> const &general_info, ms timeout) {
         const auto next_byte = get_in_jump_for_dep_psl_next(false, true, true);
         const auto gi_view = sanitize_initiator_general_info(command_code::in_jump_for_psl, general_info);
-        return chn().command_parse_response<jump_dep_psl>(
-                command_code::in_jump_for_psl,
-                bin_data::chain(false /* passive */, baudrate::kbps106, next_byte, nfcid_3t, gi_view),
-                timeout);
+        auto payload = borrow_payload(3u + nfcid_3t.size() + gi_view.size(),
+                                      false /* passive */, baudrate::kbps106, next_byte, nfcid_3t, gi_view);
+        if (not payload) {
+            return channel::error::out_of_buffers;
+        }
+        return chn().command_parse_response<jump_dep_psl>(command_code::in_jump_for_psl, *payload, timeout);
     }
 
     controller::result<jump_dep_psl> controller::initiator_jump_for_psl_passive_106kbps(
@@ -874,10 +1019,12 @@ namespace pn532 {
             std::vector<std::uint8_t> const &general_info, ms timeout) {
         const auto next_byte = get_in_jump_for_dep_psl_next(true, false, true);
         const auto gi_view = sanitize_initiator_general_info(command_code::in_jump_for_psl, general_info);
-        return chn().command_parse_response<jump_dep_psl>(
-                command_code::in_jump_for_psl,
-                bin_data::chain(false /* passive */, baudrate::kbps106, next_byte, target_id, gi_view),
-                timeout);
+        auto payload = borrow_payload(3u + target_id.size() + gi_view.size(),
+                                      false /* passive */, baudrate::kbps106, next_byte, target_id, gi_view);
+        if (not payload) {
+            return channel::error::out_of_buffers;
+        }
+        return chn().command_parse_response<jump_dep_psl>(command_code::in_jump_for_psl, *payload, timeout);
     }
 
     controller::result<jump_dep_psl> controller::initiator_jump_for_psl_passive_106kbps(
@@ -885,10 +1032,12 @@ namespace pn532 {
             std::vector<std::uint8_t> const &general_info, ms timeout) {
         const auto next_byte = get_in_jump_for_dep_psl_next(true, true, true);
         const auto gi_view = sanitize_initiator_general_info(command_code::in_jump_for_psl, general_info);
-        return chn().command_parse_response<jump_dep_psl>(
-                command_code::in_jump_for_psl,
-                bin_data::chain(false /* passive */, baudrate::kbps106, next_byte, target_id, nfcid_3t, gi_view),
-                timeout);
+        auto payload = borrow_payload(3u + target_id.size() + nfcid_3t.size() + gi_view.size(),
+                                      false /* passive */, baudrate::kbps106, next_byte, target_id, nfcid_3t, gi_view);
+        if (not payload) {
+            return channel::error::out_of_buffers;
+        }
+        return chn().command_parse_response<jump_dep_psl>(command_code::in_jump_for_psl, *payload, timeout);
     }
 
     controller::result<jump_dep_psl> controller::initiator_jump_for_psl_passive_212kbps(
@@ -896,10 +1045,12 @@ namespace pn532 {
             std::vector<std::uint8_t> const &general_info, ms timeout) {
         const auto next_byte = get_in_jump_for_dep_psl_next(true, false, true);
         const auto gi_view = sanitize_initiator_general_info(command_code::in_jump_for_psl, general_info);
-        return chn().command_parse_response<jump_dep_psl>(
-                command_code::in_jump_for_psl,
-                bin_data::chain(false /* passive */, baudrate::kbps212, next_byte, target_id, target_id, gi_view),
-                timeout);
+        auto payload = borrow_payload(3u + 2 * target_id.size() + gi_view.size(),
+                                      false /* passive */, baudrate::kbps212, next_byte, target_id, target_id, gi_view);
+        if (not payload) {
+            return channel::error::out_of_buffers;
+        }
+        return chn().command_parse_response<jump_dep_psl>(command_code::in_jump_for_psl, *payload, timeout);
     }
 
     controller::result<jump_dep_psl> controller::initiator_jump_for_psl_passive_424kbps(
@@ -907,28 +1058,44 @@ namespace pn532 {
             std::vector<std::uint8_t> const &general_info, ms timeout) {
         const auto next_byte = get_in_jump_for_dep_psl_next(true, false, true);
         const auto gi_view = sanitize_initiator_general_info(command_code::in_jump_for_psl, general_info);
-        return chn().command_parse_response<jump_dep_psl>(
-                command_code::in_jump_for_psl,
-                bin_data::chain(false /* passive */, baudrate::kbps424, next_byte, target_id, target_id, gi_view),
-                timeout);
+        auto payload = borrow_payload(3u + 2 * target_id.size() + gi_view.size(),
+                                      false /* passive */, baudrate::kbps424, next_byte, target_id, target_id, gi_view);
+        if (not payload) {
+            return channel::error::out_of_buffers;
+        }
+        return chn().command_parse_response<jump_dep_psl>(command_code::in_jump_for_psl, *payload, timeout);
     }
 
     controller::result<> controller::set_parameters(parameters const &parms, ms timeout) {
-        return chn().command_response(command_code::set_parameters, bin_data::chain(parms), timeout);
+        auto payload = borrow_payload(1, parms);
+        if (not payload) {
+            return channel::error::out_of_buffers;
+        }
+        return chn().command_response(command_code::set_parameters, *payload, timeout);
     }
 
     controller::result<rf_status> controller::power_down(std::vector<wakeup_source> const &wakeup_sources, ms timeout) {
-        return chn().command_parse_response<rf_status>(command_code::power_down, bin_data::chain(wakeup_sources), timeout);
+        auto payload = borrow_payload(1, wakeup_sources);
+        if (not payload) {
+            return channel::error::out_of_buffers;
+        }
+        return chn().command_parse_response<rf_status>(command_code::power_down, *payload, timeout);
     }
 
     controller::result<rf_status> controller::power_down(std::vector<wakeup_source> const &wakeup_sources, bool generate_irq, ms timeout) {
-        return chn().command_parse_response<rf_status>(command_code::power_down,
-                                                       bin_data::chain(prealloc(2), wakeup_sources, generate_irq),
-                                                       timeout);
+        auto payload = borrow_payload(2, wakeup_sources, generate_irq);
+        if (not payload) {
+            return channel::error::out_of_buffers;
+        }
+        return chn().command_parse_response<rf_status>(command_code::power_down, *payload, timeout);
     }
 
     controller::result<> controller::rf_regulation_test(tx_mode mode, ms timeout) {
-        return chn().command(command_code::rf_regulation_test, bin_data::chain(mode), timeout);
+        auto payload = borrow_payload(1, mode);
+        if (not payload) {
+            return channel::error::out_of_buffers;
+        }
+        return chn().command(command_code::rf_regulation_test, *payload, timeout);
     }
 
     controller::result<status_as_target> controller::target_get_target_status(ms timeout) {
@@ -945,8 +1112,8 @@ namespace pn532 {
                                        (passive_only ? bits::init_as_target_passive_only_bit : 0x00);
         const auto gi_view = sanitize_target_general_info(command_code::tg_init_as_target, general_info);
         const auto tk_view = sanitize_target_historical_bytes(command_code::tg_init_as_target, historical_bytes);
-        bin_data payload = bin_data::chain(
-                prealloc(37u + gi_view.size() + tk_view.size()),
+        auto payload = borrow_payload(
+                37u + gi_view.size() + tk_view.size(),
                 mode_byte,
                 mifare,
                 felica,
@@ -955,13 +1122,19 @@ namespace pn532 {
                 gi_view,
                 std::uint8_t(tk_view.size()),
                 tk_view);
-        return chn().command_parse_response<init_as_target_res>(command_code::tg_init_as_target, std::move(payload), timeout);
+        if (not payload) {
+            return channel::error::out_of_buffers;
+        }
+        return chn().command_parse_response<init_as_target_res>(command_code::tg_init_as_target, *payload, timeout);
     }
 
     controller::result<rf_status> controller::target_set_general_bytes(std::vector<std::uint8_t> const &general_info, ms timeout) {
         const auto gi_view = sanitize_target_general_info(command_code::tg_set_general_bytes, general_info);
-        return chn().command_parse_response<rf_status>(command_code::tg_set_general_bytes, bin_data::chain(gi_view),
-                                                       timeout);
+        auto payload = borrow_payload(gi_view.size(), gi_view);
+        if (not payload) {
+            return channel::error::out_of_buffers;
+        }
+        return chn().command_parse_response<rf_status>(command_code::tg_set_general_bytes, *payload, timeout);
     }
 
     controller::result<rf_status, bin_data> controller::target_get_data(ms timeout) {
@@ -970,13 +1143,21 @@ namespace pn532 {
 
     controller::result<rf_status> controller::target_set_data(std::vector<std::uint8_t> const &data, ms timeout) {
         const auto view = sanitize_vector(command_code::tg_set_data, "data", data, bits::max_firmware_data_length - 1);
-        return chn().command_parse_response<rf_status>(command_code::tg_set_data, bin_data::chain(view), timeout);
+        auto payload = borrow_payload(view.size(), view);
+        if (not payload) {
+            return channel::error::out_of_buffers;
+        }
+        return chn().command_parse_response<rf_status>(command_code::tg_set_data, *payload, timeout);
     }
 
     controller::result<rf_status> controller::target_set_metadata(std::vector<std::uint8_t> const &data, ms timeout) {
         const auto view = sanitize_vector(command_code::tg_set_metadata, "metadata", data,
                                           bits::max_firmware_data_length - 1);
-        return chn().command_parse_response<rf_status>(command_code::tg_set_metadata, bin_data::chain(view), timeout);
+        auto payload = borrow_payload(view.size(), view);
+        if (not payload) {
+            return channel::error::out_of_buffers;
+        }
+        return chn().command_parse_response<rf_status>(command_code::tg_set_metadata, *payload, timeout);
     }
 
     controller::result<rf_status, bin_data> controller::target_get_initiator_command(ms timeout) {
@@ -987,8 +1168,11 @@ namespace pn532 {
     controller::result<rf_status> controller::target_response_to_initiator(std::vector<std::uint8_t> const &data, ms timeout) {
         const auto view = sanitize_vector(command_code::tg_response_to_initiator, "response", data,
                                           bits::max_firmware_data_length - 1);
-        return chn().command_parse_response<rf_status>(command_code::tg_response_to_initiator, bin_data::chain(view),
-                                                       timeout);
+        auto payload = borrow_payload(view.size(), view);
+        if (not payload) {
+            return channel::error::out_of_buffers;
+        }
+        return chn().command_parse_response<rf_status>(command_code::tg_response_to_initiator, *payload, timeout);
     }
 
 
@@ -2,8 +2,43 @@
 // Created by Pietro Saccardi on 22/12/2020.
 //
 
+#include <algorithm>
 #include <pn532/data.hpp>
 
+namespace pn532 {
+    namespace {
+        constexpr std::uint8_t t0_ta1_present_mask = 0x10;
+        constexpr std::uint8_t ta1_same_bit_rate_mask = 0x80;
+        constexpr std::uint8_t ta1_ds_424kbps_mask = 0x20;
+        constexpr std::uint8_t ta1_ds_212kbps_mask = 0x10;
+        constexpr std::uint8_t ta1_dr_424kbps_mask = 0x02;
+        constexpr std::uint8_t ta1_dr_212kbps_mask = 0x01;
+
+        [[nodiscard]] baudrate max_supported_baudrate(std::uint8_t ta1, std::uint8_t mask_424kbps, std::uint8_t mask_212kbps) {
+            if ((ta1 & mask_424kbps) != 0) {
+                return baudrate::kbps424;
+            } else if ((ta1 & mask_212kbps) != 0) {
+                return baudrate::kbps212;
+            }
+            return baudrate::kbps106;
+        }
+    }// namespace
+
+    iso_iec_14443_4_bit_rates max_bit_rates_from_ats(std::vector<std::uint8_t> const &ats) {
+        // T0 tells whether TA(1) follows; 848 kbps (DS = DR = 8) is not supported by the PN532
+        if (ats.size() < 2 or (ats[0] & t0_ta1_present_mask) == 0) {
+            return {};
+        }
+        const std::uint8_t ta1 = ats[1];
+        iso_iec_14443_4_bit_rates rates{max_supported_baudrate(ta1, ta1_dr_424kbps_mask, ta1_dr_212kbps_mask),
+                                        max_supported_baudrate(ta1, ta1_ds_424kbps_mask, ta1_ds_212kbps_mask)};
+        if ((ta1 & ta1_same_bit_rate_mask) != 0) {
+            rates.in_to_trg = rates.trg_to_in = std::min(rates.in_to_trg, rates.trg_to_in);
+        }
+        return rates;
+    }
+}// namespace pn532
+
 namespace mlab {
 
     bin_data &operator<<(bin_data &bd, ciu_reg_212_424kbps const &reg) {
@@ -2,21 +2,100 @@
 // Created by Pietro Saccardi on 04/01/2021.
 //
 
+#include <algorithm>
+#include <array>
 #include <pn532/desfire_pcd.hpp>
 
 namespace pn532 {
+    namespace {
+        /**
+         * Frame size for each value of FSCI (ISO/IEC 14443-4, 5.2.3). Higher values are treated as 256.
+         */
+        constexpr std::array<std::size_t, 9> fsci_to_fsc = {16, 24, 32, 40, 48, 64, 96, 128, 256};
+
+        /**
+         * PCB, CID and two bytes of CRC.
+         */
+        constexpr std::size_t frame_overhead = 4;
+
+        constexpr std::uint8_t t0_fsci_mask = 0x0f;
+    }// namespace
+
+    std::size_t desfire_pcd::max_frame_length_from_ats(std::vector<std::uint8_t> const &ats) {
+        if (ats.empty()) {
+            PN532_LOGW("No ATS, using the default frame size of %d bytes.", desfire::bits::max_packet_length);
+            return desfire::bits::max_packet_length;
+        }
+        const std::size_t fsci = std::min(std::size_t(ats.front() & t0_fsci_mask), fsci_to_fsc.size() - 1);
+        // Data exchange needs one byte for the target
+        return std::min(fsci_to_fsc[fsci] - frame_overhead, bits::max_firmware_data_length - 1);
+    }
+
+    std::size_t desfire_pcd::max_frame_length() const {
+        return _max_frame_length;
+    }
+
+    controller::result<rf_status> desfire_pcd::upgrade_bit_rate(baudrate max_bit_rate) {
+        const iso_iec_14443_4_bit_rates target_rates{std::min(_max_bit_rates.in_to_trg, max_bit_rate),
+                                                     std::min(_max_bit_rates.trg_to_in, max_bit_rate)};
+        if (target_rates == _bit_rates) {
+            return rf_status{false, false, controller_error::none};
+        }
+        const auto res = ctrl().initiator_psl(target_logical_index(), target_rates.in_to_trg, target_rates.trg_to_in);
+        if (res and *res) {
+            PN532_LOGI("Bit rate changed to %s (PCD to PICC), %s (PICC to PCD).",
+                       to_string(target_rates.in_to_trg), to_string(target_rates.trg_to_in));
+            _bit_rates = target_rates;
+            _recent_errors.reset();
+        } else {
+            PN532_LOGW("Could not change the bit rate, staying at %s, %s.", to_string(_bit_rates.in_to_trg), to_string(_bit_rates.trg_to_in));
+        }
+        return res;
+    }
+
+    controller::result<rf_status> desfire_pcd::reset_bit_rate() {
+        if (_bit_rates == iso_iec_14443_4_bit_rates{}) {
+            return rf_status{false, false, controller_error::none};
+        }
+        const auto res = ctrl().initiator_psl(target_logical_index(), baudrate::kbps106, baudrate::kbps106);
+        // Even if the PSL failed, the lowest bit rate is the best guess of what the target can still understand
+        _bit_rates = iso_iec_14443_4_bit_rates{};
+        _recent_errors.reset();
+        return res;
+    }
+
+    void desfire_pcd::track_error(bool failed) {
+        _recent_errors <<= 1;
+        _recent_errors.set(0, failed);
+        if (failed and _recent_errors.count() >= fallback_error_count and _bit_rates != iso_iec_14443_4_bit_rates{}) {
+            PN532_LOGW("%u of the last %u exchanges failed, falling back to %s.", _recent_errors.count(),
+                       _recent_errors.size(), to_string(baudrate::kbps106));
+            if (const auto res = reset_bit_rate(); not res or not *res) {
+                PN532_LOGE("Could not fall back to %s.", to_string(baudrate::kbps106));
+            }
+        }
+    }
+
     std::pair<bin_data, bool> desfire_pcd::communicate(bin_data const &data) {
-        if (auto res = ctrl().initiator_data_exchange(target_logical_index(), data); res) {
-            _last_result = controller::result<rf_status>{res->first};
-            if (res->first.error != controller_error::none) {
-                PN532_LOGE("PCD/PICC comm failed at protocol level, %s", to_string(res->first.error));
+        bin_data data_in{};
+        const bool success = communicate_into(data, data_in);
+        return {std::move(data_in), success};
+    }
+
+    bool desfire_pcd::communicate_into(bin_data const &data, bin_data &data_in) {
+        if (auto res = ctrl().initiator_data_exchange(target_logical_index(), data, data_in); res) {
+            _last_result = controller::result<rf_status>{*res};
+            if (res->error != controller_error::none) {
+                PN532_LOGE("PCD/PICC comm failed at protocol level, %s", to_string(res->error));
             }
             // Check also the RF status
-            return {std::move(res->second), res->first.error == controller_error::none};
+            track_error(res->error != controller_error::none);
+            return res->error == controller_error::none;
         } else {
             PN532_LOGE("PCD/PICC comm failed at NFC level, %s", to_string(res.error()));
             _last_result = controller::result<rf_status>{res.error()};
-            return {bin_data{}, false};
+            track_error(true);
+            return false;
         }
     }
 }// namespace pn532
\ No newline at end of file
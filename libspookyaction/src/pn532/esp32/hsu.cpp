@@ -3,6 +3,8 @@
 //
 
 
+#ifdef ESP_PLATFORM
+
 #include <pn532/esp32/hsu.hpp>
 #include <pn532/log.h>
 
@@ -68,7 +70,7 @@ namespace pn532::esp32 {
             return error::comm_error;
         }
         reduce_timeout rt{timeout};
-        ESP_LOG_BUFFER_HEX_LEVEL(PN532_HSU_TAG " >>", buffer.data(), buffer.size(), ESP_LOG_VERBOSE);
+        PN532_LOG_BUFFER_HEX_LEVEL(PN532_HSU_TAG " >>", buffer.data(), buffer.size(), ESP_LOG_VERBOSE);
         // Send and block until transmission is finished (or timeout time expired)
         if (uart_write_bytes(_port, reinterpret_cast<const char *>(buffer.data()), buffer.size()) != buffer.size()) {
             ESP_LOGE(PN532_HSU_TAG, "Failure to send data via HSU, parameter error at at uart_write_bytes (port = %d).", _port);
@@ -117,7 +119,7 @@ namespace pn532::esp32 {
                 }
             }
         }
-        ESP_LOG_BUFFER_HEX_LEVEL(PN532_HSU_TAG " <<", buffer.data(), read_length, ESP_LOG_VERBOSE);
+        PN532_LOG_BUFFER_HEX_LEVEL(PN532_HSU_TAG " <<", buffer.data(), read_length, ESP_LOG_VERBOSE);
         if (read_length >= buffer.size()) {
             return mlab::result_success;
         }
@@ -125,4 +127,6 @@ namespace pn532::esp32 {
     }
 
 
-}// namespace pn532::esp32
\ No newline at end of file
+}// namespace pn532::esp32
+
+#endif
@@ -3,6 +3,8 @@
 //
 
 
+#ifdef ESP_PLATFORM
+
 #include <memory>
 #include <pn532/esp32/i2c.hpp>
 
@@ -115,7 +117,7 @@ namespace pn532::esp32 {
         if (_port == I2C_NUM_MAX) {
             return error::comm_error;
         }
-        ESP_LOG_BUFFER_HEX_LEVEL(PN532_I2C_TAG " >>", buffer.data(), buffer.size(), ESP_LOG_VERBOSE);
+        PN532_LOG_BUFFER_HEX_LEVEL(PN532_I2C_TAG " >>", buffer.data(), buffer.size(), ESP_LOG_VERBOSE);
         auto cmd = raw_prepare_command(comm_mode::send);
         if (buffer.size() > 0) {
             cmd.write({&*std::begin(buffer), &*std::begin(buffer) + buffer.size()}, true);
@@ -149,7 +151,7 @@ namespace pn532::esp32 {
                 return error_from_i2c_error(res_cmd.error());
             } else if ((ready_byte & 0b1) != 0) {
                 // Everything alright
-                ESP_LOG_BUFFER_HEX_LEVEL(PN532_I2C_TAG " <<", buffer.data(), buffer.size(), ESP_LOG_VERBOSE);
+                PN532_LOG_BUFFER_HEX_LEVEL(PN532_I2C_TAG " <<", buffer.data(), buffer.size(), ESP_LOG_VERBOSE);
                 return mlab::result_success;
             }
             // Wait a bit
@@ -201,3 +203,5 @@ namespace pn532::esp32 {
     }
 
 }// namespace pn532::esp32
+
+#endif
@@ -2,6 +2,8 @@
 // Created by spak on 3/14/21.
 //
 
+#ifdef ESP_PLATFORM
+
 #include <esp_log.h>
 #include <freertos/FreeRTOS.h>
 #include <freertos/semphr.h>
@@ -98,3 +100,5 @@ namespace pn532::esp32 {
         }
     }
 }// namespace pn532::esp32
+
+#endif
@@ -2,6 +2,8 @@
 // Created by spak on 3/25/21.
 //
 
+#ifdef ESP_PLATFORM
+
 #include <mbcontroller.h>
 #include <pn532/esp32/spi.hpp>
 
@@ -65,7 +67,7 @@ namespace pn532::esp32 {
         if (_device == nullptr) {
             return error::comm_error;
         }
-        ESP_LOG_BUFFER_HEX_LEVEL(PN532_SPI_TAG " >>", buffer.data(), buffer.size(), ESP_LOG_VERBOSE);
+        PN532_LOG_BUFFER_HEX_LEVEL(PN532_SPI_TAG " >>", buffer.data(), buffer.size(), ESP_LOG_VERBOSE);
         reduce_timeout rt{timeout};
         _dma_buffer.resize(buffer.size());
         if (buffer.size() > 0) {
@@ -115,7 +117,7 @@ namespace pn532::esp32 {
         if (auto res = perform_transaction(_dma_buffer, cmd, comm_mode::receive, rt.remaining()); res) {
             // Copy back to buffer
             std::copy(std::begin(_dma_buffer), std::end(_dma_buffer), std::begin(buffer));
-            ESP_LOG_BUFFER_HEX_LEVEL(PN532_SPI_TAG " <<", buffer.data(), buffer.size(), ESP_LOG_VERBOSE);
+            PN532_LOG_BUFFER_HEX_LEVEL(PN532_SPI_TAG " <<", buffer.data(), buffer.size(), ESP_LOG_VERBOSE);
             return mlab::result_success;
         } else {
             return res.error();
@@ -188,4 +190,6 @@ namespace pn532::esp32 {
         }
     }
 
-}// namespace pn532::esp32
\ No newline at end of file
+}// namespace pn532::esp32
+
+#endif
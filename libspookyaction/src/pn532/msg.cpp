@@ -247,6 +247,8 @@ namespace pn532 {
                 return "Controller acknowledged but returned error";
             case channel::error::comm_timeout:
                 return "Communication reached timeout";
+            case channel::error::out_of_buffers:
+                return "Buffer pool exhausted";
         }
         return "UNKNOWN";
     }
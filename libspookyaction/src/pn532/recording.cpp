@@ -0,0 +1,300 @@
+#include <algorithm>
+#include <limits>
+#include <mlab/random.hpp>
+#include <pn532/log.h>
+#include <pn532/recording.hpp>
+#include <thread>
+
+namespace pn532 {
+
+    namespace {
+        using mlab::lsb16;
+        using mlab::lsb32;
+        using mlab::prealloc;
+
+        constexpr std::array<std::uint8_t, 4> recording_magic = {'P', 'N', 'R', 0x01 /* version */};
+        constexpr std::size_t recording_header_length = recording_magic.size() + 1;
+        constexpr std::size_t event_header_length = 8;
+
+        [[nodiscard]] std::uint8_t encode_outcome(std::optional<channel::error> outcome) {
+            return outcome ? std::uint8_t(static_cast<std::uint8_t>(*outcome) + 1) : 0;
+        }
+
+        [[nodiscard]] bool decode_outcome(std::uint8_t b, std::optional<channel::error> &outcome) {
+            if (b == 0) {
+                outcome = std::nullopt;
+            } else if (b - 1 <= static_cast<std::uint8_t>(channel::error::out_of_buffers)) {
+                outcome = static_cast<channel::error>(b - 1);
+            } else {
+                return false;
+            }
+            return true;
+        }
+    }// namespace
+
+    std::chrono::microseconds link_recording::duration() const {
+        std::chrono::microseconds retval{0};
+        for (link_event const &e : events) {
+            retval += e.delay;
+        }
+        return retval;
+    }
+
+    std::optional<link_recording> link_recording::decode(bin_data const &data) {
+        bin_stream s{data};
+        std::array<std::uint8_t, recording_magic.size()> magic{};
+        std::uint8_t buffered = 0;
+        s >> magic >> buffered;
+        if (s.bad() or magic != recording_magic or buffered > 1) {
+            PN532_LOGE("Not a link recording.");
+            return std::nullopt;
+        }
+        link_recording retval{buffered != 0, {}};
+        while (s.good()) {
+            link_event e{};
+            std::uint8_t outcome = 0;
+            std::uint32_t delay_us = 0;
+            std::uint16_t length = 0;
+            s >> e.type >> outcome >> lsb32 >> delay_us >> lsb16 >> length;
+            if (s.bad() or e.type > link_event::kind::random or not decode_outcome(outcome, e.outcome) or s.remaining() < length) {
+                PN532_LOGE("Malformed link recording at event %u.", unsigned(retval.events.size()));
+                return std::nullopt;
+            }
+            e.delay = std::chrono::microseconds{delay_us};
+            e.data << s.read(length);
+            retval.events.push_back(std::move(e));
+            // The chunks passed to a sink are concatenated, and there is a new header after every restart
+            const auto it_next = std::begin(data) + std::ptrdiff_t(data.size() - s.remaining());
+            if (s.remaining() >= recording_header_length and std::equal(std::begin(recording_magic), std::end(recording_magic), it_next)) {
+                s >> magic >> buffered;
+            }
+        }
+        return retval;
+    }
+
+    recording_channel::recording_channel(channel &inner, std::size_t max_size, mlab::shared_buffer_pool buffer_pool)
+        : channel{std::move(buffer_pool)},
+          _inner{&inner},
+          _sink{},
+          _max_size{std::max(max_size, recording_header_length)},
+          _recording{},
+          _last_event{},
+          _event_count{0},
+          _truncated{false} {
+        restart();
+    }
+
+    recording_channel::recording_channel(channel &inner, sink_fn sink, std::size_t chunk_size, mlab::shared_buffer_pool buffer_pool)
+        : recording_channel{inner, chunk_size, std::move(buffer_pool)} {
+        _sink = std::move(sink);
+    }
+
+    recording_channel::~recording_channel() {
+        flush();
+    }
+
+    void recording_channel::restart() {
+        _recording.clear();
+        _recording << prealloc(std::min<std::size_t>(_max_size, 0x100)) << recording_magic
+                   << std::uint8_t(_inner->raw_receive_mode() == receive_mode::buffered ? 1 : 0);
+        _last_event = std::chrono::steady_clock::now();
+        _event_count = 0;
+        _truncated = false;
+    }
+
+    void recording_channel::flush() {
+        if (_sink and not _recording.empty()) {
+            _sink(_recording);
+            _recording.clear();
+        }
+    }
+
+    bool recording_channel::append_header(link_event::kind type, std::optional<error> outcome, std::size_t length) {
+        const auto now = std::chrono::steady_clock::now();
+        const auto delay_us = std::chrono::duration_cast<std::chrono::microseconds>(now - _last_event).count();
+        if (not _sink and _recording.size() + event_header_length + length > _max_size) {
+            _truncated = true;
+            return false;
+        }
+        _last_event = now;
+        ++_event_count;
+        _recording << type << encode_outcome(outcome)
+                   << lsb32 << std::uint32_t(std::min<std::int64_t>(delay_us, std::numeric_limits<std::uint32_t>::max()))
+                   << lsb16 << std::uint16_t(length);
+        return true;
+    }
+
+    void recording_channel::append(link_event::kind type, std::optional<error> outcome) {
+        if (append_header(type, outcome, 0) and _sink and _recording.size() >= _max_size) {
+            flush();
+        }
+    }
+
+    void recording_channel::append(link_event::kind type, mlab::range<bin_data::const_iterator> data) {
+        const auto length = std::min<std::size_t>(data.size(), std::numeric_limits<std::uint16_t>::max());
+        if (append_header(type, std::nullopt, length)) {
+            _recording << mlab::range<bin_data::const_iterator>{std::begin(data), std::begin(data) + std::ptrdiff_t(length)};
+            if (_sink and _recording.size() >= _max_size) {
+                flush();
+            }
+        }
+    }
+
+    random_fn recording_channel::random_source() {
+        return [this](std::uint8_t *data, std::size_t length) {
+            mlab::fill_random(data, length);
+            length = std::min<std::size_t>(length, std::numeric_limits<std::uint16_t>::max());
+            if (append_header(link_event::kind::random, std::nullopt, length)) {
+                _recording << mlab::range<std::uint8_t const *>{data, data + length};
+                if (_sink and _recording.size() >= _max_size) {
+                    flush();
+                }
+            }
+        };
+    }
+
+    bool recording_channel::wake() {
+        const bool success = _inner->wake();
+        append(link_event::kind::wake, success ? std::nullopt : std::optional<error>{error::comm_error});
+        return success;
+    }
+
+    channel::result<> recording_channel::raw_send(mlab::range<bin_data::const_iterator> buffer, ms timeout) {
+        auto r = _inner->raw_send(buffer, timeout);
+        if (r) {
+            append(link_event::kind::send, buffer);
+        } else {
+            append(link_event::kind::send, r.error());
+        }
+        return r;
+    }
+
+    channel::result<> recording_channel::raw_receive(mlab::range<bin_data::iterator> buffer, ms timeout) {
+        auto r = _inner->raw_receive(buffer, timeout);
+        if (r) {
+            append(link_event::kind::receive, mlab::range<bin_data::const_iterator>{std::begin(buffer), std::end(buffer)});
+        } else {
+            append(link_event::kind::receive, r.error());
+        }
+        return r;
+    }
+
+    channel::receive_mode recording_channel::raw_receive_mode() const {
+        return _inner->raw_receive_mode();
+    }
+
+    bool recording_channel::on_receive_prepare(ms timeout) {
+        return _inner->on_receive_prepare(timeout);
+    }
+
+    void recording_channel::on_receive_complete(result<> const &outcome) {
+        _inner->on_receive_complete(outcome);
+    }
+
+    bool recording_channel::on_send_prepare(ms timeout) {
+        return _inner->on_send_prepare(timeout);
+    }
+
+    void recording_channel::on_send_complete(result<> const &outcome) {
+        _inner->on_send_complete(outcome);
+    }
+
+    replay_channel::replay_channel(link_recording recording, double speed, mlab::shared_buffer_pool buffer_pool)
+        : channel{std::move(buffer_pool)},
+          _recording{std::move(recording)},
+          _speed{speed},
+          _next{0},
+          _deadline{std::nullopt},
+          _stats{} {}
+
+    link_event const *replay_channel::next_event(link_event::kind type) {
+        if (exhausted()) {
+            PN532_LOGE("Replay: the recording is over.");
+            ++_stats.divergences;
+            return nullptr;
+        }
+        link_event const &e = _recording.events[_next];
+        if (e.type != type) {
+            PN532_LOGE("Replay: diverged from the recording at event %u.", unsigned(_next));
+            ++_stats.divergences;
+            return nullptr;
+        }
+        ++_next;
+        ++_stats.events_replayed;
+        return &e;
+    }
+
+    void replay_channel::wait_for(link_event const &e) {
+        const auto now = std::chrono::steady_clock::now();
+        if (not _deadline) {
+            // The first event is played back right away
+            _deadline = now;
+            return;
+        }
+        if (_speed <= 0.) {
+            _deadline = now;
+            return;
+        }
+        *_deadline += std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double, std::micro>{double(e.delay.count()) / _speed});
+        std::this_thread::sleep_until(*_deadline);
+    }
+
+    bool replay_channel::wake() {
+        // A recording might start after the PN532 was woken up
+        if (not exhausted() and _recording.events[_next].type == link_event::kind::wake) {
+            link_event const *e = next_event(link_event::kind::wake);
+            wait_for(*e);
+            return not e->outcome;
+        }
+        return true;
+    }
+
+    random_fn replay_channel::random_source() {
+        return [this](std::uint8_t *data, std::size_t length) {
+            std::size_t n = 0;
+            if (link_event const *e = next_event(link_event::kind::random); e != nullptr) {
+                if (e->data.size() != length) {
+                    PN532_LOGE("Replay: drawn %u random bytes instead of %u at event %u.", unsigned(length), unsigned(e->data.size()), unsigned(_next - 1));
+                    ++_stats.divergences;
+                }
+                wait_for(*e);
+                n = std::min(e->data.size(), length);
+                std::copy_n(std::begin(e->data), n, data);
+            }
+            std::fill(data + n, data + length, 0x00);
+        };
+    }
+
+    channel::result<> replay_channel::raw_send(mlab::range<bin_data::const_iterator> buffer, ms) {
+        link_event const *e = next_event(link_event::kind::send);
+        if (e == nullptr) {
+            return error::comm_error;
+        }
+        if (not e->outcome and not std::equal(std::begin(buffer), std::end(buffer), std::begin(e->data), std::end(e->data))) {
+            PN532_LOGD("Replay: sent data differs from the recording at event %u.", unsigned(_next - 1));
+            ++_stats.send_mismatches;
+        }
+        wait_for(*e);
+        if (e->outcome) {
+            return *e->outcome;
+        }
+        return mlab::result_success;
+    }
+
+    channel::result<> replay_channel::raw_receive(mlab::range<bin_data::iterator> buffer, ms) {
+        link_event const *e = next_event(link_event::kind::receive);
+        if (e == nullptr) {
+            return error::comm_error;
+        }
+        wait_for(*e);
+        if (e->outcome) {
+            return *e->outcome;
+        }
+        // Past the recorded data there are zeroes, like in the other buffered channels
+        const auto n = std::min(e->data.size(), buffer.size());
+        std::copy_n(std::begin(e->data), n, std::begin(buffer));
+        std::fill(std::begin(buffer) + std::ptrdiff_t(n), std::end(buffer), 0x00);
+        return mlab::result_success;
+    }
+
+}// namespace pn532
@@ -0,0 +1,143 @@
+#include <algorithm>
+#include <pn532/log.h>
+#include <pn532/sim/channel.hpp>
+#include <thread>
+
+namespace pn532::sim {
+
+    sim_channel::sim_channel(firmware &fw, mlab::shared_buffer_pool buffer_pool)
+        : sim_channel{fw, link_config{}, std::move(buffer_pool)} {}
+
+    sim_channel::sim_channel(firmware &fw, link_config config, mlab::shared_buffer_pool buffer_pool)
+        : channel{std::move(buffer_pool)},
+          _firmware{&fw},
+          _config{config},
+          _now{0},
+          _pending{},
+          _last_response{},
+          _stats{} {}
+
+    bool sim_channel::wake() {
+        return true;
+    }
+
+    void sim_channel::advance(duration d) {
+        _now += d;
+        if (_config.real_time and d > duration{0}) {
+            std::this_thread::sleep_for(d);
+        }
+    }
+
+    bool sim_channel::wait_first_pending(duration timeout) {
+        if (_pending.empty()) {
+            advance(timeout);
+            return false;
+        }
+        const duration ready_at = _pending.front().ready_at;
+        if (ready_at <= _now) {
+            return true;
+        } else if (ready_at - _now > timeout) {
+            advance(timeout);
+            return false;
+        }
+        advance(ready_at - _now);
+        return true;
+    }
+
+    void sim_channel::process_frame(any_frame const &f) {
+        switch (f.type()) {
+            case frame_type::ack:
+                // Abort whatever the PN532 was about to send
+                if (not _pending.empty()) {
+                    ++_stats.aborts;
+                    _pending.clear();
+                }
+                break;
+            case frame_type::nack:
+                ++_stats.nacks_received;
+                _pending.clear();
+                _pending.push_back({_last_response, _now + _config.ack_delay});
+                break;
+            case frame_type::info: {
+                ++_stats.commands_received;
+                auto const &cmd_frame = f.get<frame_type::info>();
+                if (cmd_frame.transport != bits::transport::host_to_pn532) {
+                    PN532_LOGW("Simulated PN532 received an info frame with the wrong transport, ignoring.");
+                    break;
+                }
+                // Acknowledge the command, then respond
+                bin_data ack_data{};
+                ack_data << frame<frame_type::ack>{};
+                _pending.clear();
+                _pending.push_back({std::move(ack_data), _now + _config.ack_delay});
+                bin_data response_data{};
+                _last_response.clear();
+                if (_firmware->process(cmd_frame.command, cmd_frame.data.view(), response_data)) {
+                    // The PN532 responds with the command code incremented by one
+                    const auto response_cmd = static_cast<bits::command>(static_cast<std::uint8_t>(cmd_frame.command) + 1);
+                    _last_response << frame<frame_type::info>{bits::transport::pn532_to_host, response_cmd, std::move(response_data)};
+                } else {
+                    _last_response << frame<frame_type::error>{};
+                }
+                _pending.push_back({_last_response, _now + _config.processing_delay + _firmware->processing_time(cmd_frame.command)});
+            } break;
+            case frame_type::error:
+                PN532_LOGW("Simulated PN532 received an error frame, ignoring.");
+                break;
+        }
+    }
+
+    channel::result<> sim_channel::raw_send(mlab::range<bin_data::const_iterator> buffer, ms timeout) {
+        const duration transfer_time = _config.byte_time * buffer.size();
+        if (transfer_time > timeout) {
+            advance(timeout);
+            return error::comm_timeout;
+        }
+        advance(transfer_time);
+        _stats.bytes_sent += buffer.size();
+        frame_decoder decoder{};
+        decoder.feed(buffer);
+        if (decoder.done()) {
+            process_frame(decoder.pop_frame());
+        } else {
+            // The PN532 silently ignores malformed frames
+            PN532_LOGW("Simulated PN532 could not parse the received frame.");
+        }
+        return mlab::result_success;
+    }
+
+    channel::result<> sim_channel::raw_receive(mlab::range<bin_data::iterator> buffer, ms timeout) {
+        const duration t_begin = _now;
+        auto remaining_timeout = [&]() -> duration { return std::max(duration{0}, duration{timeout} - (_now - t_begin)); };
+        if (raw_receive_mode() == receive_mode::buffered) {
+            // Read the whole frame at once, past the frame boundary there are zeroes
+            if (not wait_first_pending(remaining_timeout())) {
+                return error::comm_timeout;
+            }
+            bin_data const &frame_data = _pending.front().data;
+            const auto n = std::min(frame_data.size(), buffer.size());
+            std::copy_n(std::begin(frame_data), n, std::begin(buffer));
+            std::fill(std::begin(buffer) + n, std::end(buffer), 0x00);
+            _pending.erase(std::begin(_pending));
+            advance(_config.byte_time * buffer.size());
+        } else {
+            // Consume the frames byte by byte
+            for (auto it = std::begin(buffer); it != std::end(buffer);) {
+                if (not wait_first_pending(remaining_timeout())) {
+                    return error::comm_timeout;
+                }
+                pending_frame &p = _pending.front();
+                const auto n = std::min(p.data.size() - p.offset, std::size_t(std::distance(it, std::end(buffer))));
+                it = std::copy_n(std::begin(p.data) + p.offset, n, it);
+                p.offset += n;
+                if (p.offset >= p.data.size()) {
+                    _pending.erase(std::begin(_pending));
+                }
+                advance(_config.byte_time * n);
+            }
+        }
+        _stats.bytes_received += buffer.size();
+        return mlab::result_success;
+    }
+
+}// namespace pn532::sim
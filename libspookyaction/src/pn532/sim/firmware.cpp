@@ -0,0 +1,231 @@
+#include <algorithm>
+#include <pn532/data.hpp>
+#include <pn532/log.h>
+#include <pn532/msg.hpp>
+#include <pn532/sim/firmware.hpp>
+
+namespace pn532::sim {
+    using mlab::make_range;
+    using namespace std::chrono_literals;
+
+    namespace {
+        constexpr std::uint8_t emulated_target_logical_index = 1;
+        constexpr std::uint8_t emulated_sam_status = 0x01;
+        constexpr std::array<std::uint8_t, 4> emulated_firmware_version = {0x32, 0x01, 0x06, 0x07};
+        constexpr std::array<std::uint8_t, 3> emulated_gpio_status = {0xff, 0xff, 0x00};
+
+        [[nodiscard]] std::uint8_t status_byte(bits::error e) {
+            return static_cast<std::uint8_t>(e);
+        }
+    }// namespace
+
+    std::chrono::microseconds firmware::processing_time(bits::command) const {
+        return 0us;
+    }
+
+    void emulated_firmware::set_target(target t) {
+        _target = std::move(t);
+        _has_target = true;
+        _target_listed = false;
+    }
+
+    void emulated_firmware::remove_target() {
+        _has_target = false;
+        _target_listed = false;
+    }
+
+    std::chrono::microseconds emulated_firmware::processing_time(bits::command cmd) const {
+        if (not _has_target) {
+            return 0us;
+        }
+        switch (cmd) {
+            case bits::command::in_data_exchange:
+                return _target.rf_latency + std::chrono::duration_cast<std::chrono::microseconds>(_last_rf_time);
+            case bits::command::in_list_passive_target:
+                [[fallthrough]];
+            case bits::command::in_psl:
+                return _target.rf_latency;
+            default:
+                return 0us;
+        }
+    }
+
+    std::chrono::nanoseconds emulated_firmware::rf_transfer_time(std::size_t bytes, bits::baudrate rate) const {
+        // 106 kbps, 212 kbps and 424 kbps are encoded as 0, 1, 2
+        return _target.rf_byte_time * bytes / (1 << static_cast<unsigned>(rate));
+    }
+
+    std::uint8_t emulated_firmware::read_register(std::uint16_t addr) const {
+        auto it = std::find_if(std::begin(_registers), std::end(_registers),
+                               [&](auto const &addr_value) { return addr_value.first == addr; });
+        return it != std::end(_registers) ? it->second : 0x00;
+    }
+
+    void emulated_firmware::write_register(std::uint16_t addr, std::uint8_t value) {
+        auto it = std::find_if(std::begin(_registers), std::end(_registers),
+                               [&](auto const &addr_value) { return addr_value.first == addr; });
+        if (it == std::end(_registers)) {
+            _registers.emplace_back(addr, value);
+        } else {
+            it->second = value;
+        }
+    }
+
+    bool emulated_firmware::in_list_passive_target(mlab::range<bin_data::const_iterator> data, bin_data &response) {
+        if (data.size() < 2) {
+            return false;
+        }
+        const auto brty = static_cast<bits::baudrate_modulation>(std::begin(data)[1]);
+        if (not _has_target or brty != bits::baudrate_modulation::kbps106_iso_iec_14443_typea) {
+            response << std::uint8_t(0);
+            return true;
+        }
+        _target_listed = true;
+        _in_to_trg = _trg_to_in = bits::baudrate::kbps106;
+        response << std::uint8_t(1) << emulated_target_logical_index
+                 << _target.sens_res << _target.sel_res
+                 << std::uint8_t(_target.nfcid.size()) << make_range(_target.nfcid)
+                 << std::uint8_t(_target.ats.size() + 1) << make_range(_target.ats);
+        return true;
+    }
+
+    bool emulated_firmware::in_data_exchange(mlab::range<bin_data::const_iterator> data, bin_data &response) {
+        if (data.size() == 0) {
+            return false;
+        }
+        const std::uint8_t target_byte = *std::begin(data);
+        if ((target_byte & ~bits::status_more_info_mask) != emulated_target_logical_index or not _target_listed) {
+            response << status_byte(bits::error::command_not_acceptable);
+            return true;
+        }
+        _chained_data << make_range(std::begin(data) + 1, std::end(data));
+        _last_rf_time = rf_transfer_time(data.size() - 1, _in_to_trg);
+        if ((target_byte & bits::status_more_info_mask) != 0) {
+            // Wait for the rest of the data before transmitting
+            response << status_byte(bits::error::none);
+            return true;
+        }
+        if (not _has_target or not _target.exchange) {
+            _chained_data.clear();
+            response << status_byte(bits::error::timeout);
+            return true;
+        }
+        if (_in_to_trg > _target.max_stable_bit_rate or _trg_to_in > _target.max_stable_bit_rate) {
+            _chained_data.clear();
+            response << status_byte(bits::error::timeout);
+            return true;
+        }
+        auto [target_response, success] = _target.exchange(_chained_data);
+        _chained_data.clear();
+        _last_rf_time += rf_transfer_time(target_response.size(), _trg_to_in);
+        if (not success) {
+            response << status_byte(bits::error::timeout);
+            return true;
+        }
+        if (target_response.size() + 1 > bits::max_firmware_data_length) {
+            PN532_LOGW("Emulated target response of %u bytes does not fit a frame, truncating.", target_response.size());
+            target_response.resize(bits::max_firmware_data_length - 1);
+        }
+        response << status_byte(bits::error::none) << target_response;
+        return true;
+    }
+
+    bool emulated_firmware::in_psl(mlab::range<bin_data::const_iterator> data, bin_data &response) {
+        if (data.size() < 3) {
+            return false;
+        }
+        const auto in_to_trg = static_cast<bits::baudrate>(std::begin(data)[1]);
+        const auto trg_to_in = static_cast<bits::baudrate>(std::begin(data)[2]);
+        if (std::begin(data)[0] != emulated_target_logical_index or not _target_listed) {
+            response << status_byte(bits::error::command_not_acceptable);
+            return true;
+        }
+        const iso_iec_14443_4_bit_rates supported = max_bit_rates_from_ats(_target.ats);
+        if (in_to_trg > supported.in_to_trg or trg_to_in > supported.trg_to_in) {
+            response << status_byte(bits::error::invalid_parameter);
+            return true;
+        }
+        _in_to_trg = in_to_trg;
+        _trg_to_in = trg_to_in;
+        response << status_byte(bits::error::none);
+        return true;
+    }
+
+    bool emulated_firmware::process(bits::command cmd, mlab::range<bin_data::const_iterator> data, bin_data &response) {
+        switch (cmd) {
+            case bits::command::diagnose:
+                if (data.size() == 0) {
+                    return false;
+                }
+                if (static_cast<bits::test>(*std::begin(data)) == bits::test::comm_line) {
+                    response << data;
+                } else {
+                    // All other tests pass
+                    response << std::uint8_t(0x00);
+                }
+                return true;
+            case bits::command::get_firmware_version:
+                response << emulated_firmware_version;
+                return true;
+            case bits::command::get_general_status:
+                response << status_byte(bits::error::none) << std::uint8_t(_rf_field ? 0x01 : 0x00);
+                if (_target_listed) {
+                    // Logical index, rx and tx baudrate, modulation
+                    response << std::uint8_t(1) << emulated_target_logical_index << _trg_to_in << _in_to_trg << std::uint8_t(0x00);
+                } else {
+                    response << std::uint8_t(0);
+                }
+                response << emulated_sam_status;
+                return true;
+            case bits::command::read_register:
+                for (auto it = std::begin(data); std::distance(it, std::end(data)) >= 2; it += 2) {
+                    response << read_register((std::uint16_t(it[0]) << 8) | it[1]);
+                }
+                return true;
+            case bits::command::write_register:
+                for (auto it = std::begin(data); std::distance(it, std::end(data)) >= 3; it += 3) {
+                    write_register((std::uint16_t(it[0]) << 8) | it[1], it[2]);
+                }
+                return true;
+            case bits::command::read_gpio:
+                response << emulated_gpio_status;
+                return true;
+            case bits::command::rf_configuration:
+                if (data.size() >= 2 and static_cast<bits::rf_config_item>(std::begin(data)[0]) == bits::rf_config_item::rf_field) {
+                    _rf_field = (std::begin(data)[1] & bits::rf_configuration_field_auto_rf_on_mask) != 0;
+                }
+                return true;
+            case bits::command::write_gpio:
+                [[fallthrough]];
+            case bits::command::set_serial_baudrate:
+                [[fallthrough]];
+            case bits::command::set_parameters:
+                [[fallthrough]];
+            case bits::command::sam_configuration:
+                return true;
+            case bits::command::power_down:
+                response << status_byte(bits::error::none);
+                return true;
+            case bits::command::in_psl:
+                return in_psl(data, response);
+            case bits::command::in_select:
+                [[fallthrough]];
+            case bits::command::in_deselect:
+                response << status_byte(_target_listed ? bits::error::none : bits::error::command_not_acceptable);
+                return true;
+            case bits::command::in_release:
+                response << status_byte(bits::error::none);
+                _target_listed = false;
+                _in_to_trg = _trg_to_in = bits::baudrate::kbps106;
+                return true;
+            case bits::command::in_list_passive_target:
+                return in_list_passive_target(data, response);
+            case bits::command::in_data_exchange:
+                return in_data_exchange(data, response);
+            default:
+                PN532_LOGW("Emulated firmware does not support command %s.", to_string(cmd));
+                return false;
+        }
+    }
+
+}// namespace pn532::sim
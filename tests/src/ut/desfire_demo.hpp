@@ -0,0 +1,59 @@
+#ifndef SPOOKY_ACTION_DESFIRE_DEMO_HPP
+#define SPOOKY_ACTION_DESFIRE_DEMO_HPP
+
+#include <desfire/tag.hpp>
+#include <string>
+
+// Demo applications and files shared by the tests on a real card and on the emulated card; no hardware needed.
+
+namespace ut {
+    namespace desfire_main {
+        using namespace ::desfire;
+
+        struct demo_app {
+            app_id aid;
+            cipher_type cipher;
+            any_key primary_key;
+            any_key secondary_key;
+
+            explicit demo_app(cipher_type c);
+
+            void ensure_selected_and_primary(tag &tag) const;
+            void ensure_created(tag &tag, any_key const &root_key) const;
+        };
+    }// namespace desfire_main
+
+    namespace desfire_files {
+        using namespace ::desfire;
+
+        struct demo_file {
+            cipher_type cipher = cipher_type::des;
+            file_type type = file_type::standard;
+            file_security security = file_security::none;
+
+            [[nodiscard]] static file_id fid();
+
+            [[nodiscard]] any_file_settings get_settings() const;
+
+            void delete_if_preexisting(tag &tag) const;
+
+            void test(tag &tag, bin_data const &test_load);
+
+            [[nodiscard]] const char *security_description() const;
+
+            [[nodiscard]] const char *cipher_description() const;
+
+            [[nodiscard]] const char *type_description() const;
+
+            [[nodiscard]] std::string get_description() const;
+
+        private:
+            void test_standard_data_file(tag &mifare, bin_data const &load) const;
+            void test_backup_data_file(tag &mifare, bin_data const &load) const;
+            void test_value_file(tag &mifare) const;
+            void test_record_file(tag &mifare) const;
+        };
+    }// namespace desfire_files
+}// namespace ut
+
+#endif//SPOOKY_ACTION_DESFIRE_DEMO_HPP
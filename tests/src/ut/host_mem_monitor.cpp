@@ -0,0 +1,155 @@
+#include "host_mem_monitor.hpp"
+
+#ifndef ESP_PLATFORM
+
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <mlab/log.h>
+#include <new>
+
+namespace ut {
+
+    namespace {
+        /**
+         * Each block starts with its size, padded so that the memory returned to the caller stays aligned.
+         */
+        constexpr std::size_t header_size = alignof(std::max_align_t);
+
+        struct heap_counters {
+            std::atomic<bool> active{false};
+            std::atomic<std::size_t> allocations{0};
+            std::atomic<std::ptrdiff_t> live_allocations{0};
+            std::atomic<std::ptrdiff_t> live_bytes{0};
+            std::atomic<std::size_t> bytes_in_use{0};
+        };
+
+        heap_counters &counters() {
+            // Constructed on first use, and never destroyed, since operator new may run during static destruction
+            static auto *_counters = new (std::malloc(sizeof(heap_counters))) heap_counters{};
+            return *_counters;
+        }
+
+        void *counted_alloc(std::size_t size) {
+            auto *block = static_cast<unsigned char *>(std::malloc(header_size + size));
+            if (block == nullptr) {
+                return nullptr;
+            }
+            *reinterpret_cast<std::size_t *>(block) = size;
+            auto &c = counters();
+            c.bytes_in_use.fetch_add(size, std::memory_order_relaxed);
+            if (c.active.load(std::memory_order_relaxed)) {
+                c.allocations.fetch_add(1, std::memory_order_relaxed);
+                c.live_allocations.fetch_add(1, std::memory_order_relaxed);
+                c.live_bytes.fetch_add(std::ptrdiff_t(size), std::memory_order_relaxed);
+            }
+            return block + header_size;
+        }
+
+        void counted_free(void *ptr) {
+            if (ptr == nullptr) {
+                return;
+            }
+            auto *block = static_cast<unsigned char *>(ptr) - header_size;
+            const std::size_t size = *reinterpret_cast<std::size_t *>(block);
+            auto &c = counters();
+            c.bytes_in_use.fetch_sub(size, std::memory_order_relaxed);
+            if (c.active.load(std::memory_order_relaxed)) {
+                c.live_allocations.fetch_sub(1, std::memory_order_relaxed);
+                c.live_bytes.fetch_sub(std::ptrdiff_t(size), std::memory_order_relaxed);
+            }
+            std::free(block);
+        }
+    }// namespace
+
+    host_mem_monitor::host_mem_monitor(bool record_all_allocations) : _record_all_allocations{record_all_allocations} {
+        ESP_LOGI("MEM", "Begin heap monitoring");
+        auto &c = counters();
+        c.allocations.store(0, std::memory_order_relaxed);
+        c.live_allocations.store(0, std::memory_order_relaxed);
+        c.live_bytes.store(0, std::memory_order_relaxed);
+        c.active.store(true, std::memory_order_relaxed);
+    }
+
+    host_mem_monitor::~host_mem_monitor() {
+        counters().active.store(false, std::memory_order_relaxed);
+        if (_record_all_allocations) {
+            ESP_LOGI("MEM", "Heap allocations: %d", int(count_allocations()));
+        }
+        if (const auto leaked = count_leaked_memory(); leaked > 0) {
+            ESP_LOGW("MEM", "End heap monitoring, leak: %d", int(leaked));
+        } else {
+            ESP_LOGI("MEM", "End heap monitoring, no leak.");
+        }
+    }
+
+    std::size_t host_mem_monitor::count_leaked_memory() const {
+        // Freeing memory that was allocated before the monitoring began can bring this below zero
+        return std::size_t(std::max(std::ptrdiff_t{0}, counters().live_bytes.load(std::memory_order_relaxed)));
+    }
+
+    std::size_t host_mem_monitor::count_allocations() const {
+        if (_record_all_allocations) {
+            return counters().allocations.load(std::memory_order_relaxed);
+        }
+        return std::size_t(std::max(std::ptrdiff_t{0}, counters().live_allocations.load(std::memory_order_relaxed)));
+    }
+
+    void host_mem_monitor::pause() {
+        counters().active.store(false, std::memory_order_relaxed);
+    }
+
+    void host_mem_monitor::resume() {
+        counters().active.store(true, std::memory_order_relaxed);
+    }
+
+    std::size_t host_mem_monitor::bytes_in_use() {
+        return counters().bytes_in_use.load(std::memory_order_relaxed);
+    }
+
+}// namespace ut
+
+void *operator new(std::size_t size) {
+    if (void *ptr = ut::counted_alloc(size); ptr != nullptr) {
+        return ptr;
+    }
+    throw std::bad_alloc{};
+}
+
+void *operator new[](std::size_t size) {
+    return ::operator new(size);
+}
+
+void *operator new(std::size_t size, std::nothrow_t const &) noexcept {
+    return ut::counted_alloc(size);
+}
+
+void *operator new[](std::size_t size, std::nothrow_t const &) noexcept {
+    return ut::counted_alloc(size);
+}
+
+void operator delete(void *ptr) noexcept {
+    ut::counted_free(ptr);
+}
+
+void operator delete[](void *ptr) noexcept {
+    ut::counted_free(ptr);
+}
+
+void operator delete(void *ptr, std::size_t) noexcept {
+    ut::counted_free(ptr);
+}
+
+void operator delete[](void *ptr, std::size_t) noexcept {
+    ut::counted_free(ptr);
+}
+
+void operator delete(void *ptr, std::nothrow_t const &) noexcept {
+    ut::counted_free(ptr);
+}
+
+void operator delete[](void *ptr, std::nothrow_t const &) noexcept {
+    ut::counted_free(ptr);
+}
+
+#endif
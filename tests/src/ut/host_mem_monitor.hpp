@@ -0,0 +1,56 @@
+#ifndef SPOOKY_ACTION_HOST_MEM_MONITOR_HPP
+#define SPOOKY_ACTION_HOST_MEM_MONITOR_HPP
+
+#include <cstddef>
+
+namespace ut {
+
+    /**
+     * @brief Counts the heap allocations for the lifetime of this object, like @ref desfire::esp32::mem_monitor does
+     * on ESP32.
+     *
+     * The test firmware replaces the global `operator new` and `operator delete` with counting versions on top of
+     * `malloc` and `free` on every platform but ESP32, so only the allocations made through `operator new` are counted.
+     * There should be at most one monitor at a time.
+     */
+    struct host_mem_monitor {
+        /**
+         * @param record_all_allocations If true, counts every allocation, also those that are freed before the end
+         *  of the monitoring, so that @ref count_allocations can prove that a piece of code does not touch the heap.
+         *  Otherwise, only counts the allocations that are not freed.
+         */
+        explicit host_mem_monitor(bool record_all_allocations = false);
+        ~host_mem_monitor();
+        host_mem_monitor(host_mem_monitor &&) noexcept = delete;
+        host_mem_monitor(host_mem_monitor const &) = delete;
+        host_mem_monitor &operator=(host_mem_monitor &&) noexcept = delete;
+        host_mem_monitor &operator=(host_mem_monitor const &) = delete;
+        [[nodiscard]] std::size_t count_leaked_memory() const;
+
+        /**
+         * @brief Number of heap allocations since construction; only counts the leaks unless recording all allocations.
+         */
+        [[nodiscard]] std::size_t count_allocations() const;
+
+        /**
+         * @brief Stops counting until @ref resume, e.g. to leave out the allocations of a simulated device.
+         */
+        void pause();
+
+        /**
+         * @brief Resumes counting after @ref pause, keeping what was counted before.
+         */
+        void resume();
+
+        /**
+         * @brief Bytes currently allocated through `operator new`, whether or not a monitor is active.
+         */
+        [[nodiscard]] static std::size_t bytes_in_use();
+
+    private:
+        bool _record_all_allocations;
+    };
+
+}// namespace ut
+
+#endif//SPOOKY_ACTION_HOST_MEM_MONITOR_HPP
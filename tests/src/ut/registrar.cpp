@@ -3,7 +3,7 @@
 //
 
 #include "registrar.hpp"
-#include <esp_log.h>
+#include <mlab/log.h>
 
 namespace ut {
 
@@ -5,6 +5,7 @@
 #ifndef SPOOKY_ACTION_REGISTRAR_HPP
 #define SPOOKY_ACTION_REGISTRAR_HPP
 
+#include <cstdint>
 #include <map>
 #include <memory>
 
@@ -3,15 +3,338 @@
 //
 
 #include "test_desfire_ciphers.hpp"
+#include "utils.hpp"
+#include <chrono>
+#include <desfire/crypto_algo.hpp>
 #include <desfire/data.hpp>
+#include <desfire/diversified_key_cache.hpp>
 #include <desfire/esp32/crypto_impl.hpp>
+#include <desfire/host/crypto_impl.hpp>
 #include <desfire/kdf.hpp>
+#include <desfire/msg.hpp>
+#include <mlab/log.h>
+#include <numeric>
 #include <unity.h>
 
+#define TEST_TAG "UT"
+
 namespace ut::desfire_ciphers {
     namespace {
         using namespace ::desfire;
-    }
+
+        [[nodiscard]] std::uint32_t crc32_fn(bin_data::const_iterator b, bin_data::const_iterator e, std::uint32_t init) {
+            return b == e ? init : compute_crc32(range<std::uint8_t const *>{&*b, &*b + std::distance(b, e)}, init);
+        }
+
+        /**
+         * Deciphered payload of a ciphered response, [[ DATA || CRC32(DATA || STATUS) || PADDING ]].
+         */
+        [[nodiscard]] bin_data make_ciphered_payload(std::size_t data_size, std::uint8_t status, std::size_t block_size) {
+            bin_data payload{};
+            payload.resize(data_size);
+            std::iota(std::begin(payload), std::end(payload), 0x00);
+            const std::uint32_t crc = compute_crc32(status, compute_crc32(payload));
+            payload << mlab::lsb32 << crc;
+            payload.resize(padded_length(payload.size(), block_size), 0x00);
+            return payload;
+        }
+
+        /**
+         * Reproduces the previous tail search, that recomputed the CRC on the whole data for every candidate tail.
+         */
+        [[nodiscard]] std::pair<bin_data::const_iterator, bool> find_crc_tail_quadratic(bin_data const &d, std::uint8_t status, std::size_t block_size) {
+            const auto crc_fn = [=](bin_data::const_iterator b, bin_data::const_iterator e, std::uint32_t init) -> std::uint32_t {
+                const auto sequence_length = static_cast<std::size_t>(std::distance(b, e));
+                const auto m = b + bin_data::difference_type(std::max(sequence_length, std::size_t(4)) - 4);
+                return crc32_fn(m, e, compute_crc32(status, crc32_fn(b, m, init)));
+            };
+            return find_crc_tail(std::begin(d), std::end(d), crc_fn, crc32_init, block_size, false);
+        }
+
+        [[nodiscard]] std::pair<bin_data::const_iterator, bool> find_crc_tail_linear(bin_data const &d, std::uint8_t status, std::size_t block_size) {
+            const auto crc_fn = [](auto b, auto e, std::uint32_t init) -> std::uint32_t {
+                return b == e ? init : compute_crc32(range<std::uint8_t const *>{&*b, &*b + std::distance(b, e)}, init);
+            };
+            return find_crc_tail_with_extra_byte(std::begin(d), std::end(d), crc_fn, crc32_init, block_size, status);
+        }
+
+        /**
+         * Bitwise CRC with reflected polynomial @p poly, used as a reference for the table driven implementation.
+         */
+        template <class N>
+        [[nodiscard]] N crc_bitwise(std::uint8_t const *p, std::size_t n, N crc, N poly) {
+            for (; n > 0; --n, ++p) {
+                crc ^= *p;
+                for (unsigned bit = 0; bit < 8; ++bit) {
+                    crc = (crc & 1) != 0 ? N((crc >> 1) ^ poly) : N(crc >> 1);
+                }
+            }
+            return crc;
+        }
+
+        template <class Fn>
+        [[nodiscard]] double crc_throughput_mbps(bin_data const &payload, Fn &&crc_fn) {
+            static constexpr std::size_t num_repetitions = 50;
+            // Volatile, so that the computation is not optimized away
+            volatile std::uint32_t checksum = 0;
+            const auto t_begin = std::chrono::steady_clock::now();
+            for (std::size_t i = 0; i < num_repetitions; ++i) {
+                checksum ^= crc_fn(payload.data_view());
+            }
+            const auto t_elapsed = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - t_begin);
+            return t_elapsed.count() > 0 ? double(payload.size() * num_repetitions) / double(t_elapsed.count()) : 0.;
+        }
+
+        template <class Fn>
+        [[nodiscard]] std::chrono::microseconds time_tail_search(bin_data const &d, Fn &&search_fn) {
+            static constexpr std::size_t num_repetitions = 50;
+            const auto t_begin = std::chrono::steady_clock::now();
+            for (std::size_t i = 0; i < num_repetitions; ++i) {
+                TEST_ASSERT(search_fn(d, 0x00, 16).second)
+            }
+            return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - t_begin) / num_repetitions;
+        }
+
+        /**
+         * Average time of a round trip of @p payload through @ref cipher::prepare_tx and @ref cipher::confirm_rx. The
+         * last enciphered frame is left in @p tx.
+         */
+        [[nodiscard]] std::chrono::nanoseconds time_cipher_round_trip(cipher &c, bin_data const &payload, bin_data &tx, bin_data &rx) {
+            static constexpr std::size_t num_repetitions = 200;
+            const auto t_begin = std::chrono::steady_clock::now();
+            for (std::size_t i = 0; i < num_repetitions; ++i) {
+                tx.clear();
+                tx << payload;
+                c.prepare_tx(tx, 1, cipher_mode::ciphered);
+                // Decipher the secured part back, with a status byte
+                rx.clear();
+                rx << tx.view(1) << std::uint8_t(0x00);
+                TEST_ASSERT(c.confirm_rx(rx, cipher_mode::ciphered_no_crc))
+            }
+            return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - t_begin) / num_repetitions;
+        }
+
+        /**
+         * Runs the same round trips on @p erased and @p typed, which must be set up with the same key, and checks that
+         * they produce the same frames without allocating.
+         */
+        void compare_cipher_dispatch(const char *name, cipher &erased, cipher &typed, bin_data const &payload) {
+            bin_data tx_erased{mlab::prealloc(2 * payload.size())};
+            bin_data rx_erased{mlab::prealloc(2 * payload.size())};
+            bin_data tx_typed{mlab::prealloc(2 * payload.size())};
+            bin_data rx_typed{mlab::prealloc(2 * payload.size())};
+            // Warm up, so that pools and buffers are in place
+            static_cast<void>(time_cipher_round_trip(erased, payload, tx_erased, rx_erased));
+            static_cast<void>(time_cipher_round_trip(typed, payload, tx_typed, rx_typed));
+            ut::mem_monitor monitor{true};
+            const auto t_erased = time_cipher_round_trip(erased, payload, tx_erased, rx_erased);
+            const auto t_typed = time_cipher_round_trip(typed, payload, tx_typed, rx_typed);
+            TEST_ASSERT_EQUAL(0, monitor.count_allocations());
+            TEST_ASSERT_EQUAL(tx_erased.size(), tx_typed.size());
+            TEST_ASSERT_EQUAL_HEX8_ARRAY(tx_erased.data(), tx_typed.data(), tx_erased.size());
+            ESP_LOGI(TEST_TAG, "%s round trip on %u bytes: type-erased %lld ns, typed %lld ns.", name, payload.size(),
+                     static_cast<long long>(t_erased.count()), static_cast<long long>(t_typed.count()));
+        }
+
+        /**
+         * Throughput of @p CryptoT on @p payload, which is processed in place. For @ref crypto_operation::mac on a
+         * @ref crypto_with_cmac, measures @ref crypto_with_cmac::do_cmac instead.
+         */
+        template <class CryptoT>
+        [[nodiscard]] double crypto_throughput_mbps(CryptoT &c, bin_data &payload, crypto_operation op) {
+            static constexpr std::size_t num_repetitions = 20;
+            std::array<std::uint8_t, 16> iv{};
+            const range<std::uint8_t *> iv_view{iv.data(), iv.data() + crypto_block_size_v<CryptoT>};
+            const auto t_begin = std::chrono::steady_clock::now();
+            for (std::size_t i = 0; i < num_repetitions; ++i) {
+                if constexpr (std::is_base_of_v<crypto_with_cmac, CryptoT>) {
+                    if (op == crypto_operation::mac) {
+                        // Chain the MAC into the payload, so that the computation is not optimized away
+                        payload.front() ^= c.do_cmac(payload.data_view(), iv_view).front();
+                        continue;
+                    }
+                }
+                c.do_crypto(payload.data_view(), iv_view, op);
+            }
+            const auto t_elapsed = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - t_begin);
+            return t_elapsed.count() > 0 ? double(payload.size() * num_repetitions) / double(t_elapsed.count()) : 0.;
+        }
+
+        template <class CryptoT, cipher_type Type>
+        void log_crypto_throughput(const char *provider_name, key<Type> const &k, bin_data &payload) {
+            CryptoT c{};
+            c.setup_with_key(mlab::make_range(k.k));
+            const double mbps_enc = crypto_throughput_mbps(c, payload, crypto_operation::encrypt);
+            const double mbps_dec = crypto_throughput_mbps(c, payload, crypto_operation::decrypt);
+            const double mbps_mac = crypto_throughput_mbps(c, payload, crypto_operation::mac);
+            ESP_LOGI(TEST_TAG, "%s %s on %u bytes: encrypt %.1f MB/s, decrypt %.1f MB/s, %s %.1f MB/s.", provider_name,
+                     to_string(Type), payload.size(), mbps_enc, mbps_dec,
+                     std::is_base_of_v<crypto_with_cmac, CryptoT> ? "CMAC" : "MAC", mbps_mac);
+        }
+
+        /**
+         * Benchmarks the crypto implementations that would be plugged into a @ref typed_cipher_provider with the same
+         * template arguments.
+         */
+        template <class CryptoDES, class Crypto2K3DES, class Crypto3K3DES, class CryptoAES>
+        void log_provider_throughput(const char *provider_name, std::size_t payload_size) {
+            bin_data payload{};
+            payload.resize(payload_size);
+            std::iota(std::begin(payload), std::end(payload), 0x00);
+            log_crypto_throughput<CryptoDES>(provider_name, key<cipher_type::des>{0, {0x00, 0x10, 0x20, 0x30, 0x40, 0x50, 0x60, 0x70}}, payload);
+            log_crypto_throughput<Crypto2K3DES>(provider_name, key<cipher_type::des3_2k>{0, {0x00, 0x10, 0x20, 0x30, 0x40, 0x50, 0x60, 0x70, 0x80, 0x90, 0xA0, 0xB0, 0xC0, 0xD0, 0xE0, 0xF0}}, payload);
+            log_crypto_throughput<Crypto3K3DES>(provider_name, key<cipher_type::des3_3k>{0, {0x00, 0x10, 0x20, 0x30, 0x40, 0x50, 0x60, 0x70, 0x80, 0x90, 0xA0, 0xB0, 0xC0, 0xD0, 0xE0, 0xF0, 0x01, 0x11, 0x21, 0x31, 0x41, 0x51, 0x61, 0x71}}, payload);
+            log_crypto_throughput<CryptoAES>(provider_name, key<cipher_type::aes128>{0, {0x00, 0x10, 0x20, 0x30, 0x40, 0x50, 0x60, 0x70, 0x80, 0x90, 0xA0, 0xB0, 0xB0, 0xA0, 0x90, 0x80}}, payload);
+        }
+
+        /**
+         * Checks @p CryptoT against a CBC known answer test. The standard CBC encipherment is
+         * @ref crypto_operation::encrypt on CMAC-enabled crypto, and @ref crypto_operation::mac on legacy crypto, where
+         * @ref crypto_operation::encrypt deciphers (see note on @ref cipher_scheme_legacy).
+         */
+        template <class CryptoT>
+        void check_cbc_kat(bin_data const &k, bin_data const &iv, bin_data const &plaintext, bin_data const &ciphertext) {
+            static constexpr auto encipher_op = std::is_base_of_v<crypto_with_cmac, CryptoT> ? crypto_operation::encrypt : crypto_operation::mac;
+            const std::size_t block_size = crypto_block_size_v<CryptoT>;
+            TEST_ASSERT_EQUAL(block_size, iv.size());
+            CryptoT c{};
+            c.setup_with_key(k.data_view());
+            bin_data data = plaintext;
+            bin_data iv_enc = iv;
+            c.do_crypto(data.data_view(), iv_enc.data_view(), encipher_op);
+            TEST_ASSERT_EQUAL_HEX8_ARRAY(ciphertext.data(), data.data(), ciphertext.size());
+            TEST_ASSERT_EQUAL_HEX8_ARRAY(ciphertext.data() + ciphertext.size() - block_size, iv_enc.data(), block_size);
+            bin_data iv_dec = iv;
+            c.do_crypto(data.data_view(), iv_dec.data_view(), crypto_operation::decrypt);
+            TEST_ASSERT_EQUAL_HEX8_ARRAY(plaintext.data(), data.data(), plaintext.size());
+            TEST_ASSERT_EQUAL_HEX8_ARRAY(ciphertext.data() + ciphertext.size() - block_size, iv_dec.data(), block_size);
+        }
+
+        /**
+         * Checks @p CryptoT against a CMAC known answer test with a zero IV. The IV ends up holding the full tag, of which
+         * @ref crypto_with_cmac::do_cmac returns the first 8 bytes.
+         */
+        template <class CryptoT>
+        void check_cmac_kat(bin_data const &k, range<std::uint8_t const *> message, bin_data const &tag) {
+            const std::size_t block_size = crypto_block_size_v<CryptoT>;
+            TEST_ASSERT_EQUAL(block_size, tag.size());
+            CryptoT c{};
+            c.setup_with_key(k.data_view());
+            std::array<std::uint8_t, 16> iv{};
+            const auto mac = c.do_cmac(message, range<std::uint8_t *>{iv.data(), iv.data() + block_size});
+            TEST_ASSERT_EQUAL_HEX8_ARRAY(tag.data(), mac.data(), mac.size());
+            TEST_ASSERT_EQUAL_HEX8_ARRAY(tag.data(), iv.data(), block_size);
+        }
+
+        /**
+         * Known answer tests for the crypto implementations that would be plugged into a @ref typed_cipher_provider
+         * with the same template arguments. DES is the CBC example from FIPS 81, AES-128 and its CMAC come from
+         * NIST SP 800-38A F.2.1 and RFC 4493, 3K3DES CMAC from the TDEA examples of NIST SP 800-38B.
+         */
+        template <class CryptoDES, class Crypto2K3DES, class Crypto3K3DES, class CryptoAES>
+        void check_provider_kat() {
+            const bin_data des3_key = {0x01, 0x23, 0x45, 0x67, 0x89, 0xAB, 0xCD, 0xEF, 0x23, 0x45, 0x67, 0x89, 0xAB, 0xCD, 0xEF, 0x01,
+                                       0x45, 0x67, 0x89, 0xAB, 0xCD, 0xEF, 0x01, 0x23};
+            const bin_data des3_iv = {0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07};
+            const bin_data aes_key = {0x2B, 0x7E, 0x15, 0x16, 0x28, 0xAE, 0xD2, 0xA6, 0xAB, 0xF7, 0x15, 0x88, 0x09, 0xCF, 0x4F, 0x3C};
+            const bin_data aes_iv = {0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0A, 0x0B, 0x0C, 0x0D, 0x0E, 0x0F};
+            const bin_data message = {0x6B, 0xC1, 0xBE, 0xE2, 0x2E, 0x40, 0x9F, 0x96, 0xE9, 0x3D, 0x7E, 0x11, 0x73, 0x93, 0x17, 0x2A,
+                                      0xAE, 0x2D, 0x8A, 0x57, 0x1E, 0x03, 0xAC, 0x9C, 0x9E, 0xB7, 0x6F, 0xAC, 0x45, 0xAF, 0x8E, 0x51,
+                                      0x30, 0xC8, 0x1C, 0x46, 0xA3, 0x5C, 0xE4, 0x11, 0xE5, 0xFB, 0xC1, 0x19, 0x1A, 0x0A, 0x52, 0xEF,
+                                      0xF6, 0x9F, 0x24, 0x45, 0xDF, 0x4F, 0x9B, 0x17, 0xAD, 0x2B, 0x41, 0x7B, 0xE6, 0x6C, 0x37, 0x10};
+            check_cbc_kat<CryptoDES>(
+                    {0x01, 0x23, 0x45, 0x67, 0x89, 0xAB, 0xCD, 0xEF},
+                    {0x12, 0x34, 0x56, 0x78, 0x90, 0xAB, 0xCD, 0xEF},
+                    {0x4E, 0x6F, 0x77, 0x20, 0x69, 0x73, 0x20, 0x74, 0x68, 0x65, 0x20, 0x74, 0x69, 0x6D, 0x65, 0x20,
+                     0x66, 0x6F, 0x72, 0x20, 0x61, 0x6C, 0x6C, 0x20},
+                    {0xE5, 0xC7, 0xCD, 0xDE, 0x87, 0x2B, 0xF2, 0x7C, 0x43, 0xE9, 0x34, 0x00, 0x8C, 0x38, 0x9C, 0x0F,
+                     0x68, 0x37, 0x88, 0x49, 0x9A, 0x7C, 0x05, 0xF6});
+            check_cbc_kat<Crypto2K3DES>(
+                    bin_data::chain(des3_key.view(0, 16)), des3_iv, bin_data::chain(message.view(0, 32)),
+                    {0xEB, 0xBB, 0xF7, 0x74, 0xAD, 0xB4, 0x8E, 0xB5, 0x47, 0x10, 0x16, 0xD5, 0xFF, 0x74, 0x52, 0x1D,
+                     0x46, 0x21, 0x1A, 0xA1, 0x7A, 0xE0, 0x9C, 0xCA, 0x0F, 0x97, 0xC8, 0xF2, 0x8C, 0x91, 0x3C, 0x1F});
+            check_cbc_kat<Crypto3K3DES>(
+                    des3_key, des3_iv, bin_data::chain(message.view(0, 32)),
+                    {0xDF, 0x4F, 0xB4, 0x8A, 0x5C, 0x34, 0x14, 0xFA, 0x34, 0x0A, 0x15, 0x53, 0xEF, 0xAE, 0x84, 0x31,
+                     0x7B, 0x4C, 0x6A, 0xAB, 0x88, 0x45, 0xFB, 0x92, 0x47, 0xEE, 0x5E, 0x08, 0x51, 0x4D, 0xD2, 0xBC});
+            check_cbc_kat<CryptoAES>(
+                    aes_key, aes_iv, message,
+                    {0x76, 0x49, 0xAB, 0xAC, 0x81, 0x19, 0xB2, 0x46, 0xCE, 0xE9, 0x8E, 0x9B, 0x12, 0xE9, 0x19, 0x7D,
+                     0x50, 0x86, 0xCB, 0x9B, 0x50, 0x72, 0x19, 0xEE, 0x95, 0xDB, 0x11, 0x3A, 0x91, 0x76, 0x78, 0xB2,
+                     0x73, 0xBE, 0xD6, 0xB8, 0xE3, 0xC1, 0x74, 0x3B, 0x71, 0x16, 0xE6, 0x9E, 0x22, 0x22, 0x95, 0x16,
+                     0x3F, 0xF1, 0xCA, 0xA1, 0x68, 0x1F, 0xAC, 0x09, 0x12, 0x0E, 0xCA, 0x30, 0x75, 0x86, 0xE1, 0xA7});
+            // Full blocks and padded last block
+            check_cmac_kat<Crypto3K3DES>(des3_key, message.data_view(0, 16), {0x30, 0x23, 0x9C, 0xF1, 0xF5, 0x2E, 0x66, 0x09});
+            check_cmac_kat<Crypto3K3DES>(des3_key, message.data_view(0, 20), {0x6C, 0x9F, 0x3E, 0xE4, 0x92, 0x3F, 0x6B, 0xE2});
+            check_cmac_kat<CryptoAES>(aes_key, message.data_view(0, 16),
+                                      {0x07, 0x0A, 0x16, 0xB4, 0x6B, 0x4D, 0x41, 0x44, 0xF7, 0x9B, 0xDD, 0x9D, 0xD0, 0x4A, 0x28, 0x7C});
+            check_cmac_kat<CryptoAES>(aes_key, message.data_view(0, 40),
+                                      {0xDF, 0xA6, 0x67, 0x47, 0xDE, 0x9A, 0xE6, 0x30, 0x30, 0xCA, 0x32, 0x61, 0x14, 0x97, 0xC8, 0x27});
+            check_cmac_kat<CryptoAES>(aes_key, message.data_view(),
+                                      {0x51, 0xF0, 0xBE, 0xBF, 0x7E, 0x3B, 0x9D, 0x92, 0xFC, 0x49, 0x74, 0x17, 0x79, 0x36, 0x3C, 0xFE});
+        }
+
+        /**
+         * Checks that @ref kdf_an10922_batch produces the same keys as @ref kdf_an10922 on inputs of all lengths.
+         */
+        template <class CryptoT, cipher_type Type>
+        void compare_kdf_batch(key<Type> const &master_key) {
+            using batch_t = kdf_an10922_batch<CryptoT>;
+            static constexpr std::size_t num_inputs = 2 * batch_t::block_size + 2;
+            CryptoT c{};
+            c.setup_with_key(mlab::make_range(master_key.k));
+            batch_t batch{c};
+            bin_data inputs{};
+            inputs.resize(num_inputs * (num_inputs - 1) / 2);
+            std::iota(std::begin(inputs), std::end(inputs), 0x00);
+            // Input i has length i, the longest ones will be truncated
+            std::array<range<std::uint8_t const *>, num_inputs> input_views{};
+            for (std::size_t i = 0, offset = 0; i < num_inputs; offset += i, ++i) {
+                input_views[i] = inputs.data_view(offset, i);
+            }
+            std::array<std::uint8_t, num_inputs * batch_t::key_length> keys{};
+            TEST_ASSERT_EQUAL(num_inputs, batch.diversify(mlab::make_range(input_views), mlab::make_range(keys)));
+            for (std::size_t i = 0; i < num_inputs; ++i) {
+                bin_data diversify_input = bin_data::chain(input_views[i]);
+                const auto expected_key = kdf_an10922(c, diversify_input);
+                TEST_ASSERT_EQUAL_HEX8_ARRAY(expected_key.data(), keys.data() + i * batch_t::key_length, batch_t::key_length);
+            }
+        }
+
+        /**
+         * Compares @ref kdf_an10922 called on each input with @ref kdf_an10922_batch, in keys per second.
+         */
+        template <class CryptoT, cipher_type Type>
+        void log_kdf_throughput(key<Type> const &master_key) {
+            using batch_t = kdf_an10922_batch<CryptoT>;
+            static constexpr std::size_t num_keys = 200;
+            static constexpr std::size_t input_length = 10;
+            CryptoT c{};
+            c.setup_with_key(mlab::make_range(master_key.k));
+            bin_data inputs{};
+            inputs.resize(num_keys * input_length);
+            std::iota(std::begin(inputs), std::end(inputs), 0x00);
+            bin_data diversify_input{mlab::prealloc(2 * batch_t::block_size)};
+            const auto t_begin_single = std::chrono::steady_clock::now();
+            for (std::size_t i = 0; i < num_keys; ++i) {
+                diversify_input.clear();
+                diversify_input << inputs.view(i * input_length, input_length);
+                static_cast<void>(kdf_an10922(c, diversify_input));
+            }
+            const auto t_single = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - t_begin_single);
+            bin_data keys{};
+            keys.resize(num_keys * batch_t::key_length);
+            const auto t_begin_batch = std::chrono::steady_clock::now();
+            batch_t batch{c};
+            TEST_ASSERT_EQUAL(num_keys, batch.diversify(inputs.data_view(), input_length, keys.data_view()));
+            const auto t_batch = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - t_begin_batch);
+            const auto keys_per_second = [](std::chrono::microseconds t) {
+                return t.count() > 0 ? double(num_keys) * 1e6 / double(t.count()) : 0.;
+            };
+            ESP_LOGI(TEST_TAG, "%s KDF: one by one %.0f keys/s, batch %.0f keys/s.", to_string(Type),
+                     keys_per_second(t_single), keys_per_second(t_batch));
+        }
+    }// namespace
     void test_des() {
         {
             // Test using examples from https://hack.cert.pl/files/desfire-9f122c71e0057d4f747d2ee295b0f5f6eef8ac32.html
@@ -203,6 +526,79 @@ namespace ut::desfire_ciphers {
         TEST_ASSERT_EQUAL_HEX8_ARRAY(std::begin(div_key.k), std::begin(exp_div_key), 16);
     }
 
+    void test_kdf_batch() {
+        const key<cipher_type::des> des_key{0, {0x00, 0x11, 0x22, 0x33, 0x44, 0x55, 0x66, 0x77}};
+        const key<cipher_type::des3_2k> des3_2k_key{0, {0x00, 0x11, 0x22, 0x33, 0x44, 0x55, 0x66, 0x77, 0x88, 0x99, 0xAA, 0xBB, 0xCC, 0xDD, 0xEE, 0xFF}};
+        const key<cipher_type::des3_3k> des3_3k_key{0, {0x00, 0x11, 0x22, 0x33, 0x44, 0x55, 0x66, 0x77, 0x88, 0x99, 0xAA, 0xBB, 0xCC, 0xDD, 0xEE, 0xFF, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08}};
+        const key<cipher_type::aes128> aes_key{0, {0x00, 0x11, 0x22, 0x33, 0x44, 0x55, 0x66, 0x77, 0x88, 0x99, 0xaa, 0xbb, 0xcc, 0xdd, 0xee, 0xff}};
+        compare_kdf_batch<esp32::crypto_des>(des_key);
+        compare_kdf_batch<esp32::crypto_2k3des>(des3_2k_key);
+        compare_kdf_batch<esp32::crypto_3k3des>(des3_3k_key);
+        compare_kdf_batch<esp32::crypto_aes>(aes_key);
+        // Same vector as test_aes_kdf
+        esp32::crypto_aes c{};
+        c.setup_with_key(mlab::make_range(aes_key.k));
+        const bin_data div_data = {0x04, 0x78, 0x2E, 0x21, 0x80, 0x1D, 0x80, 0x30, 0x42, 0xF5, 0x4E, 0x58, 0x50, 0x20, 0x41, 0x62, 0x75};
+        const std::array<std::uint8_t, 16> exp_div_key{0xA8, 0xDD, 0x63, 0xA3, 0xB8, 0x9D, 0x54, 0xB3, 0x7C, 0xA8, 0x02, 0x47, 0x3F, 0xDA, 0x91, 0x75};
+        const auto div_key = kdf_an10922_batch<esp32::crypto_aes>{c}.diversify(div_data.data_view());
+        TEST_ASSERT_EQUAL_HEX8_ARRAY(exp_div_key.data(), div_key.data(), exp_div_key.size());
+    }
+
+    void test_kdf_batch_benchmark() {
+        log_kdf_throughput<esp32::crypto_2k3des>(key<cipher_type::des3_2k>{0, {0x00, 0x11, 0x22, 0x33, 0x44, 0x55, 0x66, 0x77, 0x88, 0x99, 0xAA, 0xBB, 0xCC, 0xDD, 0xEE, 0xFF}});
+        log_kdf_throughput<esp32::crypto_3k3des>(key<cipher_type::des3_3k>{0, {0x00, 0x11, 0x22, 0x33, 0x44, 0x55, 0x66, 0x77, 0x88, 0x99, 0xAA, 0xBB, 0xCC, 0xDD, 0xEE, 0xFF, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08}});
+        log_kdf_throughput<esp32::crypto_aes>(key<cipher_type::aes128>{0, {0x00, 0x11, 0x22, 0x33, 0x44, 0x55, 0x66, 0x77, 0x88, 0x99, 0xaa, 0xbb, 0xcc, 0xdd, 0xee, 0xff}});
+    }
+
+    void test_diversified_key_cache() {
+        desfire::esp32::default_cipher_provider provider{};
+        const any_key aes_master{key<cipher_type::aes128>{0, {0x00, 0x11, 0x22, 0x33, 0x44, 0x55, 0x66, 0x77, 0x88, 0x99, 0xaa, 0xbb, 0xcc, 0xdd, 0xee, 0xff}, 0x10}};
+        const any_key des3_master{key<cipher_type::des3_3k>{0, {0x00, 0x11, 0x22, 0x33, 0x44, 0x55, 0x66, 0x77, 0x88, 0x99, 0xAA, 0xBB, 0xCC, 0xDD, 0xEE, 0xFF, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08}}};
+        const auto make_uid = [](std::uint8_t i) { return bin_data{0x04, 0x78, 0x2E, 0x21, 0x80, 0x1D, i}; };
+        const auto check_key = [&](any_key const &master_key, any_key const &div_key, bin_data const &uid) {
+            bin_data diversify_input = uid;
+            const any_key expected_key = kdf_an10922(master_key, provider, diversify_input);
+            TEST_ASSERT_EQUAL(expected_key.type(), div_key.type());
+            TEST_ASSERT_EQUAL(expected_key.version(), div_key.version());
+            TEST_ASSERT(expected_key.get_packed_key_body() == div_key.get_packed_key_body())
+        };
+
+        diversified_key_cache cache{2};
+        const bin_data uid_a = make_uid(0xa);
+        const bin_data uid_b = make_uid(0xb);
+        const auto t_begin_miss = std::chrono::steady_clock::now();
+        const any_key key_a = cache.get(1, aes_master, provider, uid_a.data_view());
+        const auto t_miss = std::chrono::steady_clock::now() - t_begin_miss;
+        check_key(aes_master, key_a, uid_a);
+        const auto t_begin_hit = std::chrono::steady_clock::now();
+        const any_key key_a_again = cache.get(1, aes_master, provider, uid_a.data_view());
+        const auto t_hit = std::chrono::steady_clock::now() - t_begin_hit;
+        check_key(aes_master, key_a_again, uid_a);
+        TEST_ASSERT_EQUAL(1, cache.stats().hits);
+        TEST_ASSERT_EQUAL(1, cache.stats().misses);
+        ESP_LOGI(TEST_TAG, "Diversified key: %lld us on a miss, %lld us on a hit.",
+                 static_cast<long long>(std::chrono::duration_cast<std::chrono::microseconds>(t_miss).count()),
+                 static_cast<long long>(std::chrono::duration_cast<std::chrono::microseconds>(t_hit).count()));
+
+        // A different master key id, or a different master key type, is a different entry
+        check_key(des3_master, cache.get(2, des3_master, provider, uid_a.data_view()), uid_a);
+        TEST_ASSERT_EQUAL(2, cache.stats().misses);
+        TEST_ASSERT_EQUAL(2, cache.size());
+
+        // The cache is full: uid_a under the AES key was used last, so the 3K3DES one is evicted
+        static_cast<void>(cache.get(1, aes_master, provider, uid_a.data_view()));
+        check_key(aes_master, cache.get(1, aes_master, provider, uid_b.data_view()), uid_b);
+        TEST_ASSERT_EQUAL(1, cache.stats().evictions);
+        static_cast<void>(cache.get(1, aes_master, provider, uid_a.data_view()));
+        TEST_ASSERT_EQUAL(3, cache.stats().misses);
+        TEST_ASSERT_EQUAL(3, cache.stats().hits);
+
+        cache.erase(1);
+        TEST_ASSERT_EQUAL(0, cache.size());
+        static_cast<void>(cache.get(1, aes_master, provider, uid_a.data_view()));
+        TEST_ASSERT_EQUAL(4, cache.stats().misses);
+    }
+
     void test_crc32() {
         {
             const bin_data payload = {0xC4, 0x00, 0x00, 0x10, 0x20, 0x31, 0x40, 0x50, 0x60, 0x70, 0x80, 0x90, 0xA0, 0xB0, 0xB0, 0xA0, 0x90, 0x80};
@@ -224,4 +620,155 @@ namespace ut::desfire_ciphers {
         const std::uint16_t computed_crc = compute_crc16(payload);
         TEST_ASSERT_EQUAL(expected_crc, computed_crc);
     }
-}// namespace ut::desfire_ciphers
\ No newline at end of file
+
+    void test_crc_tail() {
+        for (std::size_t block_size : {std::size_t(8), std::size_t(16)}) {
+            for (std::size_t data_size = 0; data_size < 3 * block_size; ++data_size) {
+                for (std::uint8_t status : {std::uint8_t(0x00), std::uint8_t(0xaf)}) {
+                    bin_data payload = make_ciphered_payload(data_size, status, block_size);
+                    const auto [it_linear, verified_linear] = find_crc_tail_linear(payload, status, block_size);
+                    const auto [it_quadratic, verified_quadratic] = find_crc_tail_quadratic(payload, status, block_size);
+                    TEST_ASSERT(verified_linear)
+                    TEST_ASSERT(verified_quadratic)
+                    TEST_ASSERT(it_linear == it_quadratic)
+                    TEST_ASSERT_EQUAL(data_size + 4, std::distance(std::cbegin(payload), it_linear));
+                    // Corrupt the CRC
+                    payload[data_size] ^= 0xff;
+                    TEST_ASSERT_FALSE(find_crc_tail_linear(payload, status, block_size).second)
+                    TEST_ASSERT_FALSE(find_crc_tail_quadratic(payload, status, block_size).second)
+                }
+            }
+        }
+    }
+
+    void test_crc_tail_benchmark() {
+        for (std::size_t data_size : {std::size_t(16), std::size_t(64), std::size_t(256), std::size_t(1024),
+                                      std::size_t(4096), std::size_t(8192)}) {
+            const bin_data payload = make_ciphered_payload(data_size, 0x00, 16);
+            const auto t_quadratic = time_tail_search(payload, find_crc_tail_quadratic);
+            const auto t_linear = time_tail_search(payload, find_crc_tail_linear);
+            ESP_LOGI(TEST_TAG, "CRC tail search on %u bytes: recompute %lld us, linear %lld us.", payload.size(),
+                     static_cast<long long>(t_quadratic.count()), static_cast<long long>(t_linear.count()));
+        }
+    }
+
+    void test_crc_lengths() {
+        // Cover all the alignments and the lengths around the 8 bytes slices
+        bin_data payload{};
+        payload.resize(0x200);
+        std::iota(std::begin(payload), std::end(payload), 0x00);
+        for (std::size_t offset = 0; offset < 8; ++offset) {
+            for (std::size_t length = 0; offset + length <= payload.size(); length += (length < 0x90 ? 1 : 0x3f)) {
+                const auto view = payload.data_view(offset, length);
+                TEST_ASSERT_EQUAL_HEX32(crc_bitwise<std::uint32_t>(view.data(), length, crc32_init, 0xedb88320), compute_crc32(view));
+                TEST_ASSERT_EQUAL_HEX16(crc_bitwise<std::uint16_t>(view.data(), length, crc16_init, 0x8408), compute_crc16(view));
+            }
+        }
+        // Chaining must hold, byte by byte and by blocks
+        const std::uint32_t crc32_full = compute_crc32(payload);
+        std::uint32_t crc32_chained = crc32_init;
+        for (std::size_t i = 0; i < 0x100; ++i) {
+            crc32_chained = compute_crc32(payload[i], crc32_chained);
+        }
+        crc32_chained = compute_crc32(payload.data_view(0x100), crc32_chained);
+        TEST_ASSERT_EQUAL_HEX32(crc32_full, crc32_chained);
+        const std::uint16_t crc16_full = compute_crc16(payload);
+        std::uint16_t crc16_chained = compute_crc16(payload.data_view(0, 0x33));
+        for (std::size_t i = 0x33; i < payload.size(); ++i) {
+            crc16_chained = compute_crc16(payload[i], crc16_chained);
+        }
+        TEST_ASSERT_EQUAL_HEX16(crc16_full, crc16_chained);
+    }
+
+    void test_crc_benchmark() {
+        for (std::size_t size : {std::size_t(64), std::size_t(1024), std::size_t(8192)}) {
+            bin_data payload{};
+            payload.resize(size);
+            std::iota(std::begin(payload), std::end(payload), 0x00);
+            const double mbps_bitwise = crc_throughput_mbps(payload, [](auto view) {
+                return crc_bitwise<std::uint32_t>(view.data(), view.size(), crc32_init, 0xedb88320);
+            });
+            const double mbps_crc32 = crc_throughput_mbps(payload, [](auto view) { return compute_crc32(view); });
+            const double mbps_crc16 = crc_throughput_mbps(payload, [](auto view) { return compute_crc16(view); });
+            ESP_LOGI(TEST_TAG, "CRC on %u bytes: bitwise %.1f MB/s, crc32 %.1f MB/s, crc16 %.1f MB/s.", payload.size(),
+                     mbps_bitwise, mbps_crc32, mbps_crc16);
+        }
+    }
+
+    void test_cmac_stream() {
+        bin_data payload{};
+        payload.resize(100);
+        std::iota(std::begin(payload), std::end(payload), 0x00);
+        const auto test_crypto = [&](crypto_with_cmac &c) {
+            for (std::size_t length = 0; length <= payload.size(); ++length) {
+                const auto data = payload.data_view(0, length);
+                std::array<std::uint8_t, 16> iv_oneshot{};
+                std::array<std::uint8_t, 16> iv_stream{};
+                const auto mac_oneshot = c.do_cmac(data, range<std::uint8_t *>{iv_oneshot.data(), iv_oneshot.data() + c.block_size()});
+                // Feed in uneven chunks, crossing block boundaries
+                auto stream = c.begin_cmac(range<std::uint8_t *>{iv_stream.data(), iv_stream.data() + c.block_size()});
+                for (std::size_t offset = 0, chunk = 1; offset < length; offset += chunk, chunk = chunk * 3 % 23 + 1) {
+                    stream.update(payload.data_view(offset, std::min(chunk, length - offset)));
+                }
+                const auto mac_stream = stream.finish();
+                TEST_ASSERT_EQUAL_HEX8_ARRAY(mac_oneshot.data(), mac_stream.data(), mac_oneshot.size());
+                TEST_ASSERT_EQUAL_HEX8_ARRAY(iv_oneshot.data(), iv_stream.data(), iv_oneshot.size());
+            }
+        };
+        const key<cipher_type::aes128> aes_key{0, {0x00, 0x10, 0x20, 0x30, 0x40, 0x50, 0x60, 0x70, 0x80, 0x90, 0xA0, 0xB0, 0xB0, 0xA0, 0x90, 0x80}};
+        esp32::crypto_aes aes{};
+        aes.setup_with_key(mlab::make_range(aes_key.k));
+        test_crypto(aes);
+        const key<cipher_type::des3_3k> des3_key{};
+        esp32::crypto_3k3des des3{};
+        des3.setup_with_key(mlab::make_range(des3_key.k));
+        test_crypto(des3);
+    }
+
+    void test_cipher_dispatch_benchmark() {
+        bin_data payload{};
+        payload.resize(64);
+        std::iota(std::begin(payload), std::end(payload), 0x00);
+        {
+            const key<cipher_type::aes128> aes_key{0, {0x00, 0x10, 0x20, 0x30, 0x40, 0x50, 0x60, 0x70, 0x80, 0x90, 0xA0, 0xB0, 0xB0, 0xA0, 0x90, 0x80}};
+            cipher_default erased{std::make_unique<esp32::crypto_aes>()};
+            typed_cipher_default<esp32::crypto_aes> typed{std::make_unique<esp32::crypto_aes>()};
+            erased.reset_with_key(mlab::make_range(aes_key.k));
+            typed.reset_with_key(mlab::make_range(aes_key.k));
+            compare_cipher_dispatch("AES", erased, typed, payload);
+        }
+        {
+            const key<cipher_type::des3_3k> des3_key{0, {0x00, 0x10, 0x20, 0x30, 0x40, 0x50, 0x60, 0x70, 0x80, 0x90, 0xA0, 0xB0,
+                                                         0xC0, 0xD0, 0xE0, 0xF0, 0x01, 0x11, 0x21, 0x31, 0x41, 0x51, 0x61, 0x71}};
+            cipher_default erased{std::make_unique<esp32::crypto_3k3des>()};
+            typed_cipher_default<esp32::crypto_3k3des> typed{std::make_unique<esp32::crypto_3k3des>()};
+            erased.reset_with_key(mlab::make_range(des3_key.k));
+            typed.reset_with_key(mlab::make_range(des3_key.k));
+            compare_cipher_dispatch("3K3DES", erased, typed, payload);
+        }
+        {
+            const key<cipher_type::des> des_key{0, {0x00, 0x10, 0x20, 0x30, 0x40, 0x50, 0x60, 0x70}};
+            cipher_legacy erased{std::make_unique<esp32::crypto_des>()};
+            typed_cipher_legacy<esp32::crypto_des> typed{std::make_unique<esp32::crypto_des>()};
+            erased.reset_with_key(mlab::make_range(des_key.k));
+            typed.reset_with_key(mlab::make_range(des_key.k));
+            compare_cipher_dispatch("DES", erased, typed, payload);
+        }
+    }
+
+    void test_crypto_kat() {
+        check_provider_kat<esp32::crypto_des, esp32::crypto_2k3des, esp32::crypto_3k3des, esp32::crypto_aes>();
+#ifdef DESFIRE_HOST_CRYPTO
+        check_provider_kat<host::crypto_des, host::crypto_2k3des, host::crypto_3k3des, host::crypto_aes>();
+#endif
+    }
+
+    void test_crypto_throughput() {
+        for (std::size_t size : {std::size_t(64), std::size_t(1024)}) {
+            log_provider_throughput<esp32::crypto_des, esp32::crypto_2k3des, esp32::crypto_3k3des, esp32::crypto_aes>("mbedTLS", size);
+#ifdef DESFIRE_HOST_CRYPTO
+            log_provider_throughput<host::crypto_des, host::crypto_2k3des, host::crypto_3k3des, host::crypto_aes>("OpenSSL", size);
+#endif
+        }
+    }
+}// namespace ut::desfire_ciphers
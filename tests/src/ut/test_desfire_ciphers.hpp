@@ -59,9 +59,20 @@ namespace ut {
         void test_aes();
         void test_crc32();
         void test_crc16();
+        void test_crc_lengths();
+        void test_crc_benchmark();
+        void test_cmac_stream();
+        void test_cipher_dispatch_benchmark();
+        void test_crypto_throughput();
+        void test_crypto_kat();
+        void test_crc_tail();
+        void test_crc_tail_benchmark();
         void test_aes_kdf();
         void test_2k3des_kdf();
         void test_3k3des_kdf();
+        void test_kdf_batch();
+        void test_kdf_batch_benchmark();
+        void test_diversified_key_cache();
     }// namespace desfire_ciphers
 
 }// namespace ut
@@ -69,7 +80,7 @@ namespace ut {
 namespace ut {
 
     template <class CryptoImpl, std::size_t BlockSize, std::size_t KeySize>
-    fake_cmac_crypto<CryptoImpl, BlockSize, KeySize>::fake_cmac_crypto() : crypto_with_cmac{BlockSize, 0x00, nullptr}, _impl{} {}
+    fake_cmac_crypto<CryptoImpl, BlockSize, KeySize>::fake_cmac_crypto() : crypto_with_cmac{BlockSize, 0x00}, _impl{} {}
 
     template <class CryptoImpl, std::size_t BlockSize, std::size_t KeySize>
     desfire::crypto_with_cmac::mac_t fake_cmac_crypto<CryptoImpl, BlockSize, KeySize>::do_cmac(range<std::uint8_t const *> data, range<std::uint8_t *> iv) {
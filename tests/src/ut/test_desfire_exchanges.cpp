@@ -122,7 +122,14 @@ namespace ut::desfire_exchanges {
 
         TEST_ASSERT(tag.get_file_ids())
 
+        // Settings are cached upon creation, explicitly refresh them to keep the exchange in the CMAC chain
+        TEST_ASSERT(tag.get_file_settings(5))
+
         TEST_ASSERT(tag.write_data(5, 0, data_to_write))
+
+        // Security must have been determined without further exchanges
+        TEST_ASSERT_EQUAL(1, tag.file_settings_cache_stats().hits);
+        TEST_ASSERT_EQUAL(0, tag.file_settings_cache_stats().misses);
     }
 
     void test_get_key_version_rx_cmac() {
@@ -5,6 +5,7 @@
 #ifndef SPOOKY_ACTION_TEST_DESFIRE_MAIN_HPP
 #define SPOOKY_ACTION_TEST_DESFIRE_MAIN_HPP
 
+#include "desfire_demo.hpp"
 #include "registrar.hpp"
 #include "test_pn532.hpp"
 #include <desfire/tag.hpp>
@@ -17,18 +18,6 @@ namespace ut {
 
         static constexpr test_tag_t test_tag = 0xde5f19e;
 
-        struct demo_app {
-            app_id aid;
-            cipher_type cipher;
-            any_key primary_key;
-            any_key secondary_key;
-
-            explicit demo_app(cipher_type c);
-
-            void ensure_selected_and_primary(tag &tag) const;
-            void ensure_created(tag &tag, any_key const &root_key) const;
-        };
-
         class test_data {
             std::unique_ptr<pn532::desfire_pcd> _pcd = nullptr;
             std::shared_ptr<ut::pn532::test_instance> _hold_test_instance;
@@ -0,0 +1,1054 @@
+#include "test_desfire_sim.hpp"
+#include "desfire_demo.hpp"
+#include "utils.hpp"
+#include <algorithm>
+#include <chrono>
+#include <desfire/esp32/crypto_impl.hpp>
+#include <desfire/file_stream.hpp>
+#include <desfire/sim/picc.hpp>
+#include <iterator>
+#include <limits>
+#include <mlab/log.h>
+#include <mlab/profiler.hpp>
+#include <mlab/trace.hpp>
+#include <numeric>
+#include <optional>
+#include <pn532/desfire_pcd.hpp>
+#include <pn532/recording.hpp>
+#include <pn532/sim/channel.hpp>
+#include <unity.h>
+
+#ifdef ESP_PLATFORM
+#include <esp_heap_caps.h>
+#endif
+
+#define TEST_TAG "UT"
+
+namespace ut::desfire_sim {
+    namespace {
+        using namespace ::desfire;
+        using mlab::bin_data;
+
+        constexpr std::array<cipher_type, 4> all_ciphers = {cipher_type::des, cipher_type::des3_2k,
+                                                            cipher_type::des3_3k, cipher_type::aes128};
+
+        /**
+         * A tag talking to its own emulated card.
+         */
+        struct sim_tag {
+            sim::emulated_picc picc;
+            tag mifare;
+
+            sim_tag() : picc{std::make_unique<esp32::default_cipher_provider>()},
+                        mifare{picc, std::make_unique<esp32::default_cipher_provider>()} {}
+        };
+
+        /**
+         * Bytes allocated on the heap, on the platform the tests run on.
+         */
+        [[nodiscard]] std::size_t heap_used() {
+#ifdef ESP_PLATFORM
+            return heap_caps_get_total_size(MALLOC_CAP_8BIT) - heap_caps_get_free_size(MALLOC_CAP_8BIT);
+#else
+            return mem_monitor::bytes_in_use();
+#endif
+        }
+
+        /**
+         * Forwards to an emulated card and tracks the peak heap usage of the host side, between exchanges.
+         * The memory that the card itself holds for chained frames is not accounted for.
+         */
+        class watermark_pcd final : public pcd {
+            sim::emulated_picc &_picc;
+            std::size_t _baseline_used = 0;
+            std::size_t _baseline_card = 0;
+            std::size_t _peak = 0;
+
+            void sample() {
+                const std::size_t used = heap_used() - std::min(_baseline_used, heap_used());
+                const std::size_t card = _picc.buffered_bytes() - std::min(_baseline_card, _picc.buffered_bytes());
+                _peak = std::max(_peak, used - std::min(used, card));
+            }
+
+        public:
+            explicit watermark_pcd(sim::emulated_picc &picc) : _picc{picc} {}
+
+            void reset() {
+                _baseline_used = heap_used();
+                _baseline_card = _picc.buffered_bytes();
+                _peak = 0;
+            }
+
+            [[nodiscard]] std::size_t peak() const {
+                return _peak;
+            }
+
+            std::pair<bin_data, bool> communicate(bin_data const &data) override {
+                sample();
+                auto retval = _picc.communicate(data);
+                sample();
+                return retval;
+            }
+        };
+
+        /**
+         * Forwards to an emulated card, pausing @ref monitor during each exchange, so that it only counts the
+         * allocations of the host side.
+         */
+        class untraced_pcd final : public pcd {
+            sim::emulated_picc &_picc;
+
+        public:
+            ut::mem_monitor *monitor = nullptr;
+
+            explicit untraced_pcd(sim::emulated_picc &picc) : _picc{picc} {}
+
+            [[nodiscard]] std::size_t max_frame_length() const override {
+                return _picc.max_frame_length();
+            }
+
+            std::pair<bin_data, bool> communicate(bin_data const &data) override {
+                if (monitor != nullptr) {
+                    monitor->pause();
+                }
+                auto retval = _picc.communicate(data);
+                if (monitor != nullptr) {
+                    monitor->resume();
+                }
+                return retval;
+            }
+        };
+
+        /**
+         * Forwards to an emulated card, until it is told to simulate the card leaving the field.
+         */
+        class tearing_pcd final : public pcd {
+            sim::emulated_picc &_picc;
+            std::size_t _exchanges_before_tear = std::numeric_limits<std::size_t>::max();
+
+        public:
+            explicit tearing_pcd(sim::emulated_picc &picc) : _picc{picc} {}
+
+            /**
+             * Lets @p n exchanges through, then fails all of them until @ref restore puts a fresh card in the field.
+             */
+            void tear_after(std::size_t n) {
+                _exchanges_before_tear = n;
+            }
+
+            void restore() {
+                _exchanges_before_tear = std::numeric_limits<std::size_t>::max();
+                _picc.reset_session();
+            }
+
+            std::pair<bin_data, bool> communicate(bin_data const &data) override {
+                if (_exchanges_before_tear == 0) {
+                    return {bin_data{}, false};
+                } else if (_exchanges_before_tear != std::numeric_limits<std::size_t>::max()) {
+                    --_exchanges_before_tear;
+                }
+                return _picc.communicate(data);
+            }
+        };
+
+        /**
+         * An emulated card behind a simulated PN532 on a fast link, so that the RF exchange dominates.
+         */
+        struct sim_reader {
+            sim::emulated_picc picc;
+            pn532::sim::emulated_firmware fw;
+            pn532::sim::sim_channel chn;
+            pn532::controller tag_reader;
+
+            explicit sim_reader(pn532::baudrate max_stable_bit_rate = pn532::baudrate::kbps424, mlab::shared_buffer_pool pool = nullptr)
+                : picc{std::make_unique<esp32::default_cipher_provider>()},
+                  fw{},
+                  chn{fw, pn532::sim::sim_channel::link_config{.buffered = true, .byte_time = std::chrono::microseconds{2}}, pool},
+                  tag_reader{chn, pool} {
+                pn532::sim::emulated_firmware::target t{};
+                t.exchange = [this](bin_data const &data) { return picc.communicate(data); };
+                t.rf_latency = std::chrono::microseconds{1000};
+                // ISO/IEC 14443 type A at 106 kbps, 9 bits per byte
+                t.rf_byte_time = std::chrono::microseconds{85};
+                t.max_stable_bit_rate = max_stable_bit_rate;
+                fw.set_target(std::move(t));
+            }
+
+            [[nodiscard]] std::unique_ptr<pn532::desfire_pcd> connect() {
+                const auto r_scan = tag_reader.initiator_list_passive_kbps106_typea(1);
+                TEST_ASSERT(r_scan)
+                TEST_ASSERT_EQUAL(1, r_scan->size());
+                return std::make_unique<pn532::desfire_pcd>(tag_reader, r_scan->front());
+            }
+        };
+
+        [[nodiscard]] bin_data make_load(std::size_t size) {
+            bin_data load{};
+            load.resize(size);
+            std::iota(std::begin(load), std::end(load), 0x00);
+            return load;
+        }
+
+        /**
+         * Measures @p op both in host time and in simulated card time, averaging over @p num_repetitions.
+         */
+        template <class Fn>
+        void benchmark_op(sim_tag &st, const char *op_name, cipher_type cipher, Fn &&op) {
+            static constexpr std::size_t num_repetitions = 20;
+            const auto exchanges_begin = st.picc.stats().exchanges;
+            const auto t_sim_begin = st.picc.elapsed();
+            const auto t_host_begin = std::chrono::steady_clock::now();
+            for (std::size_t i = 0; i < num_repetitions; ++i) {
+                TEST_ASSERT(op())
+            }
+            const auto t_host = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - t_host_begin) / num_repetitions;
+            const auto t_sim = std::chrono::duration_cast<std::chrono::microseconds>(st.picc.elapsed() - t_sim_begin) / num_repetitions;
+            ESP_LOGI(TEST_TAG, "%-8s %-16s host %6lld us, card %6lld us, %u exchanges.", to_string(cipher), op_name,
+                     static_cast<long long>(t_host.count()), static_cast<long long>(t_sim.count()),
+                     (st.picc.stats().exchanges - exchanges_begin) / num_repetitions);
+        }
+    }// namespace
+
+    void test_sim_authenticate() {
+        sim_tag st{};
+        const any_key root_key{key<cipher_type::des>{}};
+        for (cipher_type cipher : all_ciphers) {
+            const desfire_main::demo_app app{cipher};
+            app.ensure_created(st.mifare, root_key);
+            TEST_ASSERT(st.mifare.select_application(app.aid))
+            TEST_ASSERT(st.mifare.authenticate(app.primary_key))
+            TEST_ASSERT(st.mifare.change_key(app.secondary_key))
+            // Changing the key in use logs out
+            TEST_ASSERT_FALSE(st.mifare.authenticate(app.primary_key))
+            TEST_ASSERT(st.mifare.authenticate(app.secondary_key))
+            const auto r_key_version = st.mifare.get_key_version(app.secondary_key.key_number());
+            TEST_ASSERT(r_key_version)
+            TEST_ASSERT_EQUAL(app.secondary_key.version(), *r_key_version);
+            TEST_ASSERT(st.mifare.change_key(app.primary_key))
+            TEST_ASSERT(st.mifare.authenticate(app.primary_key))
+        }
+        TEST_ASSERT(st.mifare.select_application(root_app))
+        TEST_ASSERT(st.mifare.authenticate(root_key))
+        const auto r_app_ids = st.mifare.get_application_ids();
+        TEST_ASSERT(r_app_ids)
+        TEST_ASSERT_EQUAL(all_ciphers.size(), r_app_ids->size());
+        TEST_ASSERT(st.mifare.format_picc())
+        TEST_ASSERT_EQUAL(0, st.picc.stats().integrity_errors);
+    }
+
+    void test_sim_files() {
+        sim_tag st{};
+        const bin_data load = make_load(0x100);
+        for (file_security security : {file_security::none, file_security::authenticated, file_security::encrypted}) {
+            for (cipher_type cipher : all_ciphers) {
+                for (file_type type : {file_type::standard, file_type::backup, file_type::value,
+                                       file_type::linear_record, file_type::cyclic_record}) {
+                    desfire_files::demo_file file{cipher, type, security};
+                    ESP_LOGI(TEST_TAG, "Emulated %s", file.get_description().c_str());
+                    file.test(st.mifare, load);
+                }
+            }
+        }
+        TEST_ASSERT_EQUAL(0, st.picc.stats().integrity_errors);
+    }
+
+    void test_sim_file_settings_cache() {
+        static constexpr file_id fid = 0x00;
+        const bin_data load = make_load(0x20);
+        const any_key root_key{key<cipher_type::des>{}};
+        sim_tag st{};
+        const desfire_main::demo_app app{cipher_type::aes128};
+        app.ensure_created(st.mifare, root_key);
+        app.ensure_selected_and_primary(st.mifare);
+        TEST_ASSERT(st.mifare.create_file(fid, file_settings<file_type::standard>{generic_file_settings{file_security::encrypted, access_rights{0}}, data_file_settings{.size = std::uint32_t(load.size())}}))
+        // Caches the settings of the file
+        TEST_ASSERT(st.mifare.write_data(fid, 0, load))
+
+        // A new authentication does not invalidate the settings, read_data is the only command sent
+        TEST_ASSERT(st.mifare.authenticate(app.primary_key))
+        const auto misses_before = st.mifare.file_settings_cache_stats().misses;
+        const auto commands_before = st.picc.stats().commands;
+        const auto r_read = st.mifare.read_data(fid, 0, load.size());
+        TEST_ASSERT(r_read)
+        TEST_ASSERT_EQUAL(load.size(), (*r_read)->size());
+        TEST_ASSERT_EQUAL_HEX8_ARRAY(load.data(), (*r_read)->data(), load.size());
+        TEST_ASSERT_EQUAL(1, st.picc.stats().commands - commands_before);
+        TEST_ASSERT_EQUAL(misses_before, st.mifare.file_settings_cache_stats().misses);
+
+        // Same after a failed command, which logs out
+        TEST_ASSERT_FALSE(st.mifare.get_file_settings(fid + 1))
+        TEST_ASSERT(st.mifare.authenticate(app.primary_key))
+        const auto commands_after_error = st.picc.stats().commands;
+        TEST_ASSERT(st.mifare.read_data(fid, 0, load.size()))
+        TEST_ASSERT_EQUAL(1, st.picc.stats().commands - commands_after_error);
+
+        // Selecting an application forgets the settings
+        TEST_ASSERT(st.mifare.select_application(app.aid))
+        TEST_ASSERT(st.mifare.authenticate(app.primary_key))
+        const auto commands_after_select = st.picc.stats().commands;
+        TEST_ASSERT(st.mifare.read_data(fid, 0, load.size()))
+        TEST_ASSERT_EQUAL(2, st.picc.stats().commands - commands_after_select);
+        TEST_ASSERT_EQUAL(misses_before + 1, st.mifare.file_settings_cache_stats().misses);
+    }
+
+    void test_sim_benchmark() {
+        static constexpr file_id data_fid = 0x01;
+        static constexpr file_id record_fid = 0x02;
+        static constexpr file_id value_fid = 0x03;
+        const bin_data load = make_load(0x100);
+        const bin_data record = make_load(0x10);
+        const any_key root_key{key<cipher_type::des>{}};
+
+        for (file_security security : {file_security::none, file_security::encrypted}) {
+            ESP_LOGI(TEST_TAG, "Emulated card, file security %s:", to_string(security));
+            for (cipher_type cipher : all_ciphers) {
+                sim_tag st{};
+                const desfire_main::demo_app app{cipher};
+                app.ensure_created(st.mifare, root_key);
+                app.ensure_selected_and_primary(st.mifare);
+
+                const generic_file_settings gfs{security, access_rights{0}};
+                TEST_ASSERT(st.mifare.create_file(data_fid, file_settings<file_type::standard>{gfs, data_file_settings{.size = 0x100}}))
+                TEST_ASSERT(st.mifare.create_file(record_fid, file_settings<file_type::cyclic_record>{gfs, record_file_settings{.record_size = 0x10, .max_record_count = 4, .record_count = 0}}))
+                TEST_ASSERT(st.mifare.create_file(value_fid, file_settings<file_type::value>{gfs, value_file_settings{.lower_limit = 0, .upper_limit = 1000, .value = 0, .limited_credit_enabled = false}}))
+                TEST_ASSERT(st.mifare.write_data(data_fid, 0, load))
+
+                benchmark_op(st, "authenticate", cipher, [&]() { return st.mifare.authenticate(app.primary_key); });
+                benchmark_op(st, "read_data 256B", cipher, [&]() { return st.mifare.read_data(data_fid, 0, load.size()); });
+                benchmark_op(st, "write_record 16B", cipher, [&]() {
+                    return st.mifare.write_record(record_fid, 0, record) and st.mifare.commit_transaction();
+                });
+                benchmark_op(st, "credit+commit", cipher, [&]() {
+                    return st.mifare.credit(value_fid, 1) and st.mifare.commit_transaction();
+                });
+                const auto r_value = st.mifare.get_value(value_fid);
+                TEST_ASSERT(r_value)
+                TEST_ASSERT_EQUAL(20, *r_value);
+                TEST_ASSERT_EQUAL(0, st.picc.stats().integrity_errors);
+            }
+        }
+    }
+
+    void test_sim_memory_watermark() {
+        static constexpr file_id fid = 0x00;
+        static constexpr std::size_t max_size = 0x1000;
+        static constexpr std::size_t frame_length = bits::max_packet_length;
+        const bin_data load = make_load(max_size);
+        const any_key root_key{key<cipher_type::des>{}};
+
+        for (file_security security : {file_security::none, file_security::encrypted}) {
+            for (cipher_type cipher : {cipher_type::des, cipher_type::aes128}) {
+                sim::emulated_picc picc{std::make_unique<esp32::default_cipher_provider>()};
+                watermark_pcd monitor{picc};
+                tag mifare{monitor, std::make_unique<esp32::default_cipher_provider>()};
+                const desfire_main::demo_app app{cipher};
+                app.ensure_created(mifare, root_key);
+                app.ensure_selected_and_primary(mifare);
+                TEST_ASSERT(mifare.create_file(fid, file_settings<file_type::standard>{generic_file_settings{security, access_rights{0}}, data_file_settings{.size = max_size}}))
+
+                for (std::size_t size : {std::size_t{0x400}, max_size}) {
+                    const bin_data data{load.view(0, size)};
+                    // Warm up, so that the pooled buffers for the command and the response are in place
+                    TEST_ASSERT(mifare.write_data(fid, 0, data))
+                    TEST_ASSERT(mifare.read_data(fid, 0, size))
+
+                    monitor.reset();
+                    TEST_ASSERT(mifare.write_data(fid, 0, data))
+                    const std::size_t write_peak = monitor.peak();
+
+                    monitor.reset();
+                    const auto r_read = mifare.read_data(fid, 0, size);
+                    const std::size_t read_peak = monitor.peak();
+                    TEST_ASSERT(r_read)
+                    TEST_ASSERT_EQUAL(size, (*r_read)->size());
+                    TEST_ASSERT_EQUAL_HEX8_ARRAY(data.data(), (*r_read)->data(), size);
+
+                    ESP_LOGI(TEST_TAG, "%-8s %-10s %4u B: host peak write %5u B, read %5u B.", to_string(cipher),
+                             to_string(security), size, write_peak, read_peak);
+                    // The payload is streamed frame by frame, and the response goes into a pooled buffer
+                    TEST_ASSERT_LESS_THAN(4 * frame_length, write_peak);
+                    TEST_ASSERT_LESS_THAN(4 * frame_length, read_peak);
+                }
+                TEST_ASSERT_EQUAL(0, picc.stats().integrity_errors);
+            }
+        }
+    }
+
+    void test_sim_static_buffer_pool() {
+        static constexpr file_id fid = 0x00;
+        const bin_data data = make_load(0x20);
+        const any_key root_key{key<cipher_type::des>{}};
+        auto pool = std::make_shared<mlab::pool<bin_data>>(mlab::default_buffer_size_classes(), mlab::pool_mode::preallocated);
+        const std::size_t arena_bytes = pool->stats().peak_bytes;
+
+        sim::emulated_picc picc{std::make_unique<esp32::default_cipher_provider>()};
+        untraced_pcd card{picc};
+        // Recycle the ciphers too, otherwise each authentication allocates a new one
+        auto ciphers = std::make_shared<cipher_cache>(2);
+        tag mifare{card, std::make_unique<esp32::default_cipher_provider>(ciphers), pool};
+        for (cipher_type cipher : {cipher_type::des, cipher_type::aes128}) {
+            const desfire_main::demo_app app{cipher};
+            app.ensure_created(mifare, root_key);
+            app.ensure_selected_and_primary(mifare);
+            TEST_ASSERT(mifare.create_file(fid, file_settings<file_type::standard>{generic_file_settings{file_security::encrypted, access_rights{0}}, data_file_settings{.size = std::uint32_t(data.size())}}))
+            for (std::size_t i = 0; i < 2; ++i) {
+                // Once warm, a whole authenticate, write, read cycle does not touch the heap on the host side
+                ut::mem_monitor monitor{true};
+                card.monitor = &monitor;
+                TEST_ASSERT(mifare.authenticate(app.primary_key))
+                TEST_ASSERT(mifare.write_data(fid, 0, data))
+                const auto r_read = mifare.read_data(fid, 0, data.size());
+                card.monitor = nullptr;
+                TEST_ASSERT(r_read)
+                TEST_ASSERT_EQUAL_HEX8_ARRAY(data.data(), (*r_read)->data(), data.size());
+                if (i > 0) {
+                    TEST_ASSERT_EQUAL(0, monitor.count_allocations());
+                }
+            }
+        }
+        const auto stats = pool->stats();
+        ESP_LOGI(TEST_TAG, "Static pool of %u B: %u hits, peak outstanding %u.", arena_bytes, stats.hits, stats.peak_outstanding);
+        TEST_ASSERT_EQUAL(0, stats.misses);
+        TEST_ASSERT_EQUAL(0, stats.exhausted);
+        TEST_ASSERT_EQUAL(0, stats.dropped);
+        TEST_ASSERT_EQUAL(0, stats.outstanding);
+        // No buffer was reallocated, otherwise the pool would hold more bytes than it started with
+        TEST_ASSERT_EQUAL(arena_bytes, stats.peak_bytes);
+
+        // Once warm, taking buffers and computing MACs does not touch the heap
+        {
+            const key<cipher_type::des> des_key{};
+            cipher_legacy c{std::make_unique<esp32::crypto_des>()};
+            c.reset_with_key(mlab::make_range(des_key.k));
+            bin_data payload{};
+            payload.reserve(bits::max_packet_length);
+            ut::mem_monitor monitor{true};
+            for (std::size_t i = 0; i < 10; ++i) {
+                auto frame = pool->take_sized(bits::max_packet_length);
+                auto response = pool->take();
+                TEST_ASSERT(frame and response)
+                frame->resize(bits::max_packet_length);
+                payload.resize(0x20);
+                c.prepare_tx(payload, 1, cipher_mode::maced);
+            }
+            TEST_ASSERT_EQUAL(0, monitor.count_allocations());
+        }
+
+        // A pool that is too small makes the operations fail, rather than allocating
+        auto tiny_pool = std::make_shared<mlab::pool<bin_data>>(std::vector<mlab::pool_size_class>{{64, 1}}, mlab::pool_mode::preallocated);
+        tag tiny_mifare{picc, std::make_unique<esp32::default_cipher_provider>(), tiny_pool};
+        const auto r_app_ids = tiny_mifare.get_application_ids();
+        TEST_ASSERT_FALSE(r_app_ids)
+        TEST_ASSERT(r_app_ids.error() == error::out_of_buffers)
+        TEST_ASSERT_EQUAL(0, tiny_pool->stats().outstanding);
+        TEST_ASSERT_EQUAL(0, picc.stats().integrity_errors);
+
+        // The whole reader stack shares a static pool over many card sessions, and gives every buffer back
+        {
+            static constexpr std::size_t num_sessions = 5;
+            auto reader_pool = std::make_shared<mlab::pool<bin_data>>(mlab::default_buffer_size_classes(), mlab::pool_mode::preallocated);
+            sim_reader reader{pn532::baudrate::kbps424, reader_pool};
+            const desfire_main::demo_app app{cipher_type::aes128};
+            {
+                tag setup{reader.picc, std::make_unique<esp32::default_cipher_provider>()};
+                app.ensure_created(setup, root_key);
+                app.ensure_selected_and_primary(setup);
+                TEST_ASSERT(setup.create_file(fid, file_settings<file_type::standard>{generic_file_settings{file_security::encrypted, access_rights{0}}, data_file_settings{.size = std::uint32_t(data.size())}}))
+                TEST_ASSERT(setup.write_data(fid, 0, data))
+            }
+            TEST_ASSERT(reader.tag_reader.sam_configuration(pn532::sam_mode::normal, std::chrono::seconds{1}))
+            for (std::size_t i = 0; i < num_sessions; ++i) {
+                auto pcd = reader.connect();
+                tag mifare{*pcd, std::make_unique<esp32::default_cipher_provider>(), reader_pool};
+                TEST_ASSERT(mifare.select_application(app.aid))
+                TEST_ASSERT(mifare.authenticate(app.primary_key))
+                const auto r_read = mifare.read_data(fid, 0, data.size());
+                TEST_ASSERT(r_read)
+                TEST_ASSERT_EQUAL_HEX8_ARRAY(data.data(), (*r_read)->data(), data.size());
+            }
+            const auto reader_stats = reader_pool->stats();
+            TEST_ASSERT_EQUAL(0, reader_stats.exhausted);
+            TEST_ASSERT_EQUAL(0, reader_stats.outstanding);
+            TEST_ASSERT_EQUAL(0, reader_stats.dropped);
+        }
+    }
+
+    void test_sim_cipher_cache() {
+        static constexpr std::size_t num_cards = 20;
+        sim::emulated_picc picc{std::make_unique<esp32::default_cipher_provider>()};
+        const any_key root_key{key<cipher_type::des>{}};
+        {
+            tag mifare{picc, std::make_unique<esp32::default_cipher_provider>()};
+            for (cipher_type cipher : all_ciphers) {
+                desfire_main::demo_app{cipher}.ensure_created(mifare, root_key);
+            }
+        }
+
+        // A reader creates a new tag for every card in the field, authenticating with the same application keys
+        // Counts the heap allocations made by the authentications alone, leaving out the emulated card
+        untraced_pcd card{picc};
+        std::size_t auth_allocations = 0;
+        const auto authenticate_all = [&](std::shared_ptr<cipher_cache> const &cache) {
+            tag mifare{card, std::make_unique<esp32::default_cipher_provider>(cache)};
+            for (cipher_type cipher : all_ciphers) {
+                const desfire_main::demo_app app{cipher};
+                TEST_ASSERT(mifare.select_application(app.aid))
+                ut::mem_monitor monitor{true};
+                card.monitor = &monitor;
+                TEST_ASSERT(mifare.authenticate(app.primary_key))
+                card.monitor = nullptr;
+                auth_allocations += monitor.count_allocations();
+            }
+        };
+
+        const auto t_uncached_begin = std::chrono::steady_clock::now();
+        for (std::size_t i = 0; i < num_cards; ++i) {
+            authenticate_all(nullptr);
+        }
+        const auto t_uncached = std::chrono::steady_clock::now() - t_uncached_begin;
+
+        auto cache = std::make_shared<cipher_cache>(all_ciphers.size());
+        authenticate_all(cache);
+        TEST_ASSERT_EQUAL(all_ciphers.size(), cache->size());
+        TEST_ASSERT_EQUAL(all_ciphers.size(), cache->stats().misses);
+
+        auth_allocations = 0;
+        const auto t_cached_begin = std::chrono::steady_clock::now();
+        for (std::size_t i = 0; i < num_cards; ++i) {
+            authenticate_all(cache);
+        }
+        const auto t_cached = std::chrono::steady_clock::now() - t_cached_begin;
+        // Every cipher was given back and reused, and none was leaked
+        TEST_ASSERT_EQUAL(all_ciphers.size(), cache->stats().misses);
+        TEST_ASSERT_EQUAL(num_cards * all_ciphers.size(), cache->stats().hits);
+        TEST_ASSERT_EQUAL(0, auth_allocations);
+
+        ESP_LOGI(TEST_TAG, "%u cards x %u keys: %lld us without cache, %lld us with cache.", num_cards, all_ciphers.size(),
+                 static_cast<long long>(std::chrono::duration_cast<std::chrono::microseconds>(t_uncached).count()),
+                 static_cast<long long>(std::chrono::duration_cast<std::chrono::microseconds>(t_cached).count()));
+
+        // When the cache is full, a cipher of the same type is set up with the new key instead of allocating
+        auto small_cache = std::make_shared<cipher_cache>(1);
+        {
+            tag mifare{picc, std::make_unique<esp32::default_cipher_provider>(small_cache)};
+            const desfire_main::demo_app des_app{cipher_type::des};
+            TEST_ASSERT(mifare.select_application(des_app.aid))
+            TEST_ASSERT(mifare.authenticate(des_app.primary_key))
+            TEST_ASSERT(mifare.change_key(des_app.secondary_key))
+            TEST_ASSERT(mifare.authenticate(des_app.secondary_key))
+            TEST_ASSERT_EQUAL(1, small_cache->stats().misses);
+            TEST_ASSERT_EQUAL(1, small_cache->stats().recycled);
+            TEST_ASSERT(mifare.change_key(des_app.primary_key))
+            // A cipher of a different type cannot be recycled, so the idle one is evicted to make room
+            const desfire_main::demo_app aes_app{cipher_type::aes128};
+            TEST_ASSERT(mifare.select_application(aes_app.aid))
+            TEST_ASSERT(mifare.authenticate(aes_app.primary_key))
+            TEST_ASSERT_EQUAL(2, small_cache->stats().misses);
+            TEST_ASSERT_EQUAL(1, small_cache->size());
+        }
+        small_cache->clear();
+        TEST_ASSERT_EQUAL(0, small_cache->size());
+    }
+
+    void test_sim_file_stream() {
+        static constexpr file_id fid = 0x00;
+        static constexpr std::uint32_t file_size = 0x800;
+        const bin_data load = make_load(file_size);
+        const any_key root_key{key<cipher_type::des>{}};
+
+        for (cipher_type cipher : {cipher_type::des, cipher_type::aes128}) {
+            sim::emulated_picc picc{std::make_unique<esp32::default_cipher_provider>()};
+            tearing_pcd link{picc};
+            tag mifare{link, std::make_unique<esp32::default_cipher_provider>()};
+            const desfire_main::demo_app app{cipher};
+            app.ensure_created(mifare, root_key);
+            app.ensure_selected_and_primary(mifare);
+            TEST_ASSERT(mifare.create_file(fid, file_settings<file_type::backup>{generic_file_settings{file_security::encrypted, access_rights{0}}, data_file_settings{.size = file_size}}))
+
+            // Write in windows, with a tear in the middle
+            file_writer writer{mifare, fid, 0x100};
+            writer.set_commit_each_window(true);
+            link.tear_after(12);
+            TEST_ASSERT_FALSE(writer.write(0, load))
+            TEST_ASSERT_FALSE(writer.done());
+            // Only whole windows are committed
+            TEST_ASSERT_EQUAL(0, writer.position() % writer.window_size());
+            link.restore();
+            TEST_ASSERT(mifare.select_application(app.aid))
+            TEST_ASSERT(mifare.authenticate(app.primary_key))
+            TEST_ASSERT(writer.resume(load))
+            TEST_ASSERT(writer.done());
+
+            // Read back to the end of the file, with a tear in the middle
+            bin_data read_back{};
+            std::size_t num_windows = 0;
+            auto sink = [&](std::uint32_t offset, mlab::range<std::uint8_t const *> data) -> bool {
+                TEST_ASSERT_EQUAL(read_back.size(), offset);
+                TEST_ASSERT_LESS_OR_EQUAL(0x180, data.size());
+                read_back << data;
+                ++num_windows;
+                return true;
+            };
+            file_reader reader{mifare, fid, 0x180};
+            link.tear_after(8);
+            TEST_ASSERT_FALSE(reader.read(0, 0, sink))
+            TEST_ASSERT_FALSE(reader.done());
+            TEST_ASSERT_EQUAL(read_back.size(), reader.position());
+            link.restore();
+            TEST_ASSERT(mifare.select_application(app.aid))
+            TEST_ASSERT(mifare.authenticate(app.primary_key))
+            TEST_ASSERT(reader.resume(sink))
+            TEST_ASSERT(reader.done());
+            TEST_ASSERT_EQUAL((file_size + 0x17f) / 0x180, num_windows);
+            TEST_ASSERT_EQUAL(load.size(), read_back.size());
+            TEST_ASSERT_EQUAL_HEX8_ARRAY(load.data(), read_back.data(), load.size());
+
+            // A sink can also be an output iterator
+            bin_data copy{};
+            file_reader whole_reader{mifare, fid};
+            TEST_ASSERT(whole_reader.read(0x10, 0x200, file_reader::copy_to(std::back_inserter(copy))))
+            TEST_ASSERT_EQUAL(0x200, copy.size());
+            TEST_ASSERT_EQUAL_HEX8_ARRAY(load.data() + 0x10, copy.data(), copy.size());
+
+            TEST_ASSERT_EQUAL(0, picc.stats().integrity_errors);
+        }
+    }
+
+    void test_sim_frame_length() {
+        // ATS of a DESFire EV1 (without length byte): FSCI = 5, i.e. 64 bytes
+        TEST_ASSERT_EQUAL(bits::max_packet_length, pn532::desfire_pcd::max_frame_length_from_ats({0x75, 0x77, 0x81, 0x02, 0x80}));
+        TEST_ASSERT_EQUAL(12, pn532::desfire_pcd::max_frame_length_from_ats({0x70}));
+        TEST_ASSERT_EQUAL(252, pn532::desfire_pcd::max_frame_length_from_ats({0x78}));
+        // RFU values of FSCI are treated as 256 bytes
+        TEST_ASSERT_EQUAL(252, pn532::desfire_pcd::max_frame_length_from_ats({0x7f}));
+        TEST_ASSERT_EQUAL(bits::max_packet_length, pn532::desfire_pcd::max_frame_length_from_ats({}));
+
+        static constexpr file_id fid = 0x00;
+        const bin_data load = make_load(0x400);
+        const any_key root_key{key<cipher_type::des>{}};
+        std::array<std::size_t, 2> exchanges{};
+        for (std::size_t i = 0; i < exchanges.size(); ++i) {
+            sim::emulated_picc::card_config config{};
+            config.max_frame_length = i == 0 ? bits::max_packet_length : 252;
+            sim::emulated_picc picc{std::make_unique<esp32::default_cipher_provider>(), config};
+            tag mifare{picc, std::make_unique<esp32::default_cipher_provider>()};
+            const desfire_main::demo_app app{cipher_type::aes128};
+            app.ensure_created(mifare, root_key);
+            app.ensure_selected_and_primary(mifare);
+            TEST_ASSERT(mifare.create_file(fid, file_settings<file_type::standard>{generic_file_settings{file_security::encrypted, access_rights{0}}, data_file_settings{.size = std::uint32_t(load.size())}}))
+
+            const std::size_t exchanges_begin = picc.stats().exchanges;
+            TEST_ASSERT(mifare.write_data(fid, 0, load))
+            const auto r_read = mifare.read_data(fid, 0, load.size());
+            TEST_ASSERT(r_read)
+            TEST_ASSERT_EQUAL(load.size(), (*r_read)->size());
+            TEST_ASSERT_EQUAL_HEX8_ARRAY(load.data(), (*r_read)->data(), load.size());
+            exchanges[i] = picc.stats().exchanges - exchanges_begin;
+            ESP_LOGI(TEST_TAG, "Frame length %3u: %u exchanges to write and read %u bytes.", config.max_frame_length,
+                     exchanges[i], load.size());
+            TEST_ASSERT_EQUAL(0, picc.stats().integrity_errors);
+        }
+        TEST_ASSERT_LESS_THAN(exchanges[0] / 3, exchanges[1]);
+    }
+
+    void test_sim_bit_rate() {
+        using pn532::baudrate;
+        using bit_rates = pn532::iso_iec_14443_4_bit_rates;
+        static constexpr file_id fid = 0x00;
+        static constexpr std::size_t num_repetitions = 10;
+
+        // ATS of a DESFire EV1: up to 848 kbps in both directions, capped at what the PN532 supports
+        const bit_rates desfire_rates = pn532::max_bit_rates_from_ats({0x75, 0x77, 0x81, 0x02, 0x80});
+        const bit_rates max_rates{baudrate::kbps424, baudrate::kbps424};
+        TEST_ASSERT(desfire_rates == max_rates)
+        // DR up to 424 kbps, DS up to 212 kbps, but the same bit rate is required in both directions
+        const bit_rates same_rates = pn532::max_bit_rates_from_ats({0x75, 0x93});
+        const bit_rates same_rates_expected{baudrate::kbps212, baudrate::kbps212};
+        TEST_ASSERT(same_rates == same_rates_expected)
+        // No TA(1)
+        const bit_rates no_ta1_rates = pn532::max_bit_rates_from_ats({0x05});
+        TEST_ASSERT(no_ta1_rates == bit_rates{})
+
+        const bin_data load = make_load(0x400);
+        const any_key root_key{key<cipher_type::des>{}};
+        std::chrono::microseconds t_prev_read{std::numeric_limits<std::chrono::microseconds::rep>::max()};
+        for (baudrate rate : {baudrate::kbps106, baudrate::kbps212, baudrate::kbps424}) {
+            sim_reader reader{};
+            auto pcd = reader.connect();
+            const auto r_psl = pcd->upgrade_bit_rate(rate);
+            TEST_ASSERT(r_psl and *r_psl)
+            const bit_rates expected_rates{rate, rate};
+            TEST_ASSERT(pcd->bit_rates() == expected_rates)
+
+            tag mifare{*pcd, std::make_unique<esp32::default_cipher_provider>()};
+            const desfire_main::demo_app app{cipher_type::aes128};
+            app.ensure_created(mifare, root_key);
+            app.ensure_selected_and_primary(mifare);
+            TEST_ASSERT(mifare.create_file(fid, file_settings<file_type::standard>{generic_file_settings{file_security::encrypted, access_rights{0}}, data_file_settings{.size = std::uint32_t(load.size())}}))
+            TEST_ASSERT(mifare.write_data(fid, 0, load))
+
+            const auto t_begin = reader.chn.elapsed();
+            for (std::size_t i = 0; i < num_repetitions; ++i) {
+                TEST_ASSERT(mifare.read_data(fid, 0, load.size()))
+            }
+            const auto t_read = std::chrono::duration_cast<std::chrono::microseconds>(reader.chn.elapsed() - t_begin) / num_repetitions;
+            ESP_LOGI(TEST_TAG, "%s: read_data %u B in %lld us, %lld B/s.", ::pn532::to_string(rate), load.size(),
+                     static_cast<long long>(t_read.count()), static_cast<long long>(load.size() * 1000000 / t_read.count()));
+            TEST_ASSERT(t_read < t_prev_read)
+            t_prev_read = t_read;
+        }
+
+        // In a field that is too noisy above 106 kbps, the pcd falls back by itself
+        sim_reader reader{baudrate::kbps106};
+        auto pcd = reader.connect();
+        TEST_ASSERT(pcd->upgrade_bit_rate())
+        TEST_ASSERT(pcd->bit_rates() == max_rates)
+        tag mifare{*pcd, std::make_unique<esp32::default_cipher_provider>()};
+        for (std::size_t i = 0; i < pn532::desfire_pcd::fallback_error_count; ++i) {
+            TEST_ASSERT_FALSE(mifare.select_application(root_app))
+        }
+        TEST_ASSERT(pcd->bit_rates() == bit_rates{})
+        TEST_ASSERT(mifare.select_application(root_app))
+        TEST_ASSERT(mifare.authenticate(root_key))
+    }
+
+
+    void test_sim_profiler() {
+        using mlab::probe;
+        // Histogram buckets are contiguous and ordered
+        for (std::uint32_t us = 1; us < 100000; ++us) {
+            const std::size_t idx = mlab::profiler::histogram_bucket(us);
+            TEST_ASSERT_LESS_THAN(mlab::profiler::histogram_buckets, idx);
+            TEST_ASSERT_GREATER_OR_EQUAL(us, mlab::profiler::histogram_bucket_upper_bound(idx));
+            TEST_ASSERT_LESS_THAN(us, mlab::profiler::histogram_bucket_upper_bound(idx - 1));
+        }
+        TEST_ASSERT_LESS_THAN(mlab::profiler::histogram_buckets, mlab::profiler::histogram_bucket(std::numeric_limits<std::uint32_t>::max()));
+
+        mlab::profiler p{};
+        for (std::uint32_t us = 1; us <= 100; ++us) {
+            p.record(probe::cipher_tx, std::chrono::microseconds{us}, 1, 16);
+        }
+        const auto s = p.stats(probe::cipher_tx);
+        TEST_ASSERT_EQUAL(100, s.count);
+        TEST_ASSERT_EQUAL(5050, s.total.count());
+        TEST_ASSERT_EQUAL(1, s.min.count());
+        TEST_ASSERT_EQUAL(100, s.max.count());
+        TEST_ASSERT_EQUAL(100, s.allocations);
+        TEST_ASSERT_EQUAL(1600, s.allocated_bytes);
+        // Within the resolution of the histogram
+        TEST_ASSERT_GREATER_OR_EQUAL(50, s.p50.count());
+        TEST_ASSERT_LESS_OR_EQUAL(50 * 5 / 4, s.p50.count());
+        TEST_ASSERT_GREATER_OR_EQUAL(99, s.p99.count());
+        TEST_ASSERT_LESS_OR_EQUAL(100, s.p99.count());
+        TEST_ASSERT_EQUAL(0, p.stats(probe::cipher_rx).count);
+        p.reset();
+        TEST_ASSERT_EQUAL(0, p.stats(probe::cipher_tx).count);
+
+        // Profile a secure read through the whole stack
+        static constexpr file_id fid = 0x00;
+        static constexpr std::size_t num_repetitions = 10;
+        const bin_data load = make_load(0x100);
+        const any_key root_key{key<cipher_type::des>{}};
+        sim_reader reader{};
+        auto pcd = reader.connect();
+        tag mifare{*pcd, std::make_unique<esp32::default_cipher_provider>()};
+        const desfire_main::demo_app app{cipher_type::aes128};
+        app.ensure_created(mifare, root_key);
+        app.ensure_selected_and_primary(mifare);
+        TEST_ASSERT(mifare.create_file(fid, file_settings<file_type::standard>{generic_file_settings{file_security::encrypted, access_rights{0}}, data_file_settings{.size = std::uint32_t(load.size())}}))
+        TEST_ASSERT(mifare.write_data(fid, 0, load))
+
+        mlab::default_profiler().reset();
+        for (std::size_t i = 0; i < num_repetitions; ++i) {
+            TEST_ASSERT(mifare.read_data(fid, 0, load.size()))
+        }
+
+        if constexpr (mlab::profiling_enabled) {
+            mlab::default_profiler().log_summary();
+            const auto s_tag = mlab::default_profiler().stats(probe::tag_command);
+            const auto s_rf = mlab::default_profiler().stats(probe::rf_exchange);
+            const auto s_send = mlab::default_profiler().stats(probe::channel_send);
+            const auto s_recv = mlab::default_profiler().stats(probe::channel_receive);
+            TEST_ASSERT_EQUAL(num_repetitions, s_tag.count);
+            TEST_ASSERT_EQUAL(num_repetitions, mlab::default_profiler().stats(probe::cipher_tx).count);
+            TEST_ASSERT_EQUAL(num_repetitions, mlab::default_profiler().stats(probe::cipher_rx).count);
+            // Reading 256 bytes takes several frames, and each RF exchange sends a command and receives an ACK and a response
+            TEST_ASSERT_GREATER_THAN(s_tag.count, s_rf.count);
+            TEST_ASSERT_GREATER_OR_EQUAL(s_rf.count, s_send.count);
+            TEST_ASSERT_GREATER_OR_EQUAL(2 * s_rf.count, s_recv.count);
+            // Probes are nested
+            TEST_ASSERT(s_tag.total >= s_rf.total)
+            TEST_ASSERT(s_rf.total >= s_send.total)
+            TEST_ASSERT(s_tag.p50 <= s_tag.p99 and s_tag.p99 <= s_tag.max)
+        } else {
+            // Compiled out
+            for (std::size_t i = 0; i < mlab::probe_count; ++i) {
+                TEST_ASSERT_EQUAL(0, mlab::default_profiler().stats(static_cast<probe>(i)).count);
+            }
+        }
+    }
+
+    void test_sim_trace() {
+        using mlab::trace_event;
+        // The ring overwrites the oldest records
+        mlab::trace_ring ring{4};
+        for (std::uint8_t i = 0; i < 6; ++i) {
+            ring.record(trace_event::link_tx, i, bin_data{{i, i}}.data_view());
+        }
+        auto records = ring.snapshot();
+        TEST_ASSERT_EQUAL(6, ring.total_records());
+        TEST_ASSERT_EQUAL(4, records.size());
+        for (std::size_t i = 0; i < records.size(); ++i) {
+            TEST_ASSERT_EQUAL(i + 2, records[i].arg);
+            TEST_ASSERT_EQUAL(2, records[i].length);
+            TEST_ASSERT_EQUAL(2, records[i].data_view().size());
+            TEST_ASSERT_EQUAL(i + 2, records[i].data[1]);
+        }
+        TEST_ASSERT(records.front().timestamp_us <= records.back().timestamp_us)
+
+        // Long data is truncated, crypto-like events record only the length
+        ring.clear();
+        TEST_ASSERT(ring.snapshot().empty())
+        const bin_data long_data = make_load(30);
+        ring.record(trace_event::pcd_rx, 0, long_data.data_view());
+        ring.record(trace_event::crypto, 0x21, 300);
+        records = ring.snapshot();
+        TEST_ASSERT_EQUAL(2, records.size());
+        TEST_ASSERT_EQUAL(30, records[0].length);
+        TEST_ASSERT_EQUAL(mlab::trace_record::max_data_length, records[0].data_length);
+        TEST_ASSERT_EQUAL_HEX8_ARRAY(long_data.data(), records[0].data.data(), mlab::trace_record::max_data_length);
+        TEST_ASSERT_EQUAL(300, records[1].length);
+        TEST_ASSERT_EQUAL(0, records[1].data_length);
+
+        // Dump and decode roundtrip
+        const bin_data dumped = ring.dump();
+        const auto decoded = mlab::trace_ring::decode(dumped);
+        TEST_ASSERT_EQUAL(records.size(), decoded.size());
+        for (std::size_t i = 0; i < decoded.size(); ++i) {
+            TEST_ASSERT_EQUAL(records[i].timestamp_us, decoded[i].timestamp_us);
+            TEST_ASSERT(records[i].event == decoded[i].event)
+            TEST_ASSERT_EQUAL(records[i].arg, decoded[i].arg);
+            TEST_ASSERT_EQUAL(records[i].length, decoded[i].length);
+            TEST_ASSERT(std::equal(std::begin(records[i].data_view()), std::end(records[i].data_view()),
+                                   std::begin(decoded[i].data_view()), std::end(decoded[i].data_view())))
+        }
+        TEST_ASSERT(mlab::trace_ring::decode(make_load(20)).empty())
+        TEST_ASSERT(mlab::trace_ring::decode(bin_data{dumped.data_view(0, dumped.size() - 1)}).empty())
+
+        // Trace a secure read through the whole stack
+        static constexpr file_id fid = 0x00;
+        const bin_data load = make_load(0x40);
+        const any_key root_key{key<cipher_type::des>{}};
+        sim_reader reader{};
+        auto pcd = reader.connect();
+        tag mifare{*pcd, std::make_unique<esp32::default_cipher_provider>()};
+        const desfire_main::demo_app app{cipher_type::aes128};
+        app.ensure_created(mifare, root_key);
+        app.ensure_selected_and_primary(mifare);
+        TEST_ASSERT(mifare.create_file(fid, file_settings<file_type::standard>{generic_file_settings{file_security::encrypted, access_rights{0}}, data_file_settings{.size = std::uint32_t(load.size())}}))
+        TEST_ASSERT(mifare.write_data(fid, 0, load))
+
+        mlab::default_trace().clear();
+        TEST_ASSERT(mifare.read_data(fid, 0, load.size()))
+
+        if constexpr (mlab::tracing_enabled) {
+            mlab::default_trace().log_records();
+            const auto trace = mlab::default_trace().snapshot();
+            const auto count_events = [&](trace_event e) {
+                return std::count_if(std::begin(trace), std::end(trace), [&](mlab::trace_record const &rec) { return rec.event == e; });
+            };
+            TEST_ASSERT_GREATER_THAN(0, count_events(trace_event::link_tx));
+            TEST_ASSERT_GREATER_THAN(0, count_events(trace_event::link_rx));
+            TEST_ASSERT_GREATER_THAN(0, count_events(trace_event::pcd_tx));
+            TEST_ASSERT_GREATER_THAN(0, count_events(trace_event::pcd_rx));
+            TEST_ASSERT_GREATER_THAN(0, count_events(trace_event::crypto));
+            TEST_ASSERT_EQUAL(1, count_events(trace_event::status));
+            const auto it_status = std::find_if(std::begin(trace), std::end(trace), [](mlab::trace_record const &rec) { return rec.event == trace_event::status; });
+            TEST_ASSERT_EQUAL_HEX8(static_cast<std::uint8_t>(command_code::read_data), it_status->arg);
+            TEST_ASSERT_EQUAL(1, it_status->data_length);
+            TEST_ASSERT_EQUAL_HEX8(static_cast<std::uint8_t>(status::ok), it_status->data[0]);
+        } else {
+            // Compiled out
+            TEST_ASSERT_EQUAL(0, mlab::default_trace().total_records());
+        }
+    }
+
+    void test_sim_record_replay() {
+        /**
+         * A short session: identify the PN532, scan, then issue one successful and one failing DESFire command.
+         */
+        struct session_outcome {
+            std::uint8_t fw_version = 0;
+            std::vector<std::uint8_t> nfcid{};
+            std::size_t num_apps = 0;
+            std::optional<desfire::error> select_error{};
+        };
+
+        const auto run_session = [](pn532::controller &ctrl) -> session_outcome {
+            session_outcome retval{};
+            const auto r_fw = ctrl.get_firmware_version();
+            TEST_ASSERT(r_fw)
+            retval.fw_version = r_fw->version;
+            const auto r_scan = ctrl.initiator_list_passive_kbps106_typea(1);
+            TEST_ASSERT(r_scan)
+            TEST_ASSERT_EQUAL(1, r_scan->size());
+            retval.nfcid = r_scan->front().info.nfcid;
+            pn532::desfire_pcd pcd{ctrl, r_scan->front()};
+            tag mifare{pcd, std::make_unique<esp32::default_cipher_provider>()};
+            const auto r_ids = mifare.get_application_ids();
+            TEST_ASSERT(r_ids)
+            retval.num_apps = r_ids->size();
+            const auto r_select = mifare.select_application(app_id{0xaa, 0xbb, 0xcc});
+            TEST_ASSERT_FALSE(r_select)
+            retval.select_error = r_select.error();
+            return retval;
+        };
+
+        // Record on a simulated PN532 which really takes time
+        sim_reader reader{};
+        auto cfg = reader.chn.config();
+        cfg.real_time = true;
+        reader.chn.set_config(cfg);
+        pn532::recording_channel recorder{reader.chn};
+        pn532::controller recorded_ctrl{recorder};
+        const auto recorded_outcome = run_session(recorded_ctrl);
+        TEST_ASSERT_GREATER_THAN(0, recorder.event_count());
+        TEST_ASSERT_FALSE(recorder.truncated());
+
+        const auto recording = pn532::link_recording::decode(recorder.recording());
+        TEST_ASSERT(recording)
+        TEST_ASSERT(recording->buffered)
+        TEST_ASSERT_EQUAL(recorder.event_count(), recording->events.size());
+        ESP_LOGI(TEST_TAG, "Recorded %u events in %u B, spanning %lld us.", recording->events.size(),
+                 recorder.recording().size(), static_cast<long long>(recording->duration().count()));
+
+        const auto check_replay = [&](pn532::replay_channel &replay) {
+            pn532::controller replay_ctrl{replay};
+            const auto replay_outcome = run_session(replay_ctrl);
+            TEST_ASSERT_EQUAL(recorded_outcome.fw_version, replay_outcome.fw_version);
+            TEST_ASSERT(recorded_outcome.nfcid == replay_outcome.nfcid)
+            TEST_ASSERT_EQUAL(recorded_outcome.num_apps, replay_outcome.num_apps);
+            TEST_ASSERT(recorded_outcome.select_error == replay_outcome.select_error)
+            TEST_ASSERT(replay.exhausted())
+            TEST_ASSERT_EQUAL(recording->events.size(), replay.stats().events_replayed);
+            TEST_ASSERT_EQUAL(0, replay.stats().send_mismatches);
+            TEST_ASSERT_EQUAL(0, replay.stats().divergences);
+            // Past the end of the recording, everything fails
+            TEST_ASSERT_FALSE(replay_ctrl.get_firmware_version())
+            TEST_ASSERT_GREATER_THAN(0, replay.stats().divergences);
+        };
+
+        // Replay as fast as possible, then at twice the original speed, which cannot be faster than that
+        pn532::replay_channel fast_replay{*recording, 0.};
+        auto t_begin = std::chrono::steady_clock::now();
+        check_replay(fast_replay);
+        const auto t_fast = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - t_begin);
+
+        pn532::replay_channel double_speed_replay{*recording, 2.};
+        t_begin = std::chrono::steady_clock::now();
+        check_replay(double_speed_replay);
+        const auto t_double = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - t_begin);
+        ESP_LOGI(TEST_TAG, "Replayed in %lld us (no wait), %lld us (2x).", static_cast<long long>(t_fast.count()), static_cast<long long>(t_double.count()));
+        // The first event is played back without waiting
+        TEST_ASSERT(t_double >= (recording->duration() - recording->events.front().delay) / 2)
+
+        // Streaming chunks to a sink yields the same format
+        bin_data streamed{};
+        std::size_t num_chunks = 0;
+        std::size_t streamed_events = 0;
+        {
+            pn532::recording_channel streaming_recorder{reader.chn, [&](bin_data const &chunk) { streamed << chunk; ++num_chunks; }, 0x20};
+            pn532::controller streamed_ctrl{streaming_recorder};
+            TEST_ASSERT(streamed_ctrl.get_firmware_version())
+            TEST_ASSERT(streamed_ctrl.get_firmware_version())
+            streamed_events = streaming_recorder.event_count();
+        }
+        TEST_ASSERT_GREATER_THAN(1, num_chunks);
+        const auto streamed_recording = pn532::link_recording::decode(streamed);
+        TEST_ASSERT(streamed_recording)
+        TEST_ASSERT_EQUAL(streamed_events, streamed_recording->events.size());
+
+        // A recording in RAM drops whatever does not fit
+        pn532::recording_channel small_recorder{reader.chn, 0x20};
+        pn532::controller small_ctrl{small_recorder};
+        TEST_ASSERT(small_ctrl.get_firmware_version())
+        TEST_ASSERT(small_recorder.truncated())
+        TEST_ASSERT_LESS_OR_EQUAL(0x20, small_recorder.recording().size());
+        TEST_ASSERT(pn532::link_recording::decode(small_recorder.recording()))
+
+        // Malformed recordings are rejected
+        TEST_ASSERT_FALSE(pn532::link_recording::decode(make_load(0x10)))
+        TEST_ASSERT_FALSE(pn532::link_recording::decode(bin_data{recorder.recording().data_view(0, recorder.recording().size() - 1)}))
+    }
+
+    void test_sim_record_replay_authenticated() {
+        static constexpr file_id fid = 0x00;
+        const bin_data data = make_load(0x20);
+        const any_key root_key{key<cipher_type::des>{}};
+        const desfire_main::demo_app app{cipher_type::aes128};
+
+        /**
+         * Selects, authenticates and reads an encrypted file. The random challenge comes from @p random.
+         */
+        const auto run_session = [&](pn532::controller &ctrl, pn532::random_fn random) -> tag::result<bin_data> {
+            TEST_ASSERT(ctrl.sam_configuration(pn532::sam_mode::normal, std::chrono::seconds{1}))
+            const auto r_scan = ctrl.initiator_list_passive_kbps106_typea(1);
+            TEST_ASSERT(r_scan)
+            TEST_ASSERT_EQUAL(1, r_scan->size());
+            pn532::desfire_pcd pcd{ctrl, r_scan->front()};
+            tag mifare{pcd, std::make_unique<esp32::default_cipher_provider>()};
+            mifare.set_random_source(std::move(random));
+            TEST_ASSERT(mifare.select_application(app.aid))
+            if (const auto r_auth = mifare.authenticate(app.primary_key); not r_auth) {
+                return r_auth.error();
+            }
+            const auto r_read = mifare.read_data(fid, 0, data.size());
+            if (not r_read) {
+                return r_read.error();
+            }
+            return bin_data{**r_read};
+        };
+
+        sim_reader reader{};
+        {
+            tag setup{reader.picc, std::make_unique<esp32::default_cipher_provider>()};
+            app.ensure_created(setup, root_key);
+            app.ensure_selected_and_primary(setup);
+            TEST_ASSERT(setup.create_file(fid, file_settings<file_type::standard>{generic_file_settings{file_security::encrypted, access_rights{0}}, data_file_settings{.size = std::uint32_t(data.size())}}))
+            TEST_ASSERT(setup.write_data(fid, 0, data))
+        }
+
+        pn532::recording_channel recorder{reader.chn};
+        pn532::controller recorded_ctrl{recorder};
+        const auto r_recorded = run_session(recorded_ctrl, recorder.random_source());
+        TEST_ASSERT(r_recorded)
+        TEST_ASSERT(*r_recorded == data)
+        TEST_ASSERT_FALSE(recorder.truncated())
+
+        const auto recording = pn532::link_recording::decode(recorder.recording());
+        TEST_ASSERT(recording)
+        TEST_ASSERT_EQUAL(1, std::count_if(std::begin(recording->events), std::end(recording->events),
+                                           [](pn532::link_event const &e) { return e.type == pn532::link_event::kind::random; }));
+
+        // Playing back the challenge, the whole session is identical down to the last byte sent
+        {
+            pn532::replay_channel replay{*recording, 0.};
+            pn532::controller replay_ctrl{replay};
+            const auto r_replayed = run_session(replay_ctrl, replay.random_source());
+            TEST_ASSERT(r_replayed)
+            TEST_ASSERT(*r_replayed == data)
+            TEST_ASSERT(replay.exhausted())
+            TEST_ASSERT_EQUAL(0, replay.stats().send_mismatches);
+            TEST_ASSERT_EQUAL(0, replay.stats().divergences);
+        }
+
+        // With a fresh challenge, the authentication cannot be replayed
+        {
+            pn532::replay_channel replay{*recording, 0.};
+            pn532::controller replay_ctrl{replay};
+            TEST_ASSERT_FALSE(run_session(replay_ctrl, nullptr))
+            TEST_ASSERT_GREATER_THAN(0, replay.stats().send_mismatches + replay.stats().divergences);
+        }
+    }
+
+}// namespace ut::desfire_sim
@@ -0,0 +1,21 @@
+#ifndef SPOOKY_ACTION_TEST_DESFIRE_SIM_HPP
+#define SPOOKY_ACTION_TEST_DESFIRE_SIM_HPP
+
+namespace ut::desfire_sim {
+    void test_sim_authenticate();
+    void test_sim_files();
+    void test_sim_file_settings_cache();
+    void test_sim_benchmark();
+    void test_sim_memory_watermark();
+    void test_sim_static_buffer_pool();
+    void test_sim_cipher_cache();
+    void test_sim_file_stream();
+    void test_sim_frame_length();
+    void test_sim_bit_rate();
+    void test_sim_profiler();
+    void test_sim_trace();
+    void test_sim_record_replay();
+    void test_sim_record_replay_authenticated();
+}// namespace ut::desfire_sim
+
+#endif//SPOOKY_ACTION_TEST_DESFIRE_SIM_HPP
@@ -115,6 +115,36 @@ namespace ut::pn532 {
         ESP_LOGI(TEST_TAG, "IC version %u, version: %u.%u", r_fw->ic, r_fw->version, r_fw->revision);
     }
 
+    void test_deferred_ack() {
+        auto instance = default_registrar().get<test_instance>();
+        if (instance == nullptr) {
+            TEST_FAIL_MESSAGE(missing_instance_msg);
+            return;
+        }
+        auto &channel = instance->channel();
+        auto &tag_reader = instance->tag_reader();
+
+        static constexpr std::size_t num_commands = 10;
+
+        channel.set_defer_trailing_ack(true);
+        const auto stats_before = channel.deferred_ack_statistics();
+        for (std::size_t i = 0; i < num_commands; ++i) {
+            TEST_ASSERT(tag_reader.get_firmware_version())
+        }
+        TEST_ASSERT(channel.flush_deferred_ack(1s))
+        channel.set_defer_trailing_ack(false);
+
+        const auto &stats = channel.deferred_ack_statistics();
+        TEST_ASSERT_EQUAL(num_commands, stats.deferred - stats_before.deferred);
+        TEST_ASSERT_EQUAL(num_commands, stats.flushed - stats_before.flushed);
+        const auto time_saved = stats.time_saved - stats_before.time_saved;
+        ESP_LOGI(TEST_TAG, "Deferred ACK saved on average %lld us per command.",
+                 static_cast<long long>(time_saved.count() / num_commands));
+
+        // Make sure the PN532 is still responsive after the change of mode
+        TEST_ASSERT(tag_reader.get_firmware_version())
+    }
+
     void test_diagnostics() {
         auto instance = default_registrar().get<test_instance>();
         if (instance == nullptr) {
@@ -50,6 +50,7 @@ namespace ut {
 
         void test_wake_channel();
         void test_get_fw();
+        void test_deferred_ack();
         void test_diagnostics();
         void test_scan_mifare();
         void test_scan_all();
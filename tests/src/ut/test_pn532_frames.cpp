@@ -0,0 +1,567 @@
+#include "test_pn532_frames.hpp"
+#include "utils.hpp"
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <mlab/log.h>
+#include <mlab/pool.hpp>
+#include <pn532/channel.hpp>
+#include <pn532/controller.hpp>
+#include <pn532/sim/channel.hpp>
+#include <thread>
+#include <unity.h>
+#include <vector>
+
+#define TEST_TAG "UT"
+
+namespace ut::pn532_frames {
+    namespace {
+        using namespace ::pn532;
+        using mlab::bin_data;
+        using mlab::bin_stream;
+
+        [[nodiscard]] bin_data make_info_frame(std::size_t data_size) {
+            frame<frame_type::info> f{bits::transport::host_to_pn532, bits::command::in_data_exchange, {}};
+            f.data.resize(data_size);
+            for (std::size_t i = 0; i < data_size; ++i) {
+                f.data[i] = std::uint8_t(i);
+            }
+            bin_data bd{};
+            bd << f;
+            return bd;
+        }
+
+        /**
+         * Decodes @p frame_data feeding at most @p chunk_size bytes at a time, as a transport would deliver them.
+         */
+        [[nodiscard]] any_frame decode_incremental(bin_data const &frame_data, std::size_t chunk_size) {
+            frame_decoder decoder{};
+            std::size_t pos = 0;
+            while (not decoder.done() and not decoder.failed() and pos < frame_data.size()) {
+                const auto n = std::min({chunk_size, decoder.bytes_needed(), frame_data.size() - pos});
+                pos += decoder.feed(frame_data.view(pos, n));
+            }
+            TEST_ASSERT(decoder.done())
+            TEST_ASSERT_EQUAL(frame_data.size(), decoder.bytes_consumed());
+            TEST_ASSERT_EQUAL(frame_data.size(), decoder.id().frame_total_length);
+            return decoder.pop_frame();
+        }
+
+        /**
+         * Reproduces the previous receive loop, that re-parsed the @ref frame_id from the start at every new chunk.
+         */
+        [[nodiscard]] any_frame decode_reparse(bin_data const &frame_data, std::size_t chunk_size) {
+            bin_data buffer{};
+            frame_id id{};
+            while (buffer.size() < id.frame_total_length) {
+                const std::size_t old_size = buffer.size();
+                buffer.resize(std::min(id.frame_total_length, old_size + chunk_size));
+                std::copy(std::begin(frame_data) + old_size, std::begin(frame_data) + buffer.size(), std::begin(buffer) + old_size);
+                bin_stream s{buffer};
+                s >> id;
+                if (s.bad()) {
+                    // Not even the start of packet code yet, keep reading
+                    id.frame_total_length = std::min(frame_data.size(), buffer.size() + 1);
+                }
+            }
+            bin_stream s{buffer};
+            s >> id;
+            any_frame f{};
+            std::tie(s, id) >> f;
+            TEST_ASSERT_FALSE(s.bad())
+            return f;
+        }
+
+        void assert_same_info_frame(bin_data const &expected_data, any_frame const &f) {
+            TEST_ASSERT(f.type() == frame_type::info)
+            auto const &info = f.get<frame_type::info>();
+            TEST_ASSERT(info.command == bits::command::in_data_exchange)
+            TEST_ASSERT_EQUAL(expected_data.size(), info.data.size());
+            TEST_ASSERT_EQUAL_HEX8_ARRAY(expected_data.data(), info.data.data(), std::min(expected_data.size(), info.data.size()));
+        }
+
+        /**
+         * Target that answers to any data with @p response_length bytes.
+         */
+        [[nodiscard]] sim::emulated_firmware::target make_fixed_response_target(std::size_t const &response_length) {
+            sim::emulated_firmware::target t{};
+            t.exchange = [&response_length](bin_data const &) -> std::pair<bin_data, bool> {
+                bin_data response{};
+                response.resize(response_length);
+                return {std::move(response), true};
+            };
+            return t;
+        }
+
+        /**
+         * Target that answers with the two-bytes length of the data it received, followed by the first byte.
+         */
+        [[nodiscard]] sim::emulated_firmware::target make_length_echo_target() {
+            sim::emulated_firmware::target t{};
+            t.exchange = [](bin_data const &data) -> std::pair<bin_data, bool> {
+                return {bin_data::chain(std::uint8_t(data.size() >> 8), std::uint8_t(data.size() & 0xff), data.empty() ? std::uint8_t(0) : data.front()), true};
+            };
+            return t;
+        }
+
+        /**
+         * Channel that answers every command with an ACK and the same canned response, in stream mode, without ever
+         * allocating. The allocations measured around a command over this channel are thus made by the host side alone.
+         */
+        class canned_channel final : public channel {
+        public:
+            canned_channel(bits::command cmd, bin_data const &response_data) : _ack{}, _script{}, _pos{0} {
+                _ack << frame<frame_type::ack>{};
+                // The PN532 responds with the command code incremented by one
+                const auto response_cmd = static_cast<bits::command>(static_cast<std::uint8_t>(cmd) + 1);
+                _script << _ack << frame<frame_type::info>{bits::transport::pn532_to_host, response_cmd, response_data};
+                _pos = _script.size();
+            }
+
+            bool wake() override { return true; }
+
+        protected:
+            result<> raw_send(mlab::range<bin_data::const_iterator> buffer, ms) override {
+                if (std::equal(std::begin(buffer), std::end(buffer), std::begin(_ack), std::end(_ack))) {
+                    // Abort whatever is left
+                    _pos = _script.size();
+                } else {
+                    _pos = 0;
+                }
+                return mlab::result_success;
+            }
+
+            result<> raw_receive(mlab::range<bin_data::iterator> buffer, ms) override {
+                if (_script.size() - _pos < buffer.size()) {
+                    return error::comm_timeout;
+                }
+                std::copy_n(std::begin(_script) + std::ptrdiff_t(_pos), buffer.size(), std::begin(buffer));
+                _pos += buffer.size();
+                return mlab::result_success;
+            }
+
+            [[nodiscard]] receive_mode raw_receive_mode() const override { return receive_mode::stream; }
+
+        private:
+            bin_data _ack;
+            bin_data _script;
+            std::size_t _pos;
+        };
+
+        template <class Fn>
+        [[nodiscard]] std::chrono::microseconds time_decode(bin_data const &frame_data, std::size_t chunk_size, Fn &&decode_fn) {
+            static constexpr std::size_t num_repetitions = 200;
+            const auto t_begin = std::chrono::steady_clock::now();
+            for (std::size_t i = 0; i < num_repetitions; ++i) {
+                [[maybe_unused]] const auto f = decode_fn(frame_data, chunk_size);
+            }
+            return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - t_begin) / num_repetitions;
+        }
+    }// namespace
+
+    void test_frame_decoder() {
+        for (std::size_t chunk_size : {std::size_t(1), std::size_t(8), std::size_t(512)}) {
+            // Ack and nack, with and without preamble
+            for (bool ack : {true, false}) {
+                bin_data frame_data{};
+                if (ack) {
+                    frame_data << frame<frame_type::ack>{};
+                } else {
+                    frame_data << frame<frame_type::nack>{};
+                }
+                TEST_ASSERT(decode_incremental(frame_data, chunk_size).type() == (ack ? frame_type::ack : frame_type::nack))
+                // Drop preamble and postamble
+                bin_data no_preamble{};
+                no_preamble << frame_data.view(1, frame_data.size() - 2);
+                TEST_ASSERT(decode_incremental(no_preamble, chunk_size).type() == (ack ? frame_type::ack : frame_type::nack))
+            }
+            // Error frame
+            {
+                bin_data frame_data{};
+                frame_data << frame<frame_type::error>{};
+                TEST_ASSERT(decode_incremental(frame_data, chunk_size).type() == frame_type::error)
+            }
+            // Normal and extended info frame
+            for (std::size_t data_size : {std::size_t(0), std::size_t(10), std::size_t(253), std::size_t(261)}) {
+                const bin_data frame_data = make_info_frame(data_size);
+                bin_data expected_data{};
+                expected_data.resize(data_size);
+                for (std::size_t i = 0; i < data_size; ++i) {
+                    expected_data[i] = std::uint8_t(i);
+                }
+                assert_same_info_frame(expected_data, decode_incremental(frame_data, chunk_size));
+                assert_same_info_frame(expected_data, decode_reparse(frame_data, chunk_size));
+            }
+        }
+        // Corrupted data checksum
+        {
+            bin_data frame_data = make_info_frame(10);
+            frame_data[frame_data.size() - 2] ^= 0xff;
+            frame_decoder decoder{};
+            decoder.feed(frame_data.view());
+            TEST_ASSERT(decoder.failed())
+        }
+        // Corrupted length checksum
+        {
+            bin_data frame_data = make_info_frame(10);
+            frame_data[4] ^= 0xff;
+            frame_decoder decoder{};
+            decoder.feed(frame_data.view());
+            TEST_ASSERT(decoder.failed())
+        }
+        // Data is decoded in place into the provided storage, also across resets
+        {
+            const bin_data frame_data = make_info_frame(261);
+            bin_data storage{};
+            storage.reserve(bits::max_firmware_data_length);
+            storage.resize(3);
+            const auto *const storage_data = storage.data();
+            frame_decoder decoder{};
+            decoder.use_data_storage(std::move(storage));
+            // Decode halfway, then start over as in buffered mode
+            decoder.feed(frame_data.view(0, frame_data.size() / 2));
+            TEST_ASSERT_FALSE(decoder.done())
+            decoder.reset();
+            decoder.feed(frame_data.view());
+            TEST_ASSERT(decoder.done())
+            const any_frame f = decoder.pop_frame();
+            TEST_ASSERT(f.type() == frame_type::info)
+            TEST_ASSERT_EQUAL_PTR(storage_data, f.get<frame_type::info>().data.data());
+            TEST_ASSERT_EQUAL(261, f.get<frame_type::info>().data.size());
+        }
+    }
+
+    void test_info_frame_view() {
+        for (std::size_t data_size : {std::size_t(0), std::size_t(10), std::size_t(253), std::size_t(261), std::size_t(300)}) {
+            for (auto transport : {bits::transport::host_to_pn532, bits::transport::pn532_to_host}) {
+                frame<frame_type::info> f{transport, bits::command::in_data_exchange, {}};
+                f.data.resize(data_size);
+                for (std::size_t i = 0; i < data_size; ++i) {
+                    f.data[i] = std::uint8_t(i);
+                }
+                bin_data expected{};
+                expected << f;
+                bin_data actual{};
+                actual << info_frame_view{transport, bits::command::in_data_exchange, f.data.view()};
+                TEST_ASSERT_EQUAL(expected.size(), actual.size());
+                TEST_ASSERT_EQUAL_HEX8_ARRAY(expected.data(), actual.data(), std::min(expected.size(), actual.size()));
+                // Must be parseable back, with the data truncated to the max firmware length
+                const any_frame parsed = decode_incremental(actual, actual.size());
+                TEST_ASSERT(parsed.type() == frame_type::info)
+                TEST_ASSERT(parsed.get<frame_type::info>().transport == transport)
+                TEST_ASSERT_EQUAL(std::min(data_size, bits::max_firmware_data_length), parsed.get<frame_type::info>().data.size());
+            }
+        }
+        // Once the buffer has grown, serializing again into it must not reallocate
+        bin_data payload{};
+        payload.resize(bits::max_firmware_data_length);
+        bin_data buffer{};
+        buffer << info_frame_view{bits::transport::host_to_pn532, bits::command::in_data_exchange, payload.view()};
+        const auto *const buffer_data = buffer.data();
+        for (std::size_t i = 0; i < 10; ++i) {
+            buffer.clear();
+            buffer << info_frame_view{bits::transport::host_to_pn532, bits::command::in_data_exchange, payload.view()};
+            TEST_ASSERT_EQUAL_PTR(buffer_data, buffer.data());
+        }
+    }
+
+    void test_command_allocations() {
+        using namespace std::chrono_literals;
+        static constexpr std::size_t num_commands = 10;
+        {
+            canned_channel chn{bits::command::get_firmware_version, bin_data{0x32, 0x01, 0x06, 0x07}};
+            controller tag_reader{chn};
+            // Warm up, so that the buffer pool holds a buffer of each size
+            TEST_ASSERT(tag_reader.get_firmware_version())
+            ut::mem_monitor monitor{true};
+            for (std::size_t i = 0; i < num_commands; ++i) {
+                TEST_ASSERT(tag_reader.get_firmware_version())
+            }
+            TEST_ASSERT_EQUAL(0, monitor.count_allocations());
+        }
+        {
+            canned_channel chn{bits::command::in_data_exchange, bin_data{0x00, 0xaa, 0xbb, 0xcc}};
+            controller tag_reader{chn};
+            bin_data data{};
+            data.resize(60);
+            // The response is appended to a buffer owned by the caller, which is reused
+            bin_data data_in{};
+            TEST_ASSERT(tag_reader.initiator_data_exchange(1, data, data_in))
+            ut::mem_monitor monitor{true};
+            for (std::size_t i = 0; i < num_commands; ++i) {
+                data_in.clear();
+                const auto r_exchange = tag_reader.initiator_data_exchange(1, data, data_in);
+                TEST_ASSERT(r_exchange and r_exchange->error == controller_error::none)
+                TEST_ASSERT_EQUAL(3, data_in.size());
+            }
+            TEST_ASSERT_EQUAL(0, monitor.count_allocations());
+        }
+        {
+            // Configuration commands serialize their parameters into a pooled buffer too
+            canned_channel chn{bits::command::sam_configuration, bin_data{}};
+            controller tag_reader{chn};
+            TEST_ASSERT(tag_reader.sam_configuration(sam_mode::normal, 1s))
+            ut::mem_monitor monitor{true};
+            for (std::size_t i = 0; i < num_commands; ++i) {
+                TEST_ASSERT(tag_reader.sam_configuration(sam_mode::normal, 1s))
+            }
+            TEST_ASSERT_EQUAL(0, monitor.count_allocations());
+        }
+        {
+            // A response to the wrong command fails, but the buffer still goes back to the pool with its capacity
+            canned_channel chn{bits::command::get_firmware_version, bin_data{0x32, 0x01, 0x06, 0x07}};
+            controller tag_reader{chn};
+            TEST_ASSERT_FALSE(tag_reader.get_general_status())
+            ut::mem_monitor monitor{true};
+            for (std::size_t i = 0; i < num_commands; ++i) {
+                const auto r_status = tag_reader.get_general_status();
+                TEST_ASSERT(not r_status and r_status.error() == channel::error::comm_malformed)
+            }
+            TEST_ASSERT_EQUAL(0, monitor.count_allocations());
+        }
+    }
+
+    void test_response_length_prediction() {
+        using namespace std::chrono_literals;
+        static constexpr std::size_t num_commands = 5;
+        for (bool predict : {false, true}) {
+            std::size_t response_length = 0;
+            sim::emulated_firmware fw{};
+            fw.set_target(make_fixed_response_target(response_length));
+            sim::sim_channel chn{fw, sim::sim_channel::link_config{.buffered = true}};
+            chn.set_predict_response_length(predict);
+            // Variable length response, this causes a NACK in any case
+            TEST_ASSERT(chn.command_response(bits::command::in_list_passive_target, bin_data{0x01, 0x00}, 100ms))
+            // Fixed length response, it is known in advance
+            for (std::size_t i = 0; i < num_commands; ++i) {
+                const auto r = chn.command_response(bits::command::get_firmware_version, bin_data{}, 100ms);
+                TEST_ASSERT(r)
+                TEST_ASSERT_EQUAL(4, r->size());
+            }
+            // Variable length response, it is learned after the first one
+            response_length = 59;
+            for (std::size_t i = 0; i < num_commands; ++i) {
+                const auto r = chn.command_response(bits::command::in_data_exchange, bin_data{0x01}, 100ms);
+                TEST_ASSERT(r)
+                TEST_ASSERT_EQUAL(60, r->size());
+            }
+            // A shorter response must still be read correctly
+            response_length = 1;
+            TEST_ASSERT(chn.command_response(bits::command::in_data_exchange, bin_data{0x01}, 100ms))
+
+            const auto &stats = chn.response_length_statistics();
+            ESP_LOGI(TEST_TAG, "Prediction %s: %u predicted, %u NACKs avoided, %u NACKs sent.",
+                     (predict ? "on" : "off"), stats.predicted, stats.nacks_avoided, stats.nacks_sent);
+            TEST_ASSERT_EQUAL(stats.nacks_sent, chn.stats().nacks_received);
+            if (predict) {
+                TEST_ASSERT_EQUAL(2 * num_commands, stats.predicted);
+                // Only the first in_list_passive_target and in_data_exchange require a NACK
+                TEST_ASSERT_EQUAL(2 * num_commands, stats.nacks_avoided);
+                TEST_ASSERT_EQUAL(2, stats.nacks_sent);
+            } else {
+                TEST_ASSERT_EQUAL(0, stats.predicted);
+                TEST_ASSERT_EQUAL(0, stats.nacks_avoided);
+                TEST_ASSERT_EQUAL(2 * num_commands + 2, stats.nacks_sent);
+            }
+        }
+    }
+
+    void test_sim_channel() {
+        using namespace std::chrono_literals;
+        for (bool buffered : {false, true}) {
+            sim::emulated_firmware fw{};
+            fw.set_target(make_length_echo_target());
+            auto pool = std::make_shared<mlab::pool<bin_data>>(mlab::default_buffer_size_classes());
+            sim::sim_channel chn{fw, sim::sim_channel::link_config{.buffered = buffered}, pool};
+            controller tag_reader{chn, pool};
+
+            TEST_ASSERT(tag_reader.get_firmware_version())
+            TEST_ASSERT(tag_reader.sam_configuration(sam_mode::normal, 1s))
+            const auto r_diag = tag_reader.diagnose_comm_line();
+            TEST_ASSERT(r_diag and *r_diag)
+            TEST_ASSERT(tag_reader.write_register(reg_addr{0x6331}, 0x42))
+            const auto r_reg = tag_reader.read_register(reg_addr{0x6331});
+            TEST_ASSERT(r_reg)
+            TEST_ASSERT_EQUAL_HEX8(0x42, *r_reg);
+
+            const auto r_scan = tag_reader.initiator_list_passive_kbps106_typea(1);
+            TEST_ASSERT(r_scan)
+            TEST_ASSERT_EQUAL(1, r_scan->size());
+            const auto &target = r_scan->front();
+            TEST_ASSERT_EQUAL(7, target.info.nfcid.size());
+
+            // Large enough to be chained over multiple frames
+            for (std::size_t data_size : {std::size_t(1), std::size_t(60), std::size_t(500)}) {
+                bin_data data{};
+                data.resize(data_size);
+                data.front() = 0xaa;
+                const auto r_exchange = tag_reader.initiator_data_exchange(target.logical_index, data);
+                TEST_ASSERT(r_exchange)
+                TEST_ASSERT(r_exchange->first.error == controller_error::none)
+                TEST_ASSERT_EQUAL(3, r_exchange->second.size());
+                TEST_ASSERT_EQUAL(data_size, (std::size_t(r_exchange->second[0]) << 8) | r_exchange->second[1]);
+                TEST_ASSERT_EQUAL_HEX8(0xaa, r_exchange->second[2]);
+            }
+            TEST_ASSERT_EQUAL(0, chn.stats().aborts);
+
+            // All the buffers went back to the pool, and are reused from now on
+            TEST_ASSERT_EQUAL(0, pool->stats().outstanding);
+            const auto misses = pool->stats().misses;
+            TEST_ASSERT(tag_reader.sam_configuration(sam_mode::normal, 1s))
+            TEST_ASSERT(tag_reader.read_register(reg_addr{0x6331}))
+            TEST_ASSERT(tag_reader.initiator_data_exchange(target.logical_index, bin_data{0xaa}))
+            TEST_ASSERT_EQUAL(misses, pool->stats().misses);
+            TEST_ASSERT_EQUAL(0, pool->stats().outstanding);
+        }
+    }
+
+    void test_sim_channel_latency() {
+        using namespace std::chrono_literals;
+        static constexpr std::size_t num_commands = 20;
+        struct link_preset {
+            const char *name;
+            sim::sim_channel::link_config config;
+        };
+        const std::array<link_preset, 2> presets = {
+                link_preset{"HSU 115200 baud", sim::sim_channel::link_config{.buffered = false, .byte_time = 87us}},
+                link_preset{"I2C 400 kHz", sim::sim_channel::link_config{.buffered = true, .byte_time = 23us}}};
+        for (auto const &preset : presets) {
+            for (bool defer_ack : {false, true}) {
+                sim::emulated_firmware fw{};
+                sim::sim_channel chn{fw, preset.config};
+                chn.set_defer_trailing_ack(defer_ack);
+                controller tag_reader{chn};
+                const auto t_begin = chn.elapsed();
+                for (std::size_t i = 0; i < num_commands; ++i) {
+                    TEST_ASSERT(tag_reader.get_firmware_version())
+                }
+                const auto t_per_cmd = std::chrono::duration_cast<std::chrono::microseconds>(chn.elapsed() - t_begin) / num_commands;
+                ESP_LOGI(TEST_TAG, "%s, deferred ACK %s: %lld us per get_firmware_version, %u bytes sent, %u received.",
+                         preset.name, (defer_ack ? "on" : "off"), static_cast<long long>(t_per_cmd.count()),
+                         chn.stats().bytes_sent, chn.stats().bytes_received);
+            }
+        }
+    }
+
+    void test_frame_decoder_benchmark() {
+        const bin_data frame_data = make_info_frame(261);
+        for (std::size_t chunk_size : {std::size_t(1), std::size_t(8), frame_data.size()}) {
+            const auto t_reparse = time_decode(frame_data, chunk_size, decode_reparse);
+            const auto t_incremental = time_decode(frame_data, chunk_size, decode_incremental);
+            ESP_LOGI(TEST_TAG, "Decode %u bytes in chunks of %u: reparse %lld us, incremental %lld us.",
+                     frame_data.size(), chunk_size,
+                     static_cast<long long>(t_reparse.count()), static_cast<long long>(t_incremental.count()));
+        }
+    }
+
+    void test_buffer_pool() {
+        auto pool = std::make_shared<mlab::pool<bin_data>>(mlab::default_buffer_size_classes());
+        const auto classes = pool->size_classes();
+        TEST_ASSERT_EQUAL(3, classes.size());
+        TEST_ASSERT_TRUE(classes.back().capacity > bits::max_firmware_data_length);
+
+        // A miss reserves the capacity of the smallest class that fits
+        {
+            auto ack = pool->take_sized(6);
+            auto desfire = pool->take_sized(60);
+            auto frame = pool->take_sized(bits::max_firmware_data_length + 1);
+            TEST_ASSERT_GREATER_OR_EQUAL(classes[0].capacity, ack->capacity());
+            TEST_ASSERT_GREATER_OR_EQUAL(classes[1].capacity, desfire->capacity());
+            TEST_ASSERT_GREATER_OR_EQUAL(classes[2].capacity, frame->capacity());
+            TEST_ASSERT_EQUAL(3, pool->stats().outstanding);
+        }
+        auto stats = pool->stats();
+        TEST_ASSERT_EQUAL(0, stats.hits);
+        TEST_ASSERT_EQUAL(3, stats.misses);
+        TEST_ASSERT_EQUAL(0, stats.outstanding);
+        TEST_ASSERT_EQUAL(3, stats.peak_outstanding);
+        TEST_ASSERT_GREATER_OR_EQUAL(classes[0].capacity + classes[1].capacity + classes[2].capacity, stats.peak_bytes);
+        TEST_ASSERT_FALSE(pool->empty());
+
+        // Each buffer goes back to its class, and is cleared
+        {
+            auto frame = pool->take_sized(200);
+            TEST_ASSERT_GREATER_OR_EQUAL(200, frame->capacity());
+            TEST_ASSERT_TRUE(frame->empty());
+            auto desfire = pool->take_sized(32);
+            TEST_ASSERT_GREATER_OR_EQUAL(classes[1].capacity, desfire->capacity());
+            TEST_ASSERT_LESS_THAN(classes[2].capacity, desfire->capacity());
+        }
+        TEST_ASSERT_EQUAL(2, pool->stats().hits);
+
+        // Buffers that do not fit in their class are dropped
+        {
+            std::vector<mlab::borrowed<bin_data>> frames{};
+            for (std::size_t i = 0; i < classes.back().max_idle + 2; ++i) {
+                frames.push_back(pool->take_sized(bits::max_firmware_data_length + 1));
+            }
+        }
+        stats = pool->stats();
+        TEST_ASSERT_EQUAL(2, stats.dropped);
+        TEST_ASSERT_EQUAL(0, stats.outstanding);
+        TEST_ASSERT_EQUAL(classes.back().max_idle + 2, stats.peak_outstanding);
+
+        // An unsized take leaves the largest buffers to those who need them
+        {
+            auto any = pool->take();
+            TEST_ASSERT_LESS_THAN(classes[2].capacity, any->capacity());
+            auto frame = pool->take_sized(bits::max_firmware_data_length + 1);
+            TEST_ASSERT_GREATER_OR_EQUAL(classes[2].capacity, frame->capacity());
+        }
+
+        // Released objects are no longer outstanding, and do not go back to the pool until given back explicitly
+        const auto hits = pool->stats().hits;
+        auto released = pool->take_sized(bits::max_firmware_data_length + 1).release();
+        TEST_ASSERT_EQUAL(0, pool->stats().outstanding);
+        pool->give(std::move(released));
+        TEST_ASSERT_EQUAL(0, pool->stats().outstanding);
+        TEST_ASSERT_EQUAL(hits + 1, pool->stats().hits);
+    }
+
+    void test_buffer_pool_concurrent() {
+        static constexpr std::size_t num_threads = 2;
+        static constexpr std::size_t iterations = 2000;
+
+        auto pool = std::make_shared<mlab::pool<bin_data>>(mlab::default_buffer_size_classes());
+        std::atomic<std::size_t> corrupted{0};
+        const auto run = [&](std::size_t thread_idx) {
+            for (std::size_t i = 0; i < iterations; ++i) {
+                const std::size_t size = (i + thread_idx) % 3 == 0 ? bits::max_firmware_data_length + 1 : 16 * (i % 4);
+                auto buffer = pool->take_sized(size);
+                // Any buffer handed out twice would be corrupted by the other thread
+                buffer->resize(size, std::uint8_t(thread_idx));
+                if (not std::all_of(std::begin(*buffer), std::end(*buffer), [&](std::uint8_t b) { return b == thread_idx; })) {
+                    ++corrupted;
+                }
+                if (i % 5 == 0) {
+                    auto other = pool->take();
+                    other << std::uint8_t(thread_idx);
+                }
+            }
+        };
+
+        std::vector<std::thread> threads{};
+        for (std::size_t i = 0; i < num_threads; ++i) {
+            threads.emplace_back(run, i);
+        }
+        for (auto &t : threads) {
+            t.join();
+        }
+
+        const auto stats = pool->stats();
+        ESP_LOGI(TEST_TAG, "Pool stats: %u hits, %u misses, %u dropped, peak outstanding %u, peak bytes %u.",
+                 stats.hits, stats.misses, stats.dropped, stats.peak_outstanding, stats.peak_bytes);
+        TEST_ASSERT_EQUAL(0, corrupted.load());
+        TEST_ASSERT_EQUAL(num_threads * (iterations + iterations / 5), stats.hits + stats.misses);
+        TEST_ASSERT_EQUAL(0, stats.outstanding);
+        TEST_ASSERT_LESS_OR_EQUAL(2 * num_threads, stats.peak_outstanding);
+        std::size_t max_idle_bytes = 0;
+        for (auto const &c : pool->size_classes()) {
+            max_idle_bytes += c.max_idle * c.capacity;
+        }
+        // No buffer grows past the capacity of its class here, so the pool is bounded by its classes
+        TEST_ASSERT_LESS_OR_EQUAL(max_idle_bytes, stats.peak_bytes);
+    }
+
+}// namespace ut::pn532_frames
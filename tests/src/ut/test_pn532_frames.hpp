@@ -0,0 +1,16 @@
+#ifndef SPOOKY_ACTION_TEST_PN532_FRAMES_HPP
+#define SPOOKY_ACTION_TEST_PN532_FRAMES_HPP
+
+namespace ut::pn532_frames {
+    void test_frame_decoder();
+    void test_info_frame_view();
+    void test_command_allocations();
+    void test_response_length_prediction();
+    void test_sim_channel();
+    void test_sim_channel_latency();
+    void test_frame_decoder_benchmark();
+    void test_buffer_pool();
+    void test_buffer_pool_concurrent();
+}// namespace ut::pn532_frames
+
+#endif//SPOOKY_ACTION_TEST_PN532_FRAMES_HPP
@@ -5,8 +5,23 @@
 #ifndef SPOOKY_ACTION_UTILS_HPP
 #define SPOOKY_ACTION_UTILS_HPP
 
+#ifdef ESP_PLATFORM
+#include <desfire/esp32/mem_monitor.hpp>
+#else
+#include "host_mem_monitor.hpp"
+#endif
+
 namespace ut {
 
+    /**
+     * Heap monitor of the platform the tests run on.
+     */
+#ifdef ESP_PLATFORM
+    using mem_monitor = desfire::esp32::mem_monitor;
+#else
+    using mem_monitor = host_mem_monitor;
+#endif
+
     struct log_options {
         bool generic;
         bool plain_data;
@@ -1,27 +1,43 @@
-#include "ut/pn532_pinout.hpp"
 #include "ut/test_desfire_ciphers.hpp"
 #include "ut/test_desfire_exchanges.hpp"
+#include "ut/test_desfire_sim.hpp"
+#include "ut/test_pn532_frames.hpp"
+#include <mlab/log.h>
+#include <mlab/pool.hpp>
+#include <unity.h>
+
+#ifdef ESP_PLATFORM
+#include "ut/pn532_pinout.hpp"
 #include "ut/test_desfire_files.hpp"
 #include "ut/test_desfire_main.hpp"
 #include "ut/test_pn532.hpp"
 #include <mbcontroller.h>
-#include <unity.h>
-#include <mlab/pool.hpp>
+#endif
 
 #define TEST_TAG "UT"
 
 void issue_header(std::string const &title) {
     ESP_LOGI(TEST_TAG, "--------------------------------------------------------------------------------");
-    const std::size_t tail_length = std::max(68u, title.length()) - title.length();
+    const std::size_t tail_length = std::max<std::size_t>(68, title.length()) - title.length();
     const std::string header = "---------- " + title + " " + std::string(tail_length, '-');
     ESP_LOGI(TEST_TAG, "%s", header.c_str());
+#ifdef ESP_PLATFORM
     vTaskDelay(pdMS_TO_TICKS(2000));
+#endif
 }
 
 void unity_perform_cipher_tests() {
     issue_header("MIFARE CIPHER TEST (no card)");
     RUN_TEST(ut::desfire_ciphers::test_crc16);
     RUN_TEST(ut::desfire_ciphers::test_crc32);
+    RUN_TEST(ut::desfire_ciphers::test_crc_lengths);
+    RUN_TEST(ut::desfire_ciphers::test_crc_benchmark);
+    RUN_TEST(ut::desfire_ciphers::test_cmac_stream);
+    RUN_TEST(ut::desfire_ciphers::test_cipher_dispatch_benchmark);
+    RUN_TEST(ut::desfire_ciphers::test_crypto_throughput);
+    RUN_TEST(ut::desfire_ciphers::test_crypto_kat);
+    RUN_TEST(ut::desfire_ciphers::test_crc_tail);
+    RUN_TEST(ut::desfire_ciphers::test_crc_tail_benchmark);
     RUN_TEST(ut::desfire_ciphers::test_des);
     RUN_TEST(ut::desfire_ciphers::test_2k3des);
     RUN_TEST(ut::desfire_ciphers::test_3k3des);
@@ -29,6 +45,9 @@ void unity_perform_cipher_tests() {
     RUN_TEST(ut::desfire_ciphers::test_2k3des_kdf);
     RUN_TEST(ut::desfire_ciphers::test_3k3des_kdf);
     RUN_TEST(ut::desfire_ciphers::test_aes_kdf);
+    RUN_TEST(ut::desfire_ciphers::test_kdf_batch);
+    RUN_TEST(ut::desfire_ciphers::test_kdf_batch_benchmark);
+    RUN_TEST(ut::desfire_ciphers::test_diversified_key_cache);
     RUN_TEST(ut::desfire_exchanges::test_change_key_aes);
     RUN_TEST(ut::desfire_exchanges::test_change_key_des);
     RUN_TEST(ut::desfire_exchanges::test_change_key_2k3des);
@@ -38,6 +57,38 @@ void unity_perform_cipher_tests() {
     RUN_TEST(ut::desfire_exchanges::test_write_data_cmac_des);
 }
 
+void unity_perform_pn532_frame_tests() {
+    issue_header("PN532 FRAMING TEST (no hardware)");
+    RUN_TEST(ut::pn532_frames::test_frame_decoder);
+    RUN_TEST(ut::pn532_frames::test_info_frame_view);
+    RUN_TEST(ut::pn532_frames::test_command_allocations);
+    RUN_TEST(ut::pn532_frames::test_response_length_prediction);
+    RUN_TEST(ut::pn532_frames::test_sim_channel);
+    RUN_TEST(ut::pn532_frames::test_sim_channel_latency);
+    RUN_TEST(ut::pn532_frames::test_frame_decoder_benchmark);
+    RUN_TEST(ut::pn532_frames::test_buffer_pool);
+    RUN_TEST(ut::pn532_frames::test_buffer_pool_concurrent);
+}
+
+void unity_perform_desfire_sim_tests() {
+    issue_header("MIFARE EMULATED CARD TEST (no hardware)");
+    RUN_TEST(ut::desfire_sim::test_sim_authenticate);
+    RUN_TEST(ut::desfire_sim::test_sim_files);
+    RUN_TEST(ut::desfire_sim::test_sim_file_settings_cache);
+    RUN_TEST(ut::desfire_sim::test_sim_benchmark);
+    RUN_TEST(ut::desfire_sim::test_sim_memory_watermark);
+    RUN_TEST(ut::desfire_sim::test_sim_static_buffer_pool);
+    RUN_TEST(ut::desfire_sim::test_sim_cipher_cache);
+    RUN_TEST(ut::desfire_sim::test_sim_file_stream);
+    RUN_TEST(ut::desfire_sim::test_sim_frame_length);
+    RUN_TEST(ut::desfire_sim::test_sim_bit_rate);
+    RUN_TEST(ut::desfire_sim::test_sim_profiler);
+    RUN_TEST(ut::desfire_sim::test_sim_trace);
+    RUN_TEST(ut::desfire_sim::test_sim_record_replay);
+    RUN_TEST(ut::desfire_sim::test_sim_record_replay_authenticated);
+}
+
+#ifdef ESP_PLATFORM
 std::shared_ptr<ut::pn532::test_instance> unity_perform_pn532_tests(ut::pn532::channel_type channel) {
     if (not ut::pn532::channel_is_supported(channel)) {
         ESP_LOG_LEVEL(
@@ -57,6 +108,7 @@ std::shared_ptr<ut::pn532::test_instance> unity_perform_pn532_tests(ut::pn532::c
     // Just skip this bunch if the channel does not work there is no hope
     if (instance != nullptr and instance->channel_did_wake()) {
         RUN_TEST(ut::pn532::test_get_fw);
+        RUN_TEST(ut::pn532::test_deferred_ack);
         RUN_TEST(ut::pn532::test_diagnostics);
         issue_header("PN532 SCAN TEST (optionally requires card)");
         RUN_TEST(ut::pn532::test_scan_mifare);
@@ -120,16 +172,20 @@ std::shared_ptr<ut::desfire_files::test_instance> unity_perform_desfire_files_te
     }
     return instance;
 }
+#endif
 
 
-void unity_perform_all_tests() {
-    using ut::pn532::channel_type;
-
+int unity_perform_all_tests() {
     UNITY_BEGIN();
     esp_log_level_set("*", ESP_LOG_INFO);
 
     // No hardware required for these
     unity_perform_cipher_tests();
+    unity_perform_pn532_frame_tests();
+    unity_perform_desfire_sim_tests();
+
+#ifdef ESP_PLATFORM
+    using ut::pn532::channel_type;
 
     // Itereate through all available transmission channels. Those that cannot be activated will be skipped
     for (channel_type channel : {channel_type::hsu, channel_type::i2c, channel_type::i2c_irq, channel_type::spi, channel_type::spi_irq}) {
@@ -139,9 +195,12 @@ void unity_perform_all_tests() {
             }
         }
     }
-    UNITY_END();
+#endif
+    return UNITY_END();
 }
 
+#ifdef ESP_PLATFORM
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -153,3 +212,14 @@ void app_main() {
 #ifdef __cplusplus
 }
 #endif
+
+#else
+
+/**
+ * Native build (`pio test -e native`): only the tests that need no hardware are run.
+ */
+int main() {
+    return unity_perform_all_tests();
+}
+
+#endif